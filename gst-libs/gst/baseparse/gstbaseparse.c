@@ -195,9 +195,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <glib/gstdio.h>
+
+#include <gst/base/gstbytereader.h>
+#include <gst/base/gstbytewriter.h>
+
 #include "gstbaseparse.h"
 
 #define MIN_FRAMES_TO_POST_BITRATE 10
+/* bounds of the automatic read-ahead in pull mode */
+#define MIN_READ_AHEAD             (64 * 1024)
+#define MAX_READ_AHEAD             (1024 * 1024)
+
+/* persistent index file layout, all BE:
+ * magic, version, parser type name, uri, upstream size, mtime,
+ * number of entries and the (time, offset) pairs of the key entries */
+#define INDEX_FILE_MAGIC           GST_MAKE_FOURCC ('G', 'B', 'P', 'I')
+#define INDEX_FILE_VERSION         1
 #define TARGET_DIFFERENCE          (20 * GST_SECOND)
 
 GST_DEBUG_CATEGORY_STATIC (gst_base_parse_debug);
@@ -260,7 +274,10 @@ struct _GstBaseParsePrivate
 
   GList *pending_events;
 
+  /* pull mode cache, and what was left of the previous one in front of it */
   GstBuffer *cache;
+  GstBuffer *cache_tail;
+  guint read_ahead;
 
   /* index entry storage, either ours or provided */
   GstIndex *index;
@@ -276,6 +293,14 @@ struct _GstBaseParsePrivate
   GstClockTime index_last_ts;
   gint64 index_last_offset;
   gboolean index_last_valid;
+  /* persistent index; the file, the stream it belongs to and the
+   * key entries in the index */
+  gchar *index_file;
+  gchar *index_uri;
+  gint64 index_mtime;
+  GArray *index_entries;
+  gboolean index_loaded;
+  gboolean index_dirty;
 
   /* timestamps currently produced are accurate, e.g. started from 0 onwards */
   gboolean exact_position;
@@ -290,6 +315,22 @@ struct _GstBaseParsePrivate
   gint64 last_offset;
 };
 
+typedef struct _GstBaseParseIndexEntry
+{
+  guint64 ts;
+  guint64 offset;
+} GstBaseParseIndexEntry;
+
+enum
+{
+  PROP_0,
+  PROP_READ_AHEAD,
+  PROP_INDEX_FILE
+};
+
+#define DEFAULT_READ_AHEAD         0
+#define DEFAULT_INDEX_FILE         NULL
+
 typedef struct _GstBaseParseSeek
 {
   GstSegment segment;
@@ -335,6 +376,10 @@ gst_base_parse_get_type (void)
 }
 
 static void gst_base_parse_finalize (GObject * object);
+static void gst_base_parse_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_base_parse_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn gst_base_parse_change_state (GstElement * element,
     GstStateChange transition);
@@ -373,6 +418,7 @@ static gboolean gst_base_parse_src_eventfunc (GstBaseParse * parse,
     GstEvent * event);
 
 static void gst_base_parse_drain (GstBaseParse * parse);
+static void gst_base_parse_clear_cache (GstBaseParse * parse);
 
 static void gst_base_parse_post_bitrates (GstBaseParse * parse,
     gboolean post_min, gboolean post_avg, gboolean post_max);
@@ -417,10 +463,7 @@ gst_base_parse_finalize (GObject * object)
     gst_event_replace (p_ev, NULL);
   }
 
-  if (parse->priv->cache) {
-    gst_buffer_unref (parse->priv->cache);
-    parse->priv->cache = NULL;
-  }
+  gst_base_parse_clear_cache (parse);
 
   g_list_foreach (parse->priv->pending_events, (GFunc) gst_mini_object_unref,
       NULL);
@@ -431,12 +474,58 @@ gst_base_parse_finalize (GObject * object)
     gst_object_unref (parse->priv->index);
     parse->priv->index = NULL;
   }
+  g_free (parse->priv->index_file);
+  g_free (parse->priv->index_uri);
+  g_array_free (parse->priv->index_entries, TRUE);
 
   gst_base_parse_clear_queues (parse);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+static void
+gst_base_parse_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstBaseParse *parse = GST_BASE_PARSE (object);
+
+  switch (prop_id) {
+    case PROP_READ_AHEAD:
+      parse->priv->read_ahead = g_value_get_uint (value);
+      break;
+    case PROP_INDEX_FILE:
+      GST_OBJECT_LOCK (parse);
+      g_free (parse->priv->index_file);
+      parse->priv->index_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (parse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_base_parse_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstBaseParse *parse = GST_BASE_PARSE (object);
+
+  switch (prop_id) {
+    case PROP_READ_AHEAD:
+      g_value_set_uint (value, parse->priv->read_ahead);
+      break;
+    case PROP_INDEX_FILE:
+      GST_OBJECT_LOCK (parse);
+      g_value_set_string (value, parse->priv->index_file);
+      GST_OBJECT_UNLOCK (parse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_base_parse_class_init (GstBaseParseClass * klass)
 {
@@ -447,6 +536,22 @@ gst_base_parse_class_init (GstBaseParseClass * klass)
   g_type_class_add_private (klass, sizeof (GstBaseParsePrivate));
   parent_class = g_type_class_peek_parent (klass);
   gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_base_parse_finalize);
+  gobject_class->set_property = gst_base_parse_set_property;
+  gobject_class->get_property = gst_base_parse_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_READ_AHEAD,
+      g_param_spec_uint ("read-ahead", "Read ahead",
+          "Number of bytes to read ahead in pull mode "
+          "(0 = automatic, based on the bitrate)",
+          0, G_MAXUINT, DEFAULT_READ_AHEAD,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_INDEX_FILE,
+      g_param_spec_string ("index-file", "Index file",
+          "File to load the seek index of a seekable stream from, and to "
+          "save it to when done; only used for the stream it was made for, "
+          "which upstream has to identify by its URI (NULL = disabled)",
+          DEFAULT_INDEX_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gstelement_class = (GstElementClass *) klass;
   gstelement_class->change_state =
@@ -510,6 +615,10 @@ gst_base_parse_init (GstBaseParse * parse, GstBaseParseClass * bclass)
   parse->adapter = gst_adapter_new ();
 
   parse->priv->pad_mode = GST_ACTIVATE_NONE;
+  parse->priv->read_ahead = DEFAULT_READ_AHEAD;
+  parse->priv->index_file = DEFAULT_INDEX_FILE;
+  parse->priv->index_entries =
+      g_array_new (FALSE, FALSE, sizeof (GstBaseParseIndexEntry));
 
   /* init state */
   gst_base_parse_reset (parse);
@@ -596,6 +705,12 @@ gst_base_parse_reset (GstBaseParse * parse)
   parse->priv->index_last_ts = GST_CLOCK_TIME_NONE;
   parse->priv->index_last_offset = -1;
   parse->priv->index_last_valid = TRUE;
+  g_free (parse->priv->index_uri);
+  parse->priv->index_uri = NULL;
+  parse->priv->index_mtime = 0;
+  g_array_set_size (parse->priv->index_entries, 0);
+  parse->priv->index_loaded = FALSE;
+  parse->priv->index_dirty = FALSE;
   parse->priv->upstream_seekable = FALSE;
   parse->priv->upstream_size = 0;
   parse->priv->upstream_has_duration = FALSE;
@@ -616,10 +731,7 @@ gst_base_parse_reset (GstBaseParse * parse)
   g_list_free (parse->priv->pending_events);
   parse->priv->pending_events = NULL;
 
-  if (parse->priv->cache) {
-    gst_buffer_unref (parse->priv->cache);
-    parse->priv->cache = NULL;
-  }
+  gst_base_parse_clear_cache (parse);
 
   g_slist_foreach (parse->priv->pending_seeks, (GFunc) g_free, NULL);
   g_slist_free (parse->priv->pending_seeks);
@@ -1339,8 +1451,16 @@ gst_base_parse_add_index_entry (GstBaseParse * parse, guint64 offset,
   GST_OBJECT_UNLOCK (parse);
 
   if (key) {
+    GstBaseParseIndexEntry entry;
+
     parse->priv->index_last_offset = offset;
     parse->priv->index_last_ts = ts;
+
+    /* keep track of these for saving the index */
+    entry.ts = ts;
+    entry.offset = offset;
+    g_array_append_val (parse->priv->index_entries, entry);
+    parse->priv->index_dirty = TRUE;
   }
 
   ret = TRUE;
@@ -1349,6 +1469,180 @@ exit:
   return ret;
 }
 
+/* determines which stream the index is for, besides its size. Without an
+ * URI, the index file could be taken for any stream of the same size, so it
+ * is not used at all. */
+static gboolean
+gst_base_parse_index_file_key (GstBaseParse * parse)
+{
+  GstQuery *query;
+  gchar *uri = NULL, *filename;
+  struct stat st;
+
+  g_free (parse->priv->index_uri);
+  parse->priv->index_uri = NULL;
+  parse->priv->index_mtime = 0;
+
+  query = gst_query_new_uri ();
+  if (gst_pad_peer_query (parse->sinkpad, query))
+    gst_query_parse_uri (query, &uri);
+  gst_query_unref (query);
+
+  if (uri == NULL || *uri == '\0') {
+    g_free (uri);
+    return FALSE;
+  }
+  parse->priv->index_uri = uri;
+
+  /* local files might be changed without their size changing */
+  filename = g_filename_from_uri (parse->priv->index_uri, NULL, NULL);
+  if (filename && g_stat (filename, &st) == 0)
+    parse->priv->index_mtime = st.st_mtime;
+  g_free (filename);
+
+  return TRUE;
+}
+
+static gint
+gst_base_parse_index_entry_compare (gconstpointer a, gconstpointer b)
+{
+  const GstBaseParseIndexEntry *ea = a, *eb = b;
+
+  return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+/* fills the index from the index file, if it was made for this stream */
+static void
+gst_base_parse_load_index (GstBaseParse * parse, const gchar * index_file)
+{
+  GstByteReader reader;
+  GstBaseParseIndexEntry entry;
+  GstIndexAssociation associations[2];
+  guint8 *data = NULL;
+  gsize size;
+  guint32 magic = 0, version = 0, n_entries = 0, i;
+  const gchar *type = NULL, *uri = NULL;
+  guint64 upstream_size = 0;
+  gint64 mtime = 0;
+
+  if (!gst_base_parse_index_file_key (parse)) {
+    GST_DEBUG_OBJECT (parse, "upstream URI unknown, not using index file %s",
+        index_file);
+    return;
+  }
+
+  if (!g_file_get_contents (index_file, (gchar **) & data, &size, NULL)) {
+    GST_DEBUG_OBJECT (parse, "no index file %s", index_file);
+    return;
+  }
+
+  gst_byte_reader_init (&reader, data, size);
+  if (!gst_byte_reader_get_uint32_be (&reader, &magic) ||
+      magic != INDEX_FILE_MAGIC ||
+      !gst_byte_reader_get_uint32_be (&reader, &version) ||
+      version != INDEX_FILE_VERSION ||
+      !gst_byte_reader_get_string (&reader, &type) ||
+      !gst_byte_reader_get_string (&reader, &uri) ||
+      !gst_byte_reader_get_uint64_be (&reader, &upstream_size) ||
+      !gst_byte_reader_get_int64_be (&reader, &mtime) ||
+      !gst_byte_reader_get_uint32_be (&reader, &n_entries) ||
+      gst_byte_reader_get_remaining (&reader) / 16 < n_entries) {
+    GST_WARNING_OBJECT (parse, "invalid index file %s", index_file);
+    goto done;
+  }
+
+  if (strcmp (type, G_OBJECT_TYPE_NAME (parse)) != 0 ||
+      strcmp (uri, parse->priv->index_uri) != 0 ||
+      upstream_size != parse->priv->upstream_size ||
+      mtime != parse->priv->index_mtime) {
+    GST_DEBUG_OBJECT (parse, "index file %s is for another stream",
+        index_file);
+    goto done;
+  }
+
+  GST_DEBUG_OBJECT (parse, "loading %u index entries from %s", n_entries,
+      index_file);
+
+  associations[0].format = GST_FORMAT_TIME;
+  associations[1].format = GST_FORMAT_BYTES;
+  GST_OBJECT_LOCK (parse);
+  for (i = 0; i < n_entries; i++) {
+    entry.ts = gst_byte_reader_get_uint64_be_unchecked (&reader);
+    entry.offset = gst_byte_reader_get_uint64_be_unchecked (&reader);
+    g_array_append_val (parse->priv->index_entries, entry);
+
+    associations[0].value = entry.ts;
+    associations[1].value = entry.offset;
+    gst_index_add_associationv (parse->priv->index, parse->priv->index_id,
+        GST_ASSOCIATION_FLAG_KEY_UNIT, 2,
+        (const GstIndexAssociation *) &associations);
+  }
+  GST_OBJECT_UNLOCK (parse);
+
+  /* only entries past the loaded ones are interesting now */
+  if (n_entries) {
+    parse->priv->index_last_ts = entry.ts;
+    parse->priv->index_last_offset = entry.offset;
+  }
+
+done:
+  g_free (data);
+}
+
+/* saves the index to the index file, if anything was added to it */
+static void
+gst_base_parse_save_index (GstBaseParse * parse)
+{
+  GstByteWriter writer;
+  GError *err = NULL;
+  gchar *index_file;
+  guint i, len;
+
+  GST_OBJECT_LOCK (parse);
+  index_file = g_strdup (parse->priv->index_file);
+  GST_OBJECT_UNLOCK (parse);
+
+  if (!index_file || !parse->priv->index_loaded || !parse->priv->index_dirty
+      || !parse->priv->index_uri)
+    goto done;
+
+  /* entries may have been collected out of order around seeks */
+  g_array_sort (parse->priv->index_entries,
+      gst_base_parse_index_entry_compare);
+
+  len = parse->priv->index_entries->len;
+  gst_byte_writer_init_with_size (&writer, 64 + 16 * len, FALSE);
+  gst_byte_writer_put_uint32_be (&writer, INDEX_FILE_MAGIC);
+  gst_byte_writer_put_uint32_be (&writer, INDEX_FILE_VERSION);
+  gst_byte_writer_put_string (&writer, G_OBJECT_TYPE_NAME (parse));
+  gst_byte_writer_put_string (&writer, parse->priv->index_uri);
+  gst_byte_writer_put_uint64_be (&writer, parse->priv->upstream_size);
+  gst_byte_writer_put_int64_be (&writer, parse->priv->index_mtime);
+  gst_byte_writer_put_uint32_be (&writer, len);
+  for (i = 0; i < len; i++) {
+    GstBaseParseIndexEntry *entry =
+        &g_array_index (parse->priv->index_entries, GstBaseParseIndexEntry, i);
+
+    gst_byte_writer_put_uint64_be (&writer, entry->ts);
+    gst_byte_writer_put_uint64_be (&writer, entry->offset);
+  }
+
+  GST_DEBUG_OBJECT (parse, "saving %u index entries to %s", len, index_file);
+
+  /* written to a temporary file and renamed, so whoever else uses the
+   * same file never sees half of it */
+  if (!g_file_set_contents (index_file,
+          (const gchar *) gst_byte_writer_get_data (&writer),
+          gst_byte_writer_get_pos (&writer), &err)) {
+    GST_WARNING_OBJECT (parse, "failed to save index: %s", err->message);
+    g_error_free (err);
+  }
+  gst_byte_writer_reset (&writer);
+
+done:
+  g_free (index_file);
+}
+
 /* check for seekable upstream, above and beyond a mere query */
 static void
 gst_base_parse_check_seekability (GstBaseParse * parse)
@@ -1401,6 +1695,21 @@ done:
 
   GST_DEBUG_OBJECT (parse, "idx_interval: %ums", idx_interval);
   parse->priv->idx_interval = idx_interval * GST_MSECOND;
+
+  /* a previously made index saves scanning for seeks */
+  if (seekable && !parse->priv->index_loaded && parse->priv->index) {
+    gchar *index_file;
+
+    GST_OBJECT_LOCK (parse);
+    index_file = g_strdup (parse->priv->index_file);
+    GST_OBJECT_UNLOCK (parse);
+
+    if (index_file) {
+      gst_base_parse_load_index (parse, index_file);
+      parse->priv->index_loaded = TRUE;
+    }
+    g_free (index_file);
+  }
 }
 
 /* some misc checks on upstream */
@@ -2212,6 +2521,62 @@ invalid_min:
   }
 }
 
+/* how much to read when refilling the cache in pull mode; either as
+ * configured, or about half a second of data once the bitrate is known */
+static guint
+gst_base_parse_get_read_ahead (GstBaseParse * parse, guint size)
+{
+  guint read_ahead = parse->priv->read_ahead;
+
+  if (!read_ahead)
+    read_ahead = CLAMP (parse->priv->avg_bitrate / 16, MIN_READ_AHEAD,
+        MAX_READ_AHEAD);
+
+  return MAX (read_ahead, size);
+}
+
+/* get @size bytes at @offset from the cache, which must hold them; only the
+ * data that straddles the tail and the cache is copied */
+static GstBuffer *
+gst_base_parse_cache_get (GstBaseParse * parse, gint64 offset, guint size)
+{
+  GstBuffer *cache = parse->priv->cache;
+  GstBuffer *tail = parse->priv->cache_tail;
+  gint64 cache_offset = GST_BUFFER_OFFSET (cache);
+  GstBuffer *buffer;
+  guint tail_size;
+
+  if (offset >= cache_offset) {
+    buffer = gst_buffer_create_sub (cache, offset - cache_offset, size);
+  } else if (offset + size <= cache_offset) {
+    buffer = gst_buffer_create_sub (tail, offset - GST_BUFFER_OFFSET (tail),
+        size);
+  } else {
+    tail_size = cache_offset - offset;
+    buffer = gst_buffer_new_and_alloc (size);
+    memcpy (GST_BUFFER_DATA (buffer), GST_BUFFER_DATA (tail) +
+        GST_BUFFER_SIZE (tail) - tail_size, tail_size);
+    memcpy (GST_BUFFER_DATA (buffer) + tail_size, GST_BUFFER_DATA (cache),
+        size - tail_size);
+  }
+  GST_BUFFER_OFFSET (buffer) = offset;
+
+  return buffer;
+}
+
+static void
+gst_base_parse_clear_cache (GstBaseParse * parse)
+{
+  if (parse->priv->cache) {
+    gst_buffer_unref (parse->priv->cache);
+    parse->priv->cache = NULL;
+  }
+  if (parse->priv->cache_tail) {
+    gst_buffer_unref (parse->priv->cache_tail);
+    parse->priv->cache_tail = NULL;
+  }
+}
+
 /* pull @size bytes at current offset,
  * i.e. at least try to and possibly return a shorter buffer if near the end */
 static GstFlowReturn
@@ -2219,69 +2584,83 @@ gst_base_parse_pull_range (GstBaseParse * parse, guint size,
     GstBuffer ** buffer)
 {
   GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *tail = NULL, *data = NULL;
+  guint tail_size = 0, read_ahead, avail;
+  gint64 offset = parse->priv->offset;
 
   g_return_val_if_fail (buffer != NULL, GST_FLOW_ERROR);
 
-  /* Caching here actually makes much less difference than one would expect.
-   * We do it mainly to avoid pulling buffers of 1 byte all the time */
+  /* The cache avoids pulling buffers of 1 byte all the time, and a pull for
+   * every frame; frames are handed out as subbuffers of it */
   if (parse->priv->cache) {
-    gint64 cache_offset = GST_BUFFER_OFFSET (parse->priv->cache);
-    gint cache_size = GST_BUFFER_SIZE (parse->priv->cache);
-
-    if (cache_offset <= parse->priv->offset &&
-        (parse->priv->offset + size) <= (cache_offset + cache_size)) {
-      *buffer = gst_buffer_create_sub (parse->priv->cache,
-          parse->priv->offset - cache_offset, size);
-      GST_BUFFER_OFFSET (*buffer) = parse->priv->offset;
+    gint64 cache_start, cache_end;
+
+    cache_end = GST_BUFFER_OFFSET (parse->priv->cache) +
+        GST_BUFFER_SIZE (parse->priv->cache);
+    cache_start = parse->priv->cache_tail ?
+        GST_BUFFER_OFFSET (parse->priv->cache_tail) :
+        (gint64) GST_BUFFER_OFFSET (parse->priv->cache);
+
+    if (cache_start <= offset && offset + size <= cache_end) {
+      *buffer = gst_base_parse_cache_get (parse, offset, size);
       return GST_FLOW_OK;
     }
-    /* not enough data in the cache, free cache and get a new one */
-    gst_buffer_unref (parse->priv->cache);
-    parse->priv->cache = NULL;
+    /* not enough data in the cache, keep what is left of it and only pull
+     * what comes after */
+    if (cache_start <= offset && offset < cache_end) {
+      tail_size = cache_end - offset;
+      tail = gst_base_parse_cache_get (parse, offset, tail_size);
+    }
+    gst_base_parse_clear_cache (parse);
   }
 
   /* refill the cache */
-  ret =
-      gst_pad_pull_range (parse->sinkpad, parse->priv->offset, MAX (size,
-          64 * 1024), &parse->priv->cache);
-  if (ret != GST_FLOW_OK) {
-    parse->priv->cache = NULL;
-    return ret;
-  }
-
-  if (GST_BUFFER_SIZE (parse->priv->cache) >= size) {
-    *buffer = gst_buffer_create_sub (parse->priv->cache, 0, size);
-    GST_BUFFER_OFFSET (*buffer) = parse->priv->offset;
-    return GST_FLOW_OK;
+  read_ahead = gst_base_parse_get_read_ahead (parse, size);
+  GST_LOG_OBJECT (parse, "refilling cache at offset %" G_GINT64_FORMAT
+      " with %u bytes, keeping %u", offset, read_ahead - tail_size, tail_size);
+  ret = gst_pad_pull_range (parse->sinkpad, offset + tail_size,
+      read_ahead - tail_size, &data);
+
+  if (ret == GST_FLOW_OK && tail_size + GST_BUFFER_SIZE (data) < size) {
+    /* Not possible to get enough data, try a last time with
+     * requesting exactly the size we need */
+    gst_buffer_unref (data);
+    data = NULL;
+    ret = gst_pad_pull_range (parse->sinkpad, offset + tail_size,
+        size - tail_size, &data);
   }
 
-  /* Not possible to get enough data, try a last time with
-   * requesting exactly the size we need */
-  gst_buffer_unref (parse->priv->cache);
-  parse->priv->cache = NULL;
-
-  ret = gst_pad_pull_range (parse->sinkpad, parse->priv->offset, size,
-      &parse->priv->cache);
-
-  if (ret != GST_FLOW_OK) {
+  if (ret == GST_FLOW_OK) {
+    /* the tail is not merged with the new data, which would copy all of it,
+     * only the frames that straddle both are copied */
+    parse->priv->cache = data;
+    parse->priv->cache_tail = tail;
+    GST_BUFFER_OFFSET (data) = offset + tail_size;
+  } else if (ret == GST_FLOW_UNEXPECTED && tail) {
+    /* what is left in the cache is all there is */
+    parse->priv->cache = tail;
+  } else {
     GST_DEBUG_OBJECT (parse, "pull_range returned %d", ret);
+    if (tail)
+      gst_buffer_unref (tail);
     *buffer = NULL;
     return ret;
   }
 
-  if (GST_BUFFER_SIZE (parse->priv->cache) < size) {
+  avail = GST_BUFFER_OFFSET (parse->priv->cache) +
+      GST_BUFFER_SIZE (parse->priv->cache) - offset;
+  if (avail < size) {
     GST_DEBUG_OBJECT (parse, "Returning short buffer at offset %"
-        G_GUINT64_FORMAT ": wanted %u bytes, got %u bytes", parse->priv->offset,
-        size, GST_BUFFER_SIZE (parse->priv->cache));
+        G_GUINT64_FORMAT ": wanted %u bytes, got %u bytes", offset, size,
+        avail);
 
-    *buffer = parse->priv->cache;
-    parse->priv->cache = NULL;
+    *buffer = gst_base_parse_cache_get (parse, offset, avail);
+    gst_base_parse_clear_cache (parse);
 
     return GST_FLOW_OK;
   }
 
-  *buffer = gst_buffer_create_sub (parse->priv->cache, 0, size);
-  GST_BUFFER_OFFSET (*buffer) = parse->priv->offset;
+  *buffer = gst_base_parse_cache_get (parse, offset, size);
 
   return GST_FLOW_OK;
 }
@@ -3707,6 +4086,7 @@ gst_base_parse_change_state (GstElement * element, GstStateChange transition)
 
   switch (transition) {
     case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_base_parse_save_index (parse);
       gst_base_parse_reset (parse);
       break;
     default:
@@ -36,6 +36,23 @@ static void colorspace_dither_none (ColorspaceConvert * convert, int j);
 static void colorspace_dither_verterr (ColorspaceConvert * convert, int j);
 static void colorspace_dither_halftone (ColorspaceConvert * convert, int j);
 
+/* A band of a frame, converted with a copy of the ColorspaceConvert that has
+ * its own line buffers and offsets pointing at the first line of the band */
+struct _ColorspaceBand
+{
+  ColorspaceConvert convert;
+  guint8 *dest;
+  const guint8 *src;
+};
+
+static int
+colorspace_get_vsub (GstVideoFormat format, int component)
+{
+  int height = gst_video_format_get_component_height (format, component, 16);
+
+  return (height > 0 && height < 16) ? 16 / height : 1;
+}
+
 
 ColorspaceConvert *
 colorspace_convert_new (GstVideoFormat to_format, ColorSpaceColorSpec to_spec,
@@ -76,6 +93,7 @@ colorspace_convert_new (GstVideoFormat to_format, ColorSpaceColorSpec to_spec,
   convert->width = width;
   convert->convert = colorspace_convert_generic;
   convert->dither16 = colorspace_dither_none;
+  convert->n_threads = 1;
 
   if (gst_video_format_get_component_depth (to_format, 0) > 8 ||
       gst_video_format_get_component_depth (from_format, 0) > 8) {
@@ -99,6 +117,9 @@ colorspace_convert_new (GstVideoFormat to_format, ColorSpaceColorSpec to_spec,
     if (i == 0)
       convert->src_offset[i] = 0;
 
+    convert->dest_vsub[i] = colorspace_get_vsub (to_format, i);
+    convert->src_vsub[i] = colorspace_get_vsub (from_format, i);
+
     GST_DEBUG ("%d: dest %d %d src %d %d", i,
         convert->dest_stride[i], convert->dest_offset[i],
         convert->src_stride[i], convert->src_offset[i]);
@@ -139,6 +160,8 @@ colorspace_convert_new (GstVideoFormat to_format, ColorSpaceColorSpec to_spec,
 void
 colorspace_convert_free (ColorspaceConvert * convert)
 {
+  colorspace_convert_set_n_threads (convert, 1);
+
   g_free (convert->palette);
   g_free (convert->tmpline);
   g_free (convert->tmpline16);
@@ -171,6 +194,66 @@ colorspace_convert_set_dither (ColorspaceConvert * convert, int type)
   }
 }
 
+static void
+colorspace_band_func (gpointer data, gpointer user_data)
+{
+  ColorspaceBand *band = data;
+  ColorspaceConvert *convert = user_data;
+
+  band->convert.convert (&band->convert, band->dest, band->src);
+
+  g_mutex_lock (convert->lock);
+  if (--convert->n_pending == 0)
+    g_cond_signal (convert->cond);
+  g_mutex_unlock (convert->lock);
+}
+
+void
+colorspace_convert_set_n_threads (ColorspaceConvert * convert, int n_threads)
+{
+  int i;
+
+  n_threads = CLAMP (n_threads, 1, MAX (convert->height, 1));
+  if (n_threads == convert->n_threads)
+    return;
+
+  if (convert->pool) {
+    /* waits for the threads to finish */
+    g_thread_pool_free (convert->pool, TRUE, TRUE);
+    convert->pool = NULL;
+    g_mutex_free (convert->lock);
+    g_cond_free (convert->cond);
+    for (i = 0; i < convert->n_threads; i++) {
+      g_free (convert->bands[i].convert.tmpline);
+      g_free (convert->bands[i].convert.tmpline16);
+    }
+    g_free (convert->bands);
+    convert->bands = NULL;
+  }
+  convert->n_threads = 1;
+
+  if (n_threads == 1)
+    return;
+
+  convert->pool = g_thread_pool_new (colorspace_band_func, convert,
+      n_threads - 1, TRUE, NULL);
+  if (convert->pool == NULL) {
+    GST_WARNING ("could not start %d threads, converting in one",
+        n_threads - 1);
+    return;
+  }
+  convert->lock = g_mutex_new ();
+  convert->cond = g_cond_new ();
+  convert->bands = g_new0 (ColorspaceBand, n_threads);
+  for (i = 0; i < n_threads; i++) {
+    convert->bands[i].convert.tmpline =
+        g_malloc (sizeof (guint8) * (convert->width + 8) * 4);
+    convert->bands[i].convert.tmpline16 =
+        g_malloc (sizeof (guint16) * (convert->width + 8) * 4);
+  }
+  convert->n_threads = n_threads;
+}
+
 void
 colorspace_convert_set_palette (ColorspaceConvert * convert,
     const guint32 * palette)
@@ -187,11 +270,74 @@ colorspace_convert_get_palette (ColorspaceConvert * convert)
   return convert->palette;
 }
 
+static void
+colorspace_band_setup (ColorspaceConvert * convert, ColorspaceBand * band,
+    guint8 * dest, const guint8 * src, int start, int height)
+{
+  guint8 *tmpline = band->convert.tmpline;
+  guint16 *tmpline16 = band->convert.tmpline16;
+  int i;
+
+  band->convert = *convert;
+  band->convert.tmpline = tmpline;
+  band->convert.tmpline16 = tmpline16;
+  band->convert.errline = NULL;
+  band->convert.height = height;
+  for (i = 0; i < 4; i++) {
+    band->convert.dest_offset[i] +=
+        (start / convert->dest_vsub[i]) * convert->dest_stride[i];
+    band->convert.src_offset[i] +=
+        (start / convert->src_vsub[i]) * convert->src_stride[i];
+  }
+  band->dest = dest;
+  band->src = src;
+}
+
 void
 colorspace_convert_convert (ColorspaceConvert * convert,
     guint8 * dest, const guint8 * src)
 {
-  convert->convert (convert, dest, src);
+  int align, band_height, n_bands, i;
+
+  /* the vertical error diffusion depends on the line above */
+  if (convert->pool == NULL || convert->dither16 == colorspace_dither_verterr) {
+    convert->convert (convert, dest, src);
+    return;
+  }
+
+  /* bands start on a line that no subsampled line straddles, and on the
+   * first line of the halftone pattern */
+  align = 1;
+  for (i = 0; i < 4; i++) {
+    align = MAX (align, convert->dest_vsub[i]);
+    align = MAX (align, convert->src_vsub[i]);
+  }
+  if (convert->dither16 == colorspace_dither_halftone)
+    align = MAX (align, 8);
+
+  band_height = (convert->height + convert->n_threads - 1) / convert->n_threads;
+  band_height = (band_height + align - 1) / align * align;
+  n_bands = (convert->height + band_height - 1) / band_height;
+  if (n_bands <= 1) {
+    convert->convert (convert, dest, src);
+    return;
+  }
+
+  for (i = 0; i < n_bands; i++) {
+    colorspace_band_setup (convert, &convert->bands[i], dest, src,
+        i * band_height, MIN (band_height, convert->height - i * band_height));
+  }
+
+  convert->n_pending = n_bands - 1;
+  for (i = 1; i < n_bands; i++)
+    g_thread_pool_push (convert->pool, &convert->bands[i], NULL);
+
+  convert->bands[0].convert.convert (&convert->bands[0].convert, dest, src);
+
+  g_mutex_lock (convert->lock);
+  while (convert->n_pending > 0)
+    g_cond_wait (convert->cond, convert->lock);
+  g_mutex_unlock (convert->lock);
 }
 
 /* Line conversion to AYUV */
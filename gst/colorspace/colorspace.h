@@ -26,6 +26,7 @@ G_BEGIN_DECLS
 
 typedef struct _ColorspaceConvert ColorspaceConvert;
 typedef struct _ColorspaceFrame ColorspaceComponent;
+typedef struct _ColorspaceBand ColorspaceBand;
 
 typedef enum {
   COLOR_SPEC_NONE = 0,
@@ -66,6 +67,18 @@ struct _ColorspaceConvert {
   int dest_stride[4];
   int src_offset[4];
   int src_stride[4];
+  /* vertical subsampling of each component */
+  int dest_vsub[4];
+  int src_vsub[4];
+
+  /* frames are split in n_threads horizontal bands, the calling thread
+   * converts the first one and the pool the others */
+  int n_threads;
+  ColorspaceBand *bands;
+  GThreadPool *pool;
+  GMutex *lock;
+  GCond *cond;
+  int n_pending;
 
   void (*convert) (ColorspaceConvert *convert, guint8 *dest, const guint8 *src);
   void (*getline) (ColorspaceConvert *convert, guint8 *dest, const guint8 *src, int j);
@@ -84,6 +97,8 @@ ColorspaceConvert * colorspace_convert_new (GstVideoFormat to_format,
 void colorspace_convert_set_dither (ColorspaceConvert * convert, int type);
 void colorspace_convert_set_interlaced (ColorspaceConvert *convert,
     gboolean interlaced);
+void colorspace_convert_set_n_threads (ColorspaceConvert *convert,
+    int n_threads);
 void colorspace_convert_set_palette (ColorspaceConvert *convert,
     const guint32 *palette);
 const guint32 * colorspace_convert_get_palette (ColorspaceConvert *convert);
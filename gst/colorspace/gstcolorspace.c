@@ -49,7 +49,8 @@ GST_DEBUG_CATEGORY (colorspace_performance);
 enum
 {
   PROP_0,
-  PROP_DITHER
+  PROP_DITHER,
+  PROP_N_THREADS
 };
 
 #define CSP_VIDEO_CAPS						\
@@ -479,6 +480,11 @@ gst_csp_class_init (GstCspClass * klass)
           dither_method_get_type (), DITHER_NONE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Number of threads converting horizontal bands of each frame",
+          1, 64, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
 }
 
 static void
@@ -486,6 +492,7 @@ gst_csp_init (GstCsp * space, GstCspClass * klass)
 {
   space->from_format = GST_VIDEO_FORMAT_UNKNOWN;
   space->to_format = GST_VIDEO_FORMAT_UNKNOWN;
+  space->n_threads = 1;
 }
 
 void
@@ -501,6 +508,9 @@ gst_csp_set_property (GObject * object, guint property_id,
     case PROP_DITHER:
       csp->dither = g_value_get_enum (value);
       break;
+    case PROP_N_THREADS:
+      csp->n_threads = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -520,6 +530,9 @@ gst_csp_get_property (GObject * object, guint property_id,
     case PROP_DITHER:
       g_value_set_enum (value, csp->dither);
       break;
+    case PROP_N_THREADS:
+      g_value_set_uint (value, csp->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -558,6 +571,7 @@ gst_csp_transform (GstBaseTransform * btrans, GstBuffer * inbuf,
     goto unknown_format;
 
   colorspace_convert_set_dither (space->convert, space->dither);
+  colorspace_convert_set_n_threads (space->convert, space->n_threads);
 
   colorspace_convert_convert (space->convert, GST_BUFFER_DATA (outbuf),
       GST_BUFFER_DATA (inbuf));
@@ -64,6 +64,9 @@ struct _MpegTSBaseProgram
   guint16 pcr_pid;
   GstStructure *pmt_info;
   MpegTSBaseStream **streams;
+  /* the non-NULL entries of streams, so that per-stream iterations don't
+   * need to walk the whole PID range */
+  GList *stream_list;
   gint patcount;
 
   /* Pending Tags for the program */
@@ -139,6 +142,10 @@ struct _MpegTSBaseClass {
   /* find_timestamps is called to find PCR */
  GstFlowReturn (*find_timestamps) (MpegTSBase * base, guint64 initoff, guint64 *offset);
 
+  /* seek is called with the streaming thread stopped and flushed, it should
+   * update seek_offset for the given (TIME) seek event */
+  gboolean (*seek) (MpegTSBase *base, GstEvent *event);
+
   /* signals */
   void (*pat_info) (GstStructure *pat);
   void (*pmt_info) (GstStructure *pmt);
@@ -164,6 +171,8 @@ gboolean mpegts_base_handle_psi (MpegTSBase * base, MpegTSPacketizerSection * se
 void mpegts_base_program_remove_stream (MpegTSBase * base, MpegTSBaseProgram * program, guint16 pid);
 
 void mpegts_base_remove_program(MpegTSBase *base, gint program_number);
+
+gboolean mpegts_base_handle_seek_event(MpegTSBase * base, GstPad * pad, GstEvent * event);
 G_END_DECLS
 
 #endif /* GST_MPEG_TS_BASE_H */
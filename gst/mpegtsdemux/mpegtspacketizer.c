@@ -24,6 +24,8 @@
 
 #include <string.h>
 
+#include <gst/gst-mpegts-crc.h>
+
 #include "mpegtspacketizer.h"
 #include "gstmpegdesc.h"
 
@@ -79,20 +81,6 @@ static gchar *get_encoding_and_convert (const gchar * text, guint length);
 #define VERSION_NUMBER_UNSET 255
 #define TABLE_ID_UNSET 0xFF
 
-static gint
-mpegts_packetizer_stream_subtable_compare (gconstpointer a, gconstpointer b)
-{
-  MpegTSPacketizerStreamSubtable *asub, *bsub;
-
-  asub = (MpegTSPacketizerStreamSubtable *) a;
-  bsub = (MpegTSPacketizerStreamSubtable *) b;
-
-  if (asub->table_id == bsub->table_id &&
-      asub->subtable_extension == bsub->subtable_extension)
-    return 0;
-  return -1;
-}
-
 static MpegTSPacketizerStreamSubtable *
 mpegts_packetizer_stream_subtable_new (guint8 table_id,
     guint16 subtable_extension)
@@ -103,10 +91,86 @@ mpegts_packetizer_stream_subtable_new (guint8 table_id,
   subtable->version_number = VERSION_NUMBER_UNSET;
   subtable->table_id = table_id;
   subtable->subtable_extension = subtable_extension;
-  subtable->crc = 0;
+  subtable->crcs = NULL;
   return subtable;
 }
 
+static void
+mpegts_packetizer_stream_subtable_free (MpegTSPacketizerStreamSubtable *
+    subtable)
+{
+  g_free (subtable->crcs);
+  g_free (subtable);
+}
+
+static MpegTSPacketizerStreamSubtable *
+mpegts_packetizer_stream_get_subtable (MpegTSPacketizerStream * stream,
+    guint8 table_id, guint16 subtable_extension)
+{
+  MpegTSPacketizerStreamSubtable *subtable;
+  GSList *tmp;
+
+  for (tmp = stream->subtables; tmp; tmp = tmp->next) {
+    subtable = (MpegTSPacketizerStreamSubtable *) tmp->data;
+    if (subtable->table_id == table_id &&
+        subtable->subtable_extension == subtable_extension)
+      return subtable;
+  }
+
+  subtable = mpegts_packetizer_stream_subtable_new (table_id,
+      subtable_extension);
+  stream->subtables = g_slist_prepend (stream->subtables, subtable);
+
+  return subtable;
+}
+
+/* Returns TRUE if the section was already seen with the same version and
+ * CRC */
+static gboolean
+mpegts_packetizer_stream_subtable_seen (MpegTSPacketizerStreamSubtable *
+    subtable, guint8 version_number, guint8 section_number,
+    guint8 last_section_number, guint32 crc)
+{
+  guint8 mask = 1 << (section_number & 0x7);
+
+  if (G_UNLIKELY (section_number > last_section_number))
+    return FALSE;
+
+  if (version_number != subtable->version_number ||
+      last_section_number != subtable->last_section_number ||
+      subtable->crcs == NULL)
+    return FALSE;
+
+  return (subtable->seen_sections[section_number >> 3] & mask) &&
+      subtable->crcs[section_number] == crc;
+}
+
+/* Remembers a section with a valid CRC as seen */
+static void
+mpegts_packetizer_stream_subtable_mark_seen (MpegTSPacketizerStreamSubtable *
+    subtable, guint8 version_number, guint8 section_number,
+    guint8 last_section_number, guint32 crc)
+{
+  guint8 mask = 1 << (section_number & 0x7);
+
+  if (G_UNLIKELY (section_number > last_section_number))
+    return;
+
+  if (version_number != subtable->version_number ||
+      last_section_number != subtable->last_section_number ||
+      subtable->crcs == NULL) {
+    /* new version of the table, forget about the previous sections */
+    subtable->version_number = version_number;
+    subtable->last_section_number = last_section_number;
+    subtable->crcs = g_renew (guint32, subtable->crcs,
+        last_section_number + 1);
+    memset (subtable->seen_sections, 0, sizeof (subtable->seen_sections));
+  }
+
+  subtable->seen_sections[section_number >> 3] |= mask;
+  subtable->crcs[section_number] = crc;
+}
+
 static MpegTSPacketizerStream *
 mpegts_packetizer_stream_new (void)
 {
@@ -125,7 +189,8 @@ mpegts_packetizer_stream_free (MpegTSPacketizerStream * stream)
 {
   gst_adapter_clear (stream->section_adapter);
   g_object_unref (stream->section_adapter);
-  g_slist_foreach (stream->subtables, (GFunc) g_free, NULL);
+  g_slist_foreach (stream->subtables,
+      (GFunc) mpegts_packetizer_stream_subtable_free, NULL);
   g_slist_free (stream->subtables);
   g_free (stream);
 }
@@ -181,6 +246,11 @@ mpegts_packetizer_dispose (GObject * object)
       g_free (packetizer->streams);
     }
 
+    if (packetizer->map_buffer) {
+      gst_buffer_unref (packetizer->map_buffer);
+      packetizer->map_buffer = NULL;
+    }
+
     gst_adapter_clear (packetizer->adapter);
     g_object_unref (packetizer->adapter);
     packetizer->disposed = TRUE;
@@ -300,39 +370,33 @@ mpegts_packetizer_parse_section_header (MpegTSPacketizer2 * packetizer,
     MpegTSPacketizerStream * stream, MpegTSPacketizerSection * section)
 {
   guint8 tmp;
-  guint8 *data, *crc_data;
+  const guint8 *start, *data;
+  guint8 section_number, last_section_number;
+  gboolean section_syntax_indicator;
   MpegTSPacketizerStreamSubtable *subtable;
-  GSList *subtable_list = NULL;
 
   section->complete = TRUE;
-  /* get the section buffer, pass the ownership to the caller */
-  section->buffer = gst_adapter_take_buffer (stream->section_adapter,
-      3 + stream->section_length);
-  data = GST_BUFFER_DATA (section->buffer);
-  GST_BUFFER_OFFSET (section->buffer) = stream->offset;
+  section->buffer = NULL;
+
+  /* only peek at the section, repetitions of sections we already have are
+   * dropped without being taken out of the adapter */
+  start = data =
+      gst_adapter_peek (stream->section_adapter, 3 + stream->section_length);
 
   section->table_id = *data++;
+  section_syntax_indicator = (data[0] & 0x80) != 0;
   /* if table_id is 0 (pat) then ignore the subtable extension */
-  if ((data[0] & 0x80) == 0 || section->table_id == 0)
+  if (!section_syntax_indicator || section->table_id == 0)
     section->subtable_extension = 0;
   else
     section->subtable_extension = GST_READ_UINT16_BE (data + 2);
 
-  subtable = mpegts_packetizer_stream_subtable_new (section->table_id,
-      section->subtable_extension);
-
-  subtable_list = g_slist_find_custom (stream->subtables, subtable,
-      mpegts_packetizer_stream_subtable_compare);
-  if (subtable_list) {
-    g_free (subtable);
-    subtable = (MpegTSPacketizerStreamSubtable *) (subtable_list->data);
-  } else {
-    stream->subtables = g_slist_prepend (stream->subtables, subtable);
-  }
-
   section->section_length = GST_READ_UINT16_BE (data) & 0x0FFF;
   data += 2;
 
+  if (G_UNLIKELY (section->section_length < 5))
+    goto not_applicable;
+
   /* skip to the version byte */
   data += 2;
 
@@ -343,17 +407,44 @@ mpegts_packetizer_parse_section_header (MpegTSPacketizer2 * packetizer,
   if (!section->current_next_indicator)
     goto not_applicable;
 
+  /* sections without the syntax indicator are single sections */
+  if (section_syntax_indicator) {
+    section_number = *data++;
+    last_section_number = *data++;
+  } else {
+    section_number = last_section_number = 0;
+  }
+
   /* CRC is at the end of the section */
-  crc_data =
-      GST_BUFFER_DATA (section->buffer) + GST_BUFFER_SIZE (section->buffer) - 4;
-  section->crc = GST_READ_UINT32_BE (crc_data);
+  section->crc = GST_READ_UINT32_BE (start + 3 + section->section_length - 4);
 
-  if (section->version_number == subtable->version_number &&
-      section->crc == subtable->crc)
+  subtable = mpegts_packetizer_stream_get_subtable (stream, section->table_id,
+      section->subtable_extension);
+  if (mpegts_packetizer_stream_subtable_seen (subtable,
+          section->version_number, section_number, last_section_number,
+          section->crc))
     goto not_applicable;
 
-  subtable->version_number = section->version_number;
-  subtable->crc = section->crc;
+  /* only remember sections with a valid CRC, else a corrupted section would
+   * make the good repetitions with the same CRC look like they were already
+   * seen. Table ids 0x70 - 0x73 do not have a crc. Corrupted sections are
+   * bad data, the packets carrying them are not pushed either */
+  if (G_LIKELY (section->table_id < 0x70 || section->table_id > 0x73)) {
+    if (G_UNLIKELY (gst_mpegts_crc32 (start,
+                3 + stream->section_length) != 0)) {
+      GST_WARNING ("bad crc in psi pid 0x%x", section->pid);
+      section->complete = FALSE;
+      return FALSE;
+    }
+  }
+  mpegts_packetizer_stream_subtable_mark_seen (subtable,
+      section->version_number, section_number, last_section_number,
+      section->crc);
+
+  /* get the section buffer, pass the ownership to the caller */
+  section->buffer = gst_adapter_take_buffer (stream->section_adapter,
+      3 + stream->section_length);
+  GST_BUFFER_OFFSET (section->buffer) = stream->offset;
   stream->section_table_id = section->table_id;
 
   return TRUE;
@@ -364,7 +455,6 @@ not_applicable:
       section->pid, section->table_id, section->subtable_extension,
       section->current_next_indicator, section->version_number, section->crc);
   section->complete = FALSE;
-  gst_buffer_unref (section->buffer);
   return TRUE;
 }
 
@@ -2077,6 +2167,37 @@ mpegts_packetizer_clear (MpegTSPacketizer2 * packetizer)
     memset (packetizer->streams, 0, 8192 * sizeof (MpegTSPacketizerStream *));
   }
 
+  if (packetizer->map_buffer) {
+    gst_buffer_unref (packetizer->map_buffer);
+    packetizer->map_buffer = NULL;
+  }
+  packetizer->map_pos = 0;
+
+  gst_adapter_clear (packetizer->adapter);
+  packetizer->offset = 0;
+  packetizer->empty = TRUE;
+}
+
+/* Drops all pending data and partially assembled sections but, unlike
+ * mpegts_packetizer_clear(), keeps the packet size and the already seen
+ * tables. Used when jumping to another offset in the same stream. */
+void
+mpegts_packetizer_flush (MpegTSPacketizer2 * packetizer)
+{
+  if (packetizer->streams) {
+    int i;
+    for (i = 0; i < 8192; i++) {
+      if (packetizer->streams[i])
+        mpegts_packetizer_clear_section (packetizer, packetizer->streams[i]);
+    }
+  }
+
+  if (packetizer->map_buffer) {
+    gst_buffer_unref (packetizer->map_buffer);
+    packetizer->map_buffer = NULL;
+  }
+  packetizer->map_pos = 0;
+
   gst_adapter_clear (packetizer->adapter);
   packetizer->offset = 0;
   packetizer->empty = TRUE;
@@ -2117,78 +2238,191 @@ mpegts_packetizer_push (MpegTSPacketizer2 * packetizer, GstBuffer * buffer)
   gst_adapter_push (packetizer->adapter, buffer);
 }
 
+static const guint psizes[] = {
+  MPEGTS_NORMAL_PACKETSIZE,
+  MPEGTS_M2TS_PACKETSIZE,
+  MPEGTS_DVB_ASI_PACKETSIZE,
+  MPEGTS_ATSC_PACKETSIZE
+};
+
+/* Look for 4 sync bytes in a row for any of the known packet sizes.
+ * Only positions that can be fully checked within @size bytes are
+ * considered, so this never looks at more than
+ * size - 3 * MPEGTS_MAX_PACKETSIZE candidates.
+ * Returns the offset of the first packet or -1 if none was found */
+static gint
+mpegts_packetizer_find_sync (const guint8 * data, guint size,
+    guint * packet_size)
+{
+  const guint8 *p, *end;
+  guint i, psize;
+
+  if (size <= 3 * MPEGTS_MAX_PACKETSIZE)
+    return -1;
+
+  end = data + size - 3 * MPEGTS_MAX_PACKETSIZE;
+  for (p = data; p < end && (p = memchr (p, 0x47, end - p)); p++) {
+    for (i = 0; i < G_N_ELEMENTS (psizes); i++) {
+      psize = psizes[i];
+      if (p[psize] != 0x47 || p[psize * 2] != 0x47 || p[psize * 3] != 0x47)
+        continue;
+
+      /* M2TS packets have a 4 bytes header before the sync byte */
+      if (psize == MPEGTS_M2TS_PACKETSIZE) {
+        if (p - data < 4)
+          continue;
+        *packet_size = psize;
+        return p - data - 4;
+      }
+
+      *packet_size = psize;
+      return p - data;
+    }
+  }
+
+  return -1;
+}
+
 static gboolean
 mpegts_try_discover_packet_size (MpegTSPacketizer2 * packetizer)
 {
-  guint8 *dest;
-  int i, pos = -1, j;
-  static const guint psizes[] = {
-    MPEGTS_NORMAL_PACKETSIZE,
-    MPEGTS_M2TS_PACKETSIZE,
-    MPEGTS_DVB_ASI_PACKETSIZE,
-    MPEGTS_ATSC_PACKETSIZE
-  };
-
-
-  dest = g_malloc (MPEGTS_MAX_PACKETSIZE * 4);
-  /* wait for 3 sync bytes */
-  while (packetizer->adapter->size >= MPEGTS_MAX_PACKETSIZE * 4) {
-
-    /* check for sync bytes */
-    gst_adapter_copy (packetizer->adapter, dest, 0, MPEGTS_MAX_PACKETSIZE * 4);
-    /* find first sync byte */
-    pos = -1;
-    for (i = 0; i < MPEGTS_MAX_PACKETSIZE; i++) {
-      if (dest[i] == 0x47) {
-        for (j = 0; j < 4; j++) {
-          guint packetsize = psizes[j];
-          /* check each of the packet size possibilities in turn */
-          if (dest[i] == 0x47 && dest[i + packetsize] == 0x47 &&
-              dest[i + packetsize * 2] == 0x47 &&
-              dest[i + packetsize * 3] == 0x47) {
-            packetizer->know_packet_size = TRUE;
-            packetizer->packet_size = packetsize;
-            packetizer->caps = gst_caps_new_simple ("video/mpegts",
-                "systemstream", G_TYPE_BOOLEAN, TRUE,
-                "packetsize", G_TYPE_INT, packetsize, NULL);
-            if (packetsize == MPEGTS_M2TS_PACKETSIZE)
-              pos = i - 4;
-            else
-              pos = i;
-            break;
-          }
-        }
-        break;
-      }
+  GstAdapter *adapter = packetizer->adapter;
+  const guint8 *data;
+  guint size, packetsize, drop;
+  gint pos;
+
+  /* wait for 4 sync bytes */
+  while (adapter->size >= MPEGTS_MAX_PACKETSIZE * 4) {
+    /* scan the first buffer of the adapter in place, only small buffers
+     * need to be merged by the adapter to get enough data */
+    size = GST_BUFFER_SIZE (GST_BUFFER_CAST (adapter->buflist->data)) -
+        adapter->skip;
+    size = MAX (size, MPEGTS_MAX_PACKETSIZE * 4);
+    data = gst_adapter_peek (adapter, size);
+
+    pos = mpegts_packetizer_find_sync (data, size, &packetsize);
+    if (pos >= 0) {
+      packetizer->know_packet_size = TRUE;
+      packetizer->packet_size = packetsize;
+      packetizer->caps = gst_caps_new_simple ("video/mpegts",
+          "systemstream", G_TYPE_BOOLEAN, TRUE,
+          "packetsize", G_TYPE_INT, packetsize, NULL);
+      drop = pos;
+    } else {
+      /* none of the positions we could check holds a sync point */
+      drop = size - 3 * MPEGTS_MAX_PACKETSIZE;
+    }
+
+    if (drop) {
+      GST_DEBUG ("Flushing out %u bytes", drop);
+      gst_adapter_flush (adapter, drop);
+      packetizer->offset += drop;
+      packetizer->dropped_bytes += drop;
     }
 
     if (packetizer->know_packet_size)
       break;
-
-    /* Skip MPEGTS_MAX_PACKETSIZE */
-    gst_adapter_flush (packetizer->adapter, MPEGTS_MAX_PACKETSIZE);
-    packetizer->offset += MPEGTS_MAX_PACKETSIZE;
   }
 
-  g_free (dest);
-
-  if (packetizer->know_packet_size) {
+  if (packetizer->know_packet_size)
     GST_DEBUG ("have packetsize detected: %d of %u bytes",
         packetizer->know_packet_size, packetizer->packet_size);
-    /* flush to sync byte */
-    if (pos > 0) {
-      GST_DEBUG ("Flushing out %d bytes", pos);
-      gst_adapter_flush (packetizer->adapter, pos);
-      packetizer->offset += pos;
-    } else if (!packetizer->know_packet_size) {
-      /* drop invalid data and move to the next possible packets */
-      gst_adapter_flush (packetizer->adapter, MPEGTS_MAX_PACKETSIZE);
-    }
-  }
 
   return packetizer->know_packet_size;
 }
 
+/* Number of bytes left in the current run of packets */
+static inline guint
+mpegts_packetizer_map_left (MpegTSPacketizer2 * packetizer)
+{
+  if (packetizer->map_buffer == NULL)
+    return 0;
+
+  return GST_BUFFER_SIZE (packetizer->map_buffer) - packetizer->map_pos;
+}
+
+/* Make sure there is a whole packet at map_pos in the current run.
+ *
+ * Runs never span two upstream buffers: we take as many whole packets as
+ * the first buffer of the adapter holds, which is a sub-buffer and doesn't
+ * involve any copy. Only packets straddling two upstream buffers (or the
+ * end of a run after a resync) get merged into a packet-sized buffer. */
+static gboolean
+mpegts_packetizer_map (MpegTSPacketizer2 * packetizer)
+{
+  GstAdapter *adapter = packetizer->adapter;
+  guint packet_size = packetizer->packet_size;
+  guint left, size;
+  GstBuffer *buf;
+
+  left = mpegts_packetizer_map_left (packetizer);
+  if (G_LIKELY (left >= packet_size))
+    return TRUE;
+
+  if (adapter->size + left < packet_size)
+    goto need_more;
+
+  if (left) {
+    /* complete the partial packet at the end of the run */
+    buf = gst_buffer_new_and_alloc (packet_size);
+    memcpy (GST_BUFFER_DATA (buf),
+        GST_BUFFER_DATA (packetizer->map_buffer) + packetizer->map_pos, left);
+    gst_adapter_copy (adapter, GST_BUFFER_DATA (buf) + left, 0,
+        packet_size - left);
+    gst_adapter_flush (adapter, packet_size - left);
+  } else {
+    size = GST_BUFFER_SIZE (GST_BUFFER_CAST (adapter->buflist->data)) -
+        adapter->skip;
+    if (size < packet_size)
+      size = packet_size;
+    else
+      size -= size % packet_size;
+    buf = gst_adapter_take_buffer (adapter, size);
+  }
+
+  if (packetizer->map_buffer)
+    gst_buffer_unref (packetizer->map_buffer);
+  packetizer->map_buffer = buf;
+  packetizer->map_pos = 0;
+
+  GST_LOG ("mapped run of %u bytes at offset %" G_GUINT64_FORMAT,
+      GST_BUFFER_SIZE (buf), packetizer->offset);
+
+  return TRUE;
+
+need_more:
+  if (packetizer->map_buffer && left == 0) {
+    gst_buffer_unref (packetizer->map_buffer);
+    packetizer->map_buffer = NULL;
+    packetizer->map_pos = 0;
+  }
+  return FALSE;
+}
+
+/* Find the next sync point in the current run after @start (the sync byte
+ * position of the packet that lost sync) and return the number of bytes to
+ * skip to realign on it. A candidate is only accepted if the following
+ * packet also starts with a sync byte, unless that packet is beyond the end
+ * of the run. The partial packet this can leave at the end of the run gets
+ * merged with the following data by mpegts_packetizer_map(). */
+static guint
+mpegts_packetizer_resync (MpegTSPacketizer2 * packetizer, guint8 * start)
+{
+  guint8 *p, *end;
+  guint psize = packetizer->packet_size;
+
+  end = GST_BUFFER_DATA (packetizer->map_buffer) +
+      GST_BUFFER_SIZE (packetizer->map_buffer);
+
+  for (p = start + 1; p < end && (p = memchr (p, 0x47, end - p)); p++) {
+    if (p + psize >= end || p[psize] == 0x47)
+      return p - start;
+  }
+
+  /* no sync byte left in this run */
+  return end - start;
+}
+
 gboolean
 mpegts_packetizer_has_packets (MpegTSPacketizer2 * packetizer)
 {
@@ -2196,14 +2430,16 @@ mpegts_packetizer_has_packets (MpegTSPacketizer2 * packetizer)
     if (!mpegts_try_discover_packet_size (packetizer))
       return FALSE;
   }
-  return packetizer->adapter->size >= packetizer->packet_size;
+  return packetizer->adapter->size + mpegts_packetizer_map_left (packetizer) >=
+      packetizer->packet_size;
 }
 
 MpegTSPacketizerPacketReturn
 mpegts_packetizer_next_packet (MpegTSPacketizer2 * packetizer,
     MpegTSPacketizerPacket * packet)
 {
-  guint avail;
+  guint8 *data;
+  guint hdr;
 
   packet->buffer = NULL;
 
@@ -2212,57 +2448,44 @@ mpegts_packetizer_next_packet (MpegTSPacketizer2 * packetizer,
       return PACKET_NEED_MORE;
   }
 
-  while ((avail = packetizer->adapter->size) >= packetizer->packet_size) {
-    packet->buffer = gst_adapter_take_buffer (packetizer->adapter,
-        packetizer->packet_size);
-    /* M2TS packets don't start with the sync byte, all other variants do */
-    if (packetizer->packet_size == MPEGTS_M2TS_PACKETSIZE) {
-      packet->data_start = GST_BUFFER_DATA (packet->buffer) + 4;
-    } else {
-      packet->data_start = GST_BUFFER_DATA (packet->buffer);
-    }
+  /* M2TS packets don't start with the sync byte, all other variants do */
+  hdr = packetizer->packet_size == MPEGTS_M2TS_PACKETSIZE ? 4 : 0;
+
+  while (mpegts_packetizer_map (packetizer)) {
+    data = GST_BUFFER_DATA (packetizer->map_buffer) + packetizer->map_pos;
+
+    packet->buffer = packetizer->map_buffer;
+    packet->data_start = data + hdr;
     /* ALL mpeg-ts variants contain 188 bytes of data. Those with bigger packet
      * sizes contain either extra data (timesync, FEC, ..) either before or after
      * the data */
     packet->data_end = packet->data_start + 188;
-    GST_BUFFER_OFFSET (packet->buffer) = packet->offset = packetizer->offset;
+    packet->offset = packetizer->offset;
     GST_DEBUG ("offset %" G_GUINT64_FORMAT, packet->offset);
-    packetizer->offset += packetizer->packet_size;
-    GST_MEMDUMP ("buffer", GST_BUFFER_DATA (packet->buffer), 16);
     GST_MEMDUMP ("data_start", packet->data_start, 16);
 
     /* Check sync byte */
     if (G_UNLIKELY (packet->data_start[0] != 0x47)) {
-      guint i;
-      GstBuffer *tmpbuf;
-
-      GST_LOG ("Lost sync %d", packetizer->packet_size);
-      /* Find the 0x47 in the buffer */
-      for (i = 0; i < packetizer->packet_size; i++)
-        if (GST_BUFFER_DATA (packet->buffer)[i] == 0x47)
-          break;
-      if (G_UNLIKELY (i == packetizer->packet_size)) {
-        GST_ERROR ("REALLY lost the sync");
-        gst_buffer_unref (packet->buffer);
-        goto done;
-      }
-      /* Pop out the remaining data... */
-      GST_BUFFER_DATA (packet->buffer) += i;
-      GST_BUFFER_SIZE (packet->buffer) -= i;
-      GST_BUFFER_OFFSET (packet->buffer) += i;
-      tmpbuf =
-          gst_adapter_take_buffer (packetizer->adapter,
-          packetizer->adapter->size);
-      /* ... and push everything back in */
-      gst_adapter_push (packetizer->adapter, packet->buffer);
-      gst_adapter_push (packetizer->adapter, tmpbuf);
+      guint skip;
+
+      skip = mpegts_packetizer_resync (packetizer, packet->data_start);
+      GST_DEBUG ("Lost sync %d, skipping %u bytes", packetizer->packet_size,
+          skip);
+
+      packetizer->map_pos += skip;
+      packetizer->offset += skip;
+      packetizer->resync_count++;
+      packetizer->dropped_bytes += skip;
       continue;
     }
 
+    packetizer->map_pos += packetizer->packet_size;
+    packetizer->offset += packetizer->packet_size;
+
     return mpegts_packetizer_parse_packet (packetizer, packet);
   }
 
-done:
+  packet->buffer = NULL;
   return PACKET_NEED_MORE;
 }
 
@@ -2273,6 +2496,49 @@ mpegts_packetizer_clear_packet (MpegTSPacketizer2 * packetizer,
   memset (packet, 0, sizeof (MpegTSPacketizerPacket));
 }
 
+/**
+ * mpegts_packetizer_packet_get_buffer:
+ * @packetizer: a #MpegTSPacketizer2
+ * @packet: the packet returned by mpegts_packetizer_next_packet()
+ *
+ * Returns: a sub-buffer of the packet run containing the whole packet,
+ * including any extra header/trailer of M2TS/DVB-ASI/ATSC packets.
+ */
+GstBuffer *
+mpegts_packetizer_packet_get_buffer (MpegTSPacketizer2 * packetizer,
+    MpegTSPacketizerPacket * packet)
+{
+  guint8 *data = packet->data_start;
+
+  if (packetizer->packet_size == MPEGTS_M2TS_PACKETSIZE)
+    data -= 4;
+
+  return mpegts_packetizer_packet_sub_buffer (packet, data,
+      packetizer->packet_size);
+}
+
+/**
+ * mpegts_packetizer_packet_sub_buffer:
+ * @packet: the packet returned by mpegts_packetizer_next_packet()
+ * @data: start of the region within the packet
+ * @size: size of the region
+ *
+ * Returns: a sub-buffer of the packet run covering @size bytes from @data,
+ * with the offset set to the one of the packet.
+ */
+GstBuffer *
+mpegts_packetizer_packet_sub_buffer (MpegTSPacketizerPacket * packet,
+    guint8 * data, guint size)
+{
+  GstBuffer *buf;
+
+  buf = gst_buffer_create_sub (packet->buffer,
+      data - GST_BUFFER_DATA (packet->buffer), size);
+  GST_BUFFER_OFFSET (buf) = packet->offset;
+
+  return buf;
+}
+
 gboolean
 mpegts_packetizer_push_section (MpegTSPacketizer2 * packetizer,
     MpegTSPacketizerPacket * packet, MpegTSPacketizerSection * section)
@@ -79,6 +79,17 @@ struct _MpegTSPacketizer2 {
   /* current offset of the tip of the adapter */
   guint64 offset;
   gboolean empty;
+
+  /* Run of packets currently being iterated. Packets are handed out as
+   * descriptors pointing into this buffer, which is taken from the adapter
+   * in one go for as many whole packets as possible. map_pos is the
+   * position of the next packet in it. */
+  GstBuffer *map_buffer;
+  guint map_pos;
+
+  /* resync statistics, kept for the lifetime of the packetizer */
+  guint64 resync_count;
+  guint64 dropped_bytes;
 };
 
 struct _MpegTSPacketizer2Class {
@@ -87,6 +98,10 @@ struct _MpegTSPacketizer2Class {
 
 typedef struct
 {
+  /* the run of packets this packet lives in. It is owned by the packetizer
+   * and only valid until the next call to mpegts_packetizer_next_packet(),
+   * use mpegts_packetizer_packet_get_buffer() or
+   * mpegts_packetizer_packet_sub_buffer() to keep data around */
   GstBuffer *buffer;
   gint16 pid;
   guint8 payload_unit_start_indicator;
@@ -125,7 +140,12 @@ typedef struct
    * section_syntax_indicator is 0, sub_table_extension will be set to 0 */
   guint16 subtable_extension;
   guint8 version_number;
-  guint32 crc;
+  guint8 last_section_number;
+  /* sections of the current version already seen (bitmap indexed by
+   * section_number) and their CRC, so repetitions can be dropped before
+   * being parsed */
+  guint8 seen_sections[32];
+  guint32 *crcs;
 } MpegTSPacketizerStreamSubtable;
 
 typedef enum {
@@ -138,12 +158,17 @@ GType mpegts_packetizer_get_type(void);
 
 MpegTSPacketizer2 *mpegts_packetizer_new (void);
 void mpegts_packetizer_clear (MpegTSPacketizer2 *packetizer);
+void mpegts_packetizer_flush (MpegTSPacketizer2 *packetizer);
 void mpegts_packetizer_push (MpegTSPacketizer2 *packetizer, GstBuffer *buffer);
 gboolean mpegts_packetizer_has_packets (MpegTSPacketizer2 *packetizer);
 MpegTSPacketizerPacketReturn mpegts_packetizer_next_packet (MpegTSPacketizer2 *packetizer,
   MpegTSPacketizerPacket *packet);
 void mpegts_packetizer_clear_packet (MpegTSPacketizer2 *packetizer,
   MpegTSPacketizerPacket *packet);
+GstBuffer *mpegts_packetizer_packet_get_buffer (MpegTSPacketizer2 *packetizer,
+  MpegTSPacketizerPacket *packet);
+GstBuffer *mpegts_packetizer_packet_sub_buffer (MpegTSPacketizerPacket *packet,
+  guint8 *data, guint size);
 void mpegts_packetizer_remove_stream(MpegTSPacketizer2 *packetizer,
   gint16 pid);
 
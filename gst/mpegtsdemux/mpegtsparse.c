@@ -564,7 +564,7 @@ mpegts_parse_push (MpegTSBase * base, MpegTSPacketizerPacket * packet,
     mpegts_parse_sync_program_pads (parse);
 
   pid = packet->pid;
-  buffer = gst_buffer_make_metadata_writable (packet->buffer);
+  buffer = mpegts_packetizer_packet_get_buffer (base->packetizer, packet);
   /* we have the same caps on all the src pads */
   gst_buffer_set_caps (buffer, base->packetizer->caps);
 
@@ -639,7 +639,6 @@ mpegts_parse_push (MpegTSBase * base, MpegTSPacketizerPacket * packet,
   }
 
   gst_buffer_unref (buffer);
-  packet->buffer = NULL;
 
   return ret;
 }
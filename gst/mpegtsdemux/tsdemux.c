@@ -41,8 +41,19 @@
 
 #define TABLE_ID_UNSET 0xFF
 
-/* Size of the pendingbuffers array. */
-#define TS_MAX_PENDING_BUFFERS	256
+/* Initial size of the per-stream pending buffers array */
+#define TS_PENDING_BUFFERS_INITIAL_SIZE	32
+
+/* Minimum time between two entries of the seek index */
+#define TS_INDEX_INTERVAL GST_SECOND
+
+/* Sidecar index file layout, all fields big-endian:
+ *   'TSIX', version (32), upstream size (64), packet size (32),
+ *   number of entries (32), then per entry time (64) and offset (64) */
+#define TS_INDEX_FILE_MAGIC 0x54534958
+#define TS_INDEX_FILE_VERSION 1
+#define TS_INDEX_FILE_HEADER_SIZE 24
+#define TS_INDEX_FILE_ENTRY_SIZE 16
 
 GST_DEBUG_CATEGORY_STATIC (ts_demux_debug);
 #define GST_CAT_DEFAULT ts_demux_debug
@@ -85,20 +96,25 @@ struct _TSDemuxStream
 
   /* Output data */
   PendingPacketState state;
-  /* Pending buffers array. */
-  /* These buffers are stored in this array until the PES header (if needed)
-   * is succesfully parsed. */
-  GstBuffer *pendingbuffers[TS_MAX_PENDING_BUFFERS];
-  guint8 nbpending;
-
-  /* Current data to be pushed out */
-  GstBufferList *current;
-  GstBufferListIterator *currentit;
-  GList *currentlist;
+  /* Buffers of the current PES packet, in order. The first one holds the
+   * PES header. The array is allocated once and reused for every PES
+   * packet of the stream, it only grows if a PES packet spans more
+   * buffers than it can hold. */
+  GstBuffer **pendingbuffers;
+  guint nbpending;
+  guint pendingsize;
 
   GstClockTime pts;
 };
 
+static void gst_ts_demux_stream_flush (TSDemuxStream * stream);
+
+typedef struct
+{
+  GstClockTime time;            /* PCR, in GstClockTime */
+  guint64 offset;               /* offset of the packet carrying it */
+} TSDemuxIndexEntry;
+
 #define VIDEO_CAPS \
   GST_STATIC_CAPS (\
     "video/mpeg, " \
@@ -159,12 +175,17 @@ enum
   ARG_0,
   PROP_PROGRAM_NUMBER,
   PROP_EMIT_STATS,
+  PROP_INDEX_FILE,
   /* FILL ME */
 };
 
 /* Pad functions */
 static const GstQueryType *gst_ts_demux_srcpad_query_types (GstPad * pad);
 static gboolean gst_ts_demux_srcpad_query (GstPad * pad, GstQuery * query);
+static gboolean gst_ts_demux_srcpad_event (GstPad * pad, GstEvent * event);
+
+static GstStateChangeReturn gst_ts_demux_change_state (GstElement * element,
+    GstStateChange transition);
 
 
 /* mpegtsbase methods */
@@ -191,6 +212,8 @@ static GstFlowReturn
 process_pcr (MpegTSBase * base, guint64 initoff, GstClockTime * pcr,
     guint numpcr, gboolean isinitial);
 static gboolean push_event (MpegTSBase * base, GstEvent * event);
+static gboolean gst_ts_demux_do_seek (MpegTSBase * base, GstEvent * event);
+static void gst_ts_demux_index_save (GstTSDemux * demux);
 static void _extra_init (GType type);
 
 GST_BOILERPLATE_FULL (GstTSDemux, gst_ts_demux, MpegTSBase,
@@ -234,9 +257,11 @@ static void
 gst_ts_demux_class_init (GstTSDemuxClass * klass)
 {
   GObjectClass *gobject_class;
+  GstElementClass *element_class;
   MpegTSBaseClass *ts_class;
 
   gobject_class = G_OBJECT_CLASS (klass);
+  element_class = GST_ELEMENT_CLASS (klass);
   gobject_class->set_property = gst_ts_demux_set_property;
   gobject_class->get_property = gst_ts_demux_get_property;
   gobject_class->finalize = gst_ts_demux_finalize;
@@ -251,6 +276,12 @@ gst_ts_demux_class_init (GstTSDemuxClass * klass)
           "Emit messages for every pcr/opcr/pts/dts", FALSE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_INDEX_FILE,
+      g_param_spec_string ("index-file", "Index file",
+          "File to load the seek index from and save it to (NULL to disable)",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state = GST_DEBUG_FUNCPTR (gst_ts_demux_change_state);
 
   ts_class = GST_MPEGTS_BASE_CLASS (klass);
   ts_class->push = GST_DEBUG_FUNCPTR (gst_ts_demux_push);
@@ -260,6 +291,7 @@ gst_ts_demux_class_init (GstTSDemuxClass * klass)
   ts_class->stream_added = gst_ts_demux_stream_added;
   ts_class->stream_removed = gst_ts_demux_stream_removed;
   ts_class->find_timestamps = GST_DEBUG_FUNCPTR (find_timestamps);
+  ts_class->seek = GST_DEBUG_FUNCPTR (gst_ts_demux_do_seek);
 }
 
 static void
@@ -268,12 +300,20 @@ gst_ts_demux_init (GstTSDemux * demux, GstTSDemuxClass * klass)
   demux->need_newsegment = TRUE;
   demux->program_number = -1;
   demux->duration = GST_CLOCK_TIME_NONE;
+  demux->first_pcr = GST_CLOCK_TIME_NONE;
+  demux->first_pts = GST_CLOCK_TIME_NONE;
+  demux->index = g_array_new (FALSE, FALSE, sizeof (TSDemuxIndexEntry));
   GST_MPEGTS_BASE (demux)->stream_size = sizeof (TSDemuxStream);
 }
 
 static void
 gst_ts_demux_finalize (GObject * object)
 {
+  GstTSDemux *demux = GST_TS_DEMUX (object);
+
+  g_array_free (demux->index, TRUE);
+  g_free (demux->index_file);
+
   if (G_OBJECT_CLASS (parent_class)->finalize)
     G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -295,6 +335,12 @@ gst_ts_demux_set_property (GObject * object, guint prop_id,
     case PROP_EMIT_STATS:
       demux->emit_statistics = g_value_get_boolean (value);
       break;
+    case PROP_INDEX_FILE:
+      GST_OBJECT_LOCK (demux);
+      g_free (demux->index_file);
+      demux->index_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (demux);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -313,6 +359,11 @@ gst_ts_demux_get_property (GObject * object, guint prop_id,
     case PROP_EMIT_STATS:
       g_value_set_boolean (value, demux->emit_statistics);
       break;
+    case PROP_INDEX_FILE:
+      GST_OBJECT_LOCK (demux);
+      g_value_set_string (value, demux->index_file);
+      GST_OBJECT_UNLOCK (demux);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -323,6 +374,7 @@ gst_ts_demux_srcpad_query_types (GstPad * pad)
 {
   static const GstQueryType query_types[] = {
     GST_QUERY_DURATION,
+    GST_QUERY_SEEKING,
     0
   };
 
@@ -350,6 +402,21 @@ gst_ts_demux_srcpad_query (GstPad * pad, GstQuery * query)
       gst_query_set_duration (query, GST_FORMAT_TIME, demux->duration);
       break;
     }
+    case GST_QUERY_SEEKING:
+    {
+      GstFormat format;
+      MpegTSBase *base = (MpegTSBase *) demux;
+
+      gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+      if (format != GST_FORMAT_TIME)
+        goto wrong_format;
+
+      /* we can only seek in pull mode, with an index */
+      gst_query_set_seeking (query, GST_FORMAT_TIME,
+          GST_PAD_ACTIVATE_MODE (base->sinkpad) == GST_ACTIVATE_PULL
+          && GST_CLOCK_TIME_IS_VALID (demux->first_pcr), 0, demux->duration);
+      break;
+    }
     default:
       res = gst_pad_query_default (pad, query);
       break;
@@ -361,29 +428,75 @@ done:
 
 wrong_format:
   {
-    GST_DEBUG_OBJECT (demux, "only query duration on TIME is supported");
+    GST_DEBUG_OBJECT (demux, "only queries on TIME are supported");
     res = FALSE;
     goto done;
   }
 }
 
+static gboolean
+gst_ts_demux_srcpad_event (GstPad * pad, GstEvent * event)
+{
+  gboolean res;
+  GstTSDemux *demux;
+
+  demux = GST_TS_DEMUX (gst_pad_get_parent (pad));
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_SEEK:
+      res = mpegts_base_handle_seek_event ((MpegTSBase *) demux, pad, event);
+      gst_event_unref (event);
+      break;
+    default:
+      res = gst_pad_event_default (pad, event);
+      break;
+  }
+
+  gst_object_unref (demux);
+  return res;
+}
+
+static GstStateChangeReturn
+gst_ts_demux_change_state (GstElement * element, GstStateChange transition)
+{
+  GstTSDemux *demux = GST_TS_DEMUX (element);
+  GstStateChangeReturn ret;
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_ts_demux_index_save (demux);
+      g_array_set_size (demux->index, 0);
+      demux->index_dirty = FALSE;
+      demux->index_upstream_size = 0;
+      demux->first_pcr = GST_CLOCK_TIME_NONE;
+      demux->first_pts = GST_CLOCK_TIME_NONE;
+      demux->need_newsegment = TRUE;
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
 
 static gboolean
 push_event (MpegTSBase * base, GstEvent * event)
 {
   GstTSDemux *demux = (GstTSDemux *) base;
-  guint i;
+  GList *tmp;
 
   if (G_UNLIKELY (demux->program == NULL))
     return FALSE;
 
-  for (i = 0; i < 0x2000; i++) {
-    if (demux->program->streams[i]) {
-      if (((TSDemuxStream *) demux->program->streams[i])->pad) {
-        gst_event_ref (event);
-        gst_pad_push_event (((TSDemuxStream *) demux->program->streams[i])->pad,
-            event);
-      }
+  for (tmp = demux->program->stream_list; tmp; tmp = tmp->next) {
+    TSDemuxStream *stream = (TSDemuxStream *) tmp->data;
+
+    if (stream->pad) {
+      gst_event_ref (event);
+      gst_pad_push_event (stream->pad, event);
     }
   }
 
@@ -394,7 +507,7 @@ static GstFlowReturn
 tsdemux_combine_flows (GstTSDemux * demux, TSDemuxStream * stream,
     GstFlowReturn ret)
 {
-  guint i;
+  GList *tmp;
 
   /* Store the value */
   stream->flow_return = ret;
@@ -404,20 +517,18 @@ tsdemux_combine_flows (GstTSDemux * demux, TSDemuxStream * stream,
     goto done;
 
   /* Only return NOT_LINKED if all other pads returned NOT_LINKED */
-  for (i = 0; i < 0x2000; i++) {
-    if (demux->program->streams[i]) {
-      stream = (TSDemuxStream *) demux->program->streams[i];
-      if (stream->pad) {
-        ret = stream->flow_return;
-        /* some other return value (must be SUCCESS but we can return
-         * other values as well) */
-        if (ret != GST_FLOW_NOT_LINKED)
-          goto done;
-      }
+  for (tmp = demux->program->stream_list; tmp; tmp = tmp->next) {
+    stream = (TSDemuxStream *) tmp->data;
+    if (stream->pad) {
+      ret = stream->flow_return;
+      /* some other return value (must be SUCCESS but we can return
+       * other values as well) */
+      if (ret != GST_FLOW_NOT_LINKED)
+        goto done;
     }
-    /* if we get here, all other pads were unlinked and we return
-     * NOT_LINKED then */
   }
+  /* if we get here, all other pads were unlinked and we return
+   * NOT_LINKED then */
 
 done:
   return ret;
@@ -670,6 +781,7 @@ create_pad_for_stream (MpegTSBase * base, MpegTSBaseStream * bstream,
     gst_pad_set_caps (pad, caps);
     gst_pad_set_query_type_function (pad, gst_ts_demux_srcpad_query_types);
     gst_pad_set_query_function (pad, gst_ts_demux_srcpad_query);
+    gst_pad_set_event_function (pad, gst_ts_demux_srcpad_event);
     gst_caps_unref (caps);
   }
 
@@ -690,6 +802,11 @@ gst_ts_demux_stream_added (MpegTSBase * base, MpegTSBaseStream * bstream,
       stream->pad = create_pad_for_stream (base, bstream, program);
     stream->pts = GST_CLOCK_TIME_NONE;
   }
+  if (!stream->pendingbuffers) {
+    stream->pendingsize = TS_PENDING_BUFFERS_INITIAL_SIZE;
+    stream->pendingbuffers = g_new (GstBuffer *, stream->pendingsize);
+    stream->nbpending = 0;
+  }
   stream->flow_return = GST_FLOW_OK;
 }
 
@@ -703,6 +820,10 @@ gst_ts_demux_stream_removed (MpegTSBase * base, MpegTSBaseStream * bstream)
       gst_object_unref (stream->pad);
       stream->pad = NULL;
     }
+    gst_ts_demux_stream_flush (stream);
+    g_free (stream->pendingbuffers);
+    stream->pendingbuffers = NULL;
+    stream->pendingsize = 0;
     stream->flow_return = GST_FLOW_NOT_LINKED;
   }
 }
@@ -727,7 +848,7 @@ gst_ts_demux_program_started (MpegTSBase * base, MpegTSBaseProgram * program)
 
   if (demux->program_number == -1 ||
       demux->program_number == program->program_number) {
-    guint i;
+    GList *tmp;
 
     GST_LOG ("program %d started", program->program_number);
     demux->program_number = program->program_number;
@@ -739,10 +860,8 @@ gst_ts_demux_program_started (MpegTSBase * base, MpegTSBaseProgram * program)
      * For example, we don't want to expose HDV AUX private streams, we will just
      * be using them directly for seeking and metadata. */
     if (base->mode != BASE_MODE_SCANNING)
-      for (i = 0; i < 0x2000; i++)
-        if (program->streams[i])
-          activate_pad_for_stream (demux,
-              (TSDemuxStream *) program->streams[i]);
+      for (tmp = program->stream_list; tmp; tmp = tmp->next)
+        activate_pad_for_stream (demux, (TSDemuxStream *) tmp->data);
 
     /* Inform scanner we have got our program */
     demux->current_program_number = program->program_number;
@@ -752,7 +871,7 @@ gst_ts_demux_program_started (MpegTSBase * base, MpegTSBaseProgram * program)
 static void
 gst_ts_demux_program_stopped (MpegTSBase * base, MpegTSBaseProgram * program)
 {
-  guint i;
+  GList *tmp;
   GstTSDemux *demux = GST_TS_DEMUX (base);
   TSDemuxStream *localstream = NULL;
 
@@ -761,17 +880,15 @@ gst_ts_demux_program_stopped (MpegTSBase * base, MpegTSBaseProgram * program)
   if (program != demux->program)
     return;
 
-  for (i = 0; i < 0x2000; i++) {
-    if (demux->program->streams[i]) {
-      localstream = (TSDemuxStream *) program->streams[i];
-      if (localstream->pad) {
-        GST_DEBUG ("HAVE PAD %s:%s", GST_DEBUG_PAD_NAME (localstream->pad));
-        if (gst_pad_is_active (localstream->pad))
-          gst_element_remove_pad (GST_ELEMENT_CAST (demux), localstream->pad);
-        else
-          gst_object_unref (localstream->pad);
-        localstream->pad = NULL;
-      }
+  for (tmp = program->stream_list; tmp; tmp = tmp->next) {
+    localstream = (TSDemuxStream *) tmp->data;
+    if (localstream->pad) {
+      GST_DEBUG ("HAVE PAD %s:%s", GST_DEBUG_PAD_NAME (localstream->pad));
+      if (gst_pad_is_active (localstream->pad))
+        gst_element_remove_pad (GST_ELEMENT_CAST (demux), localstream->pad);
+      else
+        gst_object_unref (localstream->pad);
+      localstream->pad = NULL;
     }
   }
   demux->program = NULL;
@@ -828,6 +945,263 @@ process_section (MpegTSBase * base)
 }
 
 
+/* Seek index
+ *
+ * The index maps PCR times of the current program to byte offsets. It is
+ * seeded with the first and last PCR found when scanning the file and
+ * completed with one entry every TS_INDEX_INTERVAL while playing, so that
+ * seeks get more accurate as more of the file has been seen. It can be
+ * saved to and restored from a sidecar file to skip the initial scan of
+ * the end of the file.
+ *
+ * FIXME : PCR wraparound is not handled, entries after a wraparound are
+ * simply not added. */
+
+static void
+gst_ts_demux_index_add (GstTSDemux * demux, GstClockTime time, guint64 offset)
+{
+  TSDemuxIndexEntry *entries = (TSDemuxIndexEntry *) demux->index->data;
+  TSDemuxIndexEntry entry;
+  guint len = demux->index->len;
+  guint lo = 0, hi = len, mid;
+
+  /* entries are sorted by offset, most additions happen at the end */
+  if (len && entries[len - 1].offset < offset)
+    lo = len;
+  else {
+    while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (entries[mid].offset < offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  }
+
+  /* keep the index sparse and monotonic */
+  if (lo > 0 && time < entries[lo - 1].time + TS_INDEX_INTERVAL)
+    return;
+  if (lo < len && entries[lo].time < time + TS_INDEX_INTERVAL)
+    return;
+
+  GST_LOG_OBJECT (demux, "index entry %u: %" GST_TIME_FORMAT " at offset %"
+      G_GUINT64_FORMAT, lo, GST_TIME_ARGS (time), offset);
+
+  entry.time = time;
+  entry.offset = offset;
+  g_array_insert_val (demux->index, lo, entry);
+  demux->index_dirty = TRUE;
+}
+
+/* Returns the estimated offset of @time, interpolated between the two
+ * surrounding entries (or extrapolated from the two closest ones) */
+static gboolean
+gst_ts_demux_index_lookup (GstTSDemux * demux, GstClockTime time,
+    guint64 * offset)
+{
+  TSDemuxIndexEntry *entries = (TSDemuxIndexEntry *) demux->index->data;
+  TSDemuxIndexEntry *a, *b;
+  guint len = demux->index->len;
+  guint lo = 0, hi = len, mid;
+
+  if (len < 2)
+    return FALSE;
+
+  /* first entry after time */
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (entries[mid].time <= time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == 0) {
+    *offset = entries[0].offset;
+    return TRUE;
+  }
+  if (lo == len)
+    lo = len - 1;
+  a = &entries[lo - 1];
+  b = &entries[lo];
+
+  *offset = a->offset + gst_util_uint64_scale (time - a->time,
+      b->offset - a->offset, b->time - a->time);
+  if (demux->index_upstream_size && *offset > demux->index_upstream_size)
+    *offset = demux->index_upstream_size;
+
+  GST_DEBUG_OBJECT (demux, "%" GST_TIME_FORMAT " is around offset %"
+      G_GUINT64_FORMAT, GST_TIME_ARGS (time), *offset);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ts_demux_index_load (GstTSDemux * demux, const gchar * filename)
+{
+  MpegTSBase *base = (MpegTSBase *) demux;
+  GError *err = NULL;
+  gchar *contents;
+  const guint8 *data;
+  gsize size;
+  guint32 count, i;
+
+  if (!g_file_get_contents (filename, &contents, &size, &err)) {
+    GST_DEBUG_OBJECT (demux, "could not read index %s: %s", filename,
+        err->message);
+    g_error_free (err);
+    return FALSE;
+  }
+
+  data = (const guint8 *) contents;
+  if (size < TS_INDEX_FILE_HEADER_SIZE
+      || GST_READ_UINT32_BE (data) != TS_INDEX_FILE_MAGIC
+      || GST_READ_UINT32_BE (data + 4) != TS_INDEX_FILE_VERSION)
+    goto invalid;
+
+  if (GST_READ_UINT64_BE (data + 8) != demux->index_upstream_size
+      || GST_READ_UINT32_BE (data + 16) != base->packetsize)
+    goto stale;
+
+  count = GST_READ_UINT32_BE (data + 20);
+  if (size != TS_INDEX_FILE_HEADER_SIZE + (gsize) count *
+      TS_INDEX_FILE_ENTRY_SIZE)
+    goto invalid;
+
+  g_array_set_size (demux->index, 0);
+  data += TS_INDEX_FILE_HEADER_SIZE;
+  for (i = 0; i < count; i++) {
+    gst_ts_demux_index_add (demux, GST_READ_UINT64_BE (data),
+        GST_READ_UINT64_BE (data + 8));
+    data += TS_INDEX_FILE_ENTRY_SIZE;
+  }
+  demux->index_dirty = FALSE;
+  g_free (contents);
+
+  GST_DEBUG_OBJECT (demux, "loaded %u index entries from %s",
+      demux->index->len, filename);
+
+  return demux->index->len >= 2;
+
+invalid:
+  {
+    GST_WARNING_OBJECT (demux, "%s is not a valid index file", filename);
+    g_free (contents);
+    return FALSE;
+  }
+stale:
+  {
+    GST_DEBUG_OBJECT (demux, "index %s is for another file", filename);
+    g_free (contents);
+    return FALSE;
+  }
+}
+
+static void
+gst_ts_demux_index_save (GstTSDemux * demux)
+{
+  MpegTSBase *base = (MpegTSBase *) demux;
+  TSDemuxIndexEntry *entries = (TSDemuxIndexEntry *) demux->index->data;
+  GError *err = NULL;
+  gchar *filename;
+  guint8 *contents, *data;
+  gsize size;
+  guint i;
+
+  if (!demux->index_dirty || demux->index->len < 2
+      || demux->index_upstream_size == 0)
+    return;
+
+  GST_OBJECT_LOCK (demux);
+  filename = g_strdup (demux->index_file);
+  GST_OBJECT_UNLOCK (demux);
+
+  if (filename == NULL)
+    return;
+
+  size = TS_INDEX_FILE_HEADER_SIZE +
+      demux->index->len * TS_INDEX_FILE_ENTRY_SIZE;
+  data = contents = g_malloc (size);
+
+  GST_WRITE_UINT32_BE (data, TS_INDEX_FILE_MAGIC);
+  GST_WRITE_UINT32_BE (data + 4, TS_INDEX_FILE_VERSION);
+  GST_WRITE_UINT64_BE (data + 8, demux->index_upstream_size);
+  GST_WRITE_UINT32_BE (data + 16, base->packetsize);
+  GST_WRITE_UINT32_BE (data + 20, demux->index->len);
+  data += TS_INDEX_FILE_HEADER_SIZE;
+  for (i = 0; i < demux->index->len; i++) {
+    GST_WRITE_UINT64_BE (data, entries[i].time);
+    GST_WRITE_UINT64_BE (data + 8, entries[i].offset);
+    data += TS_INDEX_FILE_ENTRY_SIZE;
+  }
+
+  if (!g_file_set_contents (filename, (const gchar *) contents, size, &err)) {
+    GST_WARNING_OBJECT (demux, "could not write index %s: %s", filename,
+        err->message);
+    g_error_free (err);
+  } else {
+    GST_DEBUG_OBJECT (demux, "saved %u index entries to %s",
+        demux->index->len, filename);
+    demux->index_dirty = FALSE;
+  }
+
+  g_free (contents);
+  g_free (filename);
+}
+
+static gboolean
+gst_ts_demux_do_seek (MpegTSBase * base, GstEvent * event)
+{
+  GstTSDemux *demux = GST_TS_DEMUX (base);
+  GstFormat format;
+  gdouble rate;
+  GstSeekFlags flags;
+  GstSeekType start_type, stop_type;
+  gint64 start, stop;
+  guint64 offset;
+  GList *tmp;
+
+  gst_event_parse_seek (event, &rate, &format, &flags, &start_type, &start,
+      &stop_type, &stop);
+
+  if (start_type != GST_SEEK_TYPE_SET
+      || !GST_CLOCK_TIME_IS_VALID (demux->first_pcr)) {
+    GST_WARNING_OBJECT (demux, "can't seek without start position or index");
+    return FALSE;
+  }
+
+  if (start <= 0)
+    offset = base->initial_sync_point;
+  else if (!gst_ts_demux_index_lookup (demux, demux->first_pcr + start,
+          &offset))
+    return FALSE;
+
+  /* go back to a packet boundary */
+  if (offset > base->initial_sync_point)
+    offset -= (offset - base->initial_sync_point) % base->packetsize;
+  else
+    offset = base->initial_sync_point;
+
+  GST_DEBUG_OBJECT (demux, "seeking to %" GST_TIME_FORMAT " at offset %"
+      G_GUINT64_FORMAT, GST_TIME_ARGS (start), offset);
+
+  base->seek_offset = offset;
+
+  /* drop partial PES packets and timestamps from before the seek */
+  if (demux->program) {
+    for (tmp = demux->program->stream_list; tmp; tmp = tmp->next) {
+      TSDemuxStream *stream = (TSDemuxStream *) tmp->data;
+
+      gst_ts_demux_stream_flush (stream);
+      stream->pts = GST_CLOCK_TIME_NONE;
+      stream->flow_return = GST_FLOW_OK;
+    }
+  }
+  demux->need_newsegment = TRUE;
+
+  return TRUE;
+}
+
 static GstFlowReturn
 find_timestamps (MpegTSBase * base, guint64 initoff, guint64 * offset)
 {
@@ -841,6 +1215,7 @@ find_timestamps (MpegTSBase * base, guint64 initoff, guint64 * offset)
   guint i = 0;
   GstClockTime initial, final;
   GstTSDemux *demux = GST_TS_DEMUX (base);
+  gchar *index_file;
 
   GST_DEBUG ("Scanning for timestamps");
 
@@ -887,6 +1262,25 @@ find_timestamps (MpegTSBase * base, guint64 initoff, guint64 * offset)
   }
   GST_DEBUG ("Upstream is %" G_GINT64_FORMAT " bytes", total_bytes);
 
+  demux->first_pcr = initial;
+  demux->index_upstream_size = total_bytes;
+
+  /* A valid sidecar index gives us the last PCR, no need to scan for it */
+  GST_OBJECT_LOCK (demux);
+  index_file = g_strdup (demux->index_file);
+  GST_OBJECT_UNLOCK (demux);
+  if (index_file && gst_ts_demux_index_load (demux, index_file)) {
+    TSDemuxIndexEntry *last = &g_array_index (demux->index, TSDemuxIndexEntry,
+        demux->index->len - 1);
+
+    demux->duration = last->time - initial;
+    GST_DEBUG ("Duration from index:%" GST_TIME_FORMAT,
+        GST_TIME_ARGS (demux->duration));
+    g_free (index_file);
+    goto beach;
+  }
+  g_free (index_file);
+
   scan_offset = total_bytes - 4000 * MPEGTS_MAX_PACKETSIZE;
 
   GST_DEBUG ("Scanning for last sync point between:%" G_GINT64_FORMAT
@@ -1029,10 +1423,13 @@ process_pcr (MpegTSBase * base, guint64 initoff, GstClockTime * pcr,
 beach:
   GST_DEBUG ("Found %d PCR", nbpcr);
   if (nbpcr) {
-    if (isinitial)
+    if (isinitial) {
       *pcr = PCRTIME_TO_GSTTIME (pcrs[0]);
-    else
+      gst_ts_demux_index_add (demux, *pcr, pcroffs[0]);
+    } else {
       *pcr = PCRTIME_TO_GSTTIME (pcrs[nbpcr - 1]);
+      gst_ts_demux_index_add (demux, *pcr, pcroffs[nbpcr - 1]);
+    }
     GST_DEBUG ("pcrdiff:%" GST_TIME_FORMAT " offsetdiff %" G_GUINT64_FORMAT,
         GST_TIME_ARGS (PCRTIME_TO_GSTTIME (pcrs[nbpcr - 1] - pcrs[0])),
         pcroffs[nbpcr - 1] - pcroffs[0]);
@@ -1061,6 +1458,11 @@ gst_ts_demux_record_pcr (GstTSDemux * demux, TSDemuxStream * stream,
       G_GUINT64_FORMAT, bs->pid,
       GST_TIME_ARGS (PCRTIME_TO_GSTTIME (pcr)), offset);
 
+  /* complete the seek index while playing */
+  if (GST_CLOCK_TIME_IS_VALID (demux->first_pcr) && demux->program
+      && bs->pid == demux->program->pcr_pid)
+    gst_ts_demux_index_add (demux, PCRTIME_TO_GSTTIME (pcr), offset);
+
   if (G_UNLIKELY (demux->emit_statistics)) {
     GstStructure *st;
     st = gst_structure_id_empty_new (QUARK_TSDEMUX);
@@ -1257,28 +1659,8 @@ gst_ts_demux_parse_pes_header (GstTSDemux * demux, TSDemuxStream * stream)
   GST_BUFFER_DATA (stream->pendingbuffers[0]) += 6 + PES_header_data_length;
   GST_BUFFER_SIZE (stream->pendingbuffers[0]) -= 6 + PES_header_data_length;
 
-  /* FIXME : responsible for switching to PENDING_PACKET_BUFFER and
-   * creating the bufferlist */
-  if (1) {
-    /* Append to the buffer list */
-    if (G_UNLIKELY (stream->current == NULL)) {
-      guint8 i;
-
-      /* Create a new bufferlist */
-      stream->current = gst_buffer_list_new ();
-      stream->currentit = gst_buffer_list_iterate (stream->current);
-      stream->currentlist = NULL;
-      gst_buffer_list_iterator_add_group (stream->currentit);
-
-      /* Push pending buffers into the list */
-      for (i = stream->nbpending; i; i--)
-        stream->currentlist =
-            g_list_prepend (stream->currentlist, stream->pendingbuffers[i - 1]);
-      memset (stream->pendingbuffers, 0, TS_MAX_PENDING_BUFFERS);
-      stream->nbpending = 0;
-    }
-    stream->state = PENDING_PACKET_BUFFER;
-  }
+  /* The header is valid, the following buffers go out with this one */
+  stream->state = PENDING_PACKET_BUFFER;
 
   return res;
 
@@ -1287,6 +1669,29 @@ discont:
   return res;
 }
 
+/* Drop the pending data and go back to the EMPTY state */
+static void
+gst_ts_demux_stream_flush (TSDemuxStream * stream)
+{
+  guint i;
+
+  for (i = 0; i < stream->nbpending; i++)
+    gst_buffer_unref (stream->pendingbuffers[i]);
+  stream->nbpending = 0;
+  stream->state = PENDING_PACKET_EMPTY;
+}
+
+static inline void
+gst_ts_demux_stream_append (TSDemuxStream * stream, GstBuffer * buf)
+{
+  if (G_UNLIKELY (stream->nbpending == stream->pendingsize)) {
+    stream->pendingsize *= 2;
+    stream->pendingbuffers = g_renew (GstBuffer *, stream->pendingbuffers,
+        stream->pendingsize);
+  }
+  stream->pendingbuffers[stream->nbpending++] = buf;
+}
+
  /* ONLY CALL THIS:
   * * WITH packet->payload != NULL
   * * WITH pending/current flushed out if beginning of new PES packet
@@ -1299,11 +1704,9 @@ gst_ts_demux_queue_data (GstTSDemux * demux, TSDemuxStream * stream,
 
   GST_DEBUG ("state:%d", stream->state);
 
-  buf = packet->buffer;
-  /* HACK : Instead of creating a new buffer, we just modify the data/size
-   * of the buffer to point to the payload */
-  GST_BUFFER_DATA (buf) = packet->payload;
-  GST_BUFFER_SIZE (buf) = packet->data_end - packet->payload;
+  /* Only the payload is kept, as a sub-buffer of the packet run */
+  buf = mpegts_packetizer_packet_sub_buffer (packet, packet->payload,
+      packet->data_end - packet->payload);
 
   if (stream->state == PENDING_PACKET_EMPTY) {
     if (G_UNLIKELY (!packet->payload_unit_start_indicator)) {
@@ -1321,17 +1724,18 @@ gst_ts_demux_queue_data (GstTSDemux * demux, TSDemuxStream * stream,
 
   if (stream->state == PENDING_PACKET_HEADER) {
     GST_LOG ("HEADER: appending data to array");
-    /* Append to the array */
-    stream->pendingbuffers[stream->nbpending++] = buf;
+    gst_ts_demux_stream_append (stream, buf);
 
     /* parse the header */
     gst_ts_demux_parse_pes_header (demux, stream);
   } else if (stream->state == PENDING_PACKET_BUFFER) {
-    GST_LOG ("BUFFER: appending data to bufferlist");
-    stream->currentlist = g_list_prepend (stream->currentlist, buf);
+    GST_LOG ("BUFFER: appending data to array");
+    gst_ts_demux_stream_append (stream, buf);
+  } else {
+    GST_LOG ("DISCONT: dropping data");
+    gst_buffer_unref (buf);
   }
 
-
   return;
 }
 
@@ -1340,19 +1744,21 @@ gst_ts_demux_push_pending_data (GstTSDemux * demux, TSDemuxStream * stream)
 {
   GstFlowReturn res = GST_FLOW_OK;
   MpegTSBaseStream *bs = (MpegTSBaseStream *) stream;
-
-
+  GstBufferList *list;
+  GstBufferListIterator *it;
+  GList *tmp;
   guint i;
   GstClockTime tinypts = GST_CLOCK_TIME_NONE;
   GstClockTime stop = GST_CLOCK_TIME_NONE;
+  GstClockTime position = 0;
   GstEvent *newsegmentevent;
 
   GST_DEBUG ("stream:%p, pid:0x%04x stream_type:%d state:%d pad:%s:%s",
       stream, bs->pid, bs->stream_type, stream->state,
       GST_DEBUG_PAD_NAME (stream->pad));
 
-  if (G_UNLIKELY (stream->current == NULL)) {
-    GST_LOG ("stream->current == NULL");
+  if (G_UNLIKELY (stream->nbpending == 0)) {
+    GST_LOG ("no pending data");
     goto beach;
   }
 
@@ -1362,65 +1768,59 @@ gst_ts_demux_push_pending_data (GstTSDemux * demux, TSDemuxStream * stream)
   }
 
   /* We have a confirmed buffer, let's push it out */
-  if (stream->state == PENDING_PACKET_BUFFER) {
+  if (stream->state == PENDING_PACKET_BUFFER && stream->pad) {
     GST_LOG ("BUFFER: pushing out pending data");
-    stream->currentlist = g_list_reverse (stream->currentlist);
-    gst_buffer_list_iterator_add_list (stream->currentit, stream->currentlist);
-    gst_buffer_list_iterator_free (stream->currentit);
-
-
-    if (stream->pad) {
-
-      if (demux->need_newsegment) {
-
-        for (i = 0; i < 0x2000; i++) {
 
-          if (demux->program->streams[i]) {
-            if ((!GST_CLOCK_TIME_IS_VALID (tinypts))
-                || (((TSDemuxStream *) demux->program->streams[i])->pts <
-                    tinypts))
-              tinypts = ((TSDemuxStream *) demux->program->streams[i])->pts;
-          }
+    list = gst_buffer_list_new ();
+    it = gst_buffer_list_iterate (list);
+    gst_buffer_list_iterator_add_group (it);
+    for (i = 0; i < stream->nbpending; i++)
+      gst_buffer_list_iterator_add (it, stream->pendingbuffers[i]);
+    gst_buffer_list_iterator_free (it);
+    /* the list owns the buffers now */
+    stream->nbpending = 0;
+
+    if (demux->need_newsegment) {
+      for (tmp = demux->program->stream_list; tmp; tmp = tmp->next) {
+        GstClockTime pts = ((TSDemuxStream *) tmp->data)->pts;
+
+        if ((!GST_CLOCK_TIME_IS_VALID (tinypts)) || (pts < tinypts))
+          tinypts = pts;
+      }
 
+      /* stream time is relative to the start of the first segment */
+      if (!GST_CLOCK_TIME_IS_VALID (demux->first_pts))
+        demux->first_pts = tinypts;
+      if (tinypts >= demux->first_pts)
+        position = tinypts - demux->first_pts;
 
-        }
+      if (GST_CLOCK_TIME_IS_VALID (demux->duration))
+        stop = demux->first_pts + demux->duration;
 
-        if (GST_CLOCK_TIME_IS_VALID (demux->duration))
-          stop = tinypts + demux->duration;
+      GST_DEBUG ("Sending newsegment event");
+      newsegmentevent =
+          gst_event_new_new_segment (0, 1.0, GST_FORMAT_TIME, tinypts, stop,
+          position);
 
-        GST_DEBUG ("Sending newsegment event");
-        newsegmentevent =
-            gst_event_new_new_segment (0, 1.0, GST_FORMAT_TIME, tinypts, stop,
-            0);
+      push_event ((MpegTSBase *) demux, newsegmentevent);
+      gst_event_unref (newsegmentevent);
 
-        push_event ((MpegTSBase *) demux, newsegmentevent);
-
-        demux->need_newsegment = FALSE;
-      }
+      demux->need_newsegment = FALSE;
+    }
 
-      GST_DEBUG_OBJECT (stream->pad, "Pushing buffer list ");
+    GST_DEBUG_OBJECT (stream->pad, "Pushing buffer list ");
 
-      res = gst_pad_push_list (stream->pad, stream->current);
-      GST_DEBUG_OBJECT (stream->pad, "Returned %s", gst_flow_get_name (res));
-      /* FIXME : combine flow returns */
-      res = tsdemux_combine_flows (demux, stream, res);
-      GST_DEBUG_OBJECT (stream->pad, "combined %s", gst_flow_get_name (res));
-    }
+    res = gst_pad_push_list (stream->pad, list);
+    GST_DEBUG_OBJECT (stream->pad, "Returned %s", gst_flow_get_name (res));
+    /* FIXME : combine flow returns */
+    res = tsdemux_combine_flows (demux, stream, res);
+    GST_DEBUG_OBJECT (stream->pad, "combined %s", gst_flow_get_name (res));
   }
 
 beach:
   /* Reset everything */
   GST_LOG ("Resetting to EMPTY");
-  stream->state = PENDING_PACKET_EMPTY;
-
-  /* for (i = 0; i < stream->nbpending; i++) */
-  /*   gst_buffer_unref (stream->pendingbuffers[i]); */
-  memset (stream->pendingbuffers, 0, TS_MAX_PENDING_BUFFERS);
-  stream->nbpending = 0;
-
-  stream->current = NULL;
-
-
+  gst_ts_demux_stream_flush (stream);
 
   return res;
 }
@@ -1440,9 +1840,8 @@ gst_ts_demux_handle_packet (GstTSDemux * demux, TSDemuxStream * stream,
       packet->continuity_counter, packet->payload);
 
   if (section) {
-    GST_DEBUG ("section complete:%d, buffer size %d",
-        section->complete, GST_BUFFER_SIZE (section->buffer));
-    gst_buffer_unref (packet->buffer);
+    GST_DEBUG ("section complete:%d, section length %d",
+        section->complete, section->section_length);
     return res;
   }
 
@@ -1452,11 +1851,9 @@ gst_ts_demux_handle_packet (GstTSDemux * demux, TSDemuxStream * stream,
 
   if (packet->adaptation_field_control & 0x2) {
     if (packet->afc_flags & MPEGTS_AFC_PCR_FLAG)
-      gst_ts_demux_record_pcr (demux, stream, packet->pcr,
-          GST_BUFFER_OFFSET (packet->buffer));
+      gst_ts_demux_record_pcr (demux, stream, packet->pcr, packet->offset);
     if (packet->afc_flags & MPEGTS_AFC_OPCR_FLAG)
-      gst_ts_demux_record_opcr (demux, stream, packet->opcr,
-          GST_BUFFER_OFFSET (packet->buffer));
+      gst_ts_demux_record_opcr (demux, stream, packet->opcr, packet->offset);
   }
 
   if (packet->payload)
@@ -1476,13 +1873,8 @@ gst_ts_demux_push (MpegTSBase * base, MpegTSPacketizerPacket * packet,
   if (G_LIKELY (demux->program)) {
     stream = (TSDemuxStream *) demux->program->streams[packet->pid];
 
-    if (stream) {
+    if (stream)
       res = gst_ts_demux_handle_packet (demux, stream, packet, section);
-    } else if (packet->buffer)
-      gst_buffer_unref (packet->buffer);
-  } else {
-    if (packet->buffer)
-      gst_buffer_unref (packet->buffer);
   }
   return res;
 }
@@ -63,6 +63,14 @@ struct _GstTSDemux
   guint	current_program_number;
   gboolean need_newsegment;
   GstClockTime duration;	/* Total duration */
+  GstClockTime first_pcr;	/* PCR time of the start of the stream */
+  GstClockTime first_pts;	/* start of the first newsegment */
+
+  /* PCR time/offset index of the current program, sorted by offset */
+  GArray *index;
+  gboolean index_dirty;
+  guint64 index_upstream_size;
+  gchar *index_file;		/* sidecar file, protected by OBJECT_LOCK */
 };
 
 struct _GstTSDemuxClass
@@ -100,7 +100,10 @@ enum
   ARG_PROG_MAP,
   ARG_M2TS_MODE,
   ARG_PAT_INTERVAL,
-  ARG_PMT_INTERVAL
+  ARG_PMT_INTERVAL,
+  ARG_BITRATE,
+  ARG_ALIGNMENT,
+  ARG_BUFFER_LIST
 };
 
 static GstStaticPadTemplate mpegtsmux_sink_factory =
@@ -149,6 +152,8 @@ static void mpegtsmux_release_pad (GstElement * element, GstPad * pad);
 static GstStateChangeReturn mpegtsmux_change_state (GstElement * element,
     GstStateChange transition);
 static void mpegtsdemux_set_header_on_caps (MpegTsMux * mux);
+static GstFlowReturn mpegtsmux_push_pending (MpegTsMux * mux, gboolean drain);
+static void mpegtsmux_reset_output (MpegTsMux * mux);
 
 GST_BOILERPLATE (MpegTsMux, mpegtsmux, GstElement, GST_TYPE_ELEMENT);
 
@@ -205,6 +210,24 @@ mpegtsmux_class_init (MpegTsMuxClass * klass)
           "Set the interval (in ticks of the 90kHz clock) for writing out the PMT table",
           1, G_MAXUINT, TSMUX_DEFAULT_PMT_INTERVAL,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), ARG_BITRATE,
+      g_param_spec_uint64 ("bitrate", "Bitrate (in bits per second)",
+          "Set the target bitrate of the output, padded with null packets, "
+          "including the timestamps in M2TS mode (0 for variable bitrate)",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), ARG_ALIGNMENT,
+      g_param_spec_uint ("alignment", "Alignment",
+          "Number of packets to aggregate in each output buffer "
+          "(0 for one packet per buffer, 7 fits an UDP datagram)",
+          0, MAX_ALIGNMENT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (G_OBJECT_CLASS (klass), ARG_BUFFER_LIST,
+      g_param_spec_boolean ("buffer-list", "Buffer List",
+          "Push the output buffers made from one input buffer together in a "
+          "buffer list", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -229,6 +252,7 @@ mpegtsmux_init (MpegTsMux * mux, MpegTsMuxClass * g_class)
   mux->m2ts_mode = FALSE;
   mux->pat_interval = TSMUX_DEFAULT_PAT_INTERVAL;
   mux->pmt_interval = TSMUX_DEFAULT_PMT_INTERVAL;
+  mux->bitrate = 0;
   mux->first_pcr = TRUE;
   mux->last_ts = 0;
   mux->is_delta = TRUE;
@@ -236,6 +260,12 @@ mpegtsmux_init (MpegTsMux * mux, MpegTsMuxClass * g_class)
   mux->prog_map = NULL;
   mux->streamheader = NULL;
   mux->streamheader_sent = FALSE;
+
+  mux->alignment = 0;
+  mux->buffer_list = FALSE;
+  mux->out_buf = NULL;
+  mux->out_list = NULL;
+  mux->out_it = NULL;
 }
 
 static void
@@ -248,6 +278,7 @@ mpegtsmux_dispose (GObject * object)
     g_object_unref (mux->adapter);
     mux->adapter = NULL;
   }
+  mpegtsmux_reset_output (mux);
   if (mux->collect) {
     gst_object_unref (mux->collect);
     mux->collect = NULL;
@@ -285,12 +316,13 @@ gst_mpegtsmux_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
 {
   MpegTsMux *mux = GST_MPEG_TSMUX (object);
-  GSList *walk;
 
   switch (prop_id) {
     case ARG_M2TS_MODE:
       /*set incase if the output stream need to be of 192 bytes */
       mux->m2ts_mode = g_value_get_boolean (value);
+      tsmux_set_packet_size (mux->tsmux, mux->m2ts_mode ?
+          M2TS_PACKET_LENGTH : NORMAL_TS_PACKET_LENGTH);
       break;
     case ARG_PROG_MAP:
     {
@@ -310,16 +342,28 @@ gst_mpegtsmux_set_property (GObject * object, guint prop_id,
         tsmux_set_pat_interval (mux->tsmux, mux->pat_interval);
       break;
     case ARG_PMT_INTERVAL:
-      walk = mux->collect->data;
-      mux->pmt_interval = g_value_get_uint (value);
+    {
+      gint i;
 
-      while (walk) {
-        MpegTsPadData *ts_data = (MpegTsPadData *) walk->data;
+      mux->pmt_interval = g_value_get_uint (value);
 
-        tsmux_set_pmt_interval (ts_data->prog, mux->pmt_interval);
-        walk = g_slist_next (walk);
+      for (i = 0; i < MAX_PROG_NUMBER; i++) {
+        if (mux->programs[i])
+          tsmux_set_pmt_interval (mux->programs[i], mux->pmt_interval);
       }
       break;
+    }
+    case ARG_BITRATE:
+      mux->bitrate = g_value_get_uint64 (value);
+      if (mux->tsmux)
+        tsmux_set_bitrate (mux->tsmux, mux->bitrate);
+      break;
+    case ARG_ALIGNMENT:
+      mux->alignment = g_value_get_uint (value);
+      break;
+    case ARG_BUFFER_LIST:
+      mux->buffer_list = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -345,6 +389,15 @@ gst_mpegtsmux_get_property (GObject * object, guint prop_id,
     case ARG_PMT_INTERVAL:
       g_value_set_uint (value, mux->pmt_interval);
       break;
+    case ARG_BITRATE:
+      g_value_set_uint64 (value, mux->bitrate);
+      break;
+    case ARG_ALIGNMENT:
+      g_value_set_uint (value, mux->alignment);
+      break;
+    case ARG_BUFFER_LIST:
+      g_value_set_boolean (value, mux->buffer_list);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -499,51 +552,68 @@ beach:
   return ret;
 }
 
+/* Returns the index of the program @ts_data belongs to, from the prog-map */
+static gint
+mpegtsmux_get_prog_id (MpegTsMux * mux, MpegTsPadData * ts_data)
+{
+  const gchar *name = GST_PAD_NAME (((GstCollectData *) ts_data)->pad);
+  gint idx;
+
+  if (mux->prog_map == NULL || !gst_structure_has_field (mux->prog_map, name))
+    return DEFAULT_PROG_ID;
+
+  if (!gst_structure_get_int (mux->prog_map, name, &idx)) {
+    GST_ELEMENT_ERROR (mux, STREAM, MUX,
+        ("Reading program map failed. Assuming default"), (NULL));
+    return DEFAULT_PROG_ID;
+  }
+  if (idx < 0 || idx >= MAX_PROG_NUMBER) {
+    GST_DEBUG_OBJECT (mux, "Program number %d associate with pad %s out "
+        "of range (max = %d); DEFAULT_PROGRAM = %d is used instead",
+        idx, name, MAX_PROG_NUMBER, DEFAULT_PROG_ID);
+    return DEFAULT_PROG_ID;
+  }
+
+  return idx;
+}
+
 static GstFlowReturn
 mpegtsmux_create_streams (MpegTsMux * mux)
 {
   GstFlowReturn ret = GST_FLOW_OK;
-  GSList *walk = mux->collect->data;
+  gboolean used[MAX_PROG_NUMBER] = { FALSE, };
+  GSList *walk;
+  gint i;
+
+  /* Map the pads to programs */
+  for (walk = mux->collect->data; walk; walk = g_slist_next (walk)) {
+    MpegTsPadData *ts_data = (MpegTsPadData *) walk->data;
+
+    if (ts_data->prog_id == -1)
+      ts_data->prog_id = mpegtsmux_get_prog_id (mux, ts_data);
+    used[ts_data->prog_id] = TRUE;
+  }
+
+  /* Create the programs in prog-map order, so that the program numbers in
+   * the PAT follow it, each with its own PMT PID */
+  for (i = 0; i < MAX_PROG_NUMBER; i++) {
+    if (!used[i] || mux->programs[i] != NULL)
+      continue;
+
+    mux->programs[i] = tsmux_program_new (mux->tsmux);
+    if (mux->programs[i] == NULL)
+      goto no_program;
+    tsmux_set_pmt_interval (mux->programs[i], mux->pmt_interval);
+    GST_DEBUG_OBJECT (mux, "Created program %d for prog_id %d",
+        mux->programs[i]->pgm_number, i);
+  }
 
   /* Create the streams */
-  while (walk) {
+  for (walk = mux->collect->data; walk; walk = g_slist_next (walk)) {
     GstCollectData *c_data = (GstCollectData *) walk->data;
     MpegTsPadData *ts_data = (MpegTsPadData *) walk->data;
-    gchar *name = NULL;
-
-    walk = g_slist_next (walk);
-
-    if (ts_data->prog_id == -1) {
-      name = GST_PAD_NAME (c_data->pad);
-      if (mux->prog_map != NULL && gst_structure_has_field (mux->prog_map,
-              name)) {
-        gint idx;
-        gboolean ret = gst_structure_get_int (mux->prog_map, name, &idx);
-        if (!ret) {
-          GST_ELEMENT_ERROR (mux, STREAM, MUX,
-              ("Reading program map failed. Assuming default"), (NULL));
-          idx = DEFAULT_PROG_ID;
-        }
-        if (idx < 0 || idx >= MAX_PROG_NUMBER) {
-          GST_DEBUG_OBJECT (mux, "Program number %d associate with pad %s out "
-              "of range (max = %d); DEFAULT_PROGRAM = %d is used instead",
-              idx, name, MAX_PROG_NUMBER, DEFAULT_PROG_ID);
-          idx = DEFAULT_PROG_ID;
-        }
-        ts_data->prog_id = idx;
-      } else {
-        ts_data->prog_id = DEFAULT_PROG_ID;
-      }
-    }
 
     ts_data->prog = mux->programs[ts_data->prog_id];
-    if (ts_data->prog == NULL) {
-      ts_data->prog = tsmux_program_new (mux->tsmux);
-      if (ts_data->prog == NULL)
-        goto no_program;
-      tsmux_set_pmt_interval (ts_data->prog, mux->pmt_interval);
-      mux->programs[ts_data->prog_id] = ts_data->prog;
-    }
 
     if (ts_data->stream == NULL) {
       ret = mpegtsmux_create_stream (mux, ts_data, c_data->pad);
@@ -552,6 +622,20 @@ mpegtsmux_create_streams (MpegTsMux * mux)
     }
   }
 
+  /* Every program carries its PCR on its own PID, preferably the one of a
+   * video stream */
+  for (walk = mux->collect->data; walk; walk = g_slist_next (walk)) {
+    MpegTsPadData *ts_data = (MpegTsPadData *) walk->data;
+    TsMuxProgram *prog = ts_data->prog;
+
+    if (prog->pcr_stream == NULL || (ts_data->stream->is_video_stream
+            && !prog->pcr_stream->is_video_stream)) {
+      GST_DEBUG_OBJECT (mux, "Use stream (pid=%d) as PCR for program "
+          "(prog_id = %d)", ts_data->pid, ts_data->prog_id);
+      tsmux_program_set_pcr_stream (prog, ts_data->stream);
+    }
+  }
+
   return GST_FLOW_OK;
 no_program:
   GST_ELEMENT_ERROR (mux, STREAM, MUX,
@@ -646,6 +730,24 @@ mpegtsmux_choose_best_stream (MpegTsMux * mux)
   return best;
 }
 
+/* The most recent timestamp of all streams */
+static GstClockTime
+mpegtsmux_get_last_ts (MpegTsMux * mux)
+{
+  GstClockTime last_ts = GST_CLOCK_TIME_NONE;
+  GSList *walk;
+
+  for (walk = mux->collect->data; walk != NULL; walk = g_slist_next (walk)) {
+    MpegTsPadData *ts_data = (MpegTsPadData *) walk->data;
+
+    if (GST_CLOCK_TIME_IS_VALID (ts_data->last_ts) &&
+        (!GST_CLOCK_TIME_IS_VALID (last_ts) || ts_data->last_ts > last_ts))
+      last_ts = ts_data->last_ts;
+  }
+
+  return last_ts;
+}
+
 #define COLLECT_DATA_PAD(collect_data) (((GstCollectData *)(collect_data))->pad)
 
 static GstFlowReturn
@@ -706,6 +808,13 @@ mpegtsmux_collected (GstCollectPads * pads, MpegTsMux * mux)
           G_GINT64_FORMAT, GST_TIME_ARGS (best->cur_ts), pts);
     }
 
+    /* With constant bitrate, keep padding the output through gaps in the
+     * input */
+    if (pts != -1 && !tsmux_write_padding (mux->tsmux, pts, TRUE)) {
+      GST_DEBUG_OBJECT (mux, "Failed to write padding");
+      goto write_fail;
+    }
+
     tsmux_stream_add_data (best->stream, GST_BUFFER_DATA (buf),
         GST_BUFFER_SIZE (buf), buf, pts, -1, !delta);
     best->queued_buf = NULL;
@@ -720,9 +829,23 @@ mpegtsmux_collected (GstCollectPads * pads, MpegTsMux * mux)
     if (prog->pcr_stream == best->stream) {
       mux->last_ts = best->last_ts;
     }
+
+    ret = mpegtsmux_push_pending (mux, FALSE);
   } else {
+    GstClockTime end_ts;
+
     /* FIXME: Drain all remaining streams */
     /* At EOS */
+    /* With constant bitrate, pad until the last data left the T-STD */
+    end_ts = mpegtsmux_get_last_ts (mux);
+    if (GST_CLOCK_TIME_IS_VALID (end_ts) &&
+        !tsmux_write_padding (mux->tsmux, GSTTIME_TO_MPEGTIME (end_ts),
+            FALSE)) {
+      GST_DEBUG_OBJECT (mux, "Failed to write padding");
+      goto write_fail;
+    }
+
+    ret = mpegtsmux_push_pending (mux, TRUE);
     gst_pad_push_event (mux->srcpad, gst_event_new_eos ());
   }
 
@@ -804,6 +927,109 @@ mpegtsmux_release_pad (GstElement * element, GstPad * pad)
   gst_element_remove_pad (element, pad);
 }
 
+/* Push the current output buffer, or queue it in the pending buffer list */
+static gboolean
+mpegtsmux_finish_out_buffer (MpegTsMux * mux)
+{
+  GstBuffer *buf = mux->out_buf;
+  GstFlowReturn ret;
+
+  if (buf == NULL)
+    return TRUE;
+
+  mux->out_buf = NULL;
+  gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
+  GST_BUFFER_SIZE (buf) = mux->out_offset;
+
+  if (mux->buffer_list) {
+    if (mux->out_list == NULL) {
+      mux->out_list = gst_buffer_list_new ();
+      mux->out_it = gst_buffer_list_iterate (mux->out_list);
+    }
+    gst_buffer_list_iterator_add_group (mux->out_it);
+    gst_buffer_list_iterator_add (mux->out_it, buf);
+    return TRUE;
+  }
+
+  GST_LOG_OBJECT (mux, "Outputting a buffer of length %d", mux->out_offset);
+  ret = gst_pad_push (mux->srcpad, buf);
+  if (G_UNLIKELY (ret != GST_FLOW_OK)) {
+    mux->last_flow_ret = ret;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Push the output that is complete. When @drain is set, also push the
+ * output buffer being filled even if it has less packets than wanted */
+static GstFlowReturn
+mpegtsmux_push_pending (MpegTsMux * mux, gboolean drain)
+{
+  GstBufferList *list;
+
+  if (drain && !mpegtsmux_finish_out_buffer (mux))
+    return mux->last_flow_ret;
+
+  if (mux->out_list == NULL)
+    return GST_FLOW_OK;
+
+  list = mux->out_list;
+  gst_buffer_list_iterator_free (mux->out_it);
+  mux->out_list = NULL;
+  mux->out_it = NULL;
+
+  GST_LOG_OBJECT (mux, "Outputting a list of %d buffers",
+      gst_buffer_list_n_groups (list));
+  return gst_pad_push_list (mux->srcpad, list);
+}
+
+/* Aggregate one packet in the output, pushing it when it is complete */
+static gboolean
+mpegtsmux_output_packet (MpegTsMux * mux, const guint8 * data, guint len)
+{
+  guint packets = MAX (mux->alignment, 1);
+
+  if (mux->out_buf == NULL) {
+    mux->out_buf = gst_buffer_new_and_alloc (packets * len);
+    mux->out_offset = 0;
+    GST_BUFFER_TIMESTAMP (mux->out_buf) = mux->last_ts;
+    GST_BUFFER_FLAG_SET (mux->out_buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  /* The buffer is a delta unit only if all its packets are */
+  if (mux->is_delta) {
+    GST_LOG_OBJECT (mux, "marking as delta unit");
+  } else {
+    GST_DEBUG_OBJECT (mux, "marking as non-delta unit");
+    GST_BUFFER_FLAG_UNSET (mux->out_buf, GST_BUFFER_FLAG_DELTA_UNIT);
+    mux->is_delta = TRUE;
+  }
+
+  memcpy (GST_BUFFER_DATA (mux->out_buf) + mux->out_offset, data, len);
+  mux->out_offset += len;
+
+  if (mux->out_offset + len > GST_BUFFER_SIZE (mux->out_buf))
+    return mpegtsmux_finish_out_buffer (mux);
+
+  return TRUE;
+}
+
+static void
+mpegtsmux_reset_output (MpegTsMux * mux)
+{
+  if (mux->out_buf) {
+    gst_buffer_unref (mux->out_buf);
+    mux->out_buf = NULL;
+  }
+  if (mux->out_list) {
+    gst_buffer_list_iterator_free (mux->out_it);
+    gst_buffer_list_unref (mux->out_list);
+    mux->out_list = NULL;
+    mux->out_it = NULL;
+  }
+}
+
 static gboolean
 new_packet_cb (guint8 * data, guint len, void *user_data, gint64 new_pcr)
 {
@@ -811,129 +1037,102 @@ new_packet_cb (guint8 * data, guint len, void *user_data, gint64 new_pcr)
    * on error */
   MpegTsMux *mux = (MpegTsMux *) user_data;
   GstBuffer *buf, *out_buf;
-  GstFlowReturn ret;
   gfloat current_ts;
   gint64 m2ts_pcr, pcr_bytes, chunk_bytes;
   gint64 ts_rate;
 
   if (mux->m2ts_mode == TRUE) {
     /* Enters when the m2ts-mode is set true */
-    buf = gst_buffer_new_and_alloc (M2TS_PACKET_LENGTH);
-    if (mux->is_delta) {
-      GST_LOG_OBJECT (mux, "marking as delta unit");
-      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
-    } else {
-      GST_DEBUG_OBJECT (mux, "marking as non-delta unit");
-      mux->is_delta = TRUE;
-    }
-    if (G_UNLIKELY (buf == NULL)) {
-      mux->last_flow_ret = GST_FLOW_ERROR;
-      return FALSE;
-    }
-    gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
-
-    /* copies the ts data of 188 bytes to the m2ts buffer at an offset 
-       of 4 bytes of timestamp  */
-    memcpy (GST_BUFFER_DATA (buf) + 4, data, len);
-
     if (new_pcr >= 0) {
+      guint8 packet[M2TS_PACKET_LENGTH];
+
       /*when there is a pcr value in ts data */
-      pcr_bytes = 0;
-      if (mux->first_pcr) {
-        /*Incase of first pcr */
-        /*writing the 4  byte timestamp value */
-        GST_WRITE_UINT32_BE (GST_BUFFER_DATA (buf), new_pcr);
-
-        GST_LOG_OBJECT (mux, "Outputting a packet of length %d",
-            M2TS_PACKET_LENGTH);
-        ret = gst_pad_push (mux->srcpad, buf);
-        if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-          mux->last_flow_ret = ret;
-          return FALSE;
-        }
-        mux->first_pcr = FALSE;
-        mux->previous_pcr = new_pcr;
-        pcr_bytes = M2TS_PACKET_LENGTH;
-      }
+      /*writing the 4  byte timestamp value */
+      GST_WRITE_UINT32_BE (packet, new_pcr);
+      memcpy (packet + 4, data, len);
+
+      /* the packets follow the one with the previous PCR */
+      pcr_bytes = M2TS_PACKET_LENGTH;
       chunk_bytes = gst_adapter_available (mux->adapter);
 
       if (G_UNLIKELY (chunk_bytes)) {
-        /* calculate rate based on latest and previous pcr values */
-        ts_rate = ((chunk_bytes * STANDARD_TIME_CLOCK) / (new_pcr -
-                mux->previous_pcr));
+        /* calculate rate based on latest and previous pcr values. Before the
+         * first PCR (the PAT and PMTs are written ahead of it) or if the PCR
+         * did not advance there is nothing to interpolate from, and the
+         * accumulated packets get the timestamp of the new PCR */
+        if (mux->first_pcr || new_pcr <= mux->previous_pcr)
+          ts_rate = 0;
+        else
+          ts_rate = ((chunk_bytes * STANDARD_TIME_CLOCK) / (new_pcr -
+                  mux->previous_pcr));
         while (1) {
           /*loop till all the accumulated ts packets are transformed to 
              m2ts packets and pushed */
-          current_ts = ((gfloat) mux->previous_pcr / STANDARD_TIME_CLOCK) +
-              ((gfloat) pcr_bytes / ts_rate);
-          m2ts_pcr = (((gint64) (STANDARD_TIME_CLOCK * current_ts / 300) &
-                  TWO_POW_33_MINUS1) * 300) + ((gint64) (STANDARD_TIME_CLOCK *
-                  current_ts) % 300);
+          if (ts_rate > 0) {
+            current_ts = ((gfloat) mux->previous_pcr / STANDARD_TIME_CLOCK) +
+                ((gfloat) pcr_bytes / ts_rate);
+            m2ts_pcr = (((gint64) (STANDARD_TIME_CLOCK * current_ts / 300) &
+                    TWO_POW_33_MINUS1) * 300) +
+                ((gint64) (STANDARD_TIME_CLOCK * current_ts) % 300);
+          } else {
+            m2ts_pcr = new_pcr;
+          }
 
           out_buf = gst_adapter_take_buffer (mux->adapter, M2TS_PACKET_LENGTH);
           if (G_UNLIKELY (!out_buf))
             break;
-          gst_buffer_set_caps (out_buf, GST_PAD_CAPS (mux->srcpad));
 
           /*writing the 4  byte timestamp value */
           GST_WRITE_UINT32_BE (GST_BUFFER_DATA (out_buf), m2ts_pcr);
 
           GST_LOG_OBJECT (mux, "Outputting a packet of length %d",
               M2TS_PACKET_LENGTH);
-          ret = gst_pad_push (mux->srcpad, out_buf);
-          if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-            mux->last_flow_ret = ret;
+          if (!mpegtsmux_output_packet (mux, GST_BUFFER_DATA (out_buf),
+                  M2TS_PACKET_LENGTH)) {
+            gst_buffer_unref (out_buf);
             return FALSE;
           }
+          gst_buffer_unref (out_buf);
           pcr_bytes += M2TS_PACKET_LENGTH;
         }
-        mux->previous_pcr = m2ts_pcr;
       }
-    } else
+
+      /* the packet carrying the PCR follows the accumulated ones */
+      GST_LOG_OBJECT (mux, "Outputting a packet of length %d",
+          M2TS_PACKET_LENGTH);
+      if (!mpegtsmux_output_packet (mux, packet, M2TS_PACKET_LENGTH))
+        return FALSE;
+      mux->first_pcr = FALSE;
+      mux->previous_pcr = new_pcr;
+    } else {
       /* If theres no pcr in current ts packet then push the packet 
          to an adapter, which is used to create m2ts packets */
+      buf = gst_buffer_new_and_alloc (M2TS_PACKET_LENGTH);
+      memcpy (GST_BUFFER_DATA (buf) + 4, data, len);
       gst_adapter_push (mux->adapter, buf);
+    }
   } else {
     /* In case of Normal Ts packets */
     GST_LOG_OBJECT (mux, "Outputting a packet of length %d", len);
-    buf = gst_buffer_new_and_alloc (len);
-    if (G_UNLIKELY (buf == NULL)) {
-      mux->last_flow_ret = GST_FLOW_ERROR;
-      return FALSE;
-    }
-    gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
-
-    memcpy (GST_BUFFER_DATA (buf), data, len);
-    GST_BUFFER_TIMESTAMP (buf) = mux->last_ts;
 
     if (!mux->streamheader_sent) {
       guint pid = ((data[1] & 0x1f) << 8) | data[2];
       /* if it's a PAT or a PMT */
       if (pid == 0x00 ||
           (pid >= TSMUX_START_PMT_PID && pid < TSMUX_START_ES_PID)) {
-        mux->streamheader =
-            g_list_append (mux->streamheader, gst_buffer_copy (buf));
+        buf = gst_buffer_new_and_alloc (len);
+        memcpy (GST_BUFFER_DATA (buf), data, len);
+        GST_BUFFER_TIMESTAMP (buf) = mux->last_ts;
+        mux->streamheader = g_list_append (mux->streamheader, buf);
       } else if (mux->streamheader) {
+        /* the caps are set on the output buffers when they are pushed */
         mpegtsdemux_set_header_on_caps (mux);
         mux->streamheader_sent = TRUE;
-        /* don't unset the streamheaders by pushing old caps */
-        gst_buffer_set_caps (buf, GST_PAD_CAPS (mux->srcpad));
       }
     }
 
-    if (mux->is_delta) {
-      GST_LOG_OBJECT (mux, "marking as delta unit");
-      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
-    } else {
-      GST_DEBUG_OBJECT (mux, "marking as non-delta unit");
-      mux->is_delta = TRUE;
-    }
-
-    ret = gst_pad_push (mux->srcpad, buf);
-    if (G_UNLIKELY (ret != GST_FLOW_OK)) {
-      mux->last_flow_ret = ret;
+    if (!mpegtsmux_output_packet (mux, data, len))
       return FALSE;
-    }
   }
 
   return TRUE;
@@ -1010,6 +1209,7 @@ mpegtsmux_change_state (GstElement * element, GstStateChange transition)
       break;
     case GST_STATE_CHANGE_PAUSED_TO_READY:
       gst_collect_pads_stop (mux->collect);
+      mpegtsmux_reset_output (mux);
       break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       if (mux->adapter)
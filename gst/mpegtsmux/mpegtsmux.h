@@ -122,12 +122,21 @@ struct MpegTsMux {
   gboolean first_pcr;
   guint pat_interval;
   guint pmt_interval;
+  guint64 bitrate;
 
   GstClockTime last_ts;
   gboolean is_delta;
 
   GList *streamheader;
   gboolean streamheader_sent;
+
+  /* output aggregation */
+  guint alignment;
+  gboolean buffer_list;
+  GstBuffer *out_buf;
+  guint out_offset;
+  GstBufferList *out_list;
+  GstBufferListIterator *out_it;
 };
 
 struct MpegTsMuxClass  {
@@ -177,6 +186,7 @@ GType mpegtsmux_get_type (void);
 #define TWO_POW_33_MINUS1     ((0xffffffff * 2) - 1) 
 
 #define MAX_PROG_NUMBER	32
+#define MAX_ALIGNMENT	1024
 #define DEFAULT_PROG_ID	0
 
 G_END_DECLS
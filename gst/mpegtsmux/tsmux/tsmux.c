@@ -83,9 +83,10 @@
 
 #include <string.h>
 
+#include <gst/gst-mpegts-crc.h>
+
 #include "tsmux.h"
 #include "tsmuxstream.h"
-#include "crc.h"
 
 /* Maximum total data length for a PAT section is 1024 bytes, minus an 
  * 8 byte header, then the length of each program entry is 32 bits, 
@@ -105,9 +106,20 @@
 
 /* Times per second to write PCR */
 #define TSMUX_DEFAULT_PCR_FREQ (25)
+#define TSMUX_PCR_INTERVAL (TSMUX_SYS_CLOCK_FREQ / TSMUX_DEFAULT_PCR_FREQ)
+
+/* Offset in the output packet of the byte holding the last bit of the PCR
+ * base, which is the byte the PCR refers to */
+#define TSMUX_PCR_BYTE_OFFSET(mux) \
+    ((mux)->packet_size - TSMUX_PACKET_LENGTH + 10)
+
+/* For constant bitrate output, how long before its DTS the data of a PES
+ * packet can enter the T-STD buffer */
+#define TSMUX_CBR_MAX_DELAY (TSMUX_SYS_CLOCK_FREQ / 2)
 
 static gboolean tsmux_write_pat (TsMux * mux);
 static gboolean tsmux_write_pmt (TsMux * mux, TsMuxProgram * program);
+static inline gint64 tsmux_cbr_pcr (TsMux * mux, guint offset);
 
 /**
  * tsmux_new:
@@ -133,6 +145,10 @@ tsmux_new (void)
   mux->last_pat_ts = -1;
   mux->pat_interval = TSMUX_DEFAULT_PAT_INTERVAL;
 
+  mux->cur_ts = -1;
+  mux->pcr_base = -1;
+  mux->packet_size = TSMUX_PACKET_LENGTH;
+
   return mux;
 }
 
@@ -189,6 +205,70 @@ tsmux_get_pat_interval (TsMux * mux)
   return mux->pat_interval;
 }
 
+/**
+ * tsmux_set_bitrate:
+ * @mux: a #TsMux
+ * @bitrate: the output bitrate in bits per second, or 0
+ *
+ * Set the bitrate for constant bitrate output. The output is padded with
+ * null packets to keep the rate constant, PCRs are computed from the
+ * output position and the elementary streams are paced to respect the
+ * T-STD buffer model. A @bitrate of 0 gives variable bitrate output.
+ *
+ * Changing the bitrate of constant bitrate output keeps the output clock
+ * running from the current position, so that the PCRs stay continuous.
+ */
+void
+tsmux_set_bitrate (TsMux * mux, guint64 bitrate)
+{
+  g_return_if_fail (mux != NULL);
+
+  if (mux->bitrate > 0 && bitrate > 0 && mux->pcr_base != -1) {
+    mux->pcr_base = tsmux_cbr_pcr (mux, 0);
+    mux->pcr_base_bytes = mux->n_bytes;
+  } else {
+    mux->pcr_base = -1;
+  }
+  mux->bitrate = bitrate;
+}
+
+/**
+ * tsmux_set_packet_size:
+ * @mux: a #TsMux
+ * @size: the size of each packet in the output
+ *
+ * Set the number of bytes each packet takes in the output, when the write
+ * function adds a prefix to the TSMUX_PACKET_LENGTH bytes it gets, like the
+ * 4 byte timestamp of M2TS. The output position, from which the constant
+ * bitrate output and the bitrate estimates are computed, counts @size bytes
+ * per packet.
+ */
+void
+tsmux_set_packet_size (TsMux * mux, guint size)
+{
+  g_return_if_fail (mux != NULL);
+  g_return_if_fail (size >= TSMUX_PACKET_LENGTH);
+
+  mux->packet_size = size;
+}
+
+/**
+ * tsmux_get_measured_bitrate:
+ * @mux: a #TsMux
+ *
+ * Get the output bitrate, as estimated from the number of bytes written
+ * between consecutive PCRs.
+ *
+ * Returns: the bitrate in bits per second, or 0 if not known yet.
+ */
+guint
+tsmux_get_measured_bitrate (TsMux * mux)
+{
+  g_return_val_if_fail (mux != NULL, 0);
+
+  return mux->measured_bitrate;
+}
+
 /**
  * tsmux_free:
  * @mux: a #TsMux
@@ -255,7 +335,8 @@ tsmux_program_new (TsMux * mux)
 
   program->streams = g_array_sized_new (FALSE, TRUE, sizeof (TsMuxStream *), 1);
 
-  mux->programs = g_list_prepend (mux->programs, program);
+  /* Keep the programs in creation order in the PAT */
+  mux->programs = g_list_append (mux->programs, program);
   mux->nb_programs++;
   mux->pat_changed = TRUE;
 
@@ -297,6 +378,23 @@ tsmux_get_pmt_interval (TsMuxProgram * program)
   return program->pmt_interval;
 }
 
+/**
+ * tsmux_program_get_bitrate:
+ * @program: a #TsMuxProgram
+ *
+ * Get the bitrate of @program, including its PMT and PCR packets, as
+ * estimated between consecutive PCRs of the program.
+ *
+ * Returns: the bitrate in bits per second, or 0 if not known yet.
+ */
+guint
+tsmux_program_get_bitrate (TsMuxProgram * program)
+{
+  g_return_val_if_fail (program != NULL, 0);
+
+  return program->bitrate;
+}
+
 /**
  * tsmux_program_add_stream:
  * @program: a #TsMuxProgram
@@ -312,6 +410,7 @@ tsmux_program_add_stream (TsMuxProgram * program, TsMuxStream * stream)
 
   program->nb_streams++;
   g_array_append_val (program->streams, stream);
+  stream->program = program;
   program->pmt_changed = TRUE;
 }
 
@@ -429,6 +528,8 @@ tsmux_find_stream (TsMux * mux, guint16 pid)
 static gboolean
 tsmux_packet_out (TsMux * mux)
 {
+  mux->n_bytes += mux->packet_size;
+
   if (G_UNLIKELY (mux->write_func == NULL))
     return TRUE;
 
@@ -622,9 +723,10 @@ tsmux_write_ts_header (guint8 * buf, TsMuxPacketInfo * pi,
 
   /* 2 bits: scrambling_control (NOT SUPPORTED) (00)
    * 2 bits: adaptation field control (1x has_adaptation_field | x1 has_payload)
-   * 4 bits: continuity counter (xxxx)
+   * 4 bits: continuity counter (xxxx), written once we know whether
+   *   the packet has a payload
    */
-  adaptation_flag = pi->packet_count & 0x0f;
+  adaptation_flag = 0;
 
   if (pi->flags & TSMUX_PACKET_FLAG_ADAPTATION) {
     write_adapt = TRUE;
@@ -665,7 +767,12 @@ tsmux_write_ts_header (guint8 * buf, TsMuxPacketInfo * pi,
     g_assert (payload_len <= pi->stream_avail);
 
     /* Packet with payload, increment the continuity counter */
+    adaptation_flag |= pi->packet_count & 0x0f;
     pi->packet_count++;
+  } else {
+    /* A packet without payload repeats the counter of the previous packet
+     * of the PID (ISO 13818-1, 2.4.3.3) */
+    adaptation_flag |= (pi->packet_count - 1) & 0x0f;
   }
 
   /* Write the byte of transport_scrambling_control, adaptation_field_control 
@@ -683,12 +790,295 @@ tsmux_write_ts_header (guint8 * buf, TsMuxPacketInfo * pi,
   return TRUE;
 }
 
+/* Duration of @bytes at @bitrate, against the 27MHz clock. Split so that
+ * it doesn't overflow for any realistic output position. */
+static inline guint64
+tsmux_bytes_to_pcr (guint64 bytes, guint64 bitrate)
+{
+  guint64 bits = bytes * 8;
+
+  return (bits / bitrate) * TSMUX_SYS_CLOCK_FREQ +
+      (bits % bitrate) * TSMUX_SYS_CLOCK_FREQ / bitrate;
+}
+
+/* For constant bitrate output, the PCR of the byte at @offset in the next
+ * packet */
+static inline gint64
+tsmux_cbr_pcr (TsMux * mux, guint offset)
+{
+  return mux->pcr_base + tsmux_bytes_to_pcr (mux->n_bytes + offset -
+      mux->pcr_base_bytes, mux->bitrate);
+}
+
+static gboolean
+tsmux_write_null_packet (TsMux * mux)
+{
+  guint8 *buf = mux->packet_buf;
+
+  /* PID 0x1FFF, payload only, continuity counter ignored */
+  buf[0] = TSMUX_SYNC_BYTE;
+  buf[1] = 0x1F;
+  buf[2] = 0xFF;
+  buf[3] = 0x10;
+  memset (buf + TSMUX_HEADER_LENGTH, 0xFF, TSMUX_PAYLOAD_LENGTH);
+
+  mux->new_pcr = -1;
+  return tsmux_packet_out (mux);
+}
+
+/* Account a packet written on one of the PIDs of @program */
+static inline void
+tsmux_program_add_bytes (TsMuxProgram * program, guint bytes)
+{
+  if (program)
+    program->n_bytes += bytes;
+}
+
+/* Returns the PCR to write for @program or -1 if none is due. Once the
+ * output bitrate is known, the time elapsed since the last PCR of the
+ * program is derived from the output position, so that programs whose
+ * PCR stream is sparse still get regular PCRs. */
+static gint64
+tsmux_program_pcr_due (TsMux * mux, TsMuxProgram * program, gint64 cur_pcr)
+{
+  guint64 elapsed;
+
+  if (program->pcr_stream == NULL)
+    return -1;
+
+  if (program->last_pcr == -1)
+    return cur_pcr;
+
+  /* PCRs have to increase */
+  if (cur_pcr <= program->last_pcr)
+    return -1;
+
+  if (mux->bitrate > 0)
+    elapsed = tsmux_bytes_to_pcr (mux->n_bytes - program->last_pcr_bytes,
+        mux->bitrate);
+  else if (mux->measured_bitrate > 0)
+    elapsed = tsmux_bytes_to_pcr (mux->n_bytes - program->last_pcr_bytes,
+        mux->measured_bitrate);
+  else
+    elapsed = cur_pcr - program->last_pcr;
+
+  if (elapsed < TSMUX_PCR_INTERVAL)
+    return -1;
+
+  return cur_pcr;
+}
+
+/* Update the bitrate estimates when a PCR is written for @program */
+static void
+tsmux_program_pcr_written (TsMux * mux, TsMuxProgram * program, gint64 pcr)
+{
+  if (program->last_pcr != -1 && pcr > program->last_pcr) {
+    guint64 delta = pcr - program->last_pcr;
+    guint rate;
+
+    rate = (mux->n_bytes - program->last_pcr_bytes) * 8 *
+        TSMUX_SYS_CLOCK_FREQ / delta;
+    mux->measured_bitrate = mux->measured_bitrate ?
+        (7 * (guint64) mux->measured_bitrate + rate) / 8 : rate;
+
+    rate = (program->n_bytes - program->last_pcr_n_bytes) * 8 *
+        TSMUX_SYS_CLOCK_FREQ / delta;
+    program->bitrate =
+        program->bitrate ? (7 * (guint64) program->bitrate + rate) / 8 : rate;
+
+    TS_DEBUG ("program %d bitrate %u, mux bitrate %u", program->pgm_number,
+        program->bitrate, mux->measured_bitrate);
+  }
+
+  program->last_pcr = pcr;
+  program->last_pcr_bytes = mux->n_bytes;
+  program->last_pcr_n_bytes = program->n_bytes;
+}
+
+/* Write a packet without payload carrying only a PCR on the PCR PID of
+ * @program. It repeats the continuity counter of the previous packet. */
+static gboolean
+tsmux_write_pcr_packet (TsMux * mux, TsMuxProgram * program, gint64 pcr)
+{
+  TsMuxPacketInfo *pi = &program->pcr_stream->pi;
+  guint32 flags = pi->flags;
+  guint32 stream_avail = pi->stream_avail;
+  gboolean pusi = pi->packet_start_unit_indicator;
+  guint payload_len, payload_offs;
+  gboolean res;
+
+  pi->flags = TSMUX_PACKET_FLAG_ADAPTATION | TSMUX_PACKET_FLAG_WRITE_PCR;
+  pi->pcr = pcr;
+  pi->stream_avail = 0;
+  pi->packet_start_unit_indicator = FALSE;
+
+  res = tsmux_write_ts_header (mux->packet_buf, pi, &payload_len,
+      &payload_offs);
+
+  pi->flags = flags;
+  pi->stream_avail = stream_avail;
+  pi->packet_start_unit_indicator = pusi;
+
+  if (G_UNLIKELY (!res))
+    return FALSE;
+
+  TS_DEBUG ("PCR-only packet for program %d", program->pgm_number);
+
+  tsmux_program_pcr_written (mux, program, pcr);
+  tsmux_program_add_bytes (program, mux->packet_size);
+
+  mux->new_pcr = pcr;
+  res = tsmux_packet_out (mux);
+  mux->new_pcr = -1;
+
+  return res;
+}
+
+/* Write out the PAT and the PMTs whose interval elapsed */
+static gboolean
+tsmux_write_tables (TsMux * mux)
+{
+  gint64 cur_ts = MAX (mux->cur_ts, 0);
+  GList *cur;
+
+  /* with constant bitrate, time is given by the output position */
+  if (mux->bitrate > 0 && mux->pcr_base != -1)
+    cur_ts = tsmux_cbr_pcr (mux, 0) / 300;
+
+  if (mux->last_pat_ts == -1 || mux->pat_changed ||
+      cur_ts >= mux->last_pat_ts + mux->pat_interval) {
+    mux->last_pat_ts = cur_ts;
+    if (!tsmux_write_pat (mux))
+      return FALSE;
+  }
+
+  for (cur = g_list_first (mux->programs); cur != NULL; cur = g_list_next (cur)) {
+    TsMuxProgram *program = (TsMuxProgram *) cur->data;
+
+    if (program->last_pmt_ts == -1 || program->pmt_changed ||
+        cur_ts >= program->last_pmt_ts + program->pmt_interval) {
+      program->last_pmt_ts = cur_ts;
+      if (!tsmux_write_pmt (mux, program))
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Write one packet of padding for constant bitrate output, giving priority
+ * to due tables and PCRs over null packets */
+static gboolean
+tsmux_write_stuffing (TsMux * mux)
+{
+  guint64 n_bytes = mux->n_bytes;
+  GList *cur;
+
+  if (!tsmux_write_tables (mux))
+    return FALSE;
+  if (mux->n_bytes != n_bytes)
+    return TRUE;
+
+  for (cur = g_list_first (mux->programs); cur != NULL; cur = g_list_next (cur)) {
+    TsMuxProgram *program = (TsMuxProgram *) cur->data;
+    gint64 pcr = tsmux_program_pcr_due (mux, program,
+        tsmux_cbr_pcr (mux, TSMUX_PCR_BYTE_OFFSET (mux)));
+
+    if (pcr != -1)
+      return tsmux_write_pcr_packet (mux, program, pcr);
+  }
+
+  return tsmux_write_null_packet (mux);
+}
+
+/* For constant bitrate output, pad until the output clock reaches @pcr */
+static gboolean
+tsmux_cbr_pad_until (TsMux * mux, gint64 pcr)
+{
+  while (tsmux_cbr_pcr (mux, 0) < pcr) {
+    if (!tsmux_write_stuffing (mux))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * tsmux_write_padding:
+ * @mux: a #TsMux
+ * @ts: a time in 90kHz clock units
+ *
+ * For constant bitrate output, pad the output until its clock reaches @ts,
+ * or @ts less the maximum T-STD buffering delay when @before_data is set.
+ * This keeps the output rate constant through gaps in the input, where
+ * @before_data is set for the data coming after the gap, and at the end of
+ * the stream. Does nothing for variable bitrate output or before the first
+ * packet was written.
+ *
+ * Returns: TRUE if the padding could be written.
+ */
+gboolean
+tsmux_write_padding (TsMux * mux, gint64 ts, gboolean before_data)
+{
+  gint64 pcr;
+
+  g_return_val_if_fail (mux != NULL, FALSE);
+
+  if (mux->bitrate == 0 || mux->pcr_base == -1 || ts < 0)
+    return TRUE;
+
+  pcr = ts * (TSMUX_SYS_CLOCK_FREQ / TSMUX_CLOCK_FREQ);
+  if (before_data)
+    pcr -= TSMUX_CBR_MAX_DELAY;
+
+  return tsmux_cbr_pad_until (mux, pcr);
+}
+
+/* For constant bitrate output, pad until the next packet of @stream can be
+ * sent: not more than TSMUX_CBR_MAX_DELAY before the DTS of its PES packet,
+ * and without overflowing the T-STD buffer of the stream */
+static gboolean
+tsmux_cbr_pace (TsMux * mux, TsMuxStream * stream, guint len)
+{
+  gint64 now;
+
+  if (stream->pi.packet_start_unit_indicator) {
+    gint64 dts = (stream->dts != -1) ? stream->dts : stream->pts;
+
+    if (dts != -1) {
+      dts *= TSMUX_SYS_CLOCK_FREQ / TSMUX_CLOCK_FREQ;
+      if (!tsmux_cbr_pad_until (mux, dts - TSMUX_CBR_MAX_DELAY))
+        return FALSE;
+      if (tsmux_cbr_pcr (mux, 0) > dts)
+        TS_DEBUG ("PID 0x%04x: PES packet is late, bitrate too low",
+            stream->pi.pid);
+    }
+  }
+
+  while (TRUE) {
+    now = tsmux_cbr_pcr (mux, 0) / (TSMUX_SYS_CLOCK_FREQ / TSMUX_CLOCK_FREQ);
+    tsmux_stream_tstd_remove_until (stream, now);
+
+    if (tsmux_stream_tstd_fits (stream, len))
+      break;
+    /* Nothing will leave the buffer, don't wait for it */
+    if (tsmux_stream_tstd_next_removal (stream) == -1)
+      break;
+
+    if (!tsmux_write_stuffing (mux))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
 /**
  * tsmux_write_stream_packet:
  * @mux: a #TsMux
  * @stream: a #TsMuxStream
  *
- * Write a packet of @stream.
+ * Write a packet of @stream. The PAT, PMTs and the PCRs of all the programs
+ * are inserted before it as needed.
  *
  * Returns: TRUE if the packet could be written.
  */
@@ -697,79 +1087,73 @@ tsmux_write_stream_packet (TsMux * mux, TsMuxStream * stream)
 {
   guint payload_len, payload_offs;
   TsMuxPacketInfo *pi = &stream->pi;
+  gint64 cur_pts, cur_pcr = 0;
+  GList *cur;
   gboolean res;
 
-
-  mux->new_pcr = -1;
   g_return_val_if_fail (mux != NULL, FALSE);
   g_return_val_if_fail (stream != NULL, FALSE);
 
-  if (tsmux_stream_is_pcr (stream)) {
-    gint64 cur_pcr = 0;
-    gint64 cur_pts = tsmux_stream_get_pts (stream);
-    gboolean write_pat;
-    GList *cur;
+  mux->new_pcr = -1;
 
-    if (cur_pts != -1) {
-      TS_DEBUG ("TS for PCR stream is %" G_GINT64_FORMAT, cur_pts);
-    }
+  /* All programs share the same time base, the mux time is the most recent
+   * timestamp written */
+  cur_pts = tsmux_stream_get_pts (stream);
+  if (cur_pts != -1 && cur_pts > mux->cur_ts) {
+    TS_DEBUG ("mux time is now %" G_GINT64_FORMAT, cur_pts);
+    mux->cur_ts = cur_pts;
+  }
 
-    /* FIXME: The current PCR needs more careful calculation than just
-     * writing a fixed offset */
-    if (cur_pts != -1 && (cur_pts >= TSMUX_PCR_OFFSET))
-      cur_pcr = (cur_pts - TSMUX_PCR_OFFSET) *
-          (TSMUX_SYS_CLOCK_FREQ / TSMUX_CLOCK_FREQ);
+  /* FIXME: The current PCR needs more careful calculation than just
+   * writing a fixed offset */
+  if (mux->cur_ts >= TSMUX_PCR_OFFSET)
+    cur_pcr = (mux->cur_ts - TSMUX_PCR_OFFSET) *
+        (TSMUX_SYS_CLOCK_FREQ / TSMUX_CLOCK_FREQ);
 
-    /* Need to decide whether to write a new PCR in this packet */
-    if (stream->last_pcr == -1 ||
-        (cur_pcr - stream->last_pcr >
-            (TSMUX_CLOCK_FREQ / TSMUX_DEFAULT_PCR_FREQ))) {
+  pi->packet_start_unit_indicator = tsmux_stream_at_pes_start (stream);
+  if (pi->packet_start_unit_indicator)
+    tsmux_stream_initialize_pes_packet (stream);
 
-      stream->pi.flags |=
-          TSMUX_PACKET_FLAG_ADAPTATION | TSMUX_PACKET_FLAG_WRITE_PCR;
-      stream->pi.pcr = cur_pcr;
-      stream->last_pcr = cur_pcr;
-      mux->new_pcr = cur_pcr;
+  if (mux->bitrate > 0) {
+    /* The output clock starts at the PCR the first packet would have had
+     * with variable bitrate */
+    if (mux->pcr_base == -1) {
+      mux->pcr_base = cur_pcr;
+      mux->pcr_base_bytes = mux->n_bytes;
     }
+    if (pi->packet_start_unit_indicator)
+      tsmux_stream_tstd_add_pes (stream);
+    if (!tsmux_cbr_pace (mux, stream,
+            MIN (tsmux_stream_bytes_avail (stream), TSMUX_PAYLOAD_LENGTH)))
+      return FALSE;
+  }
 
-    /* check if we need to rewrite pat */
-    if (mux->last_pat_ts == -1 || mux->pat_changed)
-      write_pat = TRUE;
-    else if (cur_pts >= mux->last_pat_ts + mux->pat_interval)
-      write_pat = TRUE;
-    else
-      write_pat = FALSE;
+  if (!tsmux_write_tables (mux))
+    return FALSE;
 
-    if (write_pat) {
-      mux->last_pat_ts = cur_pts;
-      if (!tsmux_write_pat (mux))
-        return FALSE;
-    }
+  /* Insert the PCRs that are due, in the packet of the PCR stream if it is
+   * the one being written or in a separate packet otherwise */
+  for (cur = g_list_first (mux->programs); cur != NULL; cur = g_list_next (cur)) {
+    TsMuxProgram *program = (TsMuxProgram *) cur->data;
+    gint64 pcr;
 
-    /* check if we need to rewrite any of the current pmts */
-    for (cur = g_list_first (mux->programs); cur != NULL;
-        cur = g_list_next (cur)) {
-      TsMuxProgram *program = (TsMuxProgram *) cur->data;
-      gboolean write_pmt;
-
-      if (program->last_pmt_ts == -1 || program->pmt_changed)
-        write_pmt = TRUE;
-      else if (cur_pts >= program->last_pmt_ts + program->pmt_interval)
-        write_pmt = TRUE;
-      else
-        write_pmt = FALSE;
-
-      if (write_pmt) {
-        program->last_pmt_ts = cur_pts;
-        if (!tsmux_write_pmt (mux, program))
-          return FALSE;
-      }
-    }
+    if (mux->bitrate > 0)
+      cur_pcr = tsmux_cbr_pcr (mux, TSMUX_PCR_BYTE_OFFSET (mux));
+    pcr = tsmux_program_pcr_due (mux, program, cur_pcr);
+
+    if (pcr == -1)
+      continue;
+
+    if (program->pcr_stream == stream) {
+      stream->pi.flags |=
+          TSMUX_PACKET_FLAG_ADAPTATION | TSMUX_PACKET_FLAG_WRITE_PCR;
+      stream->pi.pcr = pcr;
+      tsmux_program_pcr_written (mux, program, pcr);
+      mux->new_pcr = pcr;
+    } else if (!tsmux_write_pcr_packet (mux, program, pcr))
+      return FALSE;
   }
 
-  pi->packet_start_unit_indicator = tsmux_stream_at_pes_start (stream);
-  if (pi->packet_start_unit_indicator)
-    tsmux_stream_initialize_pes_packet (stream);
   pi->stream_avail = tsmux_stream_bytes_avail (stream);
 
   if (!tsmux_write_ts_header (mux->packet_buf, pi, &payload_len, &payload_offs))
@@ -779,6 +1163,7 @@ tsmux_write_stream_packet (TsMux * mux, TsMuxStream * stream)
           payload_len))
     return FALSE;
 
+  tsmux_program_add_bytes (stream->program, mux->packet_size);
   res = tsmux_packet_out (mux);
 
   /* Reset all dynamic flags */
@@ -804,7 +1189,8 @@ tsmux_program_free (TsMuxProgram * program)
 }
 
 static gboolean
-tsmux_write_section (TsMux * mux, TsMuxSection * section)
+tsmux_write_section (TsMux * mux, TsMuxSection * section,
+    TsMuxProgram * program)
 {
   guint8 *cur_in;
   guint payload_remain;
@@ -850,6 +1236,8 @@ tsmux_write_section (TsMux * mux, TsMuxSection * section)
     cur_in += payload_len;
     payload_remain -= payload_len;
 
+    tsmux_program_add_bytes (program, mux->packet_size);
+
     if (G_UNLIKELY (!tsmux_packet_out (mux))) {
       mux->new_pcr = -1;
       return FALSE;
@@ -930,7 +1318,7 @@ tsmux_write_pat (TsMux * mux)
         mux->transport_id, mux->pat_version, 0, 0);
 
     /* Calc and output CRC for data bytes, not including itself */
-    crc = calc_crc32 (pat->data, pat->pi.stream_avail - 4);
+    crc = gst_mpegts_crc32 (pat->data, pat->pi.stream_avail - 4);
     tsmux_put32 (&pos, crc);
 
     TS_DEBUG ("PAT has %d programs, is %u bytes",
@@ -939,7 +1327,7 @@ tsmux_write_pat (TsMux * mux)
     mux->pat_version++;
   }
 
-  return tsmux_write_section (mux, pat);
+  return tsmux_write_section (mux, pat, NULL);
 }
 
 static gboolean
@@ -1035,7 +1423,7 @@ tsmux_write_pmt (TsMux * mux, TsMuxProgram * program)
 
     /* Calc and output CRC for data bytes, 
      * but not counting the CRC bytes this time */
-    crc = calc_crc32 (pmt->data, pmt->pi.stream_avail - 4);
+    crc = gst_mpegts_crc32 (pmt->data, pmt->pi.stream_avail - 4);
     tsmux_put32 (&pos, crc);
 
     TS_DEBUG ("PMT for program %d has %d streams, is %u bytes",
@@ -1046,5 +1434,5 @@ tsmux_write_pmt (TsMux * mux, TsMuxProgram * program)
     program->pmt_version++;
   }
 
-  return tsmux_write_section (mux, pmt);
+  return tsmux_write_section (mux, pmt, program);
 }
@@ -122,6 +122,13 @@ struct TsMuxProgram {
 
   TsMuxStream *pcr_stream; /* Stream which carries the PCR */
   gint64 last_pcr;
+  guint64 last_pcr_bytes; /* mux output position of the last PCR */
+
+  /* Bytes written on the PIDs of this program, and the resulting bitrate
+   * estimate in bits per second */
+  guint64 n_bytes;
+  guint64 last_pcr_n_bytes;
+  guint bitrate;
 
   GArray *streams; /* Array of TsMuxStream pointers */
   guint nb_streams;
@@ -154,6 +161,23 @@ struct TsMux {
   /* Scratch space for writing ES_info descriptors */
   guint8 es_info_buf[TSMUX_MAX_ES_INFO_LENGTH];
   gint64 new_pcr;
+
+  /* Output position in bytes, current mux time (90kHz) and the estimated
+   * output bitrate in bits per second */
+  guint64 n_bytes;
+  gint64 cur_ts;
+  guint measured_bitrate;
+
+  /* Constant bitrate output: target bitrate in bits per second (0 for
+   * variable bitrate) and the PCR of the byte at output position
+   * pcr_base_bytes, from which the PCR of any byte is derived */
+  guint64 bitrate;
+  gint64 pcr_base;
+  guint64 pcr_base_bytes;
+
+  /* Bytes taken by each packet in the output, more than TSMUX_PACKET_LENGTH
+   * if a prefix is added to the packets */
+  guint packet_size;
 };
 
 /* create/free new muxer session */
@@ -165,12 +189,16 @@ void 		tsmux_set_write_func 		(TsMux *mux, TsMuxWriteFunc func, void *user_data)
 void 		tsmux_set_pat_interval          (TsMux *mux, guint interval);
 guint 		tsmux_get_pat_interval          (TsMux *mux);
 guint16		tsmux_get_new_pid 		(TsMux *mux);
+void		tsmux_set_bitrate 		(TsMux *mux, guint64 bitrate);
+void		tsmux_set_packet_size 		(TsMux *mux, guint size);
+guint		tsmux_get_measured_bitrate 	(TsMux *mux);
 
 /* pid/program management */
 TsMuxProgram *	tsmux_program_new 		(TsMux *mux);
 void 		tsmux_program_free 		(TsMuxProgram *program);
 void 		tsmux_set_pmt_interval          (TsMuxProgram *program, guint interval);
 guint 		tsmux_get_pmt_interval   	(TsMuxProgram *program);
+guint		tsmux_program_get_bitrate 	(TsMuxProgram *program);
 
 /* stream management */
 TsMuxStream *	tsmux_create_stream 		(TsMux *mux, TsMuxStreamType stream_type, guint16 pid);
@@ -181,6 +209,7 @@ void 		tsmux_program_set_pcr_stream 	(TsMuxProgram *program, TsMuxStream *stream
 
 /* writing stuff */
 gboolean 	tsmux_write_stream_packet 	(TsMux *mux, TsMuxStream *stream);
+gboolean	tsmux_write_padding 		(TsMux *mux, gint64 ts, gboolean before_data);
 
 G_END_DECLS
 
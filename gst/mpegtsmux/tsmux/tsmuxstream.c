@@ -91,6 +91,20 @@ static void tsmux_stream_write_pes_header (TsMuxStream * stream, guint8 * data);
 static void tsmux_stream_find_pts_dts_within (TsMuxStream * stream, guint bound,
     gint64 * pts, gint64 * dts);
 
+/* Default T-STD elementary stream buffer sizes, in bytes. The profile and
+ * level of MPEG-1/2 video are not known, so use the VBV buffer size of
+ * Main profile at High level, which fits all the lower levels */
+#define TSMUX_TSTD_SIZE_VIDEO_MPEG2 (9781248 / 8)
+#define TSMUX_TSTD_SIZE_VIDEO (3750000)
+#define TSMUX_TSTD_SIZE_AUDIO (3584)
+#define TSMUX_TSTD_SIZE_AUDIO_PRIVATE (8192)
+
+typedef struct
+{
+  gint64 dts;
+  guint32 size;
+} TsMuxStreamUnit;
+
 struct TsMuxStreamBuffer
 {
   guint8 *data;
@@ -136,6 +150,11 @@ tsmux_stream_new (guint16 pid, TsMuxStreamType stream_type)
       stream->id = 0xE0;
       stream->pi.flags |= TSMUX_PACKET_FLAG_PES_FULL_HEADER;
       stream->is_video_stream = TRUE;
+      if (stream_type == TSMUX_ST_VIDEO_MPEG1 ||
+          stream_type == TSMUX_ST_VIDEO_MPEG2)
+        stream->tstd_size = TSMUX_TSTD_SIZE_VIDEO_MPEG2;
+      else
+        stream->tstd_size = TSMUX_TSTD_SIZE_VIDEO;
       break;
     case TSMUX_ST_AUDIO_AAC:
     case TSMUX_ST_AUDIO_MPEG1:
@@ -143,6 +162,7 @@ tsmux_stream_new (guint16 pid, TsMuxStreamType stream_type)
       /* FIXME: Assign sequential IDs? */
       stream->id = 0xC0;
       stream->pi.flags |= TSMUX_PACKET_FLAG_PES_FULL_HEADER;
+      stream->tstd_size = TSMUX_TSTD_SIZE_AUDIO;
       break;
     case TSMUX_ST_VIDEO_DIRAC:
     case TSMUX_ST_PS_AUDIO_LPCM:
@@ -154,6 +174,7 @@ tsmux_stream_new (guint16 pid, TsMuxStreamType stream_type)
         case TSMUX_ST_VIDEO_DIRAC:
           stream->id_extended = 0x60;
           stream->is_video_stream = TRUE;
+          stream->tstd_size = TSMUX_TSTD_SIZE_VIDEO;
           break;
         case TSMUX_ST_PS_AUDIO_LPCM:
           stream->id_extended = 0x80;
@@ -167,6 +188,8 @@ tsmux_stream_new (guint16 pid, TsMuxStreamType stream_type)
         default:
           break;
       }
+      if (stream->tstd_size == 0)
+        stream->tstd_size = TSMUX_TSTD_SIZE_AUDIO_PRIVATE;
       stream->pi.flags |=
           TSMUX_PACKET_FLAG_PES_FULL_HEADER |
           TSMUX_PACKET_FLAG_PES_EXT_STREAMID;
@@ -180,7 +203,7 @@ tsmux_stream_new (guint16 pid, TsMuxStreamType stream_type)
   stream->last_dts = -1;
 
   stream->pcr_ref = 0;
-  stream->last_pcr = -1;
+  stream->program = NULL;
 
   return stream;
 }
@@ -210,8 +233,14 @@ tsmux_stream_get_pid (TsMuxStream * stream)
 void
 tsmux_stream_free (TsMuxStream * stream)
 {
+  GList *cur;
+
   g_return_if_fail (stream != NULL);
 
+  for (cur = stream->tstd_units; cur != NULL; cur = g_list_next (cur))
+    g_slice_free (TsMuxStreamUnit, cur->data);
+  g_list_free (stream->tstd_units);
+
   g_slice_free (TsMuxStream, stream);
 }
 
@@ -333,6 +362,99 @@ tsmux_stream_bytes_in_buffer (TsMuxStream * stream)
   return stream->bytes_avail;
 }
 
+/**
+ * tsmux_stream_tstd_add_pes:
+ * @stream: a #TsMuxStream
+ *
+ * Add the PES packet that was just initialized to the T-STD buffer model
+ * of @stream. The bytes written from now on are accounted in the buffer
+ * until the PES packet is removed at its DTS.
+ */
+void
+tsmux_stream_tstd_add_pes (TsMuxStream * stream)
+{
+  TsMuxStreamUnit *unit;
+
+  g_return_if_fail (stream != NULL);
+
+  unit = g_slice_new (TsMuxStreamUnit);
+  unit->dts = (stream->dts != -1) ? stream->dts : stream->pts;
+  unit->size = stream->cur_pes_payload_size ? stream->cur_pes_payload_size :
+      (guint32) tsmux_stream_bytes_in_buffer (stream);
+  stream->tstd_units = g_list_append (stream->tstd_units, unit);
+
+  /* The audio buffer sizes are meant for a few small access units, but a
+   * PES packet can carry larger or several of them. Make room for it and
+   * the previous one, otherwise its last bytes would have to wait until
+   * the previous one or itself is removed at its DTS */
+  if (!stream->is_video_stream && stream->tstd_size < 2 * unit->size)
+    stream->tstd_size = 2 * unit->size;
+}
+
+/**
+ * tsmux_stream_tstd_remove_until:
+ * @stream: a #TsMuxStream
+ * @ts: a time against the 90kHz clock
+ *
+ * Remove from the T-STD buffer model of @stream the PES packets that are
+ * decoded at or before @ts. Packets without timestamp are removed right
+ * away.
+ */
+void
+tsmux_stream_tstd_remove_until (TsMuxStream * stream, gint64 ts)
+{
+  g_return_if_fail (stream != NULL);
+
+  while (stream->tstd_units) {
+    TsMuxStreamUnit *unit = (TsMuxStreamUnit *) stream->tstd_units->data;
+
+    if (unit->dts > ts)
+      break;
+
+    stream->tstd_fullness -= MIN (stream->tstd_fullness, unit->size);
+    stream->tstd_units =
+        g_list_delete_link (stream->tstd_units, stream->tstd_units);
+    g_slice_free (TsMuxStreamUnit, unit);
+  }
+}
+
+/**
+ * tsmux_stream_tstd_next_removal:
+ * @stream: a #TsMuxStream
+ *
+ * Get the time at which the next PES packet leaves the T-STD buffer.
+ *
+ * Returns: the time against the 90kHz clock, or -1 if the buffer is empty.
+ */
+gint64
+tsmux_stream_tstd_next_removal (TsMuxStream * stream)
+{
+  g_return_val_if_fail (stream != NULL, -1);
+
+  if (stream->tstd_units == NULL)
+    return -1;
+
+  return ((TsMuxStreamUnit *) stream->tstd_units->data)->dts;
+}
+
+/**
+ * tsmux_stream_tstd_fits:
+ * @stream: a #TsMuxStream
+ * @len: a number of bytes
+ *
+ * Check if @len more bytes can be delivered to the T-STD buffer of @stream
+ * without overflowing it.
+ *
+ * Returns: TRUE if the bytes fit.
+ */
+gboolean
+tsmux_stream_tstd_fits (TsMuxStream * stream, guint len)
+{
+  g_return_val_if_fail (stream != NULL, TRUE);
+
+  return stream->tstd_fullness + len <= stream->tstd_size;
+}
+
 /**
  * tsmux_stream_initialize_pes_packet:
  * @stream: a #TsMuxStream
@@ -424,6 +546,8 @@ tsmux_stream_get_data (TsMuxStream * stream, guint8 * buf, guint len)
     return FALSE;
 
   stream->pes_bytes_written += len;
+  if (stream->tstd_units)
+    stream->tstd_fullness += len;
 
   if (stream->cur_pes_payload_size != 0 &&
       stream->pes_bytes_written == stream->cur_pes_payload_size) {
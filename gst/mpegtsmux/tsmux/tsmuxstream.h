@@ -182,7 +182,16 @@ struct TsMuxStream {
   gint64 last_dts;
 
   gint   pcr_ref;
-  gint64 last_pcr;
+
+  /* Program the stream belongs to */
+  TsMuxProgram *program;
+
+  /* T-STD buffer model, only used for constant bitrate output: size of the
+   * elementary stream buffer, bytes delivered to it and the access units
+   * (PES packets) waiting to be removed from it at their DTS */
+  guint32 tstd_size;
+  guint32 tstd_fullness;
+  GList *tstd_units;
 
   gint audio_sampling;
   gint audio_channels;
@@ -212,6 +221,11 @@ gboolean 	tsmux_stream_at_pes_start 	(TsMuxStream *stream);
 void 		tsmux_stream_get_es_descrs 	(TsMuxStream *stream, guint8 *buf, guint16 *len);
 
 gint 		tsmux_stream_bytes_in_buffer 	(TsMuxStream *stream);
+
+void		tsmux_stream_tstd_add_pes 	(TsMuxStream *stream);
+void		tsmux_stream_tstd_remove_until 	(TsMuxStream *stream, gint64 ts);
+gint64		tsmux_stream_tstd_next_removal 	(TsMuxStream *stream);
+gboolean	tsmux_stream_tstd_fits 		(TsMuxStream *stream, guint len);
 gint 		tsmux_stream_bytes_avail 	(TsMuxStream *stream);
 gboolean 	tsmux_stream_initialize_pes_packet (TsMuxStream *stream);
 gboolean 	tsmux_stream_get_data 		(TsMuxStream *stream, guint8 *buf, guint len);
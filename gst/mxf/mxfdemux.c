@@ -110,7 +110,8 @@ enum
   PROP_0,
   PROP_PACKAGE,
   PROP_MAX_DRIFT,
-  PROP_STRUCTURE
+  PROP_STRUCTURE,
+  PROP_LAZY_DESCRIPTIVE_METADATA
 };
 
 static gboolean gst_mxf_demux_sink_event (GstPad * pad, GstEvent * event);
@@ -199,6 +200,17 @@ gst_mxf_demux_reset_linked_metadata (GstMXFDemux * demux)
   demux->current_package = NULL;
 }
 
+static void
+gst_mxf_demux_clear_descriptive_metadata (GstMXFDemux * demux)
+{
+  guint i;
+
+  for (i = 0; i < demux->descriptive_metadata->len; i++)
+    gst_buffer_unref (g_array_index (demux->descriptive_metadata,
+            GstMXFDemuxDescriptiveMetadata, i).buffer);
+  g_array_set_size (demux->descriptive_metadata, 0);
+}
+
 static void
 gst_mxf_demux_reset_metadata (GstMXFDemux * demux)
 {
@@ -206,6 +218,8 @@ gst_mxf_demux_reset_metadata (GstMXFDemux * demux)
 
   g_static_rw_lock_writer_lock (&demux->metadata_lock);
 
+  gst_mxf_demux_clear_descriptive_metadata (demux);
+
   demux->update_metadata = TRUE;
   demux->metadata_resolved = FALSE;
 
@@ -233,6 +247,12 @@ gst_mxf_demux_reset (GstMXFDemux * demux)
 
   demux->pull_footer_metadata = TRUE;
 
+  demux->push_state = GST_MXF_DEMUX_PUSH_STATE_NONE;
+  demux->push_filesize = -1;
+  demux->push_resume_offset = 0;
+  demux->push_footer_end = -1;
+  demux->push_resume = FALSE;
+
   demux->run_in = -1;
 
   memset (&demux->current_package_uid, 0, sizeof (MXFUMID));
@@ -253,17 +273,23 @@ gst_mxf_demux_reset (GstMXFDemux * demux)
     demux->random_index_pack = NULL;
   }
 
-  if (demux->pending_index_table_segments) {
+  if (demux->index_tables) {
     GList *l;
+    guint i;
+
+    for (l = demux->index_tables; l; l = l->next) {
+      GstMXFDemuxIndexTable *t = l->data;
 
-    for (l = demux->pending_index_table_segments; l; l = l->next) {
-      MXFIndexTableSegment *s = l->data;
-      mxf_index_table_segment_reset (s);
-      g_free (s);
+      for (i = 0; i < t->segments->len; i++)
+        mxf_index_table_segment_reset (&g_array_index (t->segments,
+                MXFIndexTableSegment, i));
+      g_array_free (t->segments, TRUE);
+      g_free (t);
     }
-    g_list_free (demux->pending_index_table_segments);
-    demux->pending_index_table_segments = NULL;
+    g_list_free (demux->index_tables);
+    demux->index_tables = NULL;
   }
+  demux->pulled_index_tables = FALSE;
 
   gst_mxf_demux_reset_mxf_state (demux);
   gst_mxf_demux_reset_metadata (demux);
@@ -1294,46 +1320,19 @@ gst_mxf_demux_handle_metadata (GstMXFDemux * demux, const MXFUL * key,
 }
 
 static GstFlowReturn
-gst_mxf_demux_handle_descriptive_metadata (GstMXFDemux * demux,
-    const MXFUL * key, GstBuffer * buffer)
+gst_mxf_demux_add_descriptive_metadata (GstMXFDemux * demux, guint8 scheme,
+    guint32 type, MXFPrimerPack * primer, guint64 offset, const guint8 * data,
+    guint size)
 {
-  guint32 type;
-  guint8 scheme;
-  GstFlowReturn ret = GST_FLOW_OK;
   MXFDescriptiveMetadata *m = NULL, *old = NULL;
 
-  scheme = GST_READ_UINT8 (key->u + 12);
-  type = GST_READ_UINT24_BE (key->u + 13);
-
-  GST_DEBUG_OBJECT (demux,
-      "Handling descriptive metadata of size %u at offset %"
-      G_GUINT64_FORMAT " with scheme 0x%02x and type 0x%06x",
-      GST_BUFFER_SIZE (buffer), demux->offset, scheme, type);
-
-  if (G_UNLIKELY (!demux->current_partition)) {
-    GST_ERROR_OBJECT (demux, "Partition pack doesn't exist");
-    return GST_FLOW_ERROR;
-  }
-
-  if (G_UNLIKELY (!demux->current_partition->primer.mappings)) {
-    GST_ERROR_OBJECT (demux, "Primer pack doesn't exists");
-    return GST_FLOW_ERROR;
-  }
-
-  if (demux->current_partition->parsed_metadata) {
-    GST_DEBUG_OBJECT (demux, "Metadata of this partition was already parsed");
-    return GST_FLOW_OK;
-  }
-
-  m = mxf_descriptive_metadata_new (scheme, type,
-      &demux->current_partition->primer, demux->offset,
-      GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer));
+  m = mxf_descriptive_metadata_new (scheme, type, primer, offset, data, size);
 
   if (!m) {
     GST_WARNING_OBJECT (demux,
         "Unknown or unhandled descriptive metadata of scheme 0x%02x and type 0x%06x",
         scheme, type);
-    return GST_FLOW_OK;
+    return GST_FLOW_CUSTOM_SUCCESS;
   }
 
   old =
@@ -1363,20 +1362,126 @@ gst_mxf_demux_handle_descriptive_metadata (GstMXFDemux * demux,
         "Metadata with instance uid %s already exists and is newer",
         mxf_uuid_to_string (&MXF_METADATA_BASE (m)->instance_uid, str));
     gst_mini_object_unref (GST_MINI_OBJECT (m));
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  g_hash_table_replace (demux->metadata, &MXF_METADATA_BASE (m)->instance_uid,
+      m);
+
+  return GST_FLOW_OK;
+}
+
+/* Parse all descriptive metadata that was skipped in lazy mode and
+ * resolve the references to it. Must be called with the metadata
+ * writer lock */
+static void
+gst_mxf_demux_load_descriptive_metadata (GstMXFDemux * demux)
+{
+  GHashTableIter iter;
+  MXFMetadataBase *m = NULL;
+  gboolean added = FALSE;
+  guint i;
+
+  if (demux->descriptive_metadata->len == 0)
+    return;
+
+  GST_DEBUG_OBJECT (demux, "Loading %u descriptive metadata sets",
+      demux->descriptive_metadata->len);
+
+  for (i = 0; i < demux->descriptive_metadata->len; i++) {
+    GstMXFDemuxDescriptiveMetadata *dm =
+        &g_array_index (demux->descriptive_metadata,
+        GstMXFDemuxDescriptiveMetadata, i);
+
+    if (gst_mxf_demux_add_descriptive_metadata (demux, dm->scheme, dm->type,
+            &dm->partition->primer, dm->offset, GST_BUFFER_DATA (dm->buffer),
+            GST_BUFFER_SIZE (dm->buffer)) == GST_FLOW_OK)
+      added = TRUE;
+  }
+  gst_mxf_demux_clear_descriptive_metadata (demux);
+
+  if (!added || !demux->metadata_resolved)
+    return;
+
+  /* Link the descriptive metadata to the DM segments that were resolved
+   * without it. The structural metadata is in use by the pads and resolving
+   * it again would reset the descriptors and recount the tracks, so only
+   * the new sets and these DM segments are resolved here */
+  g_hash_table_iter_init (&iter, demux->metadata);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) & m)) {
+    if (MXF_IS_METADATA_DM_SEGMENT (m)
+        && !MXF_METADATA_DM_SEGMENT (m)->dm_framework)
+      m->resolved = MXF_METADATA_BASE_RESOLVE_STATE_NONE;
+  }
+
+  g_hash_table_iter_init (&iter, demux->metadata);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) & m)) {
+    if (m->resolved != MXF_METADATA_BASE_RESOLVE_STATE_NONE)
+      continue;
+    if (MXF_IS_METADATA_DM_SEGMENT (m) || MXF_IS_DESCRIPTIVE_METADATA (m))
+      mxf_metadata_base_resolve (m, demux->metadata);
+  }
+}
+
+static GstFlowReturn
+gst_mxf_demux_handle_descriptive_metadata (GstMXFDemux * demux,
+    const MXFUL * key, GstBuffer * buffer)
+{
+  guint32 type;
+  guint8 scheme;
+  GstFlowReturn ret;
+
+  scheme = GST_READ_UINT8 (key->u + 12);
+  type = GST_READ_UINT24_BE (key->u + 13);
+
+  GST_DEBUG_OBJECT (demux,
+      "Handling descriptive metadata of size %u at offset %"
+      G_GUINT64_FORMAT " with scheme 0x%02x and type 0x%06x",
+      GST_BUFFER_SIZE (buffer), demux->offset, scheme, type);
+
+  if (G_UNLIKELY (!demux->current_partition)) {
+    GST_ERROR_OBJECT (demux, "Partition pack doesn't exist");
+    return GST_FLOW_ERROR;
+  }
+
+  if (G_UNLIKELY (!demux->current_partition->primer.mappings)) {
+    GST_ERROR_OBJECT (demux, "Primer pack doesn't exists");
+    return GST_FLOW_ERROR;
+  }
+
+  if (demux->current_partition->parsed_metadata) {
+    GST_DEBUG_OBJECT (demux, "Metadata of this partition was already parsed");
     return GST_FLOW_OK;
   }
 
-  g_static_rw_lock_writer_lock (&demux->metadata_lock);
+  /* Only keep the data around until the descriptive metadata is needed */
+  if (demux->lazy_descriptive_metadata) {
+    GstMXFDemuxDescriptiveMetadata dm;
 
-  demux->update_metadata = TRUE;
-  gst_mxf_demux_reset_linked_metadata (demux);
+    dm.scheme = scheme;
+    dm.type = type;
+    dm.offset = demux->offset;
+    dm.partition = demux->current_partition;
+    dm.buffer = gst_buffer_ref (buffer);
 
-  g_hash_table_replace (demux->metadata, &MXF_METADATA_BASE (m)->instance_uid,
-      m);
+    g_static_rw_lock_writer_lock (&demux->metadata_lock);
+    g_array_append_val (demux->descriptive_metadata, dm);
+    g_static_rw_lock_writer_unlock (&demux->metadata_lock);
+
+    return GST_FLOW_OK;
+  }
 
+  g_static_rw_lock_writer_lock (&demux->metadata_lock);
+  ret = gst_mxf_demux_add_descriptive_metadata (demux, scheme, type,
+      &demux->current_partition->primer, demux->offset,
+      GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer));
+  if (ret == GST_FLOW_OK) {
+    demux->update_metadata = TRUE;
+    gst_mxf_demux_reset_linked_metadata (demux);
+  }
   g_static_rw_lock_writer_unlock (&demux->metadata_lock);
 
-  return ret;
+  return (ret == GST_FLOW_CUSTOM_SUCCESS) ? GST_FLOW_OK : ret;
 }
 
 static GstFlowReturn
@@ -1531,6 +1636,136 @@ gst_mxf_demux_pad_set_component (GstMXFDemux * demux, GstMXFDemuxPad * pad,
   return ret;
 }
 
+static MXFIndexTableSegment *
+gst_mxf_demux_find_index_table_segment (GstMXFDemux * demux,
+    guint32 body_sid, gint64 position)
+{
+  GList *l;
+  guint i;
+
+  for (l = demux->index_tables; l; l = l->next) {
+    GstMXFDemuxIndexTable *t = l->data;
+
+    if (t->body_sid != body_sid)
+      continue;
+
+    for (i = 0; i < t->segments->len; i++) {
+      MXFIndexTableSegment *segment =
+          &g_array_index (t->segments, MXFIndexTableSegment, i);
+
+      if (position < segment->index_start_position)
+        break;
+
+      /* CBE segments with a duration of 0 cover the complete essence */
+      if (segment->edit_unit_byte_count != 0) {
+        if (segment->index_duration == 0 ||
+            position < segment->index_start_position + segment->index_duration)
+          return segment;
+      } else if (position <
+          segment->index_start_position + segment->n_index_entries) {
+        return segment;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Look up the offset of edit unit @position in the essence container of
+ * @etrack, relative to the start of the container */
+static gboolean
+gst_mxf_demux_index_table_lookup (GstMXFDemux * demux,
+    GstMXFDemuxEssenceTrack * etrack, gint64 position, guint64 * stream_offset,
+    gboolean * keyframe, gint64 * keyframe_position)
+{
+  MXFIndexTableSegment *segment;
+  MXFIndexEntry *entry;
+
+  segment =
+      gst_mxf_demux_find_index_table_segment (demux, etrack->body_sid,
+      position);
+  if (!segment)
+    return FALSE;
+
+  if (segment->edit_unit_byte_count != 0) {
+    *stream_offset = position * segment->edit_unit_byte_count;
+    *keyframe = TRUE;
+    *keyframe_position = position;
+    return TRUE;
+  }
+
+  entry = &segment->index_entries[position - segment->index_start_position];
+  *stream_offset = entry->stream_offset;
+  /* Random access flag, SMPTE 377M 10.2.3 */
+  *keyframe = ! !(entry->flags & 0x80);
+  *keyframe_position = position + entry->key_frame_offset;
+
+  return TRUE;
+}
+
+/* Find the edit unit of @etrack that contains @offset, which is in the
+ * current partition */
+static gint64
+gst_mxf_demux_index_table_find_position (GstMXFDemux * demux,
+    GstMXFDemuxEssenceTrack * etrack, guint64 offset)
+{
+  GstMXFDemuxPartition *p = demux->current_partition;
+  guint64 stream_offset;
+  gint64 position = -1;
+  GList *l;
+  guint i;
+
+  if (!p || p->partition.body_sid != etrack->body_sid
+      || offset < p->partition.this_partition + p->essence_container_offset)
+    return -1;
+
+  stream_offset =
+      offset - p->partition.this_partition - p->essence_container_offset +
+      p->partition.body_offset;
+
+  for (l = demux->index_tables; l; l = l->next) {
+    GstMXFDemuxIndexTable *t = l->data;
+
+    if (t->body_sid != etrack->body_sid)
+      continue;
+
+    for (i = 0; i < t->segments->len; i++) {
+      MXFIndexTableSegment *segment =
+          &g_array_index (t->segments, MXFIndexTableSegment, i);
+      guint lo, hi;
+
+      if (segment->edit_unit_byte_count != 0) {
+        gint64 pos = stream_offset / segment->edit_unit_byte_count;
+
+        if (pos >= segment->index_start_position &&
+            (segment->index_duration == 0 ||
+                pos < segment->index_start_position + segment->index_duration))
+          position = pos;
+        continue;
+      }
+
+      if (segment->n_index_entries == 0 ||
+          segment->index_entries[0].stream_offset > stream_offset)
+        continue;
+
+      /* Last entry starting before the offset */
+      lo = 0;
+      hi = segment->n_index_entries;
+      while (hi - lo > 1) {
+        guint mid = (lo + hi) / 2;
+
+        if (segment->index_entries[mid].stream_offset <= stream_offset)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      position = segment->index_start_position + lo;
+    }
+  }
+
+  return position;
+}
+
 static GstFlowReturn
 gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
     const MXFUL * key, GstBuffer * buffer, gboolean peek)
@@ -1606,15 +1841,29 @@ gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
       }
     }
 
+    if (etrack->position == -1)
+      etrack->position =
+          gst_mxf_demux_index_table_find_position (demux, etrack,
+          demux->offset - demux->run_in);
+
     if (etrack->position == -1) {
       GST_WARNING_OBJECT (demux, "Essence track position not in index");
       return GST_FLOW_OK;
     }
   }
 
-  if (etrack->offsets && etrack->offsets->len > etrack->position) {
+  if (etrack->offsets && etrack->offsets->len > etrack->position &&
+      g_array_index (etrack->offsets, GstMXFDemuxIndex,
+          etrack->position).offset != 0) {
     keyframe = g_array_index (etrack->offsets, GstMXFDemuxIndex,
         etrack->position).keyframe;
+  } else {
+    guint64 stream_offset;
+    gint64 keyframe_position;
+
+    if (!gst_mxf_demux_index_table_lookup (demux, etrack, etrack->position,
+            &stream_offset, &keyframe, &keyframe_position))
+      keyframe = TRUE;
   }
 
   /* Create subbuffer to be able to change metadata */
@@ -1651,19 +1900,17 @@ gst_mxf_demux_handle_generic_container_essence_element (GstMXFDemux * demux,
     etrack->offsets = g_array_new (FALSE, TRUE, sizeof (GstMXFDemuxIndex));
 
   {
-    if (etrack->offsets->len > etrack->position) {
-      GstMXFDemuxIndex *index =
-          &g_array_index (etrack->offsets, GstMXFDemuxIndex, etrack->position);
+    GstMXFDemuxIndex *index;
 
-      index->offset = demux->offset - demux->run_in;
-      index->keyframe = keyframe;
-    } else {
-      GstMXFDemuxIndex index;
+    /* After seeking through the index table segments there can be a
+     * gap, unknown offsets are 0 */
+    if (etrack->offsets->len <= etrack->position)
+      g_array_set_size (etrack->offsets, etrack->position + 1);
 
-      index.offset = demux->offset - demux->run_in;
-      index.keyframe = keyframe;
-      g_array_insert_val (etrack->offsets, etrack->position, index);
-    }
+    index =
+        &g_array_index (etrack->offsets, GstMXFDemuxIndex, etrack->position);
+    index->offset = demux->offset - demux->run_in;
+    index->keyframe = keyframe;
   }
 
   if (peek)
@@ -1895,11 +2142,25 @@ gst_mxf_demux_handle_random_index_pack (GstMXFDemux * demux, const MXFUL * key,
   return GST_FLOW_OK;
 }
 
+static gint
+gst_mxf_demux_index_table_segment_compare (const MXFIndexTableSegment * a,
+    const MXFIndexTableSegment * b)
+{
+  if (a->index_start_position < b->index_start_position)
+    return -1;
+  else if (a->index_start_position > b->index_start_position)
+    return 1;
+  return 0;
+}
+
 static GstFlowReturn
 gst_mxf_demux_handle_index_table_segment (GstMXFDemux * demux,
     const MXFUL * key, GstBuffer * buffer)
 {
-  MXFIndexTableSegment *segment;
+  MXFIndexTableSegment segment;
+  GstMXFDemuxIndexTable *table = NULL;
+  GList *l;
+  guint i;
 
   GST_DEBUG_OBJECT (demux,
       "Handling index table segment of size %u at offset %"
@@ -1909,9 +2170,7 @@ gst_mxf_demux_handle_index_table_segment (GstMXFDemux * demux,
     GST_WARNING_OBJECT (demux, "Invalid primer pack");
   }
 
-  segment = g_new0 (MXFIndexTableSegment, 1);
-
-  if (!mxf_index_table_segment_parse (key, segment,
+  if (!mxf_index_table_segment_parse (key, &segment,
           &demux->current_partition->primer, GST_BUFFER_DATA (buffer),
           GST_BUFFER_SIZE (buffer))) {
 
@@ -1919,20 +2178,52 @@ gst_mxf_demux_handle_index_table_segment (GstMXFDemux * demux,
     return GST_FLOW_ERROR;
   }
 
-  demux->pending_index_table_segments =
-      g_list_prepend (demux->pending_index_table_segments, segment);
+  for (l = demux->index_tables; l; l = l->next) {
+    GstMXFDemuxIndexTable *tmp = l->data;
+
+    if (tmp->body_sid == segment.body_sid
+        && tmp->index_sid == segment.index_sid) {
+      table = tmp;
+      break;
+    }
+  }
+
+  if (!table) {
+    table = g_new0 (GstMXFDemuxIndexTable, 1);
+    table->body_sid = segment.body_sid;
+    table->index_sid = segment.index_sid;
+    table->segments = g_array_new (FALSE, FALSE, sizeof (MXFIndexTableSegment));
+    demux->index_tables = g_list_prepend (demux->index_tables, table);
+  }
+
+  /* The same segments are usually repeated in several partitions */
+  for (i = 0; i < table->segments->len; i++) {
+    MXFIndexTableSegment *tmp =
+        &g_array_index (table->segments, MXFIndexTableSegment, i);
+
+    if (tmp->index_start_position == segment.index_start_position &&
+        tmp->index_duration == segment.index_duration) {
+      GST_DEBUG_OBJECT (demux, "Index table segment already known");
+      mxf_index_table_segment_reset (&segment);
+      return GST_FLOW_OK;
+    }
+  }
 
+  g_array_append_val (table->segments, segment);
+  g_array_sort (table->segments,
+      (GCompareFunc) gst_mxf_demux_index_table_segment_compare);
 
   return GST_FLOW_OK;
 }
 
+/* Pull the key and the length of the KLV packet at @offset */
 static GstFlowReturn
-gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
-    GstBuffer ** outbuf, guint * read)
+gst_mxf_demux_pull_klv_header (GstMXFDemux * demux, guint64 offset,
+    MXFUL * key, guint64 * out_length, guint * out_data_offset)
 {
   GstBuffer *buffer = NULL;
   const guint8 *data;
-  guint64 data_offset = 0;
+  guint data_offset = 0;
   guint64 length;
   GstFlowReturn ret = GST_FLOW_OK;
 
@@ -1983,6 +2274,29 @@ gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
   gst_buffer_unref (buffer);
   buffer = NULL;
 
+  *out_length = length;
+  *out_data_offset = data_offset;
+
+beach:
+  if (buffer)
+    gst_buffer_unref (buffer);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_mxf_demux_pull_klv_packet (GstMXFDemux * demux, guint64 offset, MXFUL * key,
+    GstBuffer ** outbuf, guint * read)
+{
+  GstBuffer *buffer = NULL;
+  guint data_offset = 0;
+  guint64 length;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if ((ret = gst_mxf_demux_pull_klv_header (demux, offset, key, &length,
+              &data_offset)) != GST_FLOW_OK)
+    goto beach;
+
   /* GStreamer's buffer sizes are stored in a guint so we
    * limit ourself to G_MAXUINT large buffers */
   if (length > G_MAXUINT) {
@@ -2242,6 +2556,268 @@ out:
   demux->current_partition = old_partition;
 }
 
+/* Pull and parse the partition pack at @this_partition, returning the
+ * previous partition offset that is stored in it */
+static GstMXFDemuxPartition *
+gst_mxf_demux_pull_partition_pack (GstMXFDemux * demux, guint64 this_partition,
+    guint64 * prev_partition)
+{
+  guint64 old_offset = demux->offset;
+  GstMXFDemuxPartition *old_partition = demux->current_partition;
+  GstMXFDemuxPartition *p = NULL;
+  MXFPartitionPack partition;
+  GstBuffer *buffer = NULL;
+  MXFUL key;
+
+  demux->offset = demux->run_in + this_partition;
+
+  if (gst_mxf_demux_pull_klv_packet (demux, demux->offset, &key, &buffer,
+          NULL) != GST_FLOW_OK)
+    goto out;
+
+  if (!mxf_is_partition_pack (&key))
+    goto out;
+
+  if (prev_partition && mxf_partition_pack_parse (&key, &partition,
+          GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer))) {
+    *prev_partition = partition.prev_partition;
+    mxf_partition_pack_reset (&partition);
+  }
+
+  if (gst_mxf_demux_handle_partition_pack (demux, &key, buffer) == GST_FLOW_OK)
+    p = demux->current_partition;
+
+out:
+  if (buffer)
+    gst_buffer_unref (buffer);
+
+  demux->offset = old_offset;
+  demux->current_partition = old_partition;
+
+  return p;
+}
+
+/* Skip the partition pack and, if present, the header metadata and index
+ * table segments of a partition. Returns the offset after them. */
+static guint64
+gst_mxf_demux_skip_partition_headers (GstMXFDemux * demux,
+    GstMXFDemuxPartition * p, gboolean skip_index)
+{
+  guint64 offset = demux->run_in + p->partition.this_partition;
+  gboolean skipped_header = FALSE, skipped_index = FALSE;
+  guint64 length;
+  guint data_offset;
+  MXFUL key;
+
+  if (gst_mxf_demux_pull_klv_header (demux, offset, &key, &length,
+          &data_offset) != GST_FLOW_OK || !mxf_is_partition_pack (&key))
+    return -1;
+  offset += data_offset + length;
+
+  while (TRUE) {
+    if (gst_mxf_demux_pull_klv_header (demux, offset, &key, &length,
+            &data_offset) != GST_FLOW_OK)
+      return -1;
+
+    if (mxf_is_fill (&key)) {
+      offset += data_offset + length;
+    } else if (mxf_is_primer_pack (&key) && !skipped_header &&
+        p->partition.header_byte_count != 0) {
+      /* Header byte count includes the primer pack and trailing fill */
+      offset += p->partition.header_byte_count;
+      skipped_header = TRUE;
+    } else if (skip_index && mxf_is_index_table_segment (&key) &&
+        !skipped_index && p->partition.index_byte_count != 0) {
+      offset += p->partition.index_byte_count;
+      skipped_index = TRUE;
+    } else {
+      break;
+    }
+  }
+
+  return offset;
+}
+
+/* Offset of the first essence element in a partition, relative to
+ * the partition */
+static guint64
+gst_mxf_demux_partition_essence_offset (GstMXFDemux * demux,
+    GstMXFDemuxPartition * p)
+{
+  guint64 offset;
+
+  if (p->essence_container_offset != 0)
+    return p->essence_container_offset;
+
+  offset = gst_mxf_demux_skip_partition_headers (demux, p, TRUE);
+  if (offset == -1)
+    return -1;
+
+  p->essence_container_offset =
+      offset - demux->run_in - p->partition.this_partition;
+
+  return p->essence_container_offset;
+}
+
+/* Convert an offset in the essence container @body_sid to an offset in
+ * the file, using the body offsets of the partitions */
+static guint64
+gst_mxf_demux_stream_offset_to_offset (GstMXFDemux * demux, guint32 body_sid,
+    guint64 stream_offset)
+{
+  GstMXFDemuxPartition *best = NULL;
+  guint64 essence_offset, offset;
+  guint64 limit = -1;
+  GList *l;
+
+  for (l = demux->partitions; l; l = l->next) {
+    GstMXFDemuxPartition *p = l->data;
+
+    if (p->partition.body_sid != body_sid)
+      continue;
+
+    /* Only known from the random index pack so far. If it can't be
+     * read, e.g. in push mode, the offset must be before it */
+    if (p->partition.major_version == 0
+        && !gst_mxf_demux_pull_partition_pack (demux,
+            p->partition.this_partition, NULL)) {
+      limit = p->partition.this_partition;
+      break;
+    }
+
+    if (p->partition.body_offset > stream_offset)
+      break;
+
+    best = p;
+  }
+
+  if (!best)
+    return -1;
+
+  essence_offset = gst_mxf_demux_partition_essence_offset (demux, best);
+  if (essence_offset == -1)
+    return -1;
+
+  offset = best->partition.this_partition + essence_offset +
+      (stream_offset - best->partition.body_offset);
+  if (offset >= limit)
+    return -1;
+
+  return offset;
+}
+
+/* Read all index table segments of the file. Without a random index pack
+ * the partitions are found by walking back from the footer partition */
+static void
+gst_mxf_demux_pull_index_tables (GstMXFDemux * demux)
+{
+  guint64 old_offset = demux->offset;
+  GstMXFDemuxPartition *old_partition = demux->current_partition;
+  GList *l;
+
+  if (demux->pulled_index_tables)
+    return;
+  demux->pulled_index_tables = TRUE;
+
+  if (!demux->random_index_pack && demux->footer_partition_pack_offset != 0) {
+    guint64 offset = demux->footer_partition_pack_offset;
+
+    while (TRUE) {
+      guint64 prev_partition = offset;
+
+      if (!gst_mxf_demux_pull_partition_pack (demux, offset, &prev_partition))
+        break;
+      if (offset == 0 || prev_partition >= offset)
+        break;
+      offset = prev_partition;
+    }
+  }
+
+  for (l = demux->partitions; l; l = l->next) {
+    GstMXFDemuxPartition *p = l->data;
+    guint64 offset, end;
+
+    if (p->partition.major_version == 0
+        && !gst_mxf_demux_pull_partition_pack (demux,
+            p->partition.this_partition, NULL))
+      continue;
+
+    if (p->partition.index_sid == 0 || p->partition.index_byte_count == 0)
+      continue;
+
+    GST_DEBUG_OBJECT (demux, "Reading index table segments of partition at "
+        "offset %" G_GUINT64_FORMAT, p->partition.this_partition);
+
+    offset = gst_mxf_demux_skip_partition_headers (demux, p, FALSE);
+    if (offset == -1)
+      continue;
+
+    demux->current_partition = p;
+    end = offset + p->partition.index_byte_count;
+    while (offset < end) {
+      GstBuffer *buffer = NULL;
+      guint read = 0;
+      MXFUL key;
+
+      if (gst_mxf_demux_pull_klv_packet (demux, offset, &key, &buffer,
+              &read) != GST_FLOW_OK)
+        break;
+
+      demux->offset = offset;
+      if (mxf_is_index_table_segment (&key))
+        gst_mxf_demux_handle_index_table_segment (demux, &key, buffer);
+      gst_buffer_unref (buffer);
+
+      if (!mxf_is_index_table_segment (&key) && !mxf_is_fill (&key))
+        break;
+      offset += read;
+    }
+  }
+
+  demux->offset = old_offset;
+  demux->current_partition = old_partition;
+}
+
+/* Find the offset of the edit unit @position of @etrack, or of the
+ * keyframe before it, from the index table segments */
+static guint64
+gst_mxf_demux_find_index_table_offset (GstMXFDemux * demux,
+    GstMXFDemuxEssenceTrack * etrack, gint64 * position, gboolean keyframe)
+{
+  gint64 current_position = *position;
+  guint64 stream_offset, offset;
+  gboolean is_keyframe;
+  gint64 keyframe_position;
+
+  while (TRUE) {
+    if (!gst_mxf_demux_index_table_lookup (demux, etrack, current_position,
+            &stream_offset, &is_keyframe, &keyframe_position))
+      return -1;
+
+    if (!keyframe || is_keyframe)
+      break;
+
+    if (keyframe_position < current_position && keyframe_position >= 0)
+      current_position = keyframe_position;
+    else if (current_position > 0)
+      current_position--;
+    else
+      return -1;
+  }
+
+  offset =
+      gst_mxf_demux_stream_offset_to_offset (demux, etrack->body_sid,
+      stream_offset);
+  if (offset == -1)
+    return -1;
+
+  GST_DEBUG_OBJECT (demux, "Found edit unit %" G_GINT64_FORMAT " in index "
+      "table at offset %" G_GUINT64_FORMAT, current_position, offset);
+  *position = current_position;
+
+  return offset;
+}
+
 static GstFlowReturn
 gst_mxf_demux_handle_klv_packet (GstMXFDemux * demux, const MXFUL * key,
     GstBuffer * buffer, gboolean peek)
@@ -2379,7 +2955,7 @@ gst_mxf_demux_find_essence_element (GstMXFDemux * demux,
   GstFlowReturn ret = GST_FLOW_OK;
   guint64 old_offset = demux->offset;
   GstMXFDemuxPartition *old_partition = demux->current_partition;
-  guint i;
+  gint i;
 
   GST_DEBUG_OBJECT (demux, "Trying to find essence element %" G_GINT64_FORMAT
       " of track %u with body_sid %u (keyframe %d)", *position,
@@ -2428,6 +3004,24 @@ from_index:
   }
 
   GST_DEBUG_OBJECT (demux, "Not found in index");
+
+  /* Then in the index table segments of the file */
+  if (demux->random_access)
+    gst_mxf_demux_pull_index_tables (demux);
+
+  {
+    gint64 index_position = *position;
+    guint64 index_offset;
+
+    index_offset =
+        gst_mxf_demux_find_index_table_offset (demux, etrack, &index_position,
+        keyframe);
+    if (index_offset != -1) {
+      *position = index_position;
+      return index_offset;
+    }
+  }
+
   if (!demux->random_access) {
     guint64 new_offset = -1;
     gint64 new_position = -1;
@@ -2804,6 +3398,219 @@ pause:
   }
 }
 
+/* Flushing seek upstream to @offset in push mode */
+static gboolean
+gst_mxf_demux_push_seek (GstMXFDemux * demux, guint64 offset)
+{
+  GstEvent *e;
+
+  GST_DEBUG_OBJECT (demux, "Seeking upstream to offset %" G_GUINT64_FORMAT,
+      offset);
+
+  e = gst_event_new_seek (1.0, GST_FORMAT_BYTES,
+      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, GST_SEEK_TYPE_SET, offset,
+      GST_SEEK_TYPE_NONE, -1);
+  if (!gst_pad_push_event (demux->sinkpad, e)) {
+    GST_WARNING_OBJECT (demux, "Upstream seek to offset %" G_GUINT64_FORMAT
+        " failed", offset);
+    return FALSE;
+  }
+
+  gst_adapter_clear (demux->adapter);
+  demux->offset = offset;
+  demux->current_partition = NULL;
+
+  return TRUE;
+}
+
+/* In push mode, get the random index pack and the footer partition with
+ * upstream byte seeks before streaming the essence, like it's done in
+ * pull mode. Returns TRUE if an upstream seek was done */
+static gboolean
+gst_mxf_demux_push_start_footer (GstMXFDemux * demux)
+{
+  GstQuery *query;
+  GstFormat fmt = GST_FORMAT_BYTES;
+  gboolean seekable = FALSE;
+  gint64 filesize = -1;
+  guint64 offset;
+
+  demux->push_state = GST_MXF_DEMUX_PUSH_STATE_DONE;
+
+  /* Like in pull mode, the metadata of a closed and complete header
+   * partition is final */
+  if (demux->current_partition->partition.closed
+      && demux->current_partition->partition.complete) {
+    GST_DEBUG_OBJECT (demux, "Closed and complete header partition");
+    return FALSE;
+  }
+
+  query = gst_query_new_seeking (GST_FORMAT_BYTES);
+  if (gst_pad_peer_query (demux->sinkpad, query))
+    gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+  gst_query_unref (query);
+
+  if (!seekable) {
+    GST_DEBUG_OBJECT (demux, "Upstream is not seekable");
+    return FALSE;
+  }
+
+  if (!gst_pad_query_peer_duration (demux->sinkpad, &fmt, &filesize) ||
+      fmt != GST_FORMAT_BYTES || filesize <= 20) {
+    GST_DEBUG_OBJECT (demux, "Can't query upstream size");
+    return FALSE;
+  }
+
+  demux->push_filesize = filesize;
+  demux->push_resume_offset = demux->offset;
+  demux->push_footer_end = -1;
+
+  if (demux->footer_partition_pack_offset != 0) {
+    demux->push_state = GST_MXF_DEMUX_PUSH_STATE_FOOTER;
+    offset = demux->run_in + demux->footer_partition_pack_offset;
+  } else {
+    demux->push_state = GST_MXF_DEMUX_PUSH_STATE_RIP_SIZE;
+    offset = filesize - 4;
+  }
+
+  if (offset <= demux->push_resume_offset || offset >= filesize) {
+    GST_DEBUG_OBJECT (demux, "Invalid footer offset %" G_GUINT64_FORMAT,
+        offset);
+    demux->push_state = GST_MXF_DEMUX_PUSH_STATE_DONE;
+    return FALSE;
+  }
+
+  /* The footer metadata replaces the header metadata */
+  if (demux->push_state == GST_MXF_DEMUX_PUSH_STATE_FOOTER)
+    gst_mxf_demux_reset_metadata (demux);
+
+  if (!gst_mxf_demux_push_seek (demux, offset)) {
+    demux->push_state = GST_MXF_DEMUX_PUSH_STATE_DONE;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Stop reading the end of the file and seek back to where the essence
+ * starts */
+static GstFlowReturn
+gst_mxf_demux_push_finish_footer (GstMXFDemux * demux)
+{
+  GList *l;
+  guint i;
+
+  GST_DEBUG_OBJECT (demux, "Finished reading the end of the file");
+
+  if (demux->push_state == GST_MXF_DEMUX_PUSH_STATE_FOOTER
+      && demux->update_metadata && demux->preface) {
+    if (gst_mxf_demux_resolve_references (demux) != GST_FLOW_OK ||
+        gst_mxf_demux_update_tracks (demux) != GST_FLOW_OK) {
+      GST_WARNING_OBJECT (demux, "Footer metadata can't be resolved");
+      gst_mxf_demux_reset_metadata (demux);
+    }
+  }
+
+  demux->push_state = GST_MXF_DEMUX_PUSH_STATE_DONE;
+  demux->pull_footer_metadata = FALSE;
+
+  /* The newsegment of this seek comes from the streaming thread, after the
+   * positions of the tracks are set below */
+  demux->push_resume = TRUE;
+  if (!gst_mxf_demux_push_seek (demux, demux->push_resume_offset)) {
+    demux->push_resume = FALSE;
+    GST_ELEMENT_ERROR (demux, STREAM, DEMUX, (NULL),
+        ("Failed to seek back after reading the footer partition"));
+    return GST_FLOW_ERROR;
+  }
+
+  gst_mxf_demux_set_partition_for_offset (demux, demux->offset);
+
+  for (l = demux->partitions; l; l = l->next) {
+    GstMXFDemuxPartition *p = l->data;
+
+    if (p->partition.type != MXF_PARTITION_PACK_HEADER
+        || p->partition.body_sid == 0 || p->partition.body_offset != 0)
+      continue;
+
+    for (i = 0; i < demux->essence_tracks->len; i++) {
+      GstMXFDemuxEssenceTrack *etrack =
+          &g_array_index (demux->essence_tracks, GstMXFDemuxEssenceTrack, i);
+
+      if (etrack->body_sid == p->partition.body_sid)
+        etrack->position = 0;
+    }
+  }
+
+  return GST_FLOW_OK;
+}
+
+/* Check if a KLV packet is expected while reading the end of the file */
+static gboolean
+gst_mxf_demux_push_footer_accept (GstMXFDemux * demux, const MXFUL * key)
+{
+  switch (demux->push_state) {
+    case GST_MXF_DEMUX_PUSH_STATE_RIP:
+      return mxf_is_random_index_pack (key);
+    case GST_MXF_DEMUX_PUSH_STATE_FOOTER:
+      /* Only the random index pack can follow the footer partition */
+      if (demux->offset >= demux->push_footer_end)
+        return mxf_is_random_index_pack (key);
+      return mxf_is_partition_pack (key) || mxf_is_primer_pack (key)
+          || mxf_is_metadata (key) || mxf_is_descriptive_metadata (key)
+          || mxf_is_index_table_segment (key) || mxf_is_fill (key)
+          || mxf_is_random_index_pack (key);
+    default:
+      return TRUE;
+  }
+}
+
+/* Handle the KLV packet that was just read from the end of the file and
+ * seek to the next part that is needed */
+static GstFlowReturn
+gst_mxf_demux_push_footer_next (GstMXFDemux * demux, const MXFUL * key,
+    gboolean * seeked)
+{
+  *seeked = FALSE;
+
+  if (demux->push_state == GST_MXF_DEMUX_PUSH_STATE_RIP) {
+    MXFRandomIndexPackEntry *entry;
+    guint64 offset;
+
+    if (!demux->random_index_pack || demux->random_index_pack->len == 0)
+      goto finish;
+
+    entry = &g_array_index (demux->random_index_pack, MXFRandomIndexPackEntry,
+        demux->random_index_pack->len - 1);
+    offset = entry->offset;
+    if (offset <= demux->push_resume_offset)
+      goto finish;
+
+    demux->push_state = GST_MXF_DEMUX_PUSH_STATE_FOOTER;
+    demux->push_footer_end = -1;
+    gst_mxf_demux_reset_metadata (demux);
+    if (!gst_mxf_demux_push_seek (demux, offset))
+      goto finish;
+    *seeked = TRUE;
+  } else if (demux->push_state == GST_MXF_DEMUX_PUSH_STATE_FOOTER) {
+    if (mxf_is_random_index_pack (key))
+      goto finish;
+
+    if (mxf_is_partition_pack (key) && demux->current_partition) {
+      MXFPartitionPack *partition = &demux->current_partition->partition;
+
+      demux->push_footer_end = demux->offset + partition->header_byte_count +
+          partition->index_byte_count;
+    }
+  }
+
+  return GST_FLOW_OK;
+
+finish:
+  *seeked = TRUE;
+  return gst_mxf_demux_push_finish_footer (demux);
+}
+
 static GstFlowReturn
 gst_mxf_demux_chain (GstPad * pad, GstBuffer * inbuf)
 {
@@ -2853,6 +3660,28 @@ gst_mxf_demux_chain (GstPad * pad, GstBuffer * inbuf)
       break;
     }
 
+    if (G_UNLIKELY (demux->push_state == GST_MXF_DEMUX_PUSH_STATE_RIP_SIZE)) {
+      guint32 pack_size;
+
+      if (gst_adapter_available (demux->adapter) < 4)
+        break;
+
+      pack_size = GST_READ_UINT32_BE (gst_adapter_peek (demux->adapter, 4));
+      GST_DEBUG_OBJECT (demux, "Random index pack size %u", pack_size);
+
+      if (pack_size < 20 || pack_size > demux->push_filesize - 20 ||
+          demux->push_filesize - pack_size <= demux->push_resume_offset) {
+        GST_DEBUG_OBJECT (demux, "No valid random index pack");
+        ret = gst_mxf_demux_push_finish_footer (demux);
+        break;
+      }
+
+      demux->push_state = GST_MXF_DEMUX_PUSH_STATE_RIP;
+      if (!gst_mxf_demux_push_seek (demux, demux->push_filesize - pack_size))
+        ret = gst_mxf_demux_push_finish_footer (demux);
+      break;
+    }
+
     if (gst_adapter_available (demux->adapter) < 16)
       break;
 
@@ -2907,6 +3736,13 @@ gst_mxf_demux_chain (GstPad * pad, GstBuffer * inbuf)
 
     memcpy (&key, data, 16);
 
+    if (G_UNLIKELY (!gst_mxf_demux_push_footer_accept (demux, &key))) {
+      GST_DEBUG_OBJECT (demux, "Unexpected KLV packet at offset %"
+          G_GUINT64_FORMAT " while reading the end of the file", demux->offset);
+      ret = gst_mxf_demux_push_finish_footer (demux);
+      break;
+    }
+
     /* Decode BER encoded packet length */
     if ((data[16] & 0x80) == 0) {
       length = data[16];
@@ -2960,6 +3796,31 @@ gst_mxf_demux_chain (GstPad * pad, GstBuffer * inbuf)
     }
 
     demux->offset += offset + length;
+
+    if (G_UNLIKELY (demux->push_state != GST_MXF_DEMUX_PUSH_STATE_NONE
+            && demux->push_state != GST_MXF_DEMUX_PUSH_STATE_DONE)) {
+      gboolean seeked;
+
+      /* Errors at the end of the file are not fatal, the essence
+       * can still be played without it */
+      if (ret != GST_FLOW_OK) {
+        GST_WARNING_OBJECT (demux, "Failed handling the end of the file: %s",
+            gst_flow_get_name (ret));
+        ret = gst_mxf_demux_push_finish_footer (demux);
+        break;
+      }
+
+      ret = gst_mxf_demux_push_footer_next (demux, &key, &seeked);
+      if (seeked)
+        break;
+    } else if (G_UNLIKELY (ret == GST_FLOW_OK
+            && demux->push_state == GST_MXF_DEMUX_PUSH_STATE_NONE
+            && mxf_is_partition_pack (&key) && demux->current_partition
+            && demux->current_partition->partition.type ==
+            MXF_PARTITION_PACK_HEADER)) {
+      if (gst_mxf_demux_push_start_footer (demux))
+        break;
+    }
   }
 
   gst_object_unref (demux);
@@ -3621,6 +4482,15 @@ gst_mxf_demux_sink_event (GstPad * pad, GstEvent * event)
       GstMXFDemuxPad *p = NULL;
       guint i;
 
+      /* End of the file reached while reading the footer, continue with
+       * the essence */
+      if (demux->push_state != GST_MXF_DEMUX_PUSH_STATE_NONE
+          && demux->push_state != GST_MXF_DEMUX_PUSH_STATE_DONE) {
+        gst_event_unref (event);
+        ret = (gst_mxf_demux_push_finish_footer (demux) == GST_FLOW_OK);
+        goto out;
+      }
+
       for (i = 0; i < demux->essence_tracks->len; i++) {
         GstMXFDemuxEssenceTrack *t =
             &g_array_index (demux->essence_tracks, GstMXFDemuxEssenceTrack, i);
@@ -3683,6 +4553,17 @@ gst_mxf_demux_sink_event (GstPad * pad, GstEvent * event)
     case GST_EVENT_NEWSEGMENT:{
       guint i;
 
+      demux->seqnum = gst_event_get_seqnum (event);
+      gst_event_unref (event);
+      ret = TRUE;
+
+      /* Resuming the essence after reading the end of the file, the
+       * positions and the current partition are already set */
+      if (demux->push_resume) {
+        demux->push_resume = FALSE;
+        break;
+      }
+
       for (i = 0; i < demux->essence_tracks->len; i++) {
         GstMXFDemuxEssenceTrack *t =
             &g_array_index (demux->essence_tracks, GstMXFDemuxEssenceTrack,
@@ -3690,9 +4571,6 @@ gst_mxf_demux_sink_event (GstPad * pad, GstEvent * event)
         t->position = -1;
       }
       demux->current_partition = NULL;
-      demux->seqnum = gst_event_get_seqnum (event);
-      gst_event_unref (event);
-      ret = TRUE;
       break;
     }
     default:
@@ -3881,6 +4759,9 @@ gst_mxf_demux_set_property (GObject * object, guint prop_id,
     case PROP_MAX_DRIFT:
       demux->max_drift = g_value_get_uint64 (value);
       break;
+    case PROP_LAZY_DESCRIPTIVE_METADATA:
+      demux->lazy_descriptive_metadata = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -3900,11 +4781,17 @@ gst_mxf_demux_get_property (GObject * object, guint prop_id,
     case PROP_MAX_DRIFT:
       g_value_set_uint64 (value, demux->max_drift);
       break;
+    case PROP_LAZY_DESCRIPTIVE_METADATA:
+      g_value_set_boolean (value, demux->lazy_descriptive_metadata);
+      break;
     case PROP_STRUCTURE:{
       GstStructure *s;
 
-      g_static_rw_lock_reader_lock (&demux->metadata_lock);
-      if (demux->preface)
+      /* Parse the descriptive metadata that was skipped so far */
+      g_static_rw_lock_writer_lock (&demux->metadata_lock);
+      gst_mxf_demux_load_descriptive_metadata (demux);
+
+      if (demux->preface && demux->metadata_resolved)
         s = mxf_metadata_base_to_structure (MXF_METADATA_BASE (demux->preface));
       else
         s = NULL;
@@ -3914,7 +4801,7 @@ gst_mxf_demux_get_property (GObject * object, guint prop_id,
       if (s)
         gst_structure_free (s);
 
-      g_static_rw_lock_reader_unlock (&demux->metadata_lock);
+      g_static_rw_lock_writer_unlock (&demux->metadata_lock);
       break;
     }
     default:
@@ -3951,6 +4838,7 @@ gst_mxf_demux_finalize (GObject * object)
   demux->essence_tracks = NULL;
 
   g_hash_table_destroy (demux->metadata);
+  g_array_free (demux->descriptive_metadata, TRUE);
 
   g_static_rw_lock_free (&demux->metadata_lock);
 
@@ -3999,6 +4887,14 @@ gst_mxf_demux_class_init (GstMXFDemuxClass * klass)
           "Structural metadata of the MXF file",
           GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+      PROP_LAZY_DESCRIPTIVE_METADATA,
+      g_param_spec_boolean ("lazy-descriptive-metadata",
+          "Lazy descriptive metadata",
+          "Only parse descriptive metadata (e.g. DMS-1) when the structure "
+          "property is read", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_mxf_demux_change_state);
   gstelement_class->query = GST_DEBUG_FUNCPTR (gst_mxf_demux_query);
@@ -4031,6 +4927,8 @@ gst_mxf_demux_init (GstMXFDemux * demux, GstMXFDemuxClass * g_class)
   g_static_rw_lock_init (&demux->metadata_lock);
 
   demux->src = g_ptr_array_new ();
+  demux->descriptive_metadata =
+      g_array_new (FALSE, FALSE, sizeof (GstMXFDemuxDescriptiveMetadata));
   demux->essence_tracks =
       g_array_new (FALSE, FALSE, sizeof (GstMXFDemuxEssenceTrack));
 
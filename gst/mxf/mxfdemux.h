@@ -47,6 +47,16 @@ typedef struct _GstMXFDemuxClass GstMXFDemuxClass;
 typedef struct _GstMXFDemuxPad GstMXFDemuxPad;
 typedef struct _GstMXFDemuxPadClass GstMXFDemuxPadClass;
 
+/* Fetching of the random index pack and footer partition in push mode */
+typedef enum
+{
+  GST_MXF_DEMUX_PUSH_STATE_NONE = 0,
+  GST_MXF_DEMUX_PUSH_STATE_RIP_SIZE,
+  GST_MXF_DEMUX_PUSH_STATE_RIP,
+  GST_MXF_DEMUX_PUSH_STATE_FOOTER,
+  GST_MXF_DEMUX_PUSH_STATE_DONE
+} GstMXFDemuxPushState;
+
 typedef struct
 {
   MXFPartitionPack partition;
@@ -61,6 +71,25 @@ typedef struct
   gboolean keyframe;
 } GstMXFDemuxIndex;
 
+/* Descriptive metadata set that is not parsed yet */
+typedef struct
+{
+  guint8 scheme;
+  guint32 type;
+  guint64 offset;
+  GstMXFDemuxPartition *partition;
+  GstBuffer *buffer;
+} GstMXFDemuxDescriptiveMetadata;
+
+typedef struct
+{
+  guint32 body_sid;
+  guint32 index_sid;
+
+  /* Array of MXFIndexTableSegment, sorted by start position */
+  GArray *segments;
+} GstMXFDemuxIndexTable;
+
 typedef struct
 {
   guint32 body_sid;
@@ -139,6 +168,15 @@ struct _GstMXFDemux
   gboolean random_access;
   gboolean flushing;
 
+  /* Push mode */
+  GstMXFDemuxPushState push_state;
+  gint64 push_filesize;
+  guint64 push_resume_offset;
+  guint64 push_footer_end;
+  /* set while seeking back to the essence after reading the end of the
+   * file, the newsegment of that seek must keep the track positions */
+  gboolean push_resume;
+
   guint64 run_in;
 
   guint64 header_partition_pack_offset;
@@ -149,7 +187,8 @@ struct _GstMXFDemux
   GstMXFDemuxPartition *current_partition;
 
   GArray *essence_tracks;
-  GList *pending_index_table_segments;
+  GList *index_tables;
+  gboolean pulled_index_tables;
 
   GArray *random_index_pack;
 
@@ -161,6 +200,7 @@ struct _GstMXFDemux
   gboolean metadata_resolved;
   MXFMetadataPreface *preface;
   GHashTable *metadata;
+  GArray *descriptive_metadata;
 
   MXFUMID current_package_uid;
   MXFMetadataGenericPackage *current_package;
@@ -169,6 +209,7 @@ struct _GstMXFDemux
   /* Properties */
   gchar *requested_package_string;
   GstClockTime max_drift;
+  gboolean lazy_descriptive_metadata;
 };
 
 struct _GstMXFDemuxClass
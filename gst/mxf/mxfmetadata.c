@@ -3692,6 +3692,8 @@ mxf_metadata_dm_segment_resolve (MXFMetadataBase * m, GHashTable * metadata)
   MXFMetadataDMSegment *self = MXF_METADATA_DM_SEGMENT (m);
   MXFMetadataBase *current = NULL;
 
+  self->dm_framework = NULL;
+
   current = g_hash_table_lookup (metadata, &self->dm_framework_uid);
   if (current && MXF_IS_DESCRIPTIVE_METADATA_FRAMEWORK (current)) {
     if (mxf_metadata_base_resolve (current, metadata)) {
@@ -3700,9 +3702,13 @@ mxf_metadata_dm_segment_resolve (MXFMetadataBase * m, GHashTable * metadata)
       GST_ERROR ("Couldn't resolve DM framework");
       return FALSE;
     }
-  } else {
-    GST_ERROR ("Couldn't find DM framework");
+  } else if (current) {
+    GST_ERROR ("DM framework has invalid type");
     return FALSE;
+  } else {
+    /* Unsupported scheme or not loaded yet, the segment itself is
+     * still valid */
+    GST_DEBUG ("DM framework not found");
   }
 
 
@@ -54,9 +54,18 @@ static GstStaticPadTemplate src_templ = GST_STATIC_PAD_TEMPLATE ("src",
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_PARTITION_INTERVAL
 };
 
+#define DEFAULT_PARTITION_INTERVAL 0
+
+#define MXF_MUX_INDEX_SID 2
+#define MXF_MUX_BODY_SID 1
+
+/* Index entries of 11 bytes have to fit the 16 bit local tag length */
+#define MXF_MUX_MAX_INDEX_ENTRIES ((G_MAXUINT16 - 8) / 11)
+
 GST_BOILERPLATE (GstMXFMux, gst_mxf_mux, GstElement, GST_TYPE_ELEMENT);
 
 static void gst_mxf_mux_finalize (GObject * object);
@@ -76,6 +85,7 @@ static void gst_mxf_mux_release_pad (GstElement * element, GstPad * pad);
 static GstStateChangeReturn
 gst_mxf_mux_change_state (GstElement * element, GstStateChange transition);
 
+static GstFlowReturn gst_mxf_mux_write_body_partition (GstMXFMux * mux);
 static void gst_mxf_mux_reset (GstMXFMux * mux);
 
 static GstFlowReturn
@@ -132,6 +142,14 @@ gst_mxf_mux_class_init (GstMXFMuxClass * klass)
   gstelement_class->request_new_pad =
       GST_DEBUG_FUNCPTR (gst_mxf_mux_request_new_pad);
   gstelement_class->release_pad = GST_DEBUG_FUNCPTR (gst_mxf_mux_release_pad);
+
+  g_object_class_install_property (gobject_class, PROP_PARTITION_INTERVAL,
+      g_param_spec_uint ("partition-interval", "Partition interval",
+          "Number of edit units after which a new body partition with the "
+          "index table of the previous ones is started (0 = only write the "
+          "index table in the footer partition)", 0, G_MAXUINT,
+          DEFAULT_PARTITION_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -150,6 +168,12 @@ gst_mxf_mux_init (GstMXFMux * mux, GstMXFMuxClass * g_class)
   gst_collect_pads_set_function (mux->collect,
       (GstCollectPadsFunction) GST_DEBUG_FUNCPTR (gst_mxf_mux_collected), mux);
 
+  mux->index_entries = g_array_new (FALSE, FALSE, sizeof (MXFIndexEntry));
+  mux->delta_entries = g_array_new (FALSE, FALSE, sizeof (MXFDeltaEntry));
+  mux->partitions =
+      g_array_new (FALSE, FALSE, sizeof (MXFRandomIndexPackEntry));
+  mux->partition_interval = DEFAULT_PARTITION_INTERVAL;
+
   gst_mxf_mux_reset (mux);
 }
 
@@ -160,6 +184,10 @@ gst_mxf_mux_finalize (GObject * object)
 
   gst_mxf_mux_reset (mux);
 
+  g_array_free (mux->index_entries, TRUE);
+  g_array_free (mux->delta_entries, TRUE);
+  g_array_free (mux->partitions, TRUE);
+
   if (mux->metadata) {
     g_hash_table_destroy (mux->metadata);
     mux->metadata = NULL;
@@ -176,9 +204,12 @@ static void
 gst_mxf_mux_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec)
 {
-  //GstMXFMux *mux = GST_MXF_MUX (object);
+  GstMXFMux *mux = GST_MXF_MUX (object);
 
   switch (prop_id) {
+    case PROP_PARTITION_INTERVAL:
+      mux->partition_interval = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -189,9 +220,12 @@ static void
 gst_mxf_mux_get_property (GObject * object,
     guint prop_id, GValue * value, GParamSpec * pspec)
 {
-  //GstMXFMux *mux = GST_MXF_MUX (object);
+  GstMXFMux *mux = GST_MXF_MUX (object);
 
   switch (prop_id) {
+    case PROP_PARTITION_INTERVAL:
+      g_value_set_uint (value, mux->partition_interval);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -229,6 +263,14 @@ gst_mxf_mux_reset (GstMXFMux * mux)
   mux->last_gc_timestamp = 0;
   mux->last_gc_position = 0;
   mux->offset = 0;
+
+  g_array_set_size (mux->index_entries, 0);
+  g_array_set_size (mux->delta_entries, 0);
+  mux->essence_offset = 0;
+  mux->edit_unit_byte_count = 0;
+  mux->last_keyframe_position = -1;
+  mux->n_indexed = 0;
+  g_array_set_size (mux->partitions, 0);
 }
 
 static gboolean
@@ -937,8 +979,8 @@ gst_mxf_mux_create_metadata (GstMXFMux * mux)
 
     cstorage->essence_container_data[0]->linked_package =
         MXF_METADATA_SOURCE_PACKAGE (cstorage->packages[1]);
-    cstorage->essence_container_data[0]->index_sid = 0;
-    cstorage->essence_container_data[0]->body_sid = 1;
+    cstorage->essence_container_data[0]->index_sid = MXF_MUX_INDEX_SID;
+    cstorage->essence_container_data[0]->body_sid = MXF_MUX_BODY_SID;
   }
 
   /* Sort descriptors at the correct places */
@@ -1083,6 +1125,147 @@ gst_mxf_mux_write_header_metadata (GstMXFMux * mux)
   return ret;
 }
 
+static GstFlowReturn
+gst_mxf_mux_push_buffers (GstMXFMux * mux, GList * buffers)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GList *l;
+
+  for (l = buffers; l; l = l->next) {
+    GstBuffer *buf = l->data;
+
+    l->data = NULL;
+    if ((ret = gst_mxf_mux_push (mux, buf)) != GST_FLOW_OK) {
+      GST_ERROR_OBJECT (mux, "Failed pushing buffer: %s",
+          gst_flow_get_name (ret));
+      g_list_foreach (l, (GFunc) gst_mini_object_unref, NULL);
+      break;
+    }
+  }
+
+  g_list_free (buffers);
+
+  return ret;
+}
+
+static void
+gst_mxf_mux_update_edit_unit_byte_count (GstMXFMux * mux, guint64 size)
+{
+  if (size == 0)
+    mux->edit_unit_byte_count = G_MAXUINT64;
+  else if (mux->edit_unit_byte_count == 0)
+    mux->edit_unit_byte_count = size;
+  else if (mux->edit_unit_byte_count != size)
+    mux->edit_unit_byte_count = G_MAXUINT64;
+}
+
+/* Add the essence element that is about to be written to the index entry
+ * of the current content package */
+static void
+gst_mxf_mux_add_index_entry (GstMXFMux * mux, GstMXFMuxPad * cpad,
+    gboolean keyframe)
+{
+  MXFIndexEntry *entry;
+  gint64 position = mux->last_gc_position;
+
+  /* First element of a new content package */
+  while (mux->index_entries->len <= position) {
+    MXFIndexEntry new_entry = { 0, };
+
+    if (mux->index_entries->len > 0) {
+      MXFIndexEntry *prev = &g_array_index (mux->index_entries, MXFIndexEntry,
+          mux->index_entries->len - 1);
+
+      gst_mxf_mux_update_edit_unit_byte_count (mux,
+          mux->essence_offset - prev->stream_offset);
+    }
+
+    new_entry.stream_offset = mux->essence_offset;
+    new_entry.flags = 0x80;
+    g_array_append_val (mux->index_entries, new_entry);
+  }
+
+  entry = &g_array_index (mux->index_entries, MXFIndexEntry, position);
+
+  /* Element offsets inside the content package, only used by CBE index
+   * tables where all content packages look the same */
+  if (position == 0) {
+    MXFDeltaEntry delta = { 0, };
+
+    delta.element_delta = mux->essence_offset - entry->stream_offset;
+    g_array_append_val (mux->delta_entries, delta);
+  }
+
+  if (mxf_metadata_track_identifier_parse (&cpad->writer->data_definition) ==
+      MXF_METADATA_TRACK_PICTURE_ESSENCE) {
+    if (keyframe) {
+      mux->last_keyframe_position = position;
+    } else {
+      entry->flags &= ~0x80;
+      /* CBE index tables can't flag non-keyframes */
+      mux->edit_unit_byte_count = G_MAXUINT64;
+    }
+  }
+
+  if (mux->last_keyframe_position != -1)
+    entry->key_frame_offset = MAX (mux->last_keyframe_position - position,
+        G_MININT8);
+}
+
+/* Create the index table segments for the edit units from @start to @end */
+static GList *
+gst_mxf_mux_create_index_table_segments (GstMXFMux * mux, guint64 start,
+    guint64 end, guint64 * size)
+{
+  MXFIndexTableSegment segment;
+  GList *buffers = NULL;
+  GstBuffer *buf;
+  gboolean cbe;
+
+  *size = 0;
+
+  if (start >= end)
+    return NULL;
+
+  /* Size of the last edit unit */
+  if (end == mux->index_entries->len)
+    gst_mxf_mux_update_edit_unit_byte_count (mux,
+        mux->essence_offset - g_array_index (mux->index_entries, MXFIndexEntry,
+            end - 1).stream_offset);
+
+  cbe = mux->edit_unit_byte_count != 0
+      && mux->edit_unit_byte_count <= G_MAXUINT32;
+
+  while (start < end) {
+    memset (&segment, 0, sizeof (MXFIndexTableSegment));
+    mxf_uuid_init (&segment.instance_id, NULL);
+    memcpy (&segment.index_edit_rate, &mux->min_edit_rate,
+        sizeof (MXFFraction));
+    segment.index_start_position = start;
+    segment.index_sid = MXF_MUX_INDEX_SID;
+    segment.body_sid = MXF_MUX_BODY_SID;
+
+    if (cbe) {
+      segment.index_duration = end - start;
+      segment.edit_unit_byte_count = mux->edit_unit_byte_count;
+      segment.n_delta_entries = mux->delta_entries->len;
+      segment.delta_entries = (MXFDeltaEntry *) mux->delta_entries->data;
+    } else {
+      segment.index_duration = MIN (end - start, MXF_MUX_MAX_INDEX_ENTRIES);
+      segment.n_index_entries = segment.index_duration;
+      segment.index_entries =
+          &g_array_index (mux->index_entries, MXFIndexEntry, start);
+    }
+    start += segment.index_duration;
+
+    buf = mxf_index_table_segment_to_buffer (&segment);
+    *size += GST_BUFFER_SIZE (buf);
+    buffers = g_list_prepend (buffers, buf);
+  }
+
+  return g_list_reverse (buffers);
+}
+
 static const guint8 _gc_essence_element_ul[] = {
   0x06, 0x0e, 0x2b, 0x34, 0x01, 0x02, 0x01, 0x00,
   0x0d, 0x01, 0x03, 0x01, 0x00, 0x00, 0x00, 0x00
@@ -1099,6 +1282,7 @@ gst_mxf_mux_handle_buffer (GstMXFMux * mux, GstMXFMuxPad * cpad)
   gboolean flush =
       (cpad->collect.abidata.ABI.eos && !cpad->have_complete_edit_unit
       && cpad->collect.buffer == NULL);
+  gboolean keyframe = TRUE;
 
   if (cpad->have_complete_edit_unit) {
     GST_DEBUG_OBJECT (cpad->collect.pad,
@@ -1113,6 +1297,7 @@ gst_mxf_mux_handle_buffer (GstMXFMux * mux, GstMXFMuxPad * cpad)
     GST_DEBUG_OBJECT (cpad->collect.pad,
         "Handling buffer of size %u for track %u at position %" G_GINT64_FORMAT,
         GST_BUFFER_SIZE (buf), cpad->source_track->parent.track_id, cpad->pos);
+    keyframe = !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
   } else {
     flush = TRUE;
     GST_DEBUG_OBJECT (cpad->collect.pad,
@@ -1151,6 +1336,20 @@ gst_mxf_mux_handle_buffer (GstMXFMux * mux, GstMXFMuxPad * cpad)
       GST_BUFFER_SIZE (buf));
   gst_buffer_unref (buf);
 
+  /* Start a new body partition at the beginning of a content package */
+  if (mux->partition_interval != 0
+      && mux->index_entries->len <= mux->last_gc_position
+      && mux->last_gc_position >= mux->n_indexed + mux->partition_interval) {
+    if ((ret = gst_mxf_mux_write_body_partition (mux)) != GST_FLOW_OK) {
+      GST_ERROR_OBJECT (mux, "Failed writing body partition");
+      gst_buffer_unref (packet);
+      return ret;
+    }
+  }
+
+  gst_mxf_mux_add_index_entry (mux, cpad, keyframe);
+  mux->essence_offset += GST_BUFFER_SIZE (packet);
+
   GST_DEBUG_OBJECT (cpad->collect.pad, "Pushing buffer of size %u for track %u",
       GST_BUFFER_SIZE (packet), cpad->source_track->parent.track_id);
 
@@ -1169,24 +1368,44 @@ gst_mxf_mux_handle_buffer (GstMXFMux * mux, GstMXFMuxPad * cpad)
   return ret;
 }
 
+/* Start a new body partition, containing the index table segments for the
+ * edit units of the previous body partitions that were not indexed yet */
 static GstFlowReturn
 gst_mxf_mux_write_body_partition (GstMXFMux * mux)
 {
   GstBuffer *buf;
+  GList *index;
+  guint64 index_byte_count;
+  MXFRandomIndexPackEntry entry;
+  GstFlowReturn ret;
+
+  index = gst_mxf_mux_create_index_table_segments (mux, mux->n_indexed,
+      mux->index_entries->len, &index_byte_count);
+  mux->n_indexed = mux->index_entries->len;
 
   mux->partition.type = MXF_PARTITION_PACK_BODY;
+  mux->partition.prev_partition = mux->partition.this_partition;
   mux->partition.this_partition = mux->offset;
-  mux->partition.prev_partition = 0;
   mux->partition.footer_partition = 0;
   mux->partition.header_byte_count = 0;
-  mux->partition.index_byte_count = 0;
-  mux->partition.index_sid = 0;
-  mux->partition.body_offset = 0;
+  mux->partition.index_byte_count = index_byte_count;
+  mux->partition.index_sid = (index_byte_count != 0) ? MXF_MUX_INDEX_SID : 0;
+  mux->partition.body_offset = mux->essence_offset;
   mux->partition.body_sid =
       mux->preface->content_storage->essence_container_data[0]->body_sid;
 
+  entry.offset = mux->partition.this_partition;
+  entry.body_sid = mux->partition.body_sid;
+  g_array_append_val (mux->partitions, entry);
+
   buf = mxf_partition_pack_to_buffer (&mux->partition);
-  return gst_mxf_mux_push (mux, buf);
+  if ((ret = gst_mxf_mux_push (mux, buf)) != GST_FLOW_OK) {
+    g_list_foreach (index, (GFunc) gst_mini_object_unref, NULL);
+    g_list_free (index);
+    return ret;
+  }
+
+  return gst_mxf_mux_push_buffers (mux, index);
 }
 
 static GstFlowReturn
@@ -1282,12 +1501,19 @@ gst_mxf_mux_handle_eos (GstMXFMux * mux)
 
   {
     guint64 body_partition = mux->partition.this_partition;
-    guint32 body_sid = mux->partition.body_sid;
     guint64 footer_partition = mux->offset;
     GArray *rip;
+    GList *index;
+    guint64 index_byte_count;
     GstFlowReturn ret;
     MXFRandomIndexPackEntry entry;
 
+    /* The index table segments of the edit units not indexed in the body
+     * partitions yet */
+    index = gst_mxf_mux_create_index_table_segments (mux, mux->n_indexed,
+        mux->index_entries->len, &index_byte_count);
+    mux->n_indexed = mux->index_entries->len;
+
     mux->partition.type = MXF_PARTITION_PACK_FOOTER;
     mux->partition.closed = TRUE;
     mux->partition.complete = TRUE;
@@ -1295,20 +1521,25 @@ gst_mxf_mux_handle_eos (GstMXFMux * mux)
     mux->partition.prev_partition = body_partition;
     mux->partition.footer_partition = mux->offset;
     mux->partition.header_byte_count = 0;
-    mux->partition.index_byte_count = 0;
-    mux->partition.index_sid = 0;
+    mux->partition.index_byte_count = index_byte_count;
+    mux->partition.index_sid = (index_byte_count != 0) ? MXF_MUX_INDEX_SID : 0;
     mux->partition.body_offset = 0;
     mux->partition.body_sid = 0;
 
-    gst_mxf_mux_write_header_metadata (mux);
+    if ((ret = gst_mxf_mux_write_header_metadata (mux)) != GST_FLOW_OK) {
+      g_list_foreach (index, (GFunc) gst_mini_object_unref, NULL);
+      g_list_free (index);
+      return ret;
+    }
+    if ((ret = gst_mxf_mux_push_buffers (mux, index)) != GST_FLOW_OK)
+      return ret;
 
-    rip = g_array_sized_new (FALSE, FALSE, sizeof (MXFRandomIndexPackEntry), 3);
+    rip = g_array_sized_new (FALSE, FALSE, sizeof (MXFRandomIndexPackEntry),
+        mux->partitions->len + 2);
     entry.offset = 0;
     entry.body_sid = 0;
     g_array_append_val (rip, entry);
-    entry.offset = body_partition;
-    entry.body_sid = body_sid;
-    g_array_append_val (rip, entry);
+    g_array_append_vals (rip, mux->partitions->data, mux->partitions->len);
     entry.offset = footer_partition;
     entry.body_sid = 0;
     g_array_append_val (rip, entry);
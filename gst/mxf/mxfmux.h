@@ -92,7 +92,21 @@ typedef struct _GstMXFMux {
   guint64 last_gc_position;
   GstClockTime last_gc_timestamp;
 
+  /* Index, one MXFIndexEntry per content package */
+  GArray *index_entries;
+  GArray *delta_entries;
+  guint64 essence_offset;
+  guint64 edit_unit_byte_count; /* 0 if unknown, G_MAXUINT64 if variable */
+  gint64 last_keyframe_position;
+  guint64 n_indexed;
+
+  /* MXFRandomIndexPackEntry for all partitions written */
+  GArray *partitions;
+
   gchar *application;
+
+  /* Properties */
+  guint partition_interval;
 } GstMXFMux;
 
 typedef struct _GstMXFMuxClass {
@@ -583,6 +583,7 @@ atom_stsz_init (AtomSTSZ * stsz)
   atom_array_init (&stsz->entries, 1024);
   stsz->sample_size = 0;
   stsz->table_size = 0;
+  stsz->collapsed = FALSE;
 }
 
 static void
@@ -616,6 +617,7 @@ atom_co64_init (AtomSTCO64 * co64)
 
   atom_full_init (&co64->header, FOURCC_stco, 0, 0, 0, flags);
   atom_array_init (&co64->entries, 256);
+  co64->chunk_end = 0;
 }
 
 static void
@@ -1608,20 +1610,22 @@ atom_stts_copy_data (AtomSTTS * stts, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
 
   if (!atom_full_copy_data (&stts->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&stts->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
+  /* write the table in one go, or only account for it */
+  data = prop_copy_reserve (buffer, size, offset,
       8 * atom_array_get_len (&stts->entries));
-  for (i = 0; i < atom_array_get_len (&stts->entries); i++) {
+  for (i = 0; data && i < atom_array_get_len (&stts->entries); i++) {
     STTSEntry *entry = &atom_array_index (&stts->entries, i);
 
-    prop_copy_uint32 (entry->sample_count, buffer, size, offset);
-    prop_copy_int32 (entry->sample_delta, buffer, size, offset);
+    GST_WRITE_UINT32_BE (data, entry->sample_count);
+    GST_WRITE_UINT32_BE (data + 4, entry->sample_delta);
+    data += 8;
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -1792,6 +1796,7 @@ atom_stsz_copy_data (AtomSTSZ * stsz, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
 
   if (!atom_full_copy_data (&stsz->header, buffer, size, offset)) {
     return 0;
@@ -1800,13 +1805,12 @@ atom_stsz_copy_data (AtomSTSZ * stsz, guint8 ** buffer, guint64 * size,
   prop_copy_uint32 (stsz->sample_size, buffer, size, offset);
   prop_copy_uint32 (stsz->table_size, buffer, size, offset);
   if (stsz->sample_size == 0) {
-    /* minimize realloc */
-    prop_copy_ensure_buffer (buffer, size, offset, 4 * stsz->table_size);
     /* entry count must match sample count */
     g_assert (atom_array_get_len (&stsz->entries) == stsz->table_size);
-    for (i = 0; i < atom_array_get_len (&stsz->entries); i++) {
-      prop_copy_uint32 (atom_array_index (&stsz->entries, i), buffer, size,
-          offset);
+    data = prop_copy_reserve (buffer, size, offset, 4 * stsz->table_size);
+    for (i = 0; data && i < atom_array_get_len (&stsz->entries); i++) {
+      GST_WRITE_UINT32_BE (data, atom_array_index (&stsz->entries, i));
+      data += 4;
     }
   }
 
@@ -1820,22 +1824,22 @@ atom_stsc_copy_data (AtomSTSC * stsc, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
 
   if (!atom_full_copy_data (&stsc->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&stsc->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
+  data = prop_copy_reserve (buffer, size, offset,
       12 * atom_array_get_len (&stsc->entries));
-
-  for (i = 0; i < atom_array_get_len (&stsc->entries); i++) {
+  for (i = 0; data && i < atom_array_get_len (&stsc->entries); i++) {
     STSCEntry *entry = &atom_array_index (&stsc->entries, i);
 
-    prop_copy_uint32 (entry->first_chunk, buffer, size, offset);
-    prop_copy_uint32 (entry->samples_per_chunk, buffer, size, offset);
-    prop_copy_uint32 (entry->sample_description_index, buffer, size, offset);
+    GST_WRITE_UINT32_BE (data, entry->first_chunk);
+    GST_WRITE_UINT32_BE (data + 4, entry->samples_per_chunk);
+    GST_WRITE_UINT32_BE (data + 8, entry->sample_description_index);
+    data += 12;
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -1848,20 +1852,21 @@ atom_ctts_copy_data (AtomCTTS * ctts, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
 
   if (!atom_full_copy_data (&ctts->header, buffer, size, offset)) {
     return 0;
   }
 
   prop_copy_uint32 (atom_array_get_len (&ctts->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
+  data = prop_copy_reserve (buffer, size, offset,
       8 * atom_array_get_len (&ctts->entries));
-  for (i = 0; i < atom_array_get_len (&ctts->entries); i++) {
+  for (i = 0; data && i < atom_array_get_len (&ctts->entries); i++) {
     CTTSEntry *entry = &atom_array_index (&ctts->entries, i);
 
-    prop_copy_uint32 (entry->samplecount, buffer, size, offset);
-    prop_copy_uint32 (entry->sampleoffset, buffer, size, offset);
+    GST_WRITE_UINT32_BE (data, entry->samplecount);
+    GST_WRITE_UINT32_BE (data + 4, entry->sampleoffset);
+    data += 8;
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -1874,6 +1879,7 @@ atom_stco64_copy_data (AtomSTCO64 * stco64, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
   gboolean trunc_to_32 = stco64->header.header.type == FOURCC_stco;
 
   if (!atom_full_copy_data (&stco64->header, buffer, size, offset)) {
@@ -1883,16 +1889,17 @@ atom_stco64_copy_data (AtomSTCO64 * stco64, guint8 ** buffer, guint64 * size,
   prop_copy_uint32 (atom_array_get_len (&stco64->entries), buffer, size,
       offset);
 
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
-      8 * atom_array_get_len (&stco64->entries));
-  for (i = 0; i < atom_array_get_len (&stco64->entries); i++) {
+  data = prop_copy_reserve (buffer, size, offset,
+      (trunc_to_32 ? 4 : 8) * atom_array_get_len (&stco64->entries));
+  for (i = 0; data && i < atom_array_get_len (&stco64->entries); i++) {
     guint64 *value = &atom_array_index (&stco64->entries, i);
 
     if (trunc_to_32) {
-      prop_copy_uint32 ((guint32) * value, buffer, size, offset);
+      GST_WRITE_UINT32_BE (data, (guint32) * value);
+      data += 4;
     } else {
-      prop_copy_uint64 (*value, buffer, size, offset);
+      GST_WRITE_UINT64_BE (data, *value);
+      data += 8;
     }
   }
 
@@ -1906,6 +1913,7 @@ atom_stss_copy_data (AtomSTSS * stss, guint8 ** buffer, guint64 * size,
 {
   guint64 original_offset = *offset;
   guint i;
+  guint8 *data;
 
   if (atom_array_get_len (&stss->entries) == 0) {
     /* FIXME not needing this atom might be confused with error while copying */
@@ -1917,12 +1925,11 @@ atom_stss_copy_data (AtomSTSS * stss, guint8 ** buffer, guint64 * size,
   }
 
   prop_copy_uint32 (atom_array_get_len (&stss->entries), buffer, size, offset);
-  /* minimize realloc */
-  prop_copy_ensure_buffer (buffer, size, offset,
+  data = prop_copy_reserve (buffer, size, offset,
       4 * atom_array_get_len (&stss->entries));
-  for (i = 0; i < atom_array_get_len (&stss->entries); i++) {
-    prop_copy_uint32 (atom_array_index (&stss->entries, i), buffer, size,
-        offset);
+  for (i = 0; data && i < atom_array_get_len (&stss->entries); i++) {
+    GST_WRITE_UINT32_BE (data, atom_array_index (&stss->entries, i));
+    data += 4;
   }
 
   atom_write_size (buffer, size, offset, original_offset);
@@ -2459,6 +2466,28 @@ atom_wave_copy_data (AtomWAVE * wave, guint8 ** buffer,
 
 /* add samples to tables */
 
+/* adds samples to the last chunk, @last_chunk */
+static void
+atom_stsc_extend_last_chunk (AtomSTSC * stsc, guint32 last_chunk,
+    guint32 nsamples)
+{
+  STSCEntry *entry;
+  STSCEntry nentry;
+
+  entry = &atom_array_index (&stsc->entries,
+      atom_array_get_len (&stsc->entries) - 1);
+  if (entry->first_chunk == last_chunk) {
+    entry->samples_per_chunk += nsamples;
+    return;
+  }
+
+  /* split off the last chunk from the run of chunks it belongs to */
+  nentry.first_chunk = last_chunk;
+  nentry.samples_per_chunk = entry->samples_per_chunk + nsamples;
+  nentry.sample_description_index = entry->sample_description_index;
+  atom_array_append (&stsc->entries, nentry, 128);
+}
+
 static void
 atom_stsc_add_new_entry (AtomSTSC * stsc, guint32 first_chunk, guint32 nsamples)
 {
@@ -2501,6 +2530,20 @@ atom_stsz_add_entry (AtomSTSZ * stsz, guint32 nsamples, guint32 size)
 {
   guint32 i;
 
+  /* as long as all samples have the same size, only that size is kept */
+  if (stsz->table_size == 0 && stsz->sample_size == 0) {
+    stsz->sample_size = size;
+    stsz->collapsed = TRUE;
+  }
+  if (G_UNLIKELY (stsz->collapsed && stsz->sample_size != size)) {
+    /* not constant after all, expand the samples so far */
+    for (i = 0; i < stsz->table_size; i++) {
+      atom_array_append (&stsz->entries, stsz->sample_size, 1024);
+    }
+    stsz->sample_size = 0;
+    stsz->collapsed = FALSE;
+  }
+
   stsz->table_size += nsamples;
   if (stsz->sample_size != 0) {
     /* it is constant size, we don't need entries */
@@ -2576,9 +2619,17 @@ atom_stbl_add_samples (AtomSTBL * stbl, guint32 nsamples, guint32 delta,
 {
   atom_stts_add_entry (&stbl->stts, nsamples, delta);
   atom_stsz_add_entry (&stbl->stsz, nsamples, size);
-  atom_stco64_add_entry (&stbl->stco64, chunk_offset);
-  atom_stsc_add_new_entry (&stbl->stsc,
-      atom_stco64_get_entry_count (&stbl->stco64), nsamples);
+  /* samples directly following the last chunk go into that chunk */
+  if (atom_stco64_get_entry_count (&stbl->stco64) != 0 &&
+      chunk_offset == stbl->stco64.chunk_end) {
+    atom_stsc_extend_last_chunk (&stbl->stsc,
+        atom_stco64_get_entry_count (&stbl->stco64), nsamples);
+  } else {
+    atom_stco64_add_entry (&stbl->stco64, chunk_offset);
+    atom_stsc_add_new_entry (&stbl->stsc,
+        atom_stco64_get_entry_count (&stbl->stco64), nsamples);
+  }
+  stbl->stco64.chunk_end = chunk_offset + (guint64) size * nsamples;
   if (sync)
     atom_stbl_add_stss_entry (stbl);
   /* always store to arrange for consistent content */
@@ -2727,6 +2778,7 @@ atom_stco64_chunks_add_offset (AtomSTCO64 * stco64, guint32 offset)
 
     *value += offset;
   }
+  stco64->chunk_end += offset;
 }
 
 void
@@ -3118,6 +3170,7 @@ static void
 atom_trak_set_constant_size_samples (AtomTRAK * trak, guint32 sample_size)
 {
   trak->mdia.minf.stbl.stsz.sample_size = sample_size;
+  trak->mdia.minf.stbl.stsz.collapsed = FALSE;
 }
 
 static void
@@ -3921,6 +3974,86 @@ atom_mfra_copy_data (AtomMFRA * mfra, guint8 ** buffer, guint64 * size,
   return *offset - original_offset;
 }
 
+AtomSIDX *
+atom_sidx_new (AtomsContext * context, guint32 reference_ID, guint32 timescale)
+{
+  AtomSIDX *sidx = g_new0 (AtomSIDX, 1);
+  guint8 flags[3] = { 0, 0, 0 };
+
+  atom_full_init (&sidx->header, FOURCC_sidx, 0, 0, 0, flags);
+  sidx->reference_ID = reference_ID;
+  sidx->timescale = timescale;
+  atom_array_init (&sidx->entries, 128);
+
+  return sidx;
+}
+
+void
+atom_sidx_free (AtomSIDX * sidx)
+{
+  atom_full_clear (&sidx->header);
+  atom_array_clear (&sidx->entries);
+  g_free (sidx);
+}
+
+void
+atom_sidx_add_entry (AtomSIDX * sidx, guint32 size, guint32 duration,
+    gboolean starts_with_sap)
+{
+  SIDXEntry entry;
+
+  entry.size = size;
+  entry.duration = duration;
+  entry.starts_with_sap = starts_with_sap;
+
+  atom_array_append (&sidx->entries, entry, 128);
+}
+
+guint64
+atom_sidx_copy_data (AtomSIDX * sidx, guint8 ** buffer, guint64 * size,
+    guint64 * offset)
+{
+  guint64 original_offset = *offset;
+  guint32 i;
+  SIDXEntry *entry;
+
+  /* auto-use 64 bits if needed */
+  if (sidx->earliest_presentation_time > G_MAXUINT32 ||
+      sidx->first_offset > G_MAXUINT32)
+    sidx->header.version = 1;
+
+  if (!atom_full_copy_data (&sidx->header, buffer, size, offset)) {
+    return 0;
+  }
+
+  prop_copy_uint32 (sidx->reference_ID, buffer, size, offset);
+  prop_copy_uint32 (sidx->timescale, buffer, size, offset);
+  if (sidx->header.version) {
+    prop_copy_uint64 (sidx->earliest_presentation_time, buffer, size, offset);
+    prop_copy_uint64 (sidx->first_offset, buffer, size, offset);
+  } else {
+    prop_copy_uint32 (sidx->earliest_presentation_time, buffer, size, offset);
+    prop_copy_uint32 (sidx->first_offset, buffer, size, offset);
+  }
+  /* reserved */
+  prop_copy_uint16 (0, buffer, size, offset);
+  prop_copy_uint16 (atom_array_get_len (&sidx->entries), buffer, size, offset);
+
+  for (i = 0; i < atom_array_get_len (&sidx->entries); i++) {
+    entry = &atom_array_index (&sidx->entries, i);
+
+    /* reference_type 0, i.e. media */
+    prop_copy_uint32 (entry->size & 0x7fffffff, buffer, size, offset);
+    prop_copy_uint32 (entry->duration, buffer, size, offset);
+    /* SAP type 1, delta time 0 */
+    prop_copy_uint32 (entry->starts_with_sap ? 0x90000000 : 0, buffer, size,
+        offset);
+  }
+
+  atom_write_size (buffer, size, offset, original_offset);
+  return *offset - original_offset;
+}
+
 /* some sample description construction helpers */
 
 AtomInfo *
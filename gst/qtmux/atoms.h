@@ -439,6 +439,10 @@ typedef struct _AtomSTSZ
    * the list is empty */
   guint32 table_size;
   ATOM_ARRAY (guint32) entries;
+
+  /* sample_size was not configured but all samples so far had that size,
+   * entries are only filled in once a sample of another size comes */
+  gboolean collapsed;
 } AtomSTSZ;
 
 typedef struct _STSCEntry
@@ -465,6 +469,9 @@ typedef struct _AtomSTCO64
   AtomFull header;
 
   ATOM_ARRAY (guint64) entries;
+
+  /* where the last chunk ends, samples starting there are added to it */
+  guint64 chunk_end;
 } AtomSTCO64;
 
 typedef struct _CTTSEntry
@@ -771,6 +778,25 @@ typedef struct _AtomMFRA
   GList *tfras;
 } AtomMFRA;
 
+typedef struct _SIDXEntry
+{
+  guint32 size;
+  guint32 duration;
+  gboolean starts_with_sap;
+} SIDXEntry;
+
+typedef struct _AtomSIDX
+{
+  AtomFull header;
+
+  guint32 reference_ID;
+  guint32 timescale;
+  guint64 earliest_presentation_time;
+  guint64 first_offset;
+  /* array of entries, one per fragment */
+  ATOM_ARRAY (SIDXEntry) entries;
+} AtomSIDX;
+
 /*
  * Function to serialize an atom
  */
@@ -864,6 +890,13 @@ void       atom_tfra_update_offset     (AtomTFRA * tfra, guint64 offset);
 void       atom_mfra_add_tfra          (AtomMFRA *mfra, AtomTFRA *tfra);
 guint64    atom_mfra_copy_data         (AtomMFRA *mfra, guint8 **buffer, guint64 *size, guint64* offset);
 
+AtomSIDX*  atom_sidx_new               (AtomsContext *context, guint32 reference_ID,
+                                        guint32 timescale);
+void       atom_sidx_free              (AtomSIDX *sidx);
+void       atom_sidx_add_entry         (AtomSIDX *sidx, guint32 size, guint32 duration,
+                                        gboolean starts_with_sap);
+guint64    atom_sidx_copy_data         (AtomSIDX *sidx, guint8 **buffer, guint64 *size, guint64* offset);
+
 
 /* media sample description related helpers */
 
@@ -65,9 +65,9 @@
  * 6) number of traks
  * 7) list of trak atoms (stbl data is ignored, except for the stsd atom)
  * 8) Buffers metadata (metadata that is relevant to the container)
- *    Buffers metadata are stored in the order they are added to the mdat,
- *    each entre has a fixed size and is stored in BE. booleans are stored
- *    as a single byte where 0 means false, otherwise is true.
+ *    Buffers metadata are stored in the order they are added to the mdat.
+ *    In version 1 each entry has a fixed size and is stored in BE. booleans
+ *    are stored as a single byte where 0 means false, otherwise is true.
  *   Metadata:
  *   - guint32   track_id;
  *   - guint32   nsamples;
@@ -78,6 +78,17 @@
  *   - gboolean  do_pts;
  *   - guint64   pts_offset; (always present, ignored if do_pts is false)
  *
+ *    Since version 2 the entries are variable sized, starting with a flags
+ *    byte (see ENTRY_FLAG_*), followed by the fields as LEB128 varints
+ *    (7 bits per byte, least significant first):
+ *   - track_id;
+ *   - nsamples; (only if ENTRY_FLAG_NSAMPLES is set, 1 otherwise)
+ *   - delta;
+ *   - size;
+ *   - chunk_offset; (only if ENTRY_FLAG_CHUNK_OFFSET is set, otherwise
+ *     the entry directly follows the data of the previous one)
+ *   - pts_offset; (only if ENTRY_FLAG_PTS_OFFSET is set, 0 otherwise)
+ *
  * The mdat file might contain ftyp and then mdat, in case this is the faststart
  * temporary file there is no ftyp and no mdat header, only the buffers data.
  *
@@ -88,6 +99,19 @@
 
 #include "atomsrecovery.h"
 
+#ifdef G_OS_WIN32
+#include <io.h>                 /* _commit */
+#else
+#include <unistd.h>             /* fsync */
+#endif
+
+/* flags of a version 2 buffer entry */
+#define ENTRY_FLAG_SYNC           (1 << 0)
+#define ENTRY_FLAG_DO_PTS         (1 << 1)
+#define ENTRY_FLAG_NSAMPLES       (1 << 2)
+#define ENTRY_FLAG_CHUNK_OFFSET   (1 << 3)
+#define ENTRY_FLAG_PTS_OFFSET     (1 << 4)
+
 #define ATOMS_RECOV_OUTPUT_WRITE_ERROR(err) \
     g_set_error (err, ATOMS_RECOV_QUARK, ATOMS_RECOV_ERR_FILE, \
         "Failed to write to output file: %s", g_strerror (errno))
@@ -193,34 +217,96 @@ atoms_recov_write_trak_info (FILE * f, AtomTRAK * trak)
   return atom_size > 0 && writen == atom_size;
 }
 
-gboolean
-atoms_recov_write_trak_samples (FILE * f, AtomTRAK * trak, guint32 nsamples,
-    guint32 delta, guint32 size, guint64 chunk_offset, gboolean sync,
-    gboolean do_pts, gint64 pts_offset)
+AtomsRecovJournal *
+atoms_recov_journal_new (void)
 {
-  guint8 data[TRAK_BUFFER_ENTRY_INFO_SIZE];
-  /*
-   * We have to write a TrakBufferEntryInfo
-   */
-  GST_WRITE_UINT32_BE (data + 0, trak->tkhd.track_ID);
-  GST_WRITE_UINT32_BE (data + 4, nsamples);
-  GST_WRITE_UINT32_BE (data + 8, delta);
-  GST_WRITE_UINT32_BE (data + 12, size);
-  GST_WRITE_UINT64_BE (data + 16, chunk_offset);
+  AtomsRecovJournal *journal = g_new0 (AtomsRecovJournal, 1);
+
+  journal->data = g_byte_array_new ();
+  journal->chunk_end = 0;
+  return journal;
+}
+
+void
+atoms_recov_journal_free (AtomsRecovJournal * journal)
+{
+  g_byte_array_free (journal->data, TRUE);
+  g_free (journal);
+}
+
+static void
+atoms_recov_journal_put_varint (AtomsRecovJournal * journal, guint64 value)
+{
+  guint8 byte;
+
+  do {
+    byte = value & 0x7f;
+    value >>= 7;
+    if (value)
+      byte |= 0x80;
+    g_byte_array_append (journal->data, &byte, 1);
+  } while (value);
+}
+
+/*
+ * Adds a buffer entry to the journal, it is only written to the file
+ * with atoms_recov_journal_write()
+ */
+void
+atoms_recov_journal_add_trak_samples (AtomsRecovJournal * journal,
+    AtomTRAK * trak, guint32 nsamples, guint32 delta, guint32 size,
+    guint64 chunk_offset, gboolean sync, gboolean do_pts, gint64 pts_offset)
+{
+  guint8 flags = 0;
+
   if (sync)
-    GST_WRITE_UINT8 (data + 24, 1);
-  else
-    GST_WRITE_UINT8 (data + 24, 0);
-  if (do_pts) {
-    GST_WRITE_UINT8 (data + 25, 1);
-    GST_WRITE_UINT64_BE (data + 26, pts_offset);
-  } else {
-    GST_WRITE_UINT8 (data + 25, 0);
-    GST_WRITE_UINT64_BE (data + 26, 0);
-  }
+    flags |= ENTRY_FLAG_SYNC;
+  if (do_pts)
+    flags |= ENTRY_FLAG_DO_PTS;
+  if (nsamples != 1)
+    flags |= ENTRY_FLAG_NSAMPLES;
+  if (chunk_offset != journal->chunk_end)
+    flags |= ENTRY_FLAG_CHUNK_OFFSET;
+  if (do_pts && pts_offset != 0)
+    flags |= ENTRY_FLAG_PTS_OFFSET;
+
+  g_byte_array_append (journal->data, &flags, 1);
+  atoms_recov_journal_put_varint (journal, trak->tkhd.track_ID);
+  if (flags & ENTRY_FLAG_NSAMPLES)
+    atoms_recov_journal_put_varint (journal, nsamples);
+  atoms_recov_journal_put_varint (journal, delta);
+  atoms_recov_journal_put_varint (journal, size);
+  if (flags & ENTRY_FLAG_CHUNK_OFFSET)
+    atoms_recov_journal_put_varint (journal, chunk_offset);
+  if (flags & ENTRY_FLAG_PTS_OFFSET)
+    atoms_recov_journal_put_varint (journal, (guint64) pts_offset);
+
+  journal->chunk_end = chunk_offset + (guint64) nsamples * size;
+}
+
+/*
+ * Writes out the entries collected in the journal, and if @sync is TRUE
+ * makes sure they actually hit the disk
+ */
+gboolean
+atoms_recov_journal_write (AtomsRecovJournal * journal, FILE * f,
+    gboolean sync)
+{
+  guint len = journal->data->len;
+
+  if (len && fwrite (journal->data->data, 1, len, f) != len)
+    return FALSE;
+  g_byte_array_set_size (journal->data, 0);
 
-  return fwrite (data, 1, TRAK_BUFFER_ENTRY_INFO_SIZE, f) ==
-      TRAK_BUFFER_ENTRY_INFO_SIZE;
+  if (!sync)
+    return TRUE;
+  if (fflush (f) != 0)
+    return FALSE;
+#ifdef G_OS_WIN32
+  return _commit (fileno (f)) == 0;
+#else
+  return fsync (fileno (f)) == 0;
+#endif
 }
 
 gboolean
@@ -262,6 +348,20 @@ read_atom_header (FILE * f, guint32 * fourcc, guint32 * size)
   return TRUE;
 }
 
+static gboolean
+moov_recov_file_parse_version (MoovRecovFile * moovrf)
+{
+  guint8 data[2];
+
+  if (fseek (moovrf->file, 0, SEEK_SET) != 0)
+    return FALSE;
+  if (fread (data, 1, 2, moovrf->file) != 2)
+    return FALSE;
+  moovrf->version = GST_READ_UINT16_BE (data);
+
+  return moovrf->version >= 1 && moovrf->version <= ATOMS_RECOV_FILE_VERSION;
+}
+
 static gboolean
 moov_recov_file_parse_prefix (MoovRecovFile * moovrf)
 {
@@ -654,6 +754,14 @@ moov_recov_file_create (FILE * file, GError ** err)
 
   moovrf->file = file;
 
+  /* the buffer entries layout depends on the version */
+  if (!moov_recov_file_parse_version (moovrf)) {
+    g_set_error (err, ATOMS_RECOV_QUARK, ATOMS_RECOV_ERR_VERSION,
+        "Unsupported or unreadable moov recovery file version (%u)",
+        moovrf->version);
+    goto fail;
+  }
+
   /* look for ftyp and prefix at the start */
   if (!moov_recov_file_parse_prefix (moovrf)) {
     g_set_error (err, ATOMS_RECOV_QUARK, ATOMS_RECOV_ERR_PARSING,
@@ -713,12 +821,72 @@ moov_recov_file_free (MoovRecovFile * moovrf)
   g_free (moovrf);
 }
 
+static gboolean
+moov_recov_read_varint (MoovRecovFile * moovrf, guint64 * value)
+{
+  gint c;
+  guint shift = 0;
+
+  *value = 0;
+  do {
+    if (shift > 63 || (c = fgetc (moovrf->file)) == EOF)
+      return FALSE;
+    *value |= (guint64) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+
+  return TRUE;
+}
+
+static gboolean
+moov_recov_parse_buffer_entry_v2 (MoovRecovFile * moovrf,
+    TrakBufferEntryInfo * b)
+{
+  gint flags;
+  guint64 track_id, nsamples = 1, delta, size, pts_offset = 0;
+  guint64 chunk_offset = moovrf->chunk_end;
+
+  if ((flags = fgetc (moovrf->file)) == EOF)
+    return FALSE;
+
+  if (!moov_recov_read_varint (moovrf, &track_id))
+    return FALSE;
+  if ((flags & ENTRY_FLAG_NSAMPLES)
+      && !moov_recov_read_varint (moovrf, &nsamples))
+    return FALSE;
+  if (!moov_recov_read_varint (moovrf, &delta))
+    return FALSE;
+  if (!moov_recov_read_varint (moovrf, &size))
+    return FALSE;
+  if ((flags & ENTRY_FLAG_CHUNK_OFFSET)
+      && !moov_recov_read_varint (moovrf, &chunk_offset))
+    return FALSE;
+  if ((flags & ENTRY_FLAG_PTS_OFFSET)
+      && !moov_recov_read_varint (moovrf, &pts_offset))
+    return FALSE;
+
+  b->track_id = track_id;
+  b->nsamples = nsamples;
+  b->delta = delta;
+  b->size = size;
+  b->chunk_offset = chunk_offset;
+  b->sync = (flags & ENTRY_FLAG_SYNC) != 0;
+  b->do_pts = (flags & ENTRY_FLAG_DO_PTS) != 0;
+  b->pts_offset = pts_offset;
+
+  moovrf->chunk_end = chunk_offset + (guint64) b->nsamples * b->size;
+  return TRUE;
+}
+
 static gboolean
 moov_recov_parse_buffer_entry (MoovRecovFile * moovrf, TrakBufferEntryInfo * b)
 {
   guint8 data[TRAK_BUFFER_ENTRY_INFO_SIZE];
   gint read;
 
+  if (moovrf->version >= 2)
+    return moov_recov_parse_buffer_entry_v2 (moovrf, b);
+
   read = fread (data, 1, TRAK_BUFFER_ENTRY_INFO_SIZE, moovrf->file);
   if (read != TRAK_BUFFER_ENTRY_INFO_SIZE)
     return FALSE;
@@ -735,7 +903,7 @@ moov_recov_parse_buffer_entry (MoovRecovFile * moovrf, TrakBufferEntryInfo * b)
 }
 
 static gboolean
-mdat_recov_add_sample (MdatRecovFile * mdatrf, guint32 size)
+mdat_recov_add_sample (MdatRecovFile * mdatrf, guint64 size)
 {
   /* test if this data exists */
   if (mdatrf->mdat_size - mdatrf->mdat_header_size + size > mdatrf->data_size)
@@ -787,7 +955,8 @@ moov_recov_parse_buffers (MoovRecovFile * moovrf, MdatRecovFile * mdatrf,
           "Invalid trak id found in buffer entry");
       return FALSE;
     }
-    if (!mdat_recov_add_sample (mdatrf, entry.size))
+    /* constant size samples come as one entry of nsamples */
+    if (!mdat_recov_add_sample (mdatrf, (guint64) entry.nsamples * entry.size))
       break;
     trak_recov_data_add_sample (trak, &entry);
   }
@@ -908,7 +1077,7 @@ moov_recov_write_file (MoovRecovFile * moovrf, MdatRecovFile * mdatrf,
   }
 
   version = GST_READ_UINT16_BE (auxdata);
-  if (version != ATOMS_RECOV_FILE_VERSION) {
+  if (version < 1 || version > ATOMS_RECOV_FILE_VERSION) {
     g_set_error (err, ATOMS_RECOV_QUARK, ATOMS_RECOV_ERR_VERSION,
         "Input file version (%u) is not supported in this version (%u)",
         version, ATOMS_RECOV_FILE_VERSION);
@@ -52,7 +52,7 @@
 
 /* Version to be incremented each time we decide
  * to change the file layout */
-#define ATOMS_RECOV_FILE_VERSION          1
+#define ATOMS_RECOV_FILE_VERSION          2
 
 #define ATOMS_RECOV_QUARK (g_quark_from_string ("qtmux-atoms-recovery"))
 
@@ -64,8 +64,8 @@
 
 /* this struct represents each buffer in a moov file, containing the info
  * that is placed in the stsd children atoms
- * Fields should be writen in BE order, and booleans should be writen as
- * 1byte with 0 for false, anything otherwise */
+ * In version 1 files, fields should be writen in BE order, and booleans
+ * should be writen as 1byte with 0 for false, anything otherwise */
 #define TRAK_BUFFER_ENTRY_INFO_SIZE 34
 typedef struct
 {
@@ -120,9 +120,18 @@ typedef struct
   guint64   mdat_size;
 } MdatRecovFile;
 
+/* buffer entries not written to the moov recovery file yet */
+typedef struct
+{
+  GByteArray *data;
+  /* where the data of the last entry ends */
+  guint64 chunk_end;
+} AtomsRecovJournal;
+
 typedef struct
 {
   FILE * file;
+  guint16 version;
   guint32 timescale;
 
   guint32 mvhd_pos;
@@ -131,6 +140,9 @@ typedef struct
 
   gint num_traks;
   TrakRecovData *traks_rd;
+
+  /* where the data of the last parsed buffer entry ends */
+  guint64 chunk_end;
 } MoovRecovFile;
 
 gboolean atoms_recov_write_trak_info      (FILE * f, AtomTRAK * trak);
@@ -138,11 +150,19 @@ gboolean atoms_recov_write_headers        (FILE * f, AtomFTYP * ftyp,
                                            GstBuffer * prefix, AtomMOOV * moov,
                                            guint32 timescale,
                                            guint32 traks_number);
-gboolean atoms_recov_write_trak_samples   (FILE * f, AtomTRAK * trak,
-                                           guint32 nsamples, guint32 delta,
-                                           guint32 size, guint64 chunk_offset,
-                                           gboolean sync, gboolean do_pts,
-                                           gint64 pts_offset);
+
+AtomsRecovJournal * atoms_recov_journal_new    (void);
+void     atoms_recov_journal_free              (AtomsRecovJournal * journal);
+void     atoms_recov_journal_add_trak_samples  (AtomsRecovJournal * journal,
+                                                AtomTRAK * trak,
+                                                guint32 nsamples,
+                                                guint32 delta, guint32 size,
+                                                guint64 chunk_offset,
+                                                gboolean sync,
+                                                gboolean do_pts,
+                                                gint64 pts_offset);
+gboolean atoms_recov_journal_write             (AtomsRecovJournal * journal,
+                                                FILE * f, gboolean sync);
 
 MdatRecovFile * mdat_recov_file_create   (FILE * file, gboolean datafile,
                                           GError ** err);
@@ -78,9 +78,23 @@
  * Alternatively, rather than having one chunk of metadata at start (or end),
  * there can be some metadata at start and most of the other data can be spread
  * out into fragments of <link linkend="GstQTMux--fragment-duration">fragment-duration</link>.
+ * With <link linkend="GstQTMux--chunk-samples">chunk-samples</link>, fragments
+ * are instead started at key frames of the first video track (at the same time
+ * for all tracks) and written out as a moof and mdat per chunk of that many
+ * samples, which keeps the latency low for live streaming.
  * If such fragmented layout is intended for streaming purposes, then
  * <link linkend="GstQTMux--streamable">streamable</link> allows foregoing to add
  * index metadata (at the end of file).
+ * Instead of buffering all media in a temporary file, a faststart-like file
+ * can also be created by reserving space for the moov at the start of the
+ * file, sized by <link linkend="GstQTMux--reserved-max-duration">reserved-max-duration</link>
+ * and <link linkend="GstQTMux--reserved-bytes-per-sec">reserved-bytes-per-sec</link>.
+ * If the moov does not fit into it in the end, it is placed at the end of the
+ * file as usual.
+ * For chunked fragments, <link linkend="GstQTMux--reserved-max-duration">reserved-max-duration</link>
+ * instead reserves space after the moov for a segment index (sidx) of the
+ * fragments of that duration, which is written into it at the end. Without it,
+ * no sidx is written.
  *
  * <link linkend="GstQTMux--dts-method">dts-method</link> allows selecting a
  * method for managing input timestamps (stay tuned for 0.11 to have this
@@ -189,6 +203,10 @@ enum
   PROP_STREAMABLE,
   PROP_DTS_METHOD,
   PROP_DO_CTTS,
+  PROP_RESERVED_MAX_DURATION,
+  PROP_RESERVED_BYTES_PER_SEC,
+  PROP_CHUNK_SAMPLES,
+  PROP_MOOV_RECOV_SYNC_INTERVAL,
 };
 
 /* some spare for header size as well */
@@ -201,9 +219,16 @@ enum
 #define DEFAULT_FAST_START              FALSE
 #define DEFAULT_FAST_START_TEMP_FILE    NULL
 #define DEFAULT_MOOV_RECOV_FILE         NULL
+#define DEFAULT_MOOV_RECOV_SYNC_INTERVAL 0
 #define DEFAULT_FRAGMENT_DURATION       0
+#define DEFAULT_CHUNK_SAMPLES           0
 #define DEFAULT_STREAMABLE              FALSE
 #define DEFAULT_DTS_METHOD              DTS_METHOD_DD
+#define DEFAULT_RESERVED_MAX_DURATION   GST_CLOCK_TIME_NONE
+#define DEFAULT_RESERVED_BYTES_PER_SEC  550
+
+/* spare room in the reserved moov space for tags and extra atoms */
+#define RESERVED_MOOV_SPARE             4096
 
 
 static void gst_qt_mux_finalize (GObject * object);
@@ -331,18 +356,51 @@ gst_qt_mux_class_init (GstQTMuxClass * klass)
           "of a crash during muxing. Null for disabled. (Experimental)",
           DEFAULT_MOOV_RECOV_FILE,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+      PROP_MOOV_RECOV_SYNC_INTERVAL,
+      g_param_spec_uint64 ("moov-recovery-sync-interval",
+          "Moov recovery sync interval",
+          "Interval of stream time (in ns) in which the moov recovery data is "
+          "collected in memory before being written and synced to disk "
+          "(0 = write it as it comes, without syncing)",
+          0, G_MAXUINT64, DEFAULT_MOOV_RECOV_SYNC_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_FRAGMENT_DURATION,
       g_param_spec_uint ("fragment-duration", "Fragment duration",
           "Fragment durations in ms (produce a fragmented file if > 0)",
           0, G_MAXUINT32, klass->format == GST_QT_MUX_FORMAT_ISML ?
           2000 : DEFAULT_FRAGMENT_DURATION,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHUNK_SAMPLES,
+      g_param_spec_uint ("chunk-samples", "Chunk samples",
+          "When fragmenting, start fragments at key frames of the first "
+          "video track for all tracks and write a moof and mdat every "
+          "number of samples per track (0 = disabled)",
+          0, G_MAXUINT32, DEFAULT_CHUNK_SAMPLES,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_STREAMABLE,
       g_param_spec_boolean ("streamable", "Streamable",
           "If set to true, the output should be as if it is to be streamed "
           "and hence no indexes written or duration written.",
           DEFAULT_STREAMABLE,
           G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RESERVED_MAX_DURATION,
+      g_param_spec_uint64 ("reserved-max-duration",
+          "Reserved maximum file duration (ns)",
+          "When set, reserve space at the start of the file for a moov "
+          "covering this duration (in ns), and write the moov into it at "
+          "the end instead of using a temporary file. With chunk-samples, "
+          "reserve space after the moov for a segment index (sidx) of the "
+          "fragments of this duration instead (GST_CLOCK_TIME_NONE "
+          "disables)", 0, GST_CLOCK_TIME_NONE, DEFAULT_RESERVED_MAX_DURATION,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RESERVED_BYTES_PER_SEC,
+      g_param_spec_uint ("reserved-bytes-per-sec",
+          "Reserved moov bytes per second, per track",
+          "Estimated moov size per second of media and per track, used to "
+          "size the space reserved by reserved-max-duration",
+          0, G_MAXUINT32, DEFAULT_RESERVED_BYTES_PER_SEC,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT | G_PARAM_STATIC_STRINGS));
 
   gstelement_class->request_new_pad =
       GST_DEBUG_FUNCPTR (gst_qt_mux_request_new_pad);
@@ -395,6 +453,19 @@ gst_qt_mux_pad_reset (GstQTPad * qtpad)
 /*
  * Takes GstQTMux back to its initial state
  */
+/* Writes out the sample information batched in the moov recovery journal
+ * and syncs the recovery file */
+static void
+gst_qt_mux_sync_moov_recovery (GstQTMux * qtmux)
+{
+  if (!qtmux->moov_recov_file || !qtmux->moov_recov_journal)
+    return;
+
+  if (!atoms_recov_journal_write (qtmux->moov_recov_journal,
+          qtmux->moov_recov_file, TRUE))
+    GST_WARNING_OBJECT (qtmux, "Failed to sync the moov recovery file");
+}
+
 static void
 gst_qt_mux_reset (GstQTMux * qtmux, gboolean alloc)
 {
@@ -404,10 +475,18 @@ gst_qt_mux_reset (GstQTMux * qtmux, gboolean alloc)
   qtmux->header_size = 0;
   qtmux->mdat_size = 0;
   qtmux->mdat_pos = 0;
+  qtmux->moov_pos = 0;
+  qtmux->reserved_moov_size = 0;
   qtmux->longest_chunk = GST_CLOCK_TIME_NONE;
   qtmux->video_pads = 0;
   qtmux->audio_pads = 0;
   qtmux->fragment_sequence = 0;
+  qtmux->fragment_ref_pad = NULL;
+  qtmux->fragment_offset = -1;
+  qtmux->fragment_start_dts = 0;
+  qtmux->fragment_end_dts = 0;
+  qtmux->sidx_pos = 0;
+  qtmux->reserved_sidx_size = 0;
 
   if (qtmux->ftyp) {
     atom_ftyp_free (qtmux->ftyp);
@@ -421,15 +500,27 @@ gst_qt_mux_reset (GstQTMux * qtmux, gboolean alloc)
     atom_mfra_free (qtmux->mfra);
     qtmux->mfra = NULL;
   }
+  if (qtmux->sidx) {
+    atom_sidx_free (qtmux->sidx);
+    qtmux->sidx = NULL;
+  }
   if (qtmux->fast_start_file) {
     fclose (qtmux->fast_start_file);
     g_remove (qtmux->fast_start_file_path);
     qtmux->fast_start_file = NULL;
   }
   if (qtmux->moov_recov_file) {
+    /* a recording stopped without EOS is when recovery is needed, don't
+     * lose what was batched since the last sync */
+    gst_qt_mux_sync_moov_recovery (qtmux);
     fclose (qtmux->moov_recov_file);
     qtmux->moov_recov_file = NULL;
   }
+  if (qtmux->moov_recov_journal) {
+    atoms_recov_journal_free (qtmux->moov_recov_journal);
+    qtmux->moov_recov_journal = NULL;
+  }
+  qtmux->moov_recov_last_sync = GST_CLOCK_TIME_NONE;
   for (walk = qtmux->extra_atoms; walk; walk = g_slist_next (walk)) {
     AtomInfo *ainfo = (AtomInfo *) walk->data;
     ainfo->free_func (ainfo->atom);
@@ -1371,6 +1462,28 @@ gst_qt_mux_update_mdat_size (GstQTMux * qtmux, guint64 mdat_pos,
   return gst_qt_mux_send_buffer (qtmux, buf, offset, FALSE);
 }
 
+/*
+ * Sends a free atom of @size bytes, including its header
+ */
+static GstFlowReturn
+gst_qt_mux_send_free_atom (GstQTMux * qtmux, guint64 * off, guint32 size)
+{
+  GstBuffer *buf;
+  guint8 *data;
+
+  g_return_val_if_fail (size >= 8, GST_FLOW_ERROR);
+
+  GST_DEBUG_OBJECT (qtmux, "Sending free atom of size %u", size);
+
+  buf = gst_buffer_new_and_alloc (size);
+  data = GST_BUFFER_DATA (buf);
+  memset (data, 0, size);
+  GST_WRITE_UINT32_BE (data, size);
+  GST_WRITE_UINT32_LE (data + 4, FOURCC_free);
+
+  return gst_qt_mux_send_buffer (qtmux, buf, off, FALSE);
+}
+
 static GstFlowReturn
 gst_qt_mux_send_ftyp (GstQTMux * qtmux, guint64 * off)
 {
@@ -1505,12 +1618,28 @@ gst_qt_mux_send_moov (GstQTMux * qtmux, guint64 * _offset, gboolean mind_fast)
   GstBuffer *buf;
   GstFlowReturn ret = GST_FLOW_OK;
 
-  /* serialize moov */
+  /* calculate the exact moov size first, so that it, and in particular the
+   * possibly huge sample tables, can be serialized into one allocation */
   offset = size = 0;
   data = NULL;
-  GST_LOG_OBJECT (qtmux, "Copying movie header into buffer");
+  if (!atom_moov_copy_data (qtmux->moov, NULL, &size, &offset))
+    goto serialize_error;
+
+  /* serialize moov */
+  size = offset;
+  offset = 0;
+  data = g_malloc (size);
+  GST_LOG_OBJECT (qtmux, "Copying movie header of %" G_GUINT64_FORMAT
+      " bytes into buffer", size);
   if (!atom_moov_copy_data (qtmux->moov, &data, &size, &offset))
     goto serialize_error;
+  if (G_UNLIKELY (offset != size)) {
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Serialized moov has %" G_GUINT64_FORMAT " bytes instead of the "
+            "expected %" G_GUINT64_FORMAT, offset, size));
+    g_free (data);
+    return GST_FLOW_ERROR;
+  }
 
   buf = _gst_buffer_new_take_data (data, offset);
   GST_DEBUG_OBJECT (qtmux, "Pushing moov atoms");
@@ -1570,6 +1699,184 @@ serialize_error:
   }
 }
 
+/*
+ * Reserves space for the moov after the ftyp, based on the expected
+ * maximum duration of the file. It is filled with a free atom for now.
+ */
+static GstFlowReturn
+gst_qt_mux_reserve_moov (GstQTMux * qtmux)
+{
+  guint64 offset = 0, size = 0;
+  guint n_traks;
+
+  /* size of the headers that are already known */
+  if (!atom_moov_copy_data (qtmux->moov, NULL, &size, &offset))
+    goto serialize_error;
+
+  n_traks = g_slist_length (qtmux->sinkpads);
+  offset += gst_util_uint64_scale (qtmux->reserved_max_duration,
+      (guint64) qtmux->reserved_bytes_per_sec * n_traks, GST_SECOND);
+  offset += RESERVED_MOOV_SPARE;
+  offset = MIN (offset, G_MAXUINT32);
+
+  GST_DEBUG_OBJECT (qtmux, "Reserving %" G_GUINT64_FORMAT " bytes for the "
+      "moov of %u tracks with maximum duration %" GST_TIME_FORMAT, offset,
+      n_traks, GST_TIME_ARGS (qtmux->reserved_max_duration));
+
+  qtmux->moov_pos = qtmux->header_size;
+  qtmux->reserved_moov_size = offset;
+
+  return gst_qt_mux_send_free_atom (qtmux, &qtmux->header_size, offset);
+
+  /* ERRORS */
+serialize_error:
+  {
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize moov"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * Writes the moov and extra atoms into the reserved space at the start of
+ * the file, with a free atom covering the remaining space. Returns
+ * GST_FLOW_CUSTOM_SUCCESS if they don't fit.
+ */
+static GstFlowReturn
+gst_qt_mux_send_reserved_moov (GstQTMux * qtmux)
+{
+  GstFlowReturn ret;
+  GstEvent *event;
+  guint64 offset = 0, size = 0;
+
+  if (!atom_moov_copy_data (qtmux->moov, NULL, &size, &offset))
+    goto serialize_error;
+  ret = gst_qt_mux_send_extra_atoms (qtmux, FALSE, &offset, FALSE);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  /* the remaining space must be able to hold a free atom */
+  if (offset != qtmux->reserved_moov_size
+      && offset + 8 > qtmux->reserved_moov_size) {
+    GST_WARNING_OBJECT (qtmux, "moov of %" G_GUINT64_FORMAT " bytes does not "
+        "fit into the %" G_GUINT64_FORMAT " reserved bytes, placing it at the "
+        "end of the file", offset, qtmux->reserved_moov_size);
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  GST_DEBUG_OBJECT (qtmux, "Writing moov of %" G_GUINT64_FORMAT " bytes into "
+      "the %" G_GUINT64_FORMAT " reserved bytes", offset,
+      qtmux->reserved_moov_size);
+
+  event = gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
+      qtmux->moov_pos, GST_CLOCK_TIME_NONE, 0);
+  gst_pad_push_event (qtmux->srcpad, event);
+
+  ret = gst_qt_mux_send_moov (qtmux, NULL, FALSE);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  ret = gst_qt_mux_send_extra_atoms (qtmux, TRUE, NULL, FALSE);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  if (offset < qtmux->reserved_moov_size)
+    ret = gst_qt_mux_send_free_atom (qtmux, NULL,
+        qtmux->reserved_moov_size - offset);
+
+  return ret;
+
+  /* ERRORS */
+serialize_error:
+  {
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize moov"));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/*
+ * Reserves space for the segment index of chunked fragments after the moov,
+ * for as many fragments as the expected maximum duration gives.
+ */
+static GstFlowReturn
+gst_qt_mux_reserve_sidx (GstQTMux * qtmux)
+{
+  guint64 n_fragments;
+
+  n_fragments = gst_util_uint64_scale (qtmux->reserved_max_duration, 1,
+      qtmux->fragment_duration * GST_MSECOND) + 1;
+  n_fragments = MIN (n_fragments, G_MAXUINT16);
+
+  qtmux->sidx_pos = qtmux->header_size;
+  /* version 1 header and one reference per fragment */
+  qtmux->reserved_sidx_size = 40 + 12 * n_fragments;
+
+  GST_DEBUG_OBJECT (qtmux, "Reserving %" G_GUINT64_FORMAT " bytes for the "
+      "sidx of %" G_GUINT64_FORMAT " fragments", qtmux->reserved_sidx_size,
+      n_fragments);
+
+  return gst_qt_mux_send_free_atom (qtmux, &qtmux->header_size,
+      qtmux->reserved_sidx_size);
+}
+
+/*
+ * Writes the segment index into the space reserved for it, with a free atom
+ * covering the remaining space. Returns GST_FLOW_CUSTOM_SUCCESS if it
+ * doesn't fit.
+ */
+static GstFlowReturn
+gst_qt_mux_send_reserved_sidx (GstQTMux * qtmux)
+{
+  GstFlowReturn ret;
+  GstEvent *event;
+  guint64 offset = 0, size = 0;
+  guint8 *data = NULL;
+  GstBuffer *buf;
+
+  if (!atom_sidx_copy_data (qtmux->sidx, NULL, &size, &offset))
+    goto serialize_error;
+  if (offset != qtmux->reserved_sidx_size
+      && offset + 8 > qtmux->reserved_sidx_size) {
+    GST_WARNING_OBJECT (qtmux, "sidx of %" G_GUINT64_FORMAT " bytes does not "
+        "fit into the %" G_GUINT64_FORMAT " reserved bytes, not writing it",
+        offset, qtmux->reserved_sidx_size);
+    return GST_FLOW_CUSTOM_SUCCESS;
+  }
+
+  /* the first fragment follows the reserved space, and is referenced
+   * relative to the end of the sidx */
+  qtmux->sidx->first_offset = qtmux->reserved_sidx_size - offset;
+
+  size = offset = 0;
+  if (!atom_sidx_copy_data (qtmux->sidx, &data, &size, &offset))
+    goto serialize_error;
+  buf = _gst_buffer_new_take_data (data, offset);
+
+  GST_DEBUG_OBJECT (qtmux, "Writing sidx of %" G_GUINT64_FORMAT " bytes with "
+      "%u references", offset, atom_array_get_len (&qtmux->sidx->entries));
+
+  event = gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
+      qtmux->sidx_pos, GST_CLOCK_TIME_NONE, 0);
+  gst_pad_push_event (qtmux->srcpad, event);
+
+  ret = gst_qt_mux_send_buffer (qtmux, buf, NULL, FALSE);
+  if (ret == GST_FLOW_OK && offset < qtmux->reserved_sidx_size)
+    ret = gst_qt_mux_send_free_atom (qtmux, NULL,
+        qtmux->reserved_sidx_size - offset);
+
+  return ret;
+
+  /* ERRORS */
+serialize_error:
+  {
+    g_free (data);
+    GST_ELEMENT_ERROR (qtmux, STREAM, MUX, (NULL),
+        ("Failed to serialize sidx"));
+    return GST_FLOW_ERROR;
+  }
+}
+
 static GstFlowReturn
 gst_qt_mux_start_file (GstQTMux * qtmux)
 {
@@ -1631,6 +1938,8 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
         qtmux->moov_recov_file = NULL;
         GST_WARNING_OBJECT (qtmux, "An error was detected while writing to "
             "recover file, moov recovery won't work");
+      } else {
+        qtmux->moov_recov_journal = atoms_recov_journal_new ();
       }
     }
   }
@@ -1642,7 +1951,8 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
    * better fine tune using the information we gather to create the whole moov
    * atom.
    */
-  if (qtmux->fast_start) {
+  if (qtmux->fast_start
+      && !GST_CLOCK_TIME_IS_VALID (qtmux->reserved_max_duration)) {
     GST_OBJECT_LOCK (qtmux);
     qtmux->fast_start_file = g_fopen (qtmux->fast_start_file_path, "wb+");
     if (!qtmux->fast_start_file)
@@ -1682,7 +1992,20 @@ gst_qt_mux_start_file (GstQTMux * qtmux)
       /* prepare index */
       if (!qtmux->streamable)
         qtmux->mfra = atom_mfra_new (qtmux->context);
+      /* and space for the segment index */
+      if (!qtmux->streamable && qtmux->chunk_samples
+          && GST_CLOCK_TIME_IS_VALID (qtmux->reserved_max_duration)) {
+        ret = gst_qt_mux_reserve_sidx (qtmux);
+        if (ret != GST_FLOW_OK)
+          return ret;
+      }
     } else {
+      if (GST_CLOCK_TIME_IS_VALID (qtmux->reserved_max_duration)) {
+        ret = gst_qt_mux_reserve_moov (qtmux);
+        if (ret != GST_FLOW_OK)
+          return ret;
+        qtmux->mdat_pos = qtmux->header_size;
+      }
       /* extended to ensure some spare space */
       ret = gst_qt_mux_send_mdat_header (qtmux, &qtmux->header_size, 0, TRUE);
     }
@@ -1740,9 +2063,17 @@ gst_qt_mux_stop_file (GstQTMux * qtmux)
     }
   }
 
+  /* the moov isn't written yet, the recovery file must be complete until
+   * it is */
+  gst_qt_mux_sync_moov_recovery (qtmux);
+
   if (qtmux->fragment_sequence) {
     GstEvent *event;
 
+    /* finish the last chunked fragment */
+    if (qtmux->fragment_offset != -1)
+      gst_qt_mux_close_fragment (qtmux, qtmux->fragment_end_dts);
+
     if (qtmux->mfra) {
       guint8 *data = NULL;
       GstBuffer *buf;
@@ -1774,8 +2105,18 @@ gst_qt_mux_stop_file (GstQTMux * qtmux)
     event = gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
         qtmux->mdat_pos, GST_CLOCK_TIME_NONE, 0);
     gst_pad_push_event (qtmux->srcpad, event);
+    ret = gst_qt_mux_send_moov (qtmux, NULL, FALSE);
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    /* and fill in the segment index */
+    if (qtmux->sidx) {
+      ret = gst_qt_mux_send_reserved_sidx (qtmux);
+      if (ret == GST_FLOW_CUSTOM_SUCCESS)
+        ret = GST_FLOW_OK;
+    }
     /* no need to seek back */
-    return gst_qt_mux_send_moov (qtmux, NULL, FALSE);
+    return ret;
   }
 
   gst_qt_mux_configure_moov (qtmux, &timescale);
@@ -1850,6 +2191,18 @@ gst_qt_mux_stop_file (GstQTMux * qtmux)
   }
   atom_moov_chunks_add_offset (qtmux->moov, offset);
 
+  /* moov into the space reserved for it, then only the mdat size is left */
+  if (qtmux->reserved_moov_size) {
+    ret = gst_qt_mux_send_reserved_moov (qtmux);
+    if (ret == GST_FLOW_OK) {
+      GST_DEBUG_OBJECT (qtmux, "updating mdat size");
+      return gst_qt_mux_update_mdat_size (qtmux, qtmux->mdat_pos,
+          qtmux->mdat_size, NULL);
+    } else if (ret != GST_FLOW_CUSTOM_SUCCESS) {
+      return ret;
+    }
+  }
+
   /* moov */
   /* note: as of this point, we no longer care about tracking written data size,
    * since there is no more use for it anyway */
@@ -1897,6 +2250,215 @@ ftyp_error:
   }
 }
 
+/*
+ * Writes the samples collected for a pad as a moof and mdat
+ */
+static GstFlowReturn
+gst_qt_mux_pad_fragment_flush (GstQTMux * qtmux, GstQTPad * pad)
+{
+  GstFlowReturn ret;
+  AtomMOOF *moof;
+  guint64 size = 0, offset = 0;
+  guint8 *data = NULL;
+  GstBuffer *buffer;
+  guint i, total_size;
+
+  /* now we know where moof ends up, update offset in tfra */
+  if (pad->tfra)
+    atom_tfra_update_offset (pad->tfra, qtmux->header_size);
+
+  moof = atom_moof_new (qtmux->context, qtmux->fragment_sequence);
+  /* takes ownership */
+  atom_moof_add_traf (moof, pad->traf);
+  pad->traf = NULL;
+  atom_moof_copy_data (moof, &data, &size, &offset);
+  buffer = _gst_buffer_new_take_data (data, offset);
+  GST_LOG_OBJECT (qtmux, "writing moof size %d", GST_BUFFER_SIZE (buffer));
+  ret = gst_qt_mux_send_buffer (qtmux, buffer, &qtmux->header_size, FALSE);
+
+  /* and actual data */
+  total_size = 0;
+  for (i = 0; i < atom_array_get_len (&pad->fragment_buffers); i++) {
+    total_size +=
+        GST_BUFFER_SIZE (atom_array_index (&pad->fragment_buffers, i));
+  }
+
+  GST_LOG_OBJECT (qtmux, "writing %d buffers, total_size %d",
+      atom_array_get_len (&pad->fragment_buffers), total_size);
+  if (ret == GST_FLOW_OK)
+    ret = gst_qt_mux_send_mdat_header (qtmux, &qtmux->header_size, total_size,
+        FALSE);
+  for (i = 0; i < atom_array_get_len (&pad->fragment_buffers); i++) {
+    if (G_LIKELY (ret == GST_FLOW_OK))
+      ret = gst_qt_mux_send_buffer (qtmux,
+          atom_array_index (&pad->fragment_buffers, i), &qtmux->header_size,
+          FALSE);
+    else
+      gst_buffer_unref (atom_array_index (&pad->fragment_buffers, i));
+  }
+
+  atom_array_clear (&pad->fragment_buffers);
+  atom_moof_free (moof);
+  qtmux->fragment_sequence++;
+
+  return ret;
+}
+
+static void
+gst_qt_mux_pad_fragment_setup (GstQTMux * qtmux, GstQTPad * pad)
+{
+  GST_LOG_OBJECT (qtmux, "setting up new fragment");
+  pad->traf = atom_traf_new (qtmux->context, atom_trak_get_id (pad->trak));
+  atom_array_init (&pad->fragment_buffers, 512);
+
+  if (G_UNLIKELY (qtmux->mfra && !pad->tfra)) {
+    pad->tfra = atom_tfra_new (qtmux->context, atom_trak_get_id (pad->trak));
+    atom_mfra_add_tfra (qtmux->mfra, pad->tfra);
+  }
+}
+
+static void
+gst_qt_mux_pad_fragment_add_sample (GstQTMux * qtmux, GstQTPad * pad,
+    GstBuffer * buf, gint64 dts, guint32 delta, guint32 size, gboolean sync,
+    gint64 pts_offset)
+{
+  /* add buffer and metadata */
+  atom_traf_add_samples (pad->traf, delta, size, sync, pts_offset,
+      pad->sync && sync);
+  atom_array_append (&pad->fragment_buffers, buf, 256);
+  pad->fragment_duration -= delta;
+
+  if (pad->tfra) {
+    guint32 sn = atom_traf_get_sample_num (pad->traf);
+
+    if ((sync && pad->sync) || (sn == 1 && !pad->sync))
+      atom_tfra_add_entry (pad->tfra, dts, sn);
+  }
+}
+
+/*
+ * Finishes the current fragment of chunked fragmenting, ending at @end_dts
+ * of the reference pad
+ */
+static void
+gst_qt_mux_close_fragment (GstQTMux * qtmux, gint64 end_dts)
+{
+  GstQTPad *ref = qtmux->fragment_ref_pad;
+  guint32 timescale = atom_trak_get_timescale (ref->trak);
+  guint64 size = qtmux->header_size - qtmux->fragment_offset;
+  guint64 duration = MAX (end_dts - qtmux->fragment_start_dts, 0);
+
+  GST_DEBUG_OBJECT (qtmux, "fragment at offset %" G_GUINT64_FORMAT " of size %"
+      G_GUINT64_FORMAT " and duration %" G_GUINT64_FORMAT " finished",
+      qtmux->fragment_offset, size, duration);
+
+  if (qtmux->sidx)
+    atom_sidx_add_entry (qtmux->sidx, size, duration, TRUE);
+
+  gst_element_post_message (GST_ELEMENT_CAST (qtmux),
+      gst_message_new_element (GST_OBJECT_CAST (qtmux),
+          gst_structure_new ("GstQTMuxFragment",
+              "offset", G_TYPE_UINT64, qtmux->fragment_offset,
+              "size", G_TYPE_UINT64, size,
+              "timestamp", G_TYPE_UINT64,
+              gst_util_uint64_scale (MAX (qtmux->fragment_start_dts, 0),
+                  GST_SECOND, timescale),
+              "duration", G_TYPE_UINT64,
+              gst_util_uint64_scale (duration, GST_SECOND, timescale), NULL)));
+}
+
+/*
+ * Starts a new fragment for all pads at @dts of the reference pad,
+ * writing out what is left of the current one first. @pts is the
+ * presentation time of the first sample of the fragment.
+ */
+static GstFlowReturn
+gst_qt_mux_start_fragment (GstQTMux * qtmux, gint64 dts, gint64 pts)
+{
+  GstQTPad *ref = qtmux->fragment_ref_pad;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GSList *walk;
+
+  for (walk = qtmux->sinkpads; walk && ret == GST_FLOW_OK;
+      walk = g_slist_next (walk)) {
+    GstQTPad *qtpad = (GstQTPad *) walk->data;
+
+    if (qtpad->traf)
+      ret = gst_qt_mux_pad_fragment_flush (qtmux, qtpad);
+  }
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  if (qtmux->fragment_offset != -1)
+    gst_qt_mux_close_fragment (qtmux, dts);
+
+  if (G_UNLIKELY (qtmux->reserved_sidx_size && !qtmux->sidx)) {
+    qtmux->sidx = atom_sidx_new (qtmux->context, atom_trak_get_id (ref->trak),
+        atom_trak_get_timescale (ref->trak));
+    /* ISO/IEC 14496-12 8.16.3: the presentation time of the first sample,
+     * not its decoding time */
+    qtmux->sidx->earliest_presentation_time = MAX (pts, 0);
+  }
+
+  GST_DEBUG_OBJECT (qtmux, "starting fragment at offset %" G_GUINT64_FORMAT,
+      qtmux->header_size);
+  qtmux->fragment_offset = qtmux->header_size;
+  qtmux->fragment_start_dts = dts;
+  ref->fragment_duration = gst_util_uint64_scale (qtmux->fragment_duration,
+      atom_trak_get_timescale (ref->trak), 1000);
+
+  return ret;
+}
+
+/*
+ * Chunked fragmenting: fragments are started at the key frames of the
+ * reference pad, for all pads at once, and every pad writes its samples
+ * as a moof and mdat per chunk of chunk-samples samples.
+ */
+static GstFlowReturn
+gst_qt_mux_pad_chunk_add_buffer (GstQTMux * qtmux, GstQTPad * pad,
+    GstBuffer * buf, gboolean force, gint64 dts, guint32 delta, guint32 size,
+    gboolean sync, gint64 pts_offset)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  /* prefer a video track with key frames */
+  if (G_UNLIKELY (!qtmux->fragment_ref_pad)) {
+    GSList *walk;
+
+    qtmux->fragment_ref_pad = pad;
+    for (walk = qtmux->sinkpads; walk; walk = g_slist_next (walk)) {
+      GstQTPad *qtpad = (GstQTPad *) walk->data;
+
+      if (qtpad->sync) {
+        qtmux->fragment_ref_pad = qtpad;
+        break;
+      }
+    }
+    GST_DEBUG_OBJECT (qtmux, "fragments start at key frames of pad %s",
+        GST_PAD_NAME (qtmux->fragment_ref_pad->collect.pad));
+  }
+
+  if (pad == qtmux->fragment_ref_pad) {
+    if ((sync || !pad->sync) && (qtmux->fragment_offset == -1
+            || pad->fragment_duration <= 0))
+      ret = gst_qt_mux_start_fragment (qtmux, dts, dts + pts_offset);
+    qtmux->fragment_end_dts = dts + delta;
+  }
+
+  if (G_UNLIKELY (!pad->traf))
+    gst_qt_mux_pad_fragment_setup (qtmux, pad);
+
+  gst_qt_mux_pad_fragment_add_sample (qtmux, pad, buf, dts, delta, size, sync,
+      pts_offset);
+
+  if (ret == GST_FLOW_OK && (force
+          || atom_traf_get_sample_num (pad->traf) >= qtmux->chunk_samples))
+    ret = gst_qt_mux_pad_fragment_flush (qtmux, pad);
+
+  return ret;
+}
+
 static GstFlowReturn
 gst_qt_mux_pad_fragment_add_buffer (GstQTMux * qtmux, GstQTPad * pad,
     GstBuffer * buf, gboolean force, guint32 nsamples, gint64 dts,
@@ -1904,6 +2466,10 @@ gst_qt_mux_pad_fragment_add_buffer (GstQTMux * qtmux, GstQTPad * pad,
 {
   GstFlowReturn ret = GST_FLOW_OK;
 
+  if (qtmux->chunk_samples)
+    return gst_qt_mux_pad_chunk_add_buffer (qtmux, pad, buf, force, dts, delta,
+        size, sync, pts_offset);
+
   /* setup if needed */
   if (G_UNLIKELY (!pad->traf || force))
     goto init;
@@ -1913,78 +2479,19 @@ flush:
    * or at new keyframe if we should be minding those in the first place */
   if (G_UNLIKELY (force || (sync && pad->sync) ||
           pad->fragment_duration < (gint64) delta)) {
-    AtomMOOF *moof;
-    guint64 size = 0, offset = 0;
-    guint8 *data = NULL;
-    GstBuffer *buffer;
-    guint i, total_size;
-
-    /* now we know where moof ends up, update offset in tfra */
-    if (pad->tfra)
-      atom_tfra_update_offset (pad->tfra, qtmux->header_size);
-
-    moof = atom_moof_new (qtmux->context, qtmux->fragment_sequence);
-    /* takes ownership */
-    atom_moof_add_traf (moof, pad->traf);
-    pad->traf = NULL;
-    atom_moof_copy_data (moof, &data, &size, &offset);
-    buffer = _gst_buffer_new_take_data (data, offset);
-    GST_LOG_OBJECT (qtmux, "writing moof size %d", GST_BUFFER_SIZE (buffer));
-    ret = gst_qt_mux_send_buffer (qtmux, buffer, &qtmux->header_size, FALSE);
-
-    /* and actual data */
-    total_size = 0;
-    for (i = 0; i < atom_array_get_len (&pad->fragment_buffers); i++) {
-      total_size +=
-          GST_BUFFER_SIZE (atom_array_index (&pad->fragment_buffers, i));
-    }
-
-    GST_LOG_OBJECT (qtmux, "writing %d buffers, total_size %d",
-        atom_array_get_len (&pad->fragment_buffers), total_size);
-    if (ret == GST_FLOW_OK)
-      ret = gst_qt_mux_send_mdat_header (qtmux, &qtmux->header_size, total_size,
-          FALSE);
-    for (i = 0; i < atom_array_get_len (&pad->fragment_buffers); i++) {
-      if (G_LIKELY (ret == GST_FLOW_OK))
-        ret = gst_qt_mux_send_buffer (qtmux,
-            atom_array_index (&pad->fragment_buffers, i), &qtmux->header_size,
-            FALSE);
-      else
-        gst_buffer_unref (atom_array_index (&pad->fragment_buffers, i));
-    }
-
-    atom_array_clear (&pad->fragment_buffers);
-    atom_moof_free (moof);
-    qtmux->fragment_sequence++;
+    ret = gst_qt_mux_pad_fragment_flush (qtmux, pad);
     force = FALSE;
   }
 
 init:
   if (G_UNLIKELY (!pad->traf)) {
-    GST_LOG_OBJECT (qtmux, "setting up new fragment");
-    pad->traf = atom_traf_new (qtmux->context, atom_trak_get_id (pad->trak));
-    atom_array_init (&pad->fragment_buffers, 512);
+    gst_qt_mux_pad_fragment_setup (qtmux, pad);
     pad->fragment_duration = gst_util_uint64_scale (qtmux->fragment_duration,
         atom_trak_get_timescale (pad->trak), 1000);
-
-    if (G_UNLIKELY (qtmux->mfra && !pad->tfra)) {
-      pad->tfra = atom_tfra_new (qtmux->context, atom_trak_get_id (pad->trak));
-      atom_mfra_add_tfra (qtmux->mfra, pad->tfra);
-    }
   }
 
-  /* add buffer and metadata */
-  atom_traf_add_samples (pad->traf, delta, size, sync, pts_offset,
-      pad->sync && sync);
-  atom_array_append (&pad->fragment_buffers, buf, 256);
-  pad->fragment_duration -= delta;
-
-  if (pad->tfra) {
-    guint32 sn = atom_traf_get_sample_num (pad->traf);
-
-    if ((sync && pad->sync) || (sn == 1 && !pad->sync))
-      atom_tfra_add_entry (pad->tfra, dts, sn);
-  }
+  gst_qt_mux_pad_fragment_add_sample (qtmux, pad, buf, dts, delta, size, sync,
+      pts_offset);
 
   if (G_UNLIKELY (force))
     goto flush;
@@ -2311,11 +2818,26 @@ again:
   }
 
   /* now we go and register this buffer/sample all over */
-  /* note that a new chunk is started each time (not fancy but works) */
   if (qtmux->moov_recov_file) {
-    if (!atoms_recov_write_trak_samples (qtmux->moov_recov_file, pad->trak,
-            nsamples, (gint32) scaled_duration, sample_size, chunk_offset, sync,
-            do_pts, pts_offset)) {
+    gboolean ok = TRUE;
+
+    atoms_recov_journal_add_trak_samples (qtmux->moov_recov_journal,
+        pad->trak, nsamples, (gint32) scaled_duration, sample_size,
+        chunk_offset, sync, do_pts, pts_offset);
+    /* either hand it to stdio right away, or batch it up and sync
+     * every interval */
+    if (!qtmux->moov_recov_sync_interval) {
+      ok = atoms_recov_journal_write (qtmux->moov_recov_journal,
+          qtmux->moov_recov_file, FALSE);
+    } else if (!GST_CLOCK_TIME_IS_VALID (qtmux->moov_recov_last_sync) ||
+        pad->last_dts >=
+        qtmux->moov_recov_last_sync + qtmux->moov_recov_sync_interval) {
+      GST_LOG_OBJECT (qtmux, "syncing moov recovery file");
+      ok = atoms_recov_journal_write (qtmux->moov_recov_journal,
+          qtmux->moov_recov_file, TRUE);
+      qtmux->moov_recov_last_sync = pad->last_dts;
+    }
+    if (!ok) {
       GST_WARNING_OBJECT (qtmux, "Failed to write sample information to "
           "recovery file, disabling recovery");
       fclose (qtmux->moov_recov_file);
@@ -3163,6 +3685,8 @@ gst_qt_mux_release_pad (GstElement * element, GstPad * pad)
     GST_DEBUG ("Checking %s:%s", GST_DEBUG_PAD_NAME (qtpad->collect.pad));
     if (qtpad->collect.pad == pad) {
       /* this is it, remove */
+      if (mux->fragment_ref_pad == qtpad)
+        mux->fragment_ref_pad = NULL;
       mux->sinkpads = g_slist_delete_link (mux->sinkpads, walk);
       gst_element_remove_pad (element, pad);
       break;
@@ -3281,12 +3805,24 @@ gst_qt_mux_get_property (GObject * object,
     case PROP_MOOV_RECOV_FILE:
       g_value_set_string (value, qtmux->moov_recov_file_path);
       break;
+    case PROP_MOOV_RECOV_SYNC_INTERVAL:
+      g_value_set_uint64 (value, qtmux->moov_recov_sync_interval);
+      break;
     case PROP_FRAGMENT_DURATION:
       g_value_set_uint (value, qtmux->fragment_duration);
       break;
+    case PROP_CHUNK_SAMPLES:
+      g_value_set_uint (value, qtmux->chunk_samples);
+      break;
     case PROP_STREAMABLE:
       g_value_set_boolean (value, qtmux->streamable);
       break;
+    case PROP_RESERVED_MAX_DURATION:
+      g_value_set_uint64 (value, qtmux->reserved_max_duration);
+      break;
+    case PROP_RESERVED_BYTES_PER_SEC:
+      g_value_set_uint (value, qtmux->reserved_bytes_per_sec);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -3342,12 +3878,24 @@ gst_qt_mux_set_property (GObject * object,
       g_free (qtmux->moov_recov_file_path);
       qtmux->moov_recov_file_path = g_value_dup_string (value);
       break;
+    case PROP_MOOV_RECOV_SYNC_INTERVAL:
+      qtmux->moov_recov_sync_interval = g_value_get_uint64 (value);
+      break;
     case PROP_FRAGMENT_DURATION:
       qtmux->fragment_duration = g_value_get_uint (value);
       break;
+    case PROP_CHUNK_SAMPLES:
+      qtmux->chunk_samples = g_value_get_uint (value);
+      break;
     case PROP_STREAMABLE:
       qtmux->streamable = g_value_get_boolean (value);
       break;
+    case PROP_RESERVED_MAX_DURATION:
+      qtmux->reserved_max_duration = g_value_get_uint64 (value);
+      break;
+    case PROP_RESERVED_BYTES_PER_SEC:
+      qtmux->reserved_bytes_per_sec = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
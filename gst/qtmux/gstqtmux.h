@@ -152,6 +152,9 @@ struct _GstQTMux
   guint64 mdat_size;
   /* position of mdat atom (for later updating) */
   guint64 mdat_pos;
+  /* position and size of the space reserved for the moov, if any */
+  guint64 moov_pos;
+  guint64 reserved_moov_size;
 
   /* keep track of the largest chunk to fine-tune brands */
   GstClockTime longest_chunk;
@@ -171,10 +174,24 @@ struct _GstQTMux
 
   /* moov recovery */
   FILE *moov_recov_file;
+  AtomsRecovJournal *moov_recov_journal;
+  GstClockTime moov_recov_last_sync;
 
   /* fragment sequence */
   guint32 fragment_sequence;
 
+  /* chunked fragments: pad whose key frames start the fragments,
+   * and offset and timing of the current fragment */
+  GstQTPad *fragment_ref_pad;
+  guint64 fragment_offset;
+  gint64 fragment_start_dts;
+  gint64 fragment_end_dts;
+
+  /* segment index, written into the space reserved after the moov */
+  AtomSIDX *sidx;
+  guint64 sidx_pos;
+  guint64 reserved_sidx_size;
+
   /* properties */
   guint32 timescale;
   guint32 trak_timescale;
@@ -184,8 +201,12 @@ struct _GstQTMux
   gint dts_method;
   gchar *fast_start_file_path;
   gchar *moov_recov_file_path;
+  GstClockTime moov_recov_sync_interval;
   guint32 fragment_duration;
+  guint32 chunk_samples;
   gboolean streamable;
+  GstClockTime reserved_max_duration;
+  guint reserved_bytes_per_sec;
 
   /* for collect pads event handling function */
   GstPadEventFunction collect_event;
@@ -49,11 +49,28 @@ prop_copy_ensure_buffer (guint8 ** buffer, guint64 * bsize, guint64 * offset,
     guint64 size)
 {
   if (buffer && *bsize - *offset < size) {
-    *bsize += size + 10 * 1024;
+    /* grow geometrically to keep the number of reallocs down */
+    *bsize = MAX (*bsize * 2, *offset + size + 10 * 1024);
     *buffer = g_realloc (*buffer, *bsize);
   }
 }
 
+/* reserves size bytes at offset, to be filled in by the caller; returns
+ * where to write them, or NULL if only the size is being calculated */
+guint8 *
+prop_copy_reserve (guint8 ** buffer, guint64 * bsize, guint64 * offset,
+    guint64 size)
+{
+  guint8 *data = NULL;
+
+  if (buffer) {
+    prop_copy_ensure_buffer (buffer, bsize, offset, size);
+    data = *buffer + *offset;
+  }
+  *offset += size;
+  return data;
+}
+
 static guint64
 copy_func (void *prop, guint size, guint8 ** buffer, guint64 * bsize,
     guint64 * offset)
@@ -57,6 +57,7 @@
  */
 
 void    prop_copy_ensure_buffer          (guint8 ** buffer, guint64 * bsize, guint64 * offset, guint64 size);
+guint8 *prop_copy_reserve                (guint8 ** buffer, guint64 * bsize, guint64 * offset, guint64 size);
 
 guint64 prop_copy_uint8                  (guint8 prop, guint8 **buffer, guint64 *size, guint64 *offset);
 guint64 prop_copy_uint16                 (guint16 prop, guint8 **buffer, guint64 *size, guint64 *offset);
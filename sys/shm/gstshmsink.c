@@ -45,7 +45,13 @@ enum
   PROP_SOCKET_PATH,
   PROP_PERMS,
   PROP_SHM_SIZE,
-  PROP_WAIT_FOR_CONNECTION
+  PROP_WAIT_FOR_CONNECTION,
+  PROP_ALLOC_STATS,
+  PROP_MAX_IN_FLIGHT,
+  PROP_LAG_POLICY,
+  PROP_MEMFD,
+  PROP_HUGEPAGES,
+  PROP_MAX_AREAS
 };
 
 struct GstShmClient
@@ -57,6 +63,31 @@ struct GstShmClient
 #define DEFAULT_SIZE ( 256 * 1024 )
 #define DEFAULT_WAIT_FOR_CONNECTION (TRUE)
 #define DEFAULT_PERMS (S_IRWXU | S_IRWXG)
+#define DEFAULT_MAX_IN_FLIGHT (0)
+#define DEFAULT_LAG_POLICY GST_SHM_SINK_LAG_POLICY_DROP_NEW
+#define DEFAULT_MEMFD (FALSE)
+#define DEFAULT_HUGEPAGES (FALSE)
+#define DEFAULT_MAX_AREAS (1)
+
+#define GST_TYPE_SHM_SINK_LAG_POLICY (gst_shm_sink_lag_policy_get_type ())
+static GType
+gst_shm_sink_lag_policy_get_type (void)
+{
+  static GType lag_policy_type = 0;
+  static const GEnumValue lag_policies[] = {
+    {GST_SHM_SINK_LAG_POLICY_DROP_NEW,
+        "Don't send new buffers to a late client", "drop-new"},
+    {GST_SHM_SINK_LAG_POLICY_DROP_OLD,
+        "Drop the oldest undelivered buffers of a late client", "drop-old"},
+    {0, NULL, NULL},
+  };
+
+  if (!lag_policy_type) {
+    lag_policy_type =
+        g_enum_register_static ("GstShmSinkLagPolicy", lag_policies);
+  }
+  return lag_policy_type;
+}
 
 
 GST_DEBUG_CATEGORY_STATIC (shmsink_debug);
@@ -86,6 +117,8 @@ static gboolean gst_shm_sink_unlock (GstBaseSink * bsink);
 static gboolean gst_shm_sink_unlock_stop (GstBaseSink * bsink);
 
 static gpointer pollthread_func (gpointer data);
+static void gst_shm_sink_wake_clients (GstShmSink * self);
+static void gst_shm_sink_update_lag_policy (GstShmSink * self);
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
@@ -111,6 +144,11 @@ gst_shm_sink_init (GstShmSink * self, GstShmSinkClass * g_class)
   self->size = DEFAULT_SIZE;
   self->wait_for_connection = DEFAULT_WAIT_FOR_CONNECTION;
   self->perms = DEFAULT_PERMS;
+  self->max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+  self->lag_policy = DEFAULT_LAG_POLICY;
+  self->memfd = DEFAULT_MEMFD;
+  self->hugepages = DEFAULT_HUGEPAGES;
+  self->max_areas = DEFAULT_MAX_AREAS;
 }
 
 static void
@@ -163,6 +201,52 @@ gst_shm_sink_class_init (GstShmSinkClass * klass)
           DEFAULT_WAIT_FOR_CONNECTION,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_ALLOC_STATS,
+      g_param_spec_boxed ("alloc-stats",
+          "Allocation statistics",
+          "Usage and fragmentation of the current shared memory area "
+          "(NULL when not started)",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_IN_FLIGHT,
+      g_param_spec_uint ("max-in-flight",
+          "Maximum buffers in flight per client",
+          "Maximum number of buffers a client can hold without releasing them,"
+          " as many more can wait to be delivered to it, the lag-policy"
+          " applies past that (0 = unlimited)",
+          0, G_MAXINT, DEFAULT_MAX_IN_FLIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LAG_POLICY,
+      g_param_spec_enum ("lag-policy",
+          "Lag policy",
+          "What to do with the buffers for a client that reached max-in-flight",
+          GST_TYPE_SHM_SINK_LAG_POLICY, DEFAULT_LAG_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MEMFD,
+      g_param_spec_boolean ("memfd",
+          "Pass memfd areas",
+          "Pass the shared memory to the clients as memfd descriptors instead"
+          " of named POSIX shared memory (applies on the next start)",
+          DEFAULT_MEMFD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_HUGEPAGES,
+      g_param_spec_boolean ("hugepages",
+          "Use huge pages",
+          "Back the shared memory with huge pages if possible, reserved ones"
+          " for memfd areas, transparent ones otherwise (applies on the next"
+          " start)", DEFAULT_HUGEPAGES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_AREAS,
+      g_param_spec_uint ("max-areas",
+          "Maximum number of areas",
+          "Number of shared memory areas of shm-size bytes the sink may use, "
+          "a new one is added when the others are full",
+          1, G_MAXINT, DEFAULT_MAX_AREAS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   signals[SIGNAL_CLIENT_CONNECTED] = g_signal_new ("client-connected",
       GST_TYPE_SHM_SINK, G_SIGNAL_RUN_LAST, 0, NULL, NULL,
       g_cclosure_marshal_VOID__INT, G_TYPE_NONE, 1, G_TYPE_INT);
@@ -184,6 +268,18 @@ gst_shm_sink_finalize (GObject * object)
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+/* Must be called with the object lock held */
+static void
+gst_shm_sink_update_lag_policy (GstShmSink * self)
+{
+  if (self->pipe) {
+    sp_writer_set_lag_policy (self->pipe, self->max_in_flight,
+        self->lag_policy == GST_SHM_SINK_LAG_POLICY_DROP_OLD);
+    /* A higher limit can let queued buffers through */
+    gst_shm_sink_wake_clients (self);
+  }
+}
+
 /*
  * Set the value of a property for the server sink.
  */
@@ -214,12 +310,13 @@ gst_shm_sink_set_property (GObject * object, guint prop_id,
     case PROP_SHM_SIZE:
       GST_OBJECT_LOCK (object);
       if (self->pipe) {
-        if (sp_writer_resize (self->pipe, g_value_get_uint (value)) < 0)
+        if (sp_writer_resize (self->pipe, g_value_get_uint (value)) >= 0)
           GST_DEBUG_OBJECT (self, "Resized shared memory area from %u to "
               "%u bytes", self->size, g_value_get_uint (value));
         else
           GST_WARNING_OBJECT (self, "Could not resize shared memory area from"
               "%u to %u bytes", self->size, g_value_get_uint (value));
+        gst_shm_sink_wake_clients (self);
       }
       self->size = g_value_get_uint (value);
       GST_OBJECT_UNLOCK (object);
@@ -230,6 +327,33 @@ gst_shm_sink_set_property (GObject * object, guint prop_id,
       GST_OBJECT_UNLOCK (object);
       g_cond_broadcast (self->cond);
       break;
+    case PROP_MAX_IN_FLIGHT:
+      GST_OBJECT_LOCK (object);
+      self->max_in_flight = g_value_get_uint (value);
+      gst_shm_sink_update_lag_policy (self);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_LAG_POLICY:
+      GST_OBJECT_LOCK (object);
+      self->lag_policy = g_value_get_enum (value);
+      gst_shm_sink_update_lag_policy (self);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_MEMFD:
+      GST_OBJECT_LOCK (object);
+      self->memfd = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_HUGEPAGES:
+      GST_OBJECT_LOCK (object);
+      self->hugepages = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
+    case PROP_MAX_AREAS:
+      GST_OBJECT_LOCK (object);
+      self->max_areas = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       break;
   }
@@ -264,6 +388,43 @@ gst_shm_sink_get_property (GObject * object, guint prop_id,
     case PROP_WAIT_FOR_CONNECTION:
       g_value_set_boolean (value, self->wait_for_connection);
       break;
+    case PROP_ALLOC_STATS:
+      if (self->pipe) {
+        ShmAllocStats stats;
+        unsigned long free_bytes;
+
+        sp_writer_get_alloc_stats (self->pipe, &stats);
+        free_bytes = stats.size - stats.used;
+
+        /* fragmentation is the part of the free space that can't be
+         * allocated in one block */
+        g_value_take_boxed (value, gst_structure_new ("GstShmSinkAllocStats",
+                "size", G_TYPE_ULONG, stats.size,
+                "used", G_TYPE_ULONG, stats.used,
+                "largest-free", G_TYPE_ULONG, stats.largest_free,
+                "blocks", G_TYPE_UINT, stats.n_blocks,
+                "free-extents", G_TYPE_UINT, stats.n_free_extents,
+                "fragmentation", G_TYPE_DOUBLE, free_bytes ?
+                1.0 - (gdouble) stats.largest_free / free_bytes : 0.0, NULL));
+      } else {
+        g_value_set_boxed (value, NULL);
+      }
+      break;
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, self->max_in_flight);
+      break;
+    case PROP_LAG_POLICY:
+      g_value_set_enum (value, self->lag_policy);
+      break;
+    case PROP_MEMFD:
+      g_value_set_boolean (value, self->memfd);
+      break;
+    case PROP_HUGEPAGES:
+      g_value_set_boolean (value, self->hugepages);
+      break;
+    case PROP_MAX_AREAS:
+      g_value_set_uint (value, self->max_areas);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -290,7 +451,9 @@ gst_shm_sink_start (GstBaseSink * bsink)
   GST_DEBUG_OBJECT (self, "Creating new socket at %s"
       " with shared memory of %d bytes", self->socket_path, self->size);
 
-  self->pipe = sp_writer_create (self->socket_path, self->size, self->perms);
+  self->pipe = sp_writer_create (self->socket_path, self->size, self->perms,
+      (self->memfd ? SP_AREA_MEMFD : 0) |
+      (self->hugepages ? SP_AREA_HUGEPAGES : 0));
 
   if (!self->pipe) {
     GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ_WRITE,
@@ -299,6 +462,8 @@ gst_shm_sink_start (GstBaseSink * bsink)
   }
 
   sp_set_data (self->pipe, self);
+  sp_writer_set_lag_policy (self->pipe, self->max_in_flight,
+      self->lag_policy == GST_SHM_SINK_LAG_POLICY_DROP_OLD);
   g_free (self->socket_path);
   self->socket_path = g_strdup (sp_writer_get_path (self->pipe));
 
@@ -359,6 +524,43 @@ gst_shm_sink_stop (GstBaseSink * bsink)
   return TRUE;
 }
 
+/* Must be called with the object lock held. The commands are only queued by
+ * the pipe, this makes the poll thread send them to the clients, so a slow
+ * client never blocks the streaming thread */
+static void
+gst_shm_sink_wake_clients (GstShmSink * self)
+{
+  GList *item;
+
+  for (item = self->clients; item; item = item->next) {
+    struct GstShmClient *gclient = item->data;
+
+    gst_poll_fd_ctl_write (self->poll, &gclient->pollfd, TRUE);
+  }
+  gst_poll_restart (self->poll);
+}
+
+/* Must be called with the object lock held, adds an area if all are full */
+static ShmBlock *
+gst_shm_sink_alloc_block (GstShmSink * self, gsize size)
+{
+  ShmBlock *block = sp_writer_alloc_block (self->pipe, size);
+
+  if (!block && sp_writer_get_num_areas (self->pipe) < self->max_areas) {
+    GST_DEBUG_OBJECT (self, "Shared memory full, adding an area of %"
+        G_GSIZE_FORMAT " bytes", MAX (size, self->size));
+
+    if (sp_writer_add_area (self->pipe, MAX (size, self->size)) >= 0) {
+      gst_shm_sink_wake_clients (self);
+      block = sp_writer_alloc_block (self->pipe, size);
+    } else {
+      GST_WARNING_OBJECT (self, "Could not add a shared memory area");
+    }
+  }
+
+  return block;
+}
+
 static GstFlowReturn
 gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
 {
@@ -377,11 +579,39 @@ gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
   rv = sp_writer_send_buf (self->pipe, (char *) GST_BUFFER_DATA (buf),
       GST_BUFFER_SIZE (buf));
 
-  if (rv == -1) {
+  /* Copy the data into a block if it is not in shared memory already. The
+   * area of the block can be retired by a resize while the lock is released
+   * for the copy, then copy it again into a new block */
+  while (rv == -1) {
     ShmBlock *block = NULL;
     gchar *shmbuf = NULL;
-    while ((block = sp_writer_alloc_block (self->pipe,
+    while ((block = gst_shm_sink_alloc_block (self,
                 GST_BUFFER_SIZE (buf))) == NULL) {
+      size_t area_size = sp_writer_get_max_area_size (self->pipe);
+
+      /* Releasing blocks will not help, no area can hold the buffer */
+      if (GST_BUFFER_SIZE (buf) > area_size &&
+          sp_writer_get_num_areas (self->pipe) >= self->max_areas) {
+        GST_OBJECT_UNLOCK (self);
+        GST_ELEMENT_ERROR (self, RESOURCE, NO_SPACE_LEFT,
+            ("Shared memory area is too small"),
+            ("A buffer of %u bytes doesn't fit in an area of %" G_GSIZE_FORMAT
+                " bytes, increase shm-size or max-areas",
+                GST_BUFFER_SIZE (buf), area_size));
+        return GST_FLOW_ERROR;
+      }
+      if (self->max_in_flight &&
+          self->lag_policy == GST_SHM_SINK_LAG_POLICY_DROP_OLD) {
+        int dropped = sp_writer_drop_queued (self->pipe);
+
+        if (dropped > 0) {
+          GST_DEBUG_OBJECT (self, "No room for a block of %u bytes, dropped"
+              " %d undelivered buffers", GST_BUFFER_SIZE (buf), dropped);
+          continue;
+        }
+      }
+      GST_LOG_OBJECT (self, "No room for a block of %u bytes, waiting for the"
+          " clients to release some", GST_BUFFER_SIZE (buf));
       g_cond_wait (self->cond, GST_OBJECT_GET_LOCK (self));
       if (self->unlock) {
         GST_OBJECT_UNLOCK (self);
@@ -397,13 +627,23 @@ gst_shm_sink_render (GstBaseSink * bsink, GstBuffer * buf)
       }
     }
 
-
+    /* The block is ours until it is sent, don't make the poll thread wait
+     * for the copy */
+    GST_OBJECT_UNLOCK (self);
     shmbuf = sp_writer_block_get_buf (block);
     memcpy (shmbuf, GST_BUFFER_DATA (buf), GST_BUFFER_SIZE (buf));
-    sp_writer_send_buf (self->pipe, shmbuf, GST_BUFFER_SIZE (buf));
+    GST_OBJECT_LOCK (self);
+
+    rv = sp_writer_send_buf (self->pipe, shmbuf, GST_BUFFER_SIZE (buf));
     sp_writer_free_block (block);
+    if (rv == -1)
+      GST_DEBUG_OBJECT (self, "Shared memory area was resized during the "
+          "copy, copying again");
   }
 
+  if (rv > 0)
+    gst_shm_sink_wake_clients (self);
+
   GST_OBJECT_UNLOCK (self);
 
   return GST_FLOW_OK;
@@ -435,7 +675,7 @@ gst_shm_sink_buffer_alloc (GstBaseSink * sink, guint64 offset, guint size,
   gpointer buf = NULL;
 
   GST_OBJECT_LOCK (self);
-  block = sp_writer_alloc_block (self->pipe, size);
+  block = gst_shm_sink_alloc_block (self, size);
   if (block) {
     buf = sp_writer_block_get_buf (block);
     g_object_ref (self);
@@ -512,7 +752,11 @@ pollthread_func (gpointer data)
       gclient->pollfd.fd = sp_writer_get_client_fd (client);
       gst_poll_add_fd (self->poll, &gclient->pollfd);
       gst_poll_fd_ctl_read (self->poll, &gclient->pollfd, TRUE);
+      /* The shm area description is waiting to be sent */
+      gst_poll_fd_ctl_write (self->poll, &gclient->pollfd, TRUE);
+      GST_OBJECT_LOCK (self);
       self->clients = g_list_prepend (self->clients, gclient);
+      GST_OBJECT_UNLOCK (self);
       g_signal_emit (self, signals[SIGNAL_CLIENT_CONNECTED], 0,
           gclient->pollfd.fd);
     }
@@ -536,6 +780,9 @@ pollthread_func (gpointer data)
 
         GST_OBJECT_LOCK (self);
         rv = sp_writer_recv (self->pipe, gclient->client);
+        /* The acks may let more buffers go to this client */
+        if (rv >= 0 && sp_writer_prepare_flush (self->pipe, gclient->client))
+          gst_poll_fd_ctl_write (self->poll, &gclient->pollfd, TRUE);
         GST_OBJECT_UNLOCK (self);
 
         if (rv < 0) {
@@ -544,14 +791,38 @@ pollthread_func (gpointer data)
           goto close_client;
         }
       }
+
+      if (gst_poll_fd_can_write (self->poll, &gclient->pollfd)) {
+        int rv;
+
+        /* Everything queued since the last wakeup goes out in one send,
+         * which is done without holding the lock */
+        GST_OBJECT_LOCK (self);
+        rv = sp_writer_prepare_flush (self->pipe, gclient->client);
+        GST_OBJECT_UNLOCK (self);
+
+        if (rv > 0)
+          rv = sp_writer_flush (gclient->client);
+
+        if (rv < 0) {
+          GST_WARNING_OBJECT (self, "One client has write error,"
+              " closing (errno: %d)", errno);
+          goto close_client;
+        }
+
+        GST_OBJECT_LOCK (self);
+        if (rv == 0)
+          rv = sp_writer_prepare_flush (self->pipe, gclient->client);
+        gst_poll_fd_ctl_write (self->poll, &gclient->pollfd, rv > 0);
+        GST_OBJECT_UNLOCK (self);
+      }
       continue;
     close_client:
       GST_OBJECT_LOCK (self);
       sp_writer_close_client (self->pipe, gclient->client);
-      GST_OBJECT_UNLOCK (self);
-
       gst_poll_remove_fd (self->poll, &gclient->pollfd);
       self->clients = g_list_remove (self->clients, gclient);
+      GST_OBJECT_UNLOCK (self);
 
       g_signal_emit (self, signals[SIGNAL_CLIENT_DISCONNECTED], 0,
           gclient->pollfd.fd);
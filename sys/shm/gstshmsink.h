@@ -41,6 +41,12 @@ G_BEGIN_DECLS
 typedef struct _GstShmSink GstShmSink;
 typedef struct _GstShmSinkClass GstShmSinkClass;
 
+typedef enum
+{
+  GST_SHM_SINK_LAG_POLICY_DROP_NEW,
+  GST_SHM_SINK_LAG_POLICY_DROP_OLD
+} GstShmSinkLagPolicy;
+
 struct _GstShmSink
 {
   GstBaseSink element;
@@ -59,6 +65,11 @@ struct _GstShmSink
   GstPollFD serverpollfd;
 
   gboolean wait_for_connection;
+  guint max_in_flight;
+  GstShmSinkLagPolicy lag_policy;
+  gboolean memfd;
+  gboolean hugepages;
+  guint max_areas;
   gboolean stop;
   gboolean unlock;
 
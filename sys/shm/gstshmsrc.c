@@ -40,9 +40,16 @@ enum
 {
   PROP_0,
   PROP_SOCKET_PATH,
-  PROP_IS_LIVE
+  PROP_IS_LIVE,
+  PROP_ACK_BATCH
 };
 
+#define DEFAULT_ACK_BATCH 1
+
+/* Acks waiting for a batch to fill are sent anyway after that long without
+ * a new buffer, so the sink never runs out of space because of them */
+#define ACK_FLUSH_TIMEOUT (50 * GST_MSECOND)
+
 struct GstShmBuffer
 {
   char *buf;
@@ -132,6 +139,13 @@ gst_shm_src_class_init (GstShmSrcClass * klass)
           "True if the element cannot produce data in PAUSED", FALSE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class, PROP_ACK_BATCH,
+      g_param_spec_uint ("ack-batch", "Released buffers per acknowledgement",
+          "Number of released buffers to acknowledge to the sink at once,"
+          " the sink only gets the memory back then",
+          1, G_MAXINT, DEFAULT_ACK_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   GST_DEBUG_CATEGORY_INIT (shmsrc_debug, "shmsrc", 0, "Shared Memory Source");
 }
 
@@ -140,6 +154,7 @@ gst_shm_src_init (GstShmSrc * self, GstShmSrcClass * g_class)
 {
   self->poll = gst_poll_new (TRUE);
   gst_poll_fd_init (&self->pollfd);
+  self->ack_batch = DEFAULT_ACK_BATCH;
 }
 
 static void
@@ -175,6 +190,11 @@ gst_shm_src_set_property (GObject * object, guint prop_id,
       gst_base_src_set_live (GST_BASE_SRC (object),
           g_value_get_boolean (value));
       break;
+    case PROP_ACK_BATCH:
+      GST_OBJECT_LOCK (object);
+      self->ack_batch = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -196,6 +216,11 @@ gst_shm_src_get_property (GObject * object, guint prop_id,
     case PROP_IS_LIVE:
       g_value_set_boolean (value, gst_base_src_is_live (GST_BASE_SRC (object)));
       break;
+    case PROP_ACK_BATCH:
+      GST_OBJECT_LOCK (object);
+      g_value_set_uint (value, self->ack_batch);
+      GST_OBJECT_UNLOCK (object);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -287,7 +312,9 @@ free_buffer (gpointer data)
   GST_LOG ("Freeing buffer %p", gsb->buf);
 
   GST_OBJECT_LOCK (gsb->pipe->src);
-  sp_client_recv_finish (gsb->pipe->pipe, gsb->buf);
+  if (sp_client_recv_release (gsb->pipe->pipe, gsb->buf) >=
+      gsb->pipe->src->ack_batch)
+    sp_client_flush_acks (gsb->pipe->pipe);
   GST_OBJECT_UNLOCK (gsb->pipe->src);
 
   gst_shm_pipe_dec (gsb->pipe);
@@ -302,9 +329,15 @@ gst_shm_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
   gchar *buf = NULL;
   int rv = 0;
   struct GstShmBuffer *gsb;
+  GstClockTime timeout;
+
+  GST_OBJECT_LOCK (self);
+  timeout = self->ack_batch > 1 ? ACK_FLUSH_TIMEOUT : GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (self);
 
   do {
-    if (gst_poll_wait (self->poll, GST_CLOCK_TIME_NONE) < 0) {
+    rv = gst_poll_wait (self->poll, timeout);
+    if (rv < 0) {
       if (errno == EBUSY)
         return GST_FLOW_WRONG_STATE;
       GST_ELEMENT_ERROR (self, RESOURCE, READ, ("Failed to read from shmsrc"),
@@ -312,6 +345,13 @@ gst_shm_src_create (GstPushSrc * psrc, GstBuffer ** outbuf)
       return GST_FLOW_ERROR;
     }
 
+    if (rv == 0) {
+      GST_OBJECT_LOCK (self);
+      sp_client_flush_acks (self->pipe->pipe);
+      GST_OBJECT_UNLOCK (self);
+      continue;
+    }
+
     if (self->unlocked)
       return GST_FLOW_WRONG_STATE;
 
@@ -54,6 +54,8 @@ struct _GstShmSrc
   GstPollFD pollfd;
 
 
+  guint ack_batch;
+
   GstFlowReturn flow_return;
   gboolean unlocked;
 };
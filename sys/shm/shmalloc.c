@@ -33,19 +33,45 @@
 #include <string.h>
 #include <assert.h>
 
+/* Blocks are allocated in multiples of this, which also keeps every block
+ * aligned on a cache line */
+#define SHM_ALLOC_ALIGN 64
+#define SHM_ALLOC_ALIGN_UP(size) \
+  (((size) + SHM_ALLOC_ALIGN - 1) & ~((unsigned long) SHM_ALLOC_ALIGN - 1))
+
+/* Free extents are kept in lists by size class, class n holds the extents
+ * of SHM_ALLOC_ALIGN << n bytes up to twice that. */
+#define SHM_ALLOC_NUM_CLASSES 32
+
 /* This is the allocated space to hold multiple blocks */
 struct _ShmAllocSpace
 {
   /* The total size of this space */
   size_t size;
 
-  /* chained list of the blocks contained in this space */
-  ShmAllocBlock *blocks;
+  /* All the extents (used or free) covering this space, in offset order */
+  ShmAllocBlock *extents;
+
+  /* The free extents, by size class */
+  ShmAllocBlock *free_lists[SHM_ALLOC_NUM_CLASSES];
+
+  /* The used blocks, sorted by offset for the lookups */
+  ShmAllocBlock **used;
+  unsigned int n_used;
+  unsigned int used_size;
+
+  /* Statistics */
+  unsigned long used_bytes;
+  unsigned int n_free;
+
+  /* Block structures kept for reuse, chained by next */
+  ShmAllocBlock *spare;
 };
 
-/* A single block of data */
+/* A single block of data, or a free extent of the space */
 struct _ShmAllocBlock
 {
+  /* 0 for free extents */
   int use_count;
 
   /* Pointer back to the AllocSpace where this block is */
@@ -56,11 +82,151 @@ struct _ShmAllocBlock
   /* The size of the block */
   unsigned long size;
 
-  /* Pointer to the next block in the chain */
+  /* The neighbours in the space */
+  ShmAllocBlock *prev;
   ShmAllocBlock *next;
+
+  /* The neighbours in the free list, only for free extents */
+  ShmAllocBlock *prev_free;
+  ShmAllocBlock *next_free;
 };
 
 
+static ShmAllocBlock *
+shm_alloc_space_new_extent (ShmAllocSpace * self, unsigned long offset,
+    unsigned long size)
+{
+  ShmAllocBlock *extent;
+
+  if (self->spare) {
+    extent = self->spare;
+    self->spare = extent->next;
+  } else {
+    extent = spalloc_new (ShmAllocBlock);
+  }
+
+  memset (extent, 0, sizeof (ShmAllocBlock));
+  extent->space = self;
+  extent->offset = offset;
+  extent->size = size;
+
+  return extent;
+}
+
+static void
+shm_alloc_space_release_extent (ShmAllocSpace * self, ShmAllocBlock * extent)
+{
+  extent->next = self->spare;
+  self->spare = extent;
+}
+
+static unsigned int
+size_class (unsigned long size)
+{
+  unsigned int class = 0;
+
+  size /= SHM_ALLOC_ALIGN;
+  while (size > 1 && class < SHM_ALLOC_NUM_CLASSES - 1) {
+    size >>= 1;
+    class++;
+  }
+
+  return class;
+}
+
+static void
+free_list_add (ShmAllocSpace * self, ShmAllocBlock * extent)
+{
+  unsigned int class = size_class (extent->size);
+
+  extent->prev_free = NULL;
+  extent->next_free = self->free_lists[class];
+  if (extent->next_free)
+    extent->next_free->prev_free = extent;
+  self->free_lists[class] = extent;
+  self->n_free++;
+}
+
+static void
+free_list_remove (ShmAllocSpace * self, ShmAllocBlock * extent)
+{
+  if (extent->prev_free)
+    extent->prev_free->next_free = extent->next_free;
+  else
+    self->free_lists[size_class (extent->size)] = extent->next_free;
+  if (extent->next_free)
+    extent->next_free->prev_free = extent->prev_free;
+  extent->prev_free = extent->next_free = NULL;
+  self->n_free--;
+}
+
+/* Returns the index of the last used block starting at or before offset,
+ * or -1 */
+static int
+used_find (ShmAllocSpace * self, unsigned long offset)
+{
+  int low = 0;
+  int high = (int) self->n_used - 1;
+  int found = -1;
+
+  while (low <= high) {
+    int mid = (low + high) / 2;
+
+    if (self->used[mid]->offset <= offset) {
+      found = mid;
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+
+  return found;
+}
+
+static int
+used_reserve (ShmAllocSpace * self)
+{
+  if (self->n_used == self->used_size) {
+    unsigned int size = self->used_size ? self->used_size * 2 : 16;
+    ShmAllocBlock **used =
+        realloc (self->used, size * sizeof (ShmAllocBlock *));
+
+    if (!used)
+      return 0;
+    self->used = used;
+    self->used_size = size;
+  }
+
+  return 1;
+}
+
+/* There must be room, see used_reserve() */
+static void
+used_insert (ShmAllocSpace * self, ShmAllocBlock * block)
+{
+  int pos = used_find (self, block->offset) + 1;
+
+  assert (self->n_used < self->used_size);
+
+  memmove (self->used + pos + 1, self->used + pos,
+      (self->n_used - pos) * sizeof (ShmAllocBlock *));
+  self->used[pos] = block;
+  self->n_used++;
+}
+
+static void
+used_remove (ShmAllocSpace * self, ShmAllocBlock * block)
+{
+  int pos = used_find (self, block->offset);
+
+  assert (pos >= 0 && self->used[pos] == block);
+
+  self->n_used--;
+  memmove (self->used + pos, self->used + pos + 1,
+      (self->n_used - pos) * sizeof (ShmAllocBlock *));
+}
+
+
 ShmAllocSpace *
 shm_alloc_space_new (size_t size)
 {
@@ -70,13 +236,34 @@ shm_alloc_space_new (size_t size)
 
   self->size = size;
 
+  if (size) {
+    self->extents = shm_alloc_space_new_extent (self, 0, size);
+    free_list_add (self, self->extents);
+  }
+
   return self;
 }
 
 void
 shm_alloc_space_free (ShmAllocSpace * self)
 {
-  assert (self && self->blocks == NULL);
+  assert (self && self->n_used == 0);
+
+  while (self->extents) {
+    ShmAllocBlock *extent = self->extents;
+
+    self->extents = extent->next;
+    spalloc_free (ShmAllocBlock, extent);
+  }
+
+  while (self->spare) {
+    ShmAllocBlock *extent = self->spare;
+
+    self->spare = extent->next;
+    spalloc_free (ShmAllocBlock, extent);
+  }
+
+  free (self->used);
   spalloc_free (ShmAllocSpace, self);
 }
 
@@ -84,45 +271,50 @@ shm_alloc_space_free (ShmAllocSpace * self)
 ShmAllocBlock *
 shm_alloc_space_alloc_block (ShmAllocSpace * self, unsigned long size)
 {
-  ShmAllocBlock *block;
-  ShmAllocBlock *item = NULL;
-  ShmAllocBlock *prev_item = NULL;
-  unsigned long prev_end_offset = 0;
+  ShmAllocBlock *block = NULL;
+  ShmAllocBlock *item;
+  unsigned int class;
+
+  size = SHM_ALLOC_ALIGN_UP (size ? size : 1);
+  if (size > self->size || !used_reserve (self))
+    return NULL;
+
+  /* Best fit in the size's own class, so frames of the same size keep
+   * reusing the same extents */
+  class = size_class (size);
+  for (item = self->free_lists[class]; item; item = item->next_free) {
+    if (item->size >= size && (!block || item->size < block->size)) {
+      block = item;
+      if (item->size == size)
+        break;
+    }
+  }
 
+  /* Anything in a bigger class is big enough */
+  for (class++; !block && class < SHM_ALLOC_NUM_CLASSES; class++)
+    block = self->free_lists[class];
 
-  for (item = self->blocks; item; item = item->next) {
-    unsigned long max_size = 0;
+  if (!block)
+    return NULL;
 
-    max_size = item->offset - prev_end_offset;
+  free_list_remove (self, block);
 
-    if (max_size >= size)
-      break;
+  if (block->size > size) {
+    ShmAllocBlock *rest = shm_alloc_space_new_extent (self,
+        block->offset + size, block->size - size);
 
-    prev_end_offset = item->offset + item->size;
-    prev_item = item;
+    rest->prev = block;
+    rest->next = block->next;
+    if (rest->next)
+      rest->next->prev = rest;
+    block->next = rest;
+    block->size = size;
+    free_list_add (self, rest);
   }
 
-  /* Did not find space before an existing block */
-  if (self->blocks && !item) {
-    /* Return NULL if there is no big enough space, otherwise, there is space
-     * at the end */
-    if (self->size - prev_end_offset < size)
-      return NULL;
-  }
-
-  block = spalloc_new (ShmAllocBlock);
-  memset (block, 0, sizeof (ShmAllocBlock));
-  block->offset = prev_end_offset;
-  block->size = size;
+  used_insert (self, block);
   block->use_count = 1;
-  block->space = self;
-
-  if (prev_item)
-    prev_item->next = block;
-  else
-    self->blocks = block;
-
-  block->next = item;
+  self->used_bytes += block->size;
 
   return block;
 }
@@ -133,40 +325,83 @@ shm_alloc_space_alloc_block_get_offset (ShmAllocBlock * block)
   return block->offset;
 }
 
+static void
+shm_alloc_space_merge_next (ShmAllocSpace * self, ShmAllocBlock * extent)
+{
+  ShmAllocBlock *next = extent->next;
+
+  extent->size += next->size;
+  extent->next = next->next;
+  if (extent->next)
+    extent->next->prev = extent;
+
+  shm_alloc_space_release_extent (self, next);
+}
+
 static void
 shm_alloc_space_free_block (ShmAllocBlock * block)
 {
-  ShmAllocBlock *item = NULL;
-  ShmAllocBlock *prev_item = NULL;
   ShmAllocSpace *self = block->space;
 
-  for (item = self->blocks; item; item = item->next) {
-    if (item == block) {
-      if (prev_item)
-        prev_item->next = item->next;
-      else
-        self->blocks = item->next;
-      break;
-    }
-    prev_item = item;
+  used_remove (self, block);
+  self->used_bytes -= block->size;
+
+  if (block->next && block->next->use_count == 0) {
+    free_list_remove (self, block->next);
+    shm_alloc_space_merge_next (self, block);
   }
 
-  spalloc_free (ShmAllocBlock, block);
+  if (block->prev && block->prev->use_count == 0) {
+    ShmAllocBlock *prev = block->prev;
+
+    free_list_remove (self, prev);
+    shm_alloc_space_merge_next (self, prev);
+    block = prev;
+  }
+
+  free_list_add (self, block);
 }
 
 ShmAllocBlock *
 shm_alloc_space_block_get (ShmAllocSpace * self, unsigned long offset)
 {
-  ShmAllocBlock *block = NULL;
+  ShmAllocBlock *block;
+  int pos = used_find (self, offset);
 
-  for (block = self->blocks; block; block = block->next) {
-    if (block->offset <= offset && (block->offset + block->size) > offset)
-      return block;
-  }
+  if (pos < 0)
+    return NULL;
+
+  block = self->used[pos];
+  if (block->offset + block->size > offset)
+    return block;
 
   return NULL;
 }
 
+void
+shm_alloc_space_get_stats (ShmAllocSpace * self, ShmAllocStats * stats)
+{
+  int class;
+
+  memset (stats, 0, sizeof (ShmAllocStats));
+
+  stats->size = self->size;
+  stats->used = self->used_bytes;
+  stats->n_blocks = self->n_used;
+  stats->n_free_extents = self->n_free;
+
+  for (class = SHM_ALLOC_NUM_CLASSES - 1; class >= 0; class--) {
+    ShmAllocBlock *item;
+
+    for (item = self->free_lists[class]; item; item = item->next_free)
+      if (item->size > stats->largest_free)
+        stats->largest_free = item->size;
+
+    if (stats->largest_free)
+      break;
+  }
+}
+
 
 void
 shm_alloc_space_block_inc (ShmAllocBlock * block)
@@ -52,6 +52,19 @@ extern "C" {
 
 typedef struct _ShmAllocSpace ShmAllocSpace;
 typedef struct _ShmAllocBlock ShmAllocBlock;
+typedef struct _ShmAllocStats ShmAllocStats;
+
+struct _ShmAllocStats
+{
+  /* The size of the space */
+  unsigned long size;
+  /* The bytes in allocated blocks, including the alignment padding */
+  unsigned long used;
+  /* The biggest block that can currently be allocated */
+  unsigned long largest_free;
+  unsigned int n_blocks;
+  unsigned int n_free_extents;
+};
 
 ShmAllocSpace *shm_alloc_space_new (size_t size);
 void shm_alloc_space_free (ShmAllocSpace * self);
@@ -66,6 +79,8 @@ void shm_alloc_space_block_dec (ShmAllocBlock * block);
 ShmAllocBlock * shm_alloc_space_block_get (ShmAllocSpace * space,
     unsigned long offset);
 
+void shm_alloc_space_get_stats (ShmAllocSpace * self, ShmAllocStats * stats);
+
 
 #ifdef __cplusplus
 }
@@ -40,6 +40,9 @@
 #include <limits.h>
 #include <sys/mman.h>
 #include <assert.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "shmalloc.h"
 
@@ -61,24 +64,58 @@
  * type 4: ack buffer
  * offset
  *
+ * type 5: new shm area passed as a file descriptor
+ * Area length
+ * The descriptor comes as SCM_RIGHTS ancillary data with the packet
+ *
+ * The server can have several areas open at once, the client must map every
+ * area it is told about until it gets a close for it.
+ *
  * Type 4 goes from the client to the server
  * The rest are from the server to the client
  * The client should never write in the SHM
+ *
+ * The server never writes to a client socket directly, it queues the packets
+ * for each client and flushes everything that was queued with a single
+ * non-blocking send, so a client that is behind receives many packets in one
+ * go. A packet may be split over two of those sends, the client must wait for
+ * its tail.
+ *
+ * The client may also send several acks at once.
+ *
+ * With a limit on the buffers in flight for each client, the server only
+ * hands a client a new buffer once it has acked enough of the previous ones,
+ * the others wait in its queue. When that queue is also full, either the new
+ * buffer is not sent to that client, or the oldest waiting one is dropped.
  */
 
 
 #define LISTEN_BACKLOG 10
 
+#define COMMAND_QUEUE_MIN_SIZE (16 * sizeof (struct CommandBuffer))
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
 enum
 {
   COMMAND_NEW_SHM_AREA = 1,
   COMMAND_CLOSE_SHM_AREA = 2,
   COMMAND_NEW_BUFFER = 3,
-  COMMAND_ACK_BUFFER = 4
+  COMMAND_ACK_BUFFER = 4,
+  COMMAND_NEW_SHM_AREA_FD = 5
 };
 
 typedef struct _ShmArea ShmArea;
 typedef struct _ShmBuffer ShmBuffer;
+typedef struct _CommandQueue CommandQueue;
+typedef struct _CommandQueueFd CommandQueueFd;
 
 struct _ShmArea
 {
@@ -91,10 +128,14 @@ struct _ShmArea
   char *shm_area_buf;
   size_t shm_area_len;
 
+  /* NULL for memfd areas */
   char *shm_area_name;
 
   ShmAllocSpace *allocspace;
 
+  /* Writer side, no new blocks are allocated in a retired area */
+  int retired;
+
   ShmArea *next;
 };
 
@@ -132,12 +173,53 @@ struct _ShmPipe
   ShmClient *clients;
 
   mode_t perms;
+  int area_flags;
+
+  /* Lag policy, 0 for no limit */
+  int max_in_flight;
+  int drop_oldest;
+
+  /* Client side, the acks that have not been sent yet */
+  struct CommandBuffer *pending_acks;
+  int num_pending_acks;
+  int pending_acks_size;
+
+  /* Client side, descriptor received with the last command */
+  int received_fd;
+};
+
+/* A descriptor to pass with the command at pos */
+struct _CommandQueueFd
+{
+  size_t pos;
+  int fd;
+};
+
+struct _CommandQueue
+{
+  char *data;
+  size_t len;
+  size_t size;
+
+  /* Sorted by position */
+  CommandQueueFd *fds;
+  int num_fds;
 };
 
 struct _ShmClient
 {
   int fd;
 
+  /* Filled by the writer calls */
+  CommandQueue queued;
+  /* Only touched by sp_writer_flush() */
+  CommandQueue sending;
+
+  /* Buffers handed to the client and not acked yet */
+  int in_flight;
+  /* Buffer notifications waiting in the queue */
+  int queued_buffers;
+
   ShmClient *next;
 };
 
@@ -173,11 +255,13 @@ struct CommandBuffer
   } payload;
 };
 
-static ShmArea *sp_open_shm (char *path, int id, mode_t perms, size_t size);
+static ShmArea *sp_open_shm (char *path, int fd, int id, mode_t perms,
+    size_t size, int flags);
 static void sp_close_shm (ShmArea * area);
 static int sp_shmbuf_dec (ShmPipe * self, ShmBuffer * buf,
     ShmBuffer * prev_buf);
 static void sp_shm_area_dec (ShmPipe * self, ShmArea * area);
+static int sp_writer_drop_oldest (ShmPipe * self, ShmClient * client);
 
 
 
@@ -188,7 +272,7 @@ static void sp_shm_area_dec (ShmPipe * self, ShmArea * area);
   } while (0)
 
 ShmPipe *
-sp_writer_create (const char *path, size_t size, mode_t perms)
+sp_writer_create (const char *path, size_t size, mode_t perms, int area_flags)
 {
   ShmPipe *self = spalloc_new (ShmPipe);
   int flags;
@@ -231,9 +315,11 @@ sp_writer_create (const char *path, size_t size, mode_t perms)
   if (listen (self->main_socket, LISTEN_BACKLOG) < 0)
     RETURN_ERROR ("listen() failed (%d): %s\n", errno, strerror (errno));
 
-  self->shm_area = sp_open_shm (NULL, ++self->next_area_id, perms, size);
+  self->shm_area = sp_open_shm (NULL, -1, ++self->next_area_id, perms, size,
+      area_flags);
 
   self->perms = perms;
+  self->area_flags = area_flags;
 
   if (!self->shm_area)
     RETURN_ERROR ("Could not open shm area (%d): %s", errno, strerror (errno));
@@ -250,21 +336,59 @@ sp_writer_create (const char *path, size_t size, mode_t perms)
   return NULL;                                            \
   } while (0)
 
+static int
+sp_memfd_create (unsigned int flags)
+{
+#if defined (__linux__) && defined (SYS_memfd_create)
+  return syscall (SYS_memfd_create, "shmpipe", MFD_CLOEXEC | flags);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Tries to back the area with explicit huge pages, they are only available
+ * if the admin reserved some */
+static int
+sp_open_hugetlb (ShmArea * area, size_t size)
+{
+  size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+
+  area->shm_fd = sp_memfd_create (MFD_HUGETLB);
+  if (area->shm_fd < 0)
+    return 0;
+
+  /* mmap() fails if there are not enough reserved pages */
+  if (ftruncate (area->shm_fd, size) == 0) {
+    area->shm_area_buf = mmap (NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, area->shm_fd, 0);
+    if (area->shm_area_buf != MAP_FAILED) {
+      area->shm_area_len = size;
+      return 1;
+    }
+  }
+
+  close (area->shm_fd);
+  area->shm_fd = -1;
+  return 0;
+}
+
 /**
  * sp_open_shm:
  * @path: Path of the shm area for a reader,
  *  NULL if this is a writer (then it will allocate its own path)
+ * @fd: The descriptor of a memfd area for a reader, -1 otherwise
+ * @flags: For a writer, the SP_AREA_* flags
  *
  * Opens a ShmArea
  */
 
 static ShmArea *
-sp_open_shm (char *path, int id, mode_t perms, size_t size)
+sp_open_shm (char *path, int fd, int id, mode_t perms, size_t size, int flags)
 {
   ShmArea *area = spalloc_new (ShmArea);
   char tmppath[PATH_MAX];
-  int flags;
-  int prot;
+  int writer = (path == NULL && fd < 0);
   int i = 0;
 
   memset (area, 0, sizeof (ShmArea));
@@ -272,48 +396,62 @@ sp_open_shm (char *path, int id, mode_t perms, size_t size)
   area->use_count = 1;
 
   area->shm_area_len = size;
-
-
-  if (path)
-    flags = O_RDONLY;
-  else
-    flags = O_RDWR | O_CREAT | O_TRUNC | O_EXCL;
-
-  area->shm_fd = -1;
+  area->shm_area_buf = MAP_FAILED;
+  area->shm_fd = fd;
+
+  if (writer && (flags & SP_AREA_MEMFD)) {
+    if (!(flags & SP_AREA_HUGEPAGES) || !sp_open_hugetlb (area, size))
+      area->shm_fd = sp_memfd_create (0);
+    if (area->shm_fd < 0)
+      fprintf (stderr, "memfd_create failed (%d): %s, using POSIX shm\n",
+          errno, strerror (errno));
+  }
 
   if (path) {
-    area->shm_fd = shm_open (path, flags, perms);
-  } else {
+    area->shm_fd = shm_open (path, O_RDONLY, perms);
+  } else if (area->shm_fd < 0) {
     do {
       snprintf (tmppath, PATH_MAX, "/shmpipe.5%d.%5d", getpid (), i++);
-      area->shm_fd = shm_open (tmppath, flags, perms);
+      area->shm_fd = shm_open (tmppath, O_RDWR | O_CREAT | O_TRUNC | O_EXCL,
+          perms);
     } while (area->shm_fd < 0 && errno == EEXIST);
+
+    if (area->shm_fd >= 0)
+      area->shm_area_name = strdup (tmppath);
   }
 
   if (area->shm_fd < 0)
     RETURN_ERROR ("shm_open failed on %s (%d): %s\n",
         path ? path : tmppath, errno, strerror (errno));
 
-  if (!path) {
-    area->shm_area_name = strdup (tmppath);
+  if (writer && area->shm_area_buf == MAP_FAILED) {
+    if (area->shm_area_name == NULL && fchmod (area->shm_fd, perms))
+      RETURN_ERROR ("Could not set permissions on memfd (%d): %s\n", errno,
+          strerror (errno));
 
     if (ftruncate (area->shm_fd, size))
       RETURN_ERROR ("Could not resize memory area to header size,"
           " ftruncate failed (%d): %s\n", errno, strerror (errno));
 
-    prot = PROT_READ | PROT_WRITE;
-  } else {
-    prot = PROT_READ;
-  }
+    area->shm_area_buf = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        area->shm_fd, 0);
 
-  area->shm_area_buf = mmap (NULL, size, prot, MAP_SHARED, area->shm_fd, 0);
+#ifdef MADV_HUGEPAGE
+    /* Fall back to transparent huge pages, if enabled for shmem */
+    if (area->shm_area_buf != MAP_FAILED && (flags & SP_AREA_HUGEPAGES))
+      madvise (area->shm_area_buf, size, MADV_HUGEPAGE);
+#endif
+  } else if (!writer) {
+    area->shm_area_buf = mmap (NULL, size, PROT_READ, MAP_SHARED,
+        area->shm_fd, 0);
+  }
 
   if (area->shm_area_buf == MAP_FAILED)
     RETURN_ERROR ("mmap failed (%d): %s\n", errno, strerror (errno));
 
   area->id = id;
 
-  if (!path)
+  if (writer)
     area->allocspace = shm_alloc_space_new (area->shm_area_len);
 
   return area;
@@ -421,6 +559,13 @@ sp_close (ShmPipe * self)
   while (self->clients)
     sp_writer_close_client (self, self->clients);
 
+  free (self->pending_acks);
+  self->pending_acks = NULL;
+
+  if (self->received_fd >= 0)
+    close (self->received_fd);
+  self->received_fd = -1;
+
   sp_dec (self);
 }
 
@@ -451,67 +596,292 @@ send_command (int fd, struct CommandBuffer *cb, unsigned short int type,
   return 1;
 }
 
+static int
+command_queue_append (CommandQueue * queue, const void *data, size_t len)
+{
+  if (queue->len + len > queue->size) {
+    size_t size = queue->size ? queue->size : COMMAND_QUEUE_MIN_SIZE;
+    char *newdata;
+
+    while (size < queue->len + len)
+      size *= 2;
+
+    newdata = realloc (queue->data, size);
+    if (!newdata)
+      return 0;
+    queue->data = newdata;
+    queue->size = size;
+  }
+
+  memcpy (queue->data + queue->len, data, len);
+  queue->len += len;
+
+  return 1;
+}
+
+static int
+command_queue_add_fd (CommandQueue * queue, size_t pos, int fd)
+{
+  CommandQueueFd *fds = realloc (queue->fds,
+      (queue->num_fds + 1) * sizeof (CommandQueueFd));
+
+  if (!fds)
+    return 0;
+
+  queue->fds = fds;
+  queue->fds[queue->num_fds].pos = pos;
+  queue->fds[queue->num_fds].fd = fd;
+  queue->num_fds++;
+
+  return 1;
+}
+
+/* Removes whole commands, or data already sent from the start */
+static void
+command_queue_remove (CommandQueue * queue, size_t pos, size_t len)
+{
+  int i;
+
+  memmove (queue->data + pos, queue->data + pos + len,
+      queue->len - pos - len);
+  queue->len -= len;
+
+  for (i = 0; i < queue->num_fds; i++) {
+    assert (queue->fds[i].pos < pos || queue->fds[i].pos >= pos + len);
+    if (queue->fds[i].pos >= pos + len)
+      queue->fds[i].pos -= len;
+  }
+}
+
+/* Moves the first len bytes of src to the end of dest */
+static int
+command_queue_move (CommandQueue * dest, CommandQueue * src, size_t len)
+{
+  size_t dest_len = dest->len;
+  int n = 0;
+  int i;
+
+  while (n < src->num_fds && src->fds[n].pos < len)
+    n++;
+
+  if (n) {
+    CommandQueueFd *fds = realloc (dest->fds,
+        (dest->num_fds + n) * sizeof (CommandQueueFd));
+
+    if (!fds)
+      return 0;
+    dest->fds = fds;
+  }
+
+  if (!command_queue_append (dest, src->data, len))
+    return 0;
+
+  for (i = 0; i < n; i++) {
+    dest->fds[dest->num_fds].pos = dest_len + src->fds[i].pos;
+    dest->fds[dest->num_fds].fd = src->fds[i].fd;
+    dest->num_fds++;
+  }
+
+  src->num_fds -= n;
+  memmove (src->fds, src->fds + n, src->num_fds * sizeof (CommandQueueFd));
+  command_queue_remove (src, 0, len);
+
+  return 1;
+}
+
+static void
+command_queue_clear (CommandQueue * queue)
+{
+  int i;
+
+  for (i = 0; i < queue->num_fds; i++)
+    close (queue->fds[i].fd);
+
+  free (queue->fds);
+  free (queue->data);
+  memset (queue, 0, sizeof (CommandQueue));
+}
+
+static int
+queue_command (ShmClient * client, struct CommandBuffer *cb,
+    unsigned short int type, int area_id)
+{
+  cb->type = type;
+  cb->area_id = area_id;
+
+  return command_queue_append (&client->queued, cb,
+      sizeof (struct CommandBuffer));
+}
+
+/* The length of the command at pos, including its payload */
+static size_t
+command_queue_peek (CommandQueue * queue, size_t pos, struct CommandBuffer *cb)
+{
+  memcpy (cb, queue->data + pos, sizeof (struct CommandBuffer));
+
+  if (cb->type == COMMAND_NEW_SHM_AREA)
+    return sizeof (struct CommandBuffer) + cb->payload.new_shm_area.path_size;
+  else
+    return sizeof (struct CommandBuffer);
+}
+
+static int
+queue_new_shm_area (ShmClient * client, ShmArea * area)
+{
+  struct CommandBuffer cb = { 0 };
+  int pathlen;
+
+  cb.payload.new_shm_area.size = area->shm_area_len;
+
+  if (!area->shm_area_name) {
+    /* The queue owns a copy of the descriptor until it is sent */
+    int fd = fcntl (area->shm_fd, F_DUPFD_CLOEXEC, 0);
+
+    if (fd < 0)
+      return 0;
+
+    if (!queue_command (client, &cb, COMMAND_NEW_SHM_AREA_FD, area->id)) {
+      close (fd);
+      return 0;
+    }
+
+    if (!command_queue_add_fd (&client->queued,
+            client->queued.len - sizeof (struct CommandBuffer), fd)) {
+      client->queued.len -= sizeof (struct CommandBuffer);
+      close (fd);
+      return 0;
+    }
+
+    return 1;
+  }
+
+  pathlen = strlen (area->shm_area_name) + 1;
+  cb.payload.new_shm_area.path_size = pathlen;
+  if (!queue_command (client, &cb, COMMAND_NEW_SHM_AREA, area->id))
+    return 0;
+
+  return command_queue_append (&client->queued, area->shm_area_name, pathlen);
+}
+
 int
 sp_writer_resize (ShmPipe * self, size_t size)
 {
   ShmArea *newarea;
-  ShmArea *old_current;
+  ShmArea *area, *next;
   ShmClient *client;
   int c = 0;
-  int pathlen;
 
   if (self->shm_area->shm_area_len == size)
     return 0;
 
-  newarea = sp_open_shm (NULL, ++self->next_area_id, self->perms, size);
+  newarea = sp_open_shm (NULL, -1, ++self->next_area_id, self->perms, size,
+      self->area_flags);
 
   if (!newarea)
     return -1;
 
-  old_current = self->shm_area;
+  for (client = self->clients; client; client = client->next) {
+    int ok = 1;
+
+    for (area = self->shm_area; area; area = area->next) {
+      struct CommandBuffer cb = { 0 };
+
+      if (!area->retired)
+        ok &= queue_command (client, &cb, COMMAND_CLOSE_SHM_AREA, area->id);
+    }
+
+    if (ok && queue_new_shm_area (client, newarea))
+      c++;
+  }
+
+  /* The blocks and buffers already in the old areas stay valid until they
+   * are released */
+  for (area = self->shm_area; area; area = next) {
+    next = area->next;
+    if (!area->retired) {
+      area->retired = 1;
+      sp_shm_area_dec (self, area);
+    }
+  }
+
   newarea->next = self->shm_area;
   self->shm_area = newarea;
 
-  pathlen = strlen (newarea->shm_area_name) + 1;
-
-  for (client = self->clients; client; client = client->next) {
-    struct CommandBuffer cb = { 0 };
+  return c;
+}
 
-    if (!send_command (client->fd, &cb, COMMAND_CLOSE_SHM_AREA,
-            old_current->id))
-      continue;
+int
+sp_writer_add_area (ShmPipe * self, size_t size)
+{
+  ShmArea *newarea;
+  ShmClient *client;
+  int c = 0;
 
-    cb.payload.new_shm_area.size = newarea->shm_area_len;
-    cb.payload.new_shm_area.path_size = pathlen;
-    if (!send_command (client->fd, &cb, COMMAND_NEW_SHM_AREA, newarea->id))
-      continue;
+  newarea = sp_open_shm (NULL, -1, ++self->next_area_id, self->perms, size,
+      self->area_flags);
 
-    if (send (client->fd, newarea->shm_area_name, pathlen, MSG_NOSIGNAL) !=
-        pathlen)
-      continue;
-    c++;
-  }
+  if (!newarea)
+    return -1;
 
-  sp_shm_area_dec (self, old_current);
+  newarea->next = self->shm_area;
+  self->shm_area = newarea;
 
+  for (client = self->clients; client; client = client->next)
+    if (queue_new_shm_area (client, newarea))
+      c++;
 
   return c;
 }
 
+int
+sp_writer_get_num_areas (ShmPipe * self)
+{
+  ShmArea *area;
+  int n = 0;
+
+  for (area = self->shm_area; area; area = area->next)
+    if (!area->retired)
+      n++;
+
+  return n;
+}
+
+size_t
+sp_writer_get_max_area_size (ShmPipe * self)
+{
+  ShmArea *area;
+  size_t size = 0;
+
+  for (area = self->shm_area; area; area = area->next)
+    if (!area->retired && area->shm_area_len > size)
+      size = area->shm_area_len;
+
+  return size;
+}
+
 ShmBlock *
 sp_writer_alloc_block (ShmPipe * self, size_t size)
 {
   ShmBlock *block;
-  ShmAllocBlock *ablock =
-      shm_alloc_space_alloc_block (self->shm_area->allocspace, size);
+  ShmArea *area;
+  ShmAllocBlock *ablock = NULL;
+
+  /* The newest area first */
+  for (area = self->shm_area; area; area = area->next) {
+    if (area->retired)
+      continue;
+    ablock = shm_alloc_space_alloc_block (area->allocspace, size);
+    if (ablock)
+      break;
+  }
 
   if (!ablock)
     return NULL;
 
   block = spalloc_new (ShmBlock);
-  sp_shm_area_inc (self->shm_area);
+  sp_shm_area_inc (area);
   block->pipe = self;
-  block->area = self->shm_area;
+  block->area = area;
   block->ablock = ablock;
   sp_inc (self);
   return block;
@@ -539,7 +909,8 @@ sp_writer_free_block (ShmBlock * block)
   spalloc_free (ShmBlock, block);
 }
 
-/* Returns the number of client this has successfully been sent to */
+/* Returns the number of client this has successfully been queued for,
+ * the notifications go out with the next sp_writer_flush() */
 
 int
 sp_writer_send_buf (ShmPipe * self, char *buf, size_t size)
@@ -566,7 +937,9 @@ sp_writer_send_buf (ShmPipe * self, char *buf, size_t size)
     }
   }
 
-  if (!ablock)
+  /* Clients may have unmapped a retired area, the caller must copy the data
+   * to a new block */
+  if (!ablock || area->retired)
     return -1;
 
   sb = spalloc_alloc (sizeof (ShmBuffer) + sizeof (int) * self->num_clients);
@@ -578,38 +951,75 @@ sp_writer_send_buf (ShmPipe * self, char *buf, size_t size)
   sb->num_clients = self->num_clients;
   sb->ablock = ablock;
 
+  /* Hold a reference while dropping old buffers, they could be the last
+   * users of the area */
+  sp_shm_area_inc (area);
+  shm_alloc_space_block_inc (ablock);
+  sb->use_count = 1;
+  sb->next = self->buffers;
+  self->buffers = sb;
+
   for (client = self->clients; client; client = client->next) {
     struct CommandBuffer cb = { 0 };
+
+    if (self->max_in_flight > 0 &&
+        client->queued_buffers >= self->max_in_flight &&
+        (!self->drop_oldest || !sp_writer_drop_oldest (self, client)))
+      continue;
+
     cb.payload.buffer.offset = offset;
     cb.payload.buffer.size = bsize;
-    if (!send_command (client->fd, &cb, COMMAND_NEW_BUFFER, self->shm_area->id))
+    if (!queue_command (client, &cb, COMMAND_NEW_BUFFER, area->id))
       continue;
+    client->queued_buffers++;
     sb->clients[i++] = client->fd;
+    sb->use_count++;
     c++;
   }
 
-  if (c == 0) {
-    spalloc_free1 (sizeof (ShmBuffer) + sizeof (int) * sb->num_clients, sb);
-    return 0;
-  }
-
-  sp_shm_area_inc (area);
-  shm_alloc_space_block_inc (ablock);
-
-  sb->use_count = c;
-
-  sb->next = self->buffers;
-  self->buffers = sb;
+  sp_shmbuf_dec (self, sb, NULL);
 
   return c;
 }
 
 static int
-recv_command (int fd, struct CommandBuffer *cb)
+recv_command (ShmPipe * self, struct CommandBuffer *cb)
 {
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  char control[CMSG_SPACE (sizeof (int))];
+  struct cmsghdr *cmsg;
   int retval;
 
-  retval = recv (fd, cb, sizeof (struct CommandBuffer), MSG_DONTWAIT);
+  iov.iov_base = cb;
+  iov.iov_len = sizeof (struct CommandBuffer);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof (control);
+
+  retval = recvmsg (self->main_socket, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+  /* A descriptor comes with the first byte of its command */
+  for (cmsg = CMSG_FIRSTHDR (&msg); retval > 0 && cmsg;
+      cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      if (self->received_fd >= 0)
+        close (self->received_fd);
+      memcpy (&self->received_fd, CMSG_DATA (cmsg), sizeof (int));
+    }
+  }
+
+  /* The other side flushes without blocking, so a command can be cut in
+   * two, the rest of it is already on its way */
+  if (retval > 0 && retval < sizeof (struct CommandBuffer)) {
+    int rest = recv (self->main_socket, (char *) cb + retval,
+        sizeof (struct CommandBuffer) - retval, MSG_WAITALL);
+
+    if (rest > 0)
+      retval += rest;
+  }
+
   if (retval == sizeof (struct CommandBuffer)) {
     return 1;
   } else {
@@ -626,7 +1036,7 @@ sp_client_recv (ShmPipe * self, char **buf)
   struct CommandBuffer cb;
   int retval;
 
-  if (!recv_command (self->main_socket, &cb))
+  if (!recv_command (self, &cb))
     return -1;
 
   switch (cb.type) {
@@ -636,14 +1046,14 @@ sp_client_recv (ShmPipe * self, char **buf)
 
       area_name = malloc (cb.payload.new_shm_area.path_size);
       retval = recv (self->main_socket, area_name,
-          cb.payload.new_shm_area.path_size, 0);
+          cb.payload.new_shm_area.path_size, MSG_WAITALL);
       if (retval != cb.payload.new_shm_area.path_size) {
         free (area_name);
         return -3;
       }
 
-      newarea = sp_open_shm (area_name, cb.area_id, 0,
-          cb.payload.new_shm_area.size);
+      newarea = sp_open_shm (area_name, -1, cb.area_id, 0,
+          cb.payload.new_shm_area.size, 0);
       free (area_name);
       if (!newarea)
         return -4;
@@ -657,6 +1067,22 @@ sp_client_recv (ShmPipe * self, char **buf)
        */
       break;
 
+    case COMMAND_NEW_SHM_AREA_FD:
+      if (self->received_fd < 0)
+        return -3;
+      assert (cb.payload.new_shm_area.size > 0);
+
+      /* The area owns the descriptor now, even if it fails */
+      newarea = sp_open_shm (NULL, self->received_fd, cb.area_id, 0,
+          cb.payload.new_shm_area.size, 0);
+      self->received_fd = -1;
+      if (!newarea)
+        return -4;
+
+      newarea->next = self->shm_area;
+      self->shm_area = newarea;
+      break;
+
     case COMMAND_CLOSE_SHM_AREA:
       for (area = self->shm_area; area; area = area->next) {
         if (area->id == cb.area_id) {
@@ -684,44 +1110,119 @@ sp_client_recv (ShmPipe * self, char **buf)
   return 0;
 }
 
+/* Releases the reference of one client on a buffer */
+static int
+sp_writer_release_buffer (ShmPipe * self, ShmClient * client, int area_id,
+    unsigned long offset)
+{
+  ShmBuffer *buf = NULL, *prev_buf = NULL;
+  int i;
+
+  for (buf = self->buffers; buf; buf = buf->next) {
+    if (buf->shm_area->id == area_id && buf->offset == offset) {
+      for (i = 0; i < buf->num_clients; i++) {
+        if (buf->clients[i] == client->fd) {
+          buf->clients[i] = -1;
+          sp_shmbuf_dec (self, buf, prev_buf);
+          return 1;
+        }
+      }
+    }
+    prev_buf = buf;
+  }
+
+  return 0;
+}
+
+#define MAX_COMMANDS_PER_RECV 32
+
 int
 sp_writer_recv (ShmPipe * self, ShmClient * client)
 {
-  ShmBuffer *buf = NULL, *prev_buf = NULL;
-  struct CommandBuffer cb;
+  struct CommandBuffer cbs[MAX_COMMANDS_PER_RECV];
+  int retval;
+  int i;
 
-  if (!recv_command (client->fd, &cb))
+  retval = recv (client->fd, cbs, sizeof (cbs), MSG_DONTWAIT);
+  if (retval <= 0)
     return -1;
 
-  switch (cb.type) {
-    case COMMAND_ACK_BUFFER:
+  /* Get the end of a command that was cut */
+  if (retval % sizeof (struct CommandBuffer)) {
+    int missing = sizeof (struct CommandBuffer) -
+        retval % sizeof (struct CommandBuffer);
 
-      for (buf = self->buffers; buf; buf = buf->next) {
-        if (buf->shm_area->id == cb.area_id &&
-            buf->offset == cb.payload.ack_buffer.offset) {
-          sp_shmbuf_dec (self, buf, prev_buf);
-          break;
-        }
-        prev_buf = buf;
-      }
+    if (recv (client->fd, (char *) cbs + retval, missing,
+            MSG_WAITALL) != missing)
+      return -1;
+    retval += missing;
+  }
 
-      if (!buf)
-        return -2;
+  for (i = 0; i < retval / sizeof (struct CommandBuffer); i++) {
+    switch (cbs[i].type) {
+      case COMMAND_ACK_BUFFER:
+        if (!sp_writer_release_buffer (self, client, cbs[i].area_id,
+                cbs[i].payload.ack_buffer.offset))
+          return -2;
+        client->in_flight--;
+        break;
+      default:
+        return -99;
+    }
+  }
 
-      break;
-    default:
-      return -99;
+  return 0;
+}
+
+void
+sp_writer_set_lag_policy (ShmPipe * self, int max_in_flight, int drop_oldest)
+{
+  self->max_in_flight = max_in_flight;
+  self->drop_oldest = drop_oldest;
+}
+
+/* Drops the oldest buffer notification still waiting in the queue of the
+ * client, the ones already handed to the client can't be taken back */
+static int
+sp_writer_drop_oldest (ShmPipe * self, ShmClient * client)
+{
+  size_t pos = 0;
+
+  while (pos < client->queued.len) {
+    struct CommandBuffer cb;
+    size_t len = command_queue_peek (&client->queued, pos, &cb);
+
+    if (cb.type == COMMAND_NEW_BUFFER) {
+      command_queue_remove (&client->queued, pos, len);
+      client->queued_buffers--;
+      sp_writer_release_buffer (self, client, cb.area_id,
+          cb.payload.buffer.offset);
+      return 1;
+    }
+    pos += len;
   }
 
   return 0;
 }
 
 int
-sp_client_recv_finish (ShmPipe * self, char *buf)
+sp_writer_drop_queued (ShmPipe * self)
+{
+  ShmClient *client;
+  int dropped = 0;
+
+  for (client = self->clients; client; client = client->next)
+    while (sp_writer_drop_oldest (self, client))
+      dropped++;
+
+  return dropped;
+}
+
+int
+sp_client_recv_release (ShmPipe * self, char *buf)
 {
   ShmArea *shm_area = NULL;
-  unsigned long offset;
-  struct CommandBuffer cb = { 0 };
+  struct CommandBuffer *cb;
 
   for (shm_area = self->shm_area; shm_area; shm_area = shm_area->next) {
     if (buf >= shm_area->shm_area_buf &&
@@ -731,13 +1232,52 @@ sp_client_recv_finish (ShmPipe * self, char *buf)
 
   assert (shm_area);
 
-  offset = buf - shm_area->shm_area_buf;
+  if (self->num_pending_acks == self->pending_acks_size) {
+    int size = self->pending_acks_size ? self->pending_acks_size * 2 : 16;
+    struct CommandBuffer *acks = realloc (self->pending_acks,
+        size * sizeof (struct CommandBuffer));
+
+    if (!acks)
+      return -1;
+    self->pending_acks = acks;
+    self->pending_acks_size = size;
+  }
+
+  cb = self->pending_acks + self->num_pending_acks;
+  memset (cb, 0, sizeof (struct CommandBuffer));
+  cb->type = COMMAND_ACK_BUFFER;
+  cb->area_id = shm_area->id;
+  cb->payload.ack_buffer.offset = buf - shm_area->shm_area_buf;
+  self->num_pending_acks++;
 
   sp_shm_area_dec (self, shm_area);
 
-  cb.payload.ack_buffer.offset = offset;
-  return send_command (self->main_socket, &cb, COMMAND_ACK_BUFFER,
-      self->shm_area->id);
+  return self->num_pending_acks;
+}
+
+int
+sp_client_flush_acks (ShmPipe * self)
+{
+  size_t len = self->num_pending_acks * sizeof (struct CommandBuffer);
+
+  if (len == 0)
+    return 1;
+
+  self->num_pending_acks = 0;
+
+  if (send (self->main_socket, self->pending_acks, len, MSG_NOSIGNAL) != len)
+    return 0;
+
+  return 1;
+}
+
+int
+sp_client_recv_finish (ShmPipe * self, char *buf)
+{
+  if (sp_client_recv_release (self, buf) < 0)
+    return 0;
+
+  return sp_client_flush_acks (self);
 }
 
 ShmPipe *
@@ -750,6 +1290,7 @@ sp_client_open (const char *path)
 
   self->main_socket = socket (PF_UNIX, SOCK_STREAM, 0);
   self->use_count = 1;
+  self->received_fd = -1;
 
   if (self->main_socket < 0)
     goto error;
@@ -773,9 +1314,8 @@ ShmClient *
 sp_writer_accept_client (ShmPipe * self)
 {
   ShmClient *client = NULL;
+  ShmArea *area;
   int fd;
-  struct CommandBuffer cb = { 0 };
-  int pathlen = strlen (self->shm_area->shm_area_name) + 1;
 
 
   fd = accept (self->main_socket, NULL, NULL);
@@ -785,22 +1325,17 @@ sp_writer_accept_client (ShmPipe * self)
     return NULL;
   }
 
-  cb.payload.new_shm_area.size = self->shm_area->shm_area_len;
-  cb.payload.new_shm_area.path_size = pathlen;
-  if (!send_command (fd, &cb, COMMAND_NEW_SHM_AREA, self->shm_area->id)) {
-    fprintf (stderr, "Sending new shm area failed: %s", strerror (errno));
-    goto error;
-  }
-
-  if (send (fd, self->shm_area->shm_area_name, pathlen, MSG_NOSIGNAL) !=
-      pathlen) {
-    fprintf (stderr, "Sending new shm area path failed: %s", strerror (errno));
-    goto error;
-  }
-
   client = spalloc_new (ShmClient);
+  memset (client, 0, sizeof (ShmClient));
   client->fd = fd;
 
+  for (area = self->shm_area; area; area = area->next) {
+    if (!area->retired && !queue_new_shm_area (client, area)) {
+      fprintf (stderr, "Queueing new shm area failed");
+      goto error;
+    }
+  }
+
   /* Prepend ot linked list */
   client->next = self->clients;
   self->clients = client;
@@ -809,6 +1344,8 @@ sp_writer_accept_client (ShmPipe * self)
   return client;
 
 error:
+  command_queue_clear (&client->queued);
+  spalloc_free (ShmClient, client);
   close (fd);
   return NULL;
 }
@@ -849,12 +1386,14 @@ again:
     for (i = 0; i < buffer->num_clients; i++) {
       if (buffer->clients[i] == client->fd) {
         buffer->clients[i] = -1;
-        if (!sp_shmbuf_dec (self, buffer, prev_buf))
+        if (!sp_shmbuf_dec (self, buffer, prev_buf)) {
+          prev_buf = NULL;
           goto again;
+        }
         break;
       }
-      prev_buf = buffer;
     }
+    prev_buf = buffer;
   }
 
   for (item = self->clients; item; item = item->next) {
@@ -871,9 +1410,126 @@ again:
 
   self->num_clients--;
 
+  command_queue_clear (&client->queued);
+  command_queue_clear (&client->sending);
   spalloc_free (ShmClient, client);
 }
 
+int
+sp_writer_prepare_flush (ShmPipe * self, ShmClient * client)
+{
+  size_t len = 0;
+  int buffers = 0;
+
+  if (self->max_in_flight <= 0) {
+    len = client->queued.len;
+    buffers = client->queued_buffers;
+  } else {
+    /* Stop at the first buffer over the limit, the rest must stay in order */
+    while (len < client->queued.len) {
+      struct CommandBuffer cb;
+      size_t cmdlen = command_queue_peek (&client->queued, len, &cb);
+
+      if (cb.type == COMMAND_NEW_BUFFER) {
+        if (client->in_flight + buffers >= self->max_in_flight)
+          break;
+        buffers++;
+      }
+      len += cmdlen;
+    }
+  }
+
+  if (len == 0)
+    return client->sending.len;
+
+  if (client->sending.len == 0 && len == client->queued.len) {
+    CommandQueue tmp = client->sending;
+
+    client->sending = client->queued;
+    client->queued = tmp;
+  } else if (!command_queue_move (&client->sending, &client->queued, len)) {
+    return client->sending.len;
+  }
+
+  client->in_flight += buffers;
+  client->queued_buffers -= buffers;
+
+  return client->sending.len;
+}
+
+static ssize_t
+send_with_fd (int sock, const char *data, size_t len, int fd)
+{
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  char control[CMSG_SPACE (sizeof (int))];
+  struct cmsghdr *cmsg;
+
+  if (fd < 0)
+    return send (sock, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+  iov.iov_base = (void *) data;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof (control);
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+
+  return sendmsg (sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+int
+sp_writer_flush (ShmClient * client)
+{
+  CommandQueue *sending = &client->sending;
+
+  while (sending->len) {
+    size_t len = sending->len;
+    int fd = -1;
+    ssize_t ret;
+
+    /* A descriptor goes alone with its command, so the client gets it with
+     * the right read */
+    if (sending->num_fds) {
+      if (sending->fds[0].pos == 0) {
+        fd = sending->fds[0].fd;
+        len = sizeof (struct CommandBuffer);
+      } else {
+        len = sending->fds[0].pos;
+      }
+    }
+
+    ret = send_with_fd (client->fd, sending->data, len, fd);
+
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return sending->len;
+      return -1;
+    }
+
+    /* Sent with the first byte */
+    if (fd >= 0 && ret > 0) {
+      close (fd);
+      sending->num_fds--;
+      memmove (sending->fds, sending->fds + 1,
+          sending->num_fds * sizeof (CommandQueueFd));
+    }
+
+    command_queue_remove (sending, 0, ret);
+
+    if (ret < len)
+      break;
+  }
+
+  return sending->len;
+}
+
 int
 sp_get_fd (ShmPipe * self)
 {
@@ -892,6 +1548,30 @@ sp_writer_pending_writes (ShmPipe * self)
   return (self->buffers != NULL);
 }
 
+/* Summed over the areas used for new blocks */
+void
+sp_writer_get_alloc_stats (ShmPipe * self, ShmAllocStats * stats)
+{
+  ShmArea *area;
+
+  memset (stats, 0, sizeof (ShmAllocStats));
+
+  for (area = self->shm_area; area; area = area->next) {
+    ShmAllocStats area_stats;
+
+    if (area->retired)
+      continue;
+
+    shm_alloc_space_get_stats (area->allocspace, &area_stats);
+    stats->size += area_stats.size;
+    stats->used += area_stats.used;
+    if (area_stats.largest_free > stats->largest_free)
+      stats->largest_free = area_stats.largest_free;
+    stats->n_blocks += area_stats.n_blocks;
+    stats->n_free_extents += area_stats.n_free_extents;
+  }
+}
+
 const char *
 sp_writer_get_path (ShmPipe * pipe)
 {
@@ -36,13 +36,25 @@
  * If it gets an error on that socket, it call sp_writer_close_client().
  * If there is something to read, it calls sp_writer_recv().
  *
+ * Nothing is written to the clients directly, the writer calls only queue
+ * commands. To send them, the server calls sp_writer_prepare_flush() which
+ * returns the number of bytes waiting for that client, and then
+ * sp_writer_flush() which sends as much as it can without blocking and
+ * returns the number of bytes that are still waiting (it should then
+ * select() for writing on the client fd). sp_writer_flush() only touches
+ * data owned by the flushing side, so it can run outside of the mutex as long
+ * as it's always called from the thread that closes the clients.
+ *
  * The writer allocates buffers with sp_writer_alloc_block(),
  * writes something in the buffer (retrieved with sp_writer_block_get_buf(),
- * then calls  sp_writer_send_buf() to send the buffer or a subsection to
+ * then calls  sp_writer_send_buf() to queue the buffer or a subsection for
  * the other side. When it is done with the block, it calls
  * sp_writer_free_block().
  * If alloc fails, then the server must wait for events from the clients before
- * trying again.
+ * trying again, or add another area with sp_writer_add_area(). Blocks are
+ * allocated from every area, sp_writer_resize() replaces all of them with a
+ * single new one. The blocks and buffers in the replaced areas stay valid,
+ * but sp_writer_send_buf() returns -1 for them so they must be copied.
  *
  *
  * The clients connect with sp_client_open()
@@ -52,6 +64,16 @@
  * message and <0 if there was an error. If there was an error, one must close
  * it with sp_close(). If was valid buffer was received, the client must release
  * it with sp_client_recv_finish() when it is done reading from it.
+ * It can also use sp_client_recv_release(), which only queues the ack and
+ * returns the number of queued acks, and later send them all at once with
+ * sp_client_flush_acks().
+ *
+ * The server can bound what each client holds with
+ * sp_writer_set_lag_policy(): a client gets at most max_in_flight buffers
+ * it has not acked yet, and at most as many more wait in its queue. Past
+ * that, the new buffer is not sent to that client, or if drop_oldest is set,
+ * the oldest waiting one is dropped for it. sp_writer_drop_queued() drops
+ * every buffer still waiting in the queues, to get space back.
  */
 
 
@@ -63,6 +85,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "shmalloc.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -72,7 +95,18 @@ typedef struct _ShmClient ShmClient;
 typedef struct _ShmPipe ShmPipe;
 typedef struct _ShmBlock ShmBlock;
 
-ShmPipe *sp_writer_create (const char *path, size_t size, mode_t perms);
+/* Flags for the areas of a writer */
+enum
+{
+  /* Pass the areas as memfd descriptors instead of POSIX shm names */
+  SP_AREA_MEMFD = (1 << 0),
+  /* Use huge pages if possible, explicit ones for memfd areas if the
+   * system has some reserved, transparent ones otherwise */
+  SP_AREA_HUGEPAGES = (1 << 1)
+};
+
+ShmPipe *sp_writer_create (const char *path, size_t size, mode_t perms,
+    int area_flags);
 const char *sp_writer_get_path (ShmPipe *pipe);
 void sp_close (ShmPipe * self);
 void *sp_get_data (ShmPipe * self);
@@ -80,6 +114,9 @@ void sp_set_data (ShmPipe * self, void *data);
 
 int sp_writer_setperms_shm (ShmPipe * self, mode_t perms);
 int sp_writer_resize (ShmPipe * self, size_t size);
+int sp_writer_add_area (ShmPipe * self, size_t size);
+int sp_writer_get_num_areas (ShmPipe * self);
+size_t sp_writer_get_max_area_size (ShmPipe * self);
 
 int sp_get_fd (ShmPipe * self);
 int sp_writer_get_client_fd (ShmClient * client);
@@ -93,12 +130,20 @@ ShmPipe *sp_writer_block_get_pipe (ShmBlock *block);
 ShmClient * sp_writer_accept_client (ShmPipe * self);
 void sp_writer_close_client (ShmPipe *self, ShmClient * client);
 int sp_writer_recv (ShmPipe * self, ShmClient * client);
+int sp_writer_prepare_flush (ShmPipe * self, ShmClient * client);
+int sp_writer_flush (ShmClient * client);
 
 int sp_writer_pending_writes (ShmPipe * self);
+void sp_writer_set_lag_policy (ShmPipe * self, int max_in_flight,
+    int drop_oldest);
+int sp_writer_drop_queued (ShmPipe * self);
+void sp_writer_get_alloc_stats (ShmPipe * self, ShmAllocStats * stats);
 
 ShmPipe *sp_client_open (const char *path);
 long int sp_client_recv (ShmPipe * self, char **buf);
 int sp_client_recv_finish (ShmPipe * self, char *buf);
+int sp_client_recv_release (ShmPipe * self, char *buf);
+int sp_client_flush_acks (ShmPipe * self);
 
 #ifdef __cplusplus
 }
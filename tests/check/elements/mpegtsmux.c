@@ -0,0 +1,193 @@
+/* GStreamer
+ *
+ * unit test for mpegtsmux
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+
+/* For ease of programming we use globals to keep refs for our floating
+ * src and sink pads we create; otherwise we always have to do get_pad,
+ * get_peer, and then remove references in every test function */
+static GstPad *mysrcpad, *mysinkpad;
+
+#define VIDEO_CAPS_STRING "video/mpeg, " \
+                           "mpegversion = (int) 2, " \
+                           "systemstream = (boolean) false, " \
+                           "width = (int) 384, " \
+                           "height = (int) 288, " \
+                           "framerate = (fraction) 25/1"
+
+#define TS_PACKET_LENGTH 188
+#define TS_NULL_PID 0x1fff
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/mpegts"));
+static GstStaticPadTemplate srcvideotemplate = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (VIDEO_CAPS_STRING));
+
+static GstElement *
+setup_mpegtsmux (void)
+{
+  GstElement *mux;
+  GstPad *sinkpad;
+  GstCaps *caps;
+
+  GST_DEBUG ("setup_mpegtsmux");
+  mux = gst_check_setup_element ("mpegtsmux");
+
+  mysrcpad = gst_pad_new_from_static_template (&srcvideotemplate, "src");
+  fail_if (mysrcpad == NULL, "Could not create a srcpad");
+  sinkpad = gst_element_get_request_pad (mux, "sink_%d");
+  fail_if (sinkpad == NULL, "Could not get sink pad from mpegtsmux");
+  caps = gst_caps_from_string (VIDEO_CAPS_STRING);
+  fail_unless (gst_pad_set_caps (mysrcpad, caps));
+  gst_caps_unref (caps);
+  fail_unless (gst_pad_link (mysrcpad, sinkpad) == GST_PAD_LINK_OK);
+  gst_object_unref (sinkpad);
+
+  mysinkpad = gst_check_setup_sink_pad (mux, &sinktemplate, NULL);
+  gst_pad_set_active (mysrcpad, TRUE);
+  gst_pad_set_active (mysinkpad, TRUE);
+
+  return mux;
+}
+
+static void
+cleanup_mpegtsmux (GstElement * mux)
+{
+  GstPad *sinkpad;
+
+  GST_DEBUG ("cleanup_mpegtsmux");
+  gst_element_set_state (mux, GST_STATE_NULL);
+
+  gst_pad_set_active (mysrcpad, FALSE);
+  gst_pad_set_active (mysinkpad, FALSE);
+
+  sinkpad = gst_pad_get_peer (mysrcpad);
+  gst_pad_unlink (mysrcpad, sinkpad);
+  gst_element_release_request_pad (mux, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_object_unref (mysrcpad);
+
+  gst_check_teardown_sink_pad (mux);
+  gst_check_teardown_element (mux);
+}
+
+/* Checks the continuity counters of all the packets in the output buffers.
+ * Packets with a payload increment the counter of their PID, packets with
+ * only an adaptation field repeat it. Returns the number of packets without
+ * payload that carry a PCR. */
+static guint
+check_continuity (void)
+{
+  gint cc[TS_NULL_PID];
+  guint n_pcr_only = 0;
+  guint8 *data;
+  guint size, pos;
+  GList *l;
+
+  for (pos = 0; pos < TS_NULL_PID; pos++)
+    cc[pos] = -1;
+
+  for (l = buffers; l; l = l->next) {
+    data = GST_BUFFER_DATA (l->data);
+    size = GST_BUFFER_SIZE (l->data);
+    fail_unless (size % TS_PACKET_LENGTH == 0);
+
+    for (pos = 0; pos < size; pos += TS_PACKET_LENGTH) {
+      guint8 *p = data + pos;
+      guint pid = GST_READ_UINT16_BE (p + 1) & 0x1fff;
+      guint afc = (p[3] >> 4) & 0x3;
+      guint counter = p[3] & 0xf;
+
+      fail_unless (p[0] == 0x47);
+      if (pid == TS_NULL_PID)
+        continue;
+
+      if (afc & 0x1) {
+        if (cc[pid] != -1)
+          fail_unless_equals_int (counter, (cc[pid] + 1) & 0xf);
+        cc[pid] = counter;
+      } else {
+        fail_unless (afc == 0x2);
+        /* only a PCR, with the PCR flag set in the adaptation field */
+        fail_unless (p[4] > 0 && (p[5] & 0x10));
+        if (cc[pid] != -1)
+          fail_unless_equals_int (counter, cc[pid]);
+        n_pcr_only++;
+      }
+    }
+  }
+
+  return n_pcr_only;
+}
+
+GST_START_TEST (test_pcr_continuity_counter)
+{
+  GstElement *mux;
+  GstBuffer *inbuffer;
+  int i, num_buffers = 25;
+
+  mux = setup_mpegtsmux ();
+  /* a constant bitrate well above the input bitrate makes the muxer fill
+   * the gaps between the frames with PCR-only packets on the video PID */
+  g_object_set (mux, "bitrate", (guint64) 2000000, NULL);
+  fail_unless (gst_element_set_state (mux,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  for (i = 0; i < num_buffers; i++) {
+    inbuffer = gst_buffer_new_and_alloc (1000);
+    memset (GST_BUFFER_DATA (inbuffer), 0, GST_BUFFER_SIZE (inbuffer));
+    gst_buffer_set_caps (inbuffer, GST_PAD_CAPS (mysrcpad));
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * 40 * GST_MSECOND;
+    GST_BUFFER_DURATION (inbuffer) = 40 * GST_MSECOND;
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()));
+
+  fail_unless (check_continuity () > 0);
+
+  g_list_foreach (buffers, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (buffers);
+  buffers = NULL;
+
+  cleanup_mpegtsmux (mux);
+}
+
+GST_END_TEST;
+
+static Suite *
+mpegtsmux_suite (void)
+{
+  Suite *s = suite_create ("mpegtsmux");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_pcr_continuity_counter);
+
+  return s;
+}
+
+GST_CHECK_MAIN (mpegtsmux)
@@ -21,7 +21,9 @@
  */
 
 #include <gst/check/gstcheck.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <unistd.h>
 
 static const gchar *
 get_mpeg2enc_element_name (void)
@@ -239,6 +241,127 @@ GST_START_TEST (test_multiple_av_streams)
 
 GST_END_TEST;
 
+static const guint8 partition_pack_key[] = {
+  0x06, 0x0e, 0x2b, 0x34, 0x02, 0x05, 0x01, 0x01,
+  0x0d, 0x01, 0x02, 0x01, 0x01
+};
+
+static const guint8 index_table_segment_key[] = {
+  0x06, 0x0e, 0x2b, 0x34, 0x02, 0x53, 0x01, 0x01,
+  0x0d, 0x01, 0x02, 0x01, 0x01, 0x10, 0x01, 0x00
+};
+
+static const guint8 random_index_pack_key[] = {
+  0x06, 0x0e, 0x2b, 0x34, 0x02, 0x05, 0x01, 0x01,
+  0x0d, 0x01, 0x02, 0x01, 0x01, 0x11, 0x01, 0x00
+};
+
+/* Reads the key and BER length of the KLV packet at @offset, returns the
+ * offset of its value or 0 if it doesn't fit in @size */
+static gsize
+read_klv (const guint8 * data, gsize size, gsize offset, guint64 * length)
+{
+  guint8 n;
+
+  if (offset + 17 > size)
+    return 0;
+  offset += 16;
+
+  if (data[offset] < 0x80) {
+    *length = data[offset];
+    offset += 1;
+  } else {
+    n = data[offset] & 0x7f;
+    offset += 1;
+    if (n > 8 || offset + n > size)
+      return 0;
+    *length = 0;
+    while (n--)
+      *length = (*length << 8) | data[offset++];
+  }
+
+  if (offset + *length > size)
+    return 0;
+
+  return offset;
+}
+
+GST_START_TEST (test_index_and_rip)
+{
+  gchar *pipeline, *filename, *contents = NULL;
+  const guint8 *data;
+  gsize size, offset, value, rip_offset = 0;
+  guint64 length, rip_length = 0;
+  guint n_partitions = 0, n_body_partitions = 0, n_index_segments = 0;
+  guint i, n_entries;
+  gint fd;
+
+  fd = g_file_open_tmp ("mxfmux-XXXXXX.mxf", &filename, NULL);
+  fail_unless (fd != -1);
+  close (fd);
+
+  pipeline = g_strdup_printf ("videotestsrc num-buffers=50 ! "
+      "video/x-raw-yuv,format=(GstFourcc)v308,width=64,height=48,framerate=25/1 ! "
+      "mxfmux partition-interval=10 ! " "filesink location=%s", filename);
+
+  run_test (pipeline);
+  g_free (pipeline);
+
+  fail_unless (g_file_get_contents (filename, &contents, &size, NULL));
+  data = (const guint8 *) contents;
+
+  /* Walk the KLV packets of the file */
+  for (offset = 0; offset < size; offset = value + length) {
+    value = read_klv (data, size, offset, &length);
+    fail_unless (value != 0, "Invalid KLV packet at offset %" G_GSIZE_FORMAT,
+        offset);
+
+    if (memcmp (data + offset, partition_pack_key,
+            sizeof (partition_pack_key)) == 0 && data[offset + 13] >= 0x02
+        && data[offset + 13] <= 0x04) {
+      n_partitions++;
+      if (data[offset + 13] == 0x03)
+        n_body_partitions++;
+    } else if (memcmp (data + offset, index_table_segment_key, 16) == 0) {
+      n_index_segments++;
+    } else if (memcmp (data + offset, random_index_pack_key, 16) == 0) {
+      rip_offset = offset;
+      rip_length = value + length - offset;
+    }
+  }
+
+  /* A body partition every 10 edit units, each with the index table of the
+   * previous ones, and the remaining index table in the footer */
+  fail_unless (n_body_partitions >= 4, "Only %u body partitions",
+      n_body_partitions);
+  fail_unless (n_index_segments >= n_body_partitions,
+      "Only %u index table segments", n_index_segments);
+
+  /* The RIP is the last packet of the file, ends with its own length and
+   * references all the partitions */
+  fail_unless (rip_length != 0, "No random index pack");
+  fail_unless_equals_int (rip_offset + rip_length, size);
+  fail_unless_equals_int (GST_READ_UINT32_BE (data + size - 4), rip_length);
+
+  value = read_klv (data, size, rip_offset, &length);
+  n_entries = (length - 4) / 12;
+  fail_unless_equals_int (n_entries, n_partitions);
+  for (i = 0; i < n_entries; i++) {
+    guint64 partition = GST_READ_UINT64_BE (data + value + i * 12 + 4);
+
+    fail_unless (partition + 16 <= size);
+    fail_unless (memcmp (data + partition, partition_pack_key,
+            sizeof (partition_pack_key)) == 0,
+        "RIP entry %u doesn't point to a partition pack", i);
+  }
+
+  g_free (contents);
+  g_unlink (filename);
+  g_free (filename);
+}
+
+GST_END_TEST;
+
 static Suite *
 mxfmux_suite (void)
 {
@@ -254,6 +377,7 @@ mxfmux_suite (void)
   tcase_add_test (tc_chain, test_jpeg2000_alaw);
   tcase_add_test (tc_chain, test_dnxhd_mp3);
   tcase_add_test (tc_chain, test_multiple_av_streams);
+  tcase_add_test (tc_chain, test_index_and_rip);
 
   return s;
 }
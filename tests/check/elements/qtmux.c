@@ -385,6 +385,256 @@ GST_START_TEST (test_reuse)
 
 GST_END_TEST;
 
+/* Reassembles the output file from the buffers and the byte newsegment
+ * events used to seek back into it */
+typedef struct
+{
+  GByteArray *data;
+  guint64 pos;
+} OutputFile;
+
+static gboolean
+output_file_probe (GstPad * pad, GstMiniObject * obj, OutputFile * file)
+{
+  if (GST_IS_BUFFER (obj)) {
+    GstBuffer *buf = GST_BUFFER_CAST (obj);
+    guint64 end = file->pos + GST_BUFFER_SIZE (buf);
+
+    if (end > file->data->len)
+      g_byte_array_set_size (file->data, end);
+    memcpy (file->data->data + file->pos, GST_BUFFER_DATA (buf),
+        GST_BUFFER_SIZE (buf));
+    file->pos = end;
+  } else if (GST_EVENT_TYPE (obj) == GST_EVENT_NEWSEGMENT) {
+    GstFormat format;
+    gint64 start;
+
+    gst_event_parse_new_segment (GST_EVENT_CAST (obj), NULL, NULL, &format,
+        &start, NULL, NULL);
+    if (format == GST_FORMAT_BYTES)
+      file->pos = start;
+  }
+
+  return TRUE;
+}
+
+/* Pushes @n_buffers video buffers of 40ms, with a key frame every
+ * @key_interval buffers, and EOS, and returns the output file */
+static GByteArray *
+push_video_and_get_file (GstElement * qtmux, guint n_buffers,
+    guint key_interval)
+{
+  OutputFile file = { NULL, 0 };
+  GstBuffer *inbuffer;
+  GstCaps *caps;
+  gulong probe_id;
+  guint i;
+
+  file.data = g_byte_array_new ();
+  probe_id = gst_pad_add_data_probe (mysinkpad,
+      G_CALLBACK (output_file_probe), &file);
+
+  fail_unless (gst_element_set_state (qtmux,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  caps = gst_caps_copy (gst_pad_get_pad_template_caps (mysrcpad));
+  for (i = 0; i < n_buffers; i++) {
+    inbuffer = gst_buffer_new_and_alloc (1);
+    GST_BUFFER_DATA (inbuffer)[0] = i;
+    gst_buffer_set_caps (inbuffer, caps);
+    GST_BUFFER_TIMESTAMP (inbuffer) = i * 40 * GST_MSECOND;
+    GST_BUFFER_DURATION (inbuffer) = 40 * GST_MSECOND;
+    if (i % key_interval)
+      GST_BUFFER_FLAG_SET (inbuffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    fail_unless (gst_pad_push (mysrcpad, inbuffer) == GST_FLOW_OK);
+  }
+  gst_caps_unref (caps);
+
+  fail_unless (gst_pad_push_event (mysrcpad, gst_event_new_eos ()) == TRUE);
+
+  /* the probe data is on our stack */
+  gst_pad_remove_data_probe (mysinkpad, probe_id);
+
+  g_list_foreach (buffers, (GFunc) gst_mini_object_unref, NULL);
+  g_list_free (buffers);
+  buffers = NULL;
+
+  return file.data;
+}
+
+typedef struct
+{
+  guint32 fourcc;
+  guint64 offset;
+  guint64 size;
+} TopAtom;
+
+/* Splits @file into its top level atoms, which must cover it exactly */
+static GArray *
+parse_top_atoms (GByteArray * file)
+{
+  GArray *atoms = g_array_new (FALSE, FALSE, sizeof (TopAtom));
+  guint64 offset = 0;
+
+  while (offset < file->len) {
+    TopAtom atom;
+
+    fail_unless (offset + 8 <= file->len);
+    atom.offset = offset;
+    atom.size = GST_READ_UINT32_BE (file->data + offset);
+    atom.fourcc = GST_READ_UINT32_LE (file->data + offset + 4);
+    if (atom.size == 1) {
+      fail_unless (offset + 16 <= file->len);
+      atom.size = GST_READ_UINT64_BE (file->data + offset + 8);
+    }
+    fail_unless (atom.size >= 8, "Invalid atom size at offset %"
+        G_GUINT64_FORMAT, offset);
+    fail_unless (offset + atom.size <= file->len, "Atom %" GST_FOURCC_FORMAT
+        " at offset %" G_GUINT64_FORMAT " is truncated",
+        GST_FOURCC_ARGS (atom.fourcc), offset);
+    g_array_append_val (atoms, atom);
+    offset += atom.size;
+  }
+
+  return atoms;
+}
+
+static gint
+find_top_atom (GArray * atoms, guint32 fourcc, guint from)
+{
+  guint i;
+
+  for (i = from; i < atoms->len; i++)
+    if (g_array_index (atoms, TopAtom, i).fourcc == fourcc)
+      return i;
+
+  return -1;
+}
+
+GST_START_TEST (test_reserved_moov)
+{
+  GstElement *qtmux = setup_qtmux (&srcvideotemplate, "video_%d");
+  GByteArray *file;
+  GArray *atoms;
+  gint moov, mdat;
+  TopAtom *atom;
+
+  g_object_set (qtmux, "reserved-max-duration", 10 * GST_SECOND, NULL);
+  file = push_video_and_get_file (qtmux, 25, 5);
+  atoms = parse_top_atoms (file);
+
+  /* ftyp, the moov in the reserved space with a free atom covering the
+   * rest of it, and then the media */
+  fail_unless (atoms->len >= 3);
+  fail_unless_equals_int (g_array_index (atoms, TopAtom, 0).fourcc,
+      GST_MAKE_FOURCC ('f', 't', 'y', 'p'));
+  moov = find_top_atom (atoms, GST_MAKE_FOURCC ('m', 'o', 'o', 'v'), 0);
+  mdat = find_top_atom (atoms, GST_MAKE_FOURCC ('m', 'd', 'a', 't'), 0);
+  fail_unless_equals_int (moov, 1);
+  fail_unless (mdat > moov);
+  fail_unless_equals_int (find_top_atom (atoms,
+          GST_MAKE_FOURCC ('m', 'o', 'o', 'v'), moov + 1), -1);
+  if (mdat > moov + 1) {
+    fail_unless_equals_int (mdat, moov + 2);
+    fail_unless_equals_int (g_array_index (atoms, TopAtom, moov + 1).fourcc,
+        GST_MAKE_FOURCC ('f', 'r', 'e', 'e'));
+  }
+
+  /* the mdat size was updated to hold all the media */
+  atom = &g_array_index (atoms, TopAtom, mdat);
+  fail_unless (atom->offset + atom->size == file->len);
+  fail_unless (atom->size >= 25 + 8);
+
+  g_array_free (atoms, TRUE);
+  g_byte_array_free (file, TRUE);
+  cleanup_qtmux (qtmux, "video_%d");
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_chunked_fragments_sidx)
+{
+  GstElement *qtmux = setup_qtmux (&srcvideotemplate, "video_%d");
+  GByteArray *file;
+  GArray *atoms;
+  gint moov, sidx, moof, mfra, i;
+  guint n_moof = 0, n_refs, version, entries_offset;
+  guint64 ept, first_offset, ref_offset;
+  const guint8 *data;
+  TopAtom *atom;
+
+  g_object_set (qtmux, "fragment-duration", 200, "chunk-samples", 2,
+      "reserved-max-duration", 10 * GST_SECOND, NULL);
+  file = push_video_and_get_file (qtmux, 25, 5);
+  atoms = parse_top_atoms (file);
+
+  /* ftyp, moov, the sidx in its reserved space, then the moof and mdat
+   * pairs and the mfra */
+  fail_unless_equals_int (g_array_index (atoms, TopAtom, 0).fourcc,
+      GST_MAKE_FOURCC ('f', 't', 'y', 'p'));
+  moov = find_top_atom (atoms, GST_MAKE_FOURCC ('m', 'o', 'o', 'v'), 0);
+  sidx = find_top_atom (atoms, GST_MAKE_FOURCC ('s', 'i', 'd', 'x'), 0);
+  moof = find_top_atom (atoms, GST_MAKE_FOURCC ('m', 'o', 'o', 'f'), 0);
+  mfra = find_top_atom (atoms, GST_MAKE_FOURCC ('m', 'f', 'r', 'a'), 0);
+  fail_unless_equals_int (moov, 1);
+  fail_unless_equals_int (sidx, 2);
+  fail_unless (moof > sidx);
+  fail_unless_equals_int (mfra, atoms->len - 1);
+
+  for (i = moof; i < mfra; i += 2) {
+    fail_unless_equals_int (g_array_index (atoms, TopAtom, i).fourcc,
+        GST_MAKE_FOURCC ('m', 'o', 'o', 'f'));
+    fail_unless (i + 1 < mfra);
+    fail_unless_equals_int (g_array_index (atoms, TopAtom, i + 1).fourcc,
+        GST_MAKE_FOURCC ('m', 'd', 'a', 't'));
+    n_moof++;
+  }
+  /* several chunks of 2 samples per fragment of 5 samples */
+  fail_unless (n_moof >= 10, "Only %u moof", n_moof);
+
+  /* the sidx references consecutive fragments, starting at the first moof
+   * and ending at the mfra, and starts at the first presentation time */
+  atom = &g_array_index (atoms, TopAtom, sidx);
+  data = file->data + atom->offset;
+  version = data[8];
+  if (version) {
+    ept = GST_READ_UINT64_BE (data + 20);
+    first_offset = GST_READ_UINT64_BE (data + 28);
+    entries_offset = 36;
+  } else {
+    ept = GST_READ_UINT32_BE (data + 20);
+    first_offset = GST_READ_UINT32_BE (data + 24);
+    entries_offset = 28;
+  }
+  n_refs = GST_READ_UINT16_BE (data + entries_offset + 2);
+  entries_offset += 4;
+  fail_unless_equals_uint64 (ept, 0);
+  fail_unless (n_refs >= 4, "Only %u fragments", n_refs);
+  fail_unless (entries_offset + 12 * n_refs <= atom->size);
+
+  ref_offset = atom->offset + atom->size + first_offset;
+  fail_unless_equals_uint64 (ref_offset,
+      g_array_index (atoms, TopAtom, moof).offset);
+  for (i = 0; i < n_refs; i++) {
+    const guint8 *ref = data + entries_offset + 12 * i;
+
+    fail_unless_equals_int (GST_READ_UINT32_LE (file->data + ref_offset + 4),
+        GST_MAKE_FOURCC ('m', 'o', 'o', 'f'));
+    /* fragments start with a key frame */
+    fail_unless (ref[8] & 0x80);
+    ref_offset += GST_READ_UINT32_BE (ref) & 0x7fffffff;
+  }
+  fail_unless_equals_uint64 (ref_offset,
+      g_array_index (atoms, TopAtom, mfra).offset);
+
+  g_array_free (atoms, TRUE);
+  g_byte_array_free (file, TRUE);
+  cleanup_qtmux (qtmux, "video_%d");
+}
+
+GST_END_TEST;
+
 static Suite *
 qtmux_suite (void)
 {
@@ -398,6 +648,8 @@ qtmux_suite (void)
   tcase_add_test (tc_chain, test_audio_pad_frag);
   tcase_add_test (tc_chain, test_video_pad_frag_streamable);
   tcase_add_test (tc_chain, test_audio_pad_frag_streamable);
+  tcase_add_test (tc_chain, test_reserved_moov);
+  tcase_add_test (tc_chain, test_chunked_fragments_sidx);
 
   tcase_add_test (tc_chain, test_reuse);
 
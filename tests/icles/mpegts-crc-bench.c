@@ -0,0 +1,94 @@
+/* GStreamer
+ *
+ * Copyright (C) 2010 GStreamer developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/* Micro-benchmark of the MPEG-2 CRC32 used by the MPEG-TS elements,
+ * comparing the slice-by-8 implementation with the byte-wise one.
+ *
+ * compile with :
+ * gcc -Wall -O2 -I../../gst-libs $(pkg-config --cflags --libs glib-2.0) \
+ *   mpegts-crc-bench.c -o mpegts-crc-bench
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+#include <gst/gst-mpegts-crc.h>
+
+/* EIT sections are at most 4096 bytes, PAT/PMT ones are usually small */
+static const guint section_sizes[] = { 16, 188, 1024, 4096 };
+
+static guint32
+crc32_bytewise (const guint8 * data, guint datalen)
+{
+  guint32 crc = 0xffffffff;
+
+  while (datalen--)
+    crc = (crc << 8) ^ gst_mpegts_crc_table[0][(crc >> 24) ^ *data++];
+
+  return crc;
+}
+
+int
+main (int argc, char **argv)
+{
+  guint8 *data;
+  guint i, j, size, iterations;
+  guint32 crc_ref, crc;
+  GTimer *timer;
+  gdouble ref_time, time;
+
+  iterations = argc > 1 ? atoi (argv[1]) : 100000;
+
+  data = g_malloc (4096);
+  for (i = 0; i < 4096; i++)
+    data[i] = g_random_int_range (0, 256);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < G_N_ELEMENTS (section_sizes); i++) {
+    size = section_sizes[i];
+
+    crc_ref = 0;
+    g_timer_start (timer);
+    for (j = 0; j < iterations; j++)
+      crc_ref ^= crc32_bytewise (data, size);
+    ref_time = g_timer_elapsed (timer, NULL);
+
+    crc = 0;
+    g_timer_start (timer);
+    for (j = 0; j < iterations; j++)
+      crc ^= gst_mpegts_crc32 (data, size);
+    time = g_timer_elapsed (timer, NULL);
+
+    if (crc != crc_ref) {
+      g_printerr ("CRC mismatch for %u bytes: 0x%08x != 0x%08x\n", size, crc,
+          crc_ref);
+      return 1;
+    }
+
+    g_print ("%5u bytes: byte-wise %8.1f MB/s, slice-by-8 %8.1f MB/s "
+        "(x%.2f)\n", size, size * (gdouble) iterations / ref_time / 1e6,
+        size * (gdouble) iterations / time / 1e6, ref_time / time);
+  }
+
+  g_timer_destroy (timer);
+  g_free (data);
+
+  return 0;
+}